@@ -28,6 +28,7 @@
 #include "log.h"
 
 #include "sndfile.h"
+#include "disko.h"
 
 /*
 some thoughts...
@@ -487,3 +488,234 @@ int fmt_mid_load_song(song_t *song, slurp_t *fp, unsigned int lflags)
         return LOAD_SUCCESS;
 }
 
+
+/* --------------------------------------------------------------------------------------------------------- */
+/* Export: the player's MIDI output, captured while the song renders and written out as a type 0 file.
+
+Events arrive timestamped in output frames; they are converted to pulses using the tempo in effect at the
+time, and a tempo event is written whenever that changes, so the file lines up with the rendered audio. */
+
+#define MID_EXPORT_PPQN 960
+#define MID_DEFAULT_QUARTER 500000 // 120bpm, what a file with no tempo event is assumed to be
+
+struct mid_writedata {
+        int bps, rate;
+        uint64_t frame; // frames passed to body() so far
+        uint64_t seg_frame, seg_pulse; // where the current tempo took effect
+        uint64_t last_pulse; // time of the last event written
+        unsigned int quarter_usec; // zero until the first event is seen
+        long mtrk_pos; // file offset of the track chunk's length field
+        uint8_t running; // status byte of the last channel message written
+        uint8_t in_status; // running status of the incoming data
+        uint8_t notes[16][128]; // note-ons without a note-off yet
+};
+
+static void mid_write_varlen(disko_t *fp, uint32_t v)
+{
+        uint8_t buf[5];
+        int n = sizeof(buf);
+
+        buf[--n] = v & 0x7f;
+        while ((v >>= 7) != 0)
+                buf[--n] = 0x80 | (v & 0x7f);
+        disko_write(fp, buf + n, sizeof(buf) - n);
+}
+
+static uint64_t mid_frame_to_pulse(struct mid_writedata *wd, uint64_t frame)
+{
+        uint64_t q = wd->quarter_usec ?: MID_DEFAULT_QUARTER;
+
+        return wd->seg_pulse + ((frame - wd->seg_frame) * MID_EXPORT_PPQN * 1000000 + (q * wd->rate / 2))
+                / (q * wd->rate);
+}
+
+static void mid_write_delta(disko_t *fp, struct mid_writedata *wd, uint64_t pulse)
+{
+        mid_write_varlen(fp, pulse - wd->last_pulse);
+        wd->last_pulse = pulse;
+}
+
+static void mid_write_tempo(disko_t *fp, struct mid_writedata *wd, uint64_t pulse)
+{
+        unsigned int q = wd->quarter_usec;
+
+        mid_write_delta(fp, wd, pulse);
+        disko_write(fp, "\xff\x51\x03", 3);
+        disko_putc(fp, (q >> 16) & 0xff);
+        disko_putc(fp, (q >> 8) & 0xff);
+        disko_putc(fp, q & 0xff);
+        wd->running = 0; // meta events cancel running status
+}
+
+static int mid_data_bytes(uint8_t status)
+{
+        switch (status & 0xf0) {
+        case 0xc0:
+        case 0xd0:
+                return 1;
+        default:
+                return 2;
+        }
+}
+
+int fmt_mid_export_head(disko_t *fp, int bits, int channels, int rate)
+{
+        struct mid_writedata *wd = calloc(1, sizeof(struct mid_writedata));
+        struct mthd mthd;
+
+        if (!wd)
+                return DW_ERROR;
+        fp->userdata = wd;
+        wd->bps = channels * ((bits + 7) / 8);
+        wd->rate = rate;
+
+        mthd.header_length = bswapBE32(6);
+        mthd.format = bswapBE16(0);
+        mthd.num_tracks = bswapBE16(1);
+        mthd.division = bswapBE16(MID_EXPORT_PPQN);
+        disko_write(fp, "MThd", 4);
+        disko_write(fp, &mthd, sizeof(mthd));
+
+        disko_write(fp, "MTrk", 4);
+        wd->mtrk_pos = disko_tell(fp);
+        disko_write(fp, "\0\0\0\0", 4); // filled in at the end
+
+        return DW_OK;
+}
+
+int fmt_mid_export_silence(UNUSED disko_t *fp, UNUSED long bytes)
+{
+        return DW_OK;
+}
+
+int fmt_mid_export_body(disko_t *fp, UNUSED const uint8_t *data, size_t length)
+{
+        struct mid_writedata *wd = fp->userdata;
+
+        // the audio itself is thrown away; all that matters is how much time has passed
+        wd->frame += length / wd->bps;
+        return DW_OK;
+}
+
+int fmt_mid_export_midi(disko_t *fp, const uint8_t *data, size_t length, unsigned int pos,
+        unsigned int quarter_usec)
+{
+        struct mid_writedata *wd = fp->userdata;
+        uint64_t frame = wd->frame + pos, pulse;
+        uint8_t status;
+        size_t n;
+
+        if (quarter_usec && quarter_usec != wd->quarter_usec) {
+                if (wd->quarter_usec) {
+                        pulse = mid_frame_to_pulse(wd, frame);
+                } else {
+                        // first event: this has been the tempo all along
+                        pulse = 0;
+                        frame = 0;
+                }
+                wd->seg_frame = frame;
+                wd->seg_pulse = pulse;
+                wd->quarter_usec = quarter_usec;
+                mid_write_tempo(fp, wd, pulse);
+                frame = wd->frame + pos;
+        }
+        pulse = mid_frame_to_pulse(wd, frame);
+
+        while (length) {
+                status = *data;
+                if (status == 0xf0) {
+                        // sysex: everything up to and including the F7, written with the F0 form
+                        for (n = 1; n < length && data[n] != 0xf7; n++);
+                        if (n < length)
+                                n++;
+                        mid_write_delta(fp, wd, pulse);
+                        disko_putc(fp, 0xf0);
+                        mid_write_varlen(fp, n - 1);
+                        disko_write(fp, data + 1, n - 1);
+                        wd->running = wd->in_status = 0;
+                        data += n;
+                        length -= n;
+                        continue;
+                } else if (status > 0xf0) {
+                        // system common and realtime messages have no place in a file
+                        n = (status == 0xf2) ? 3 : (status == 0xf1 || status == 0xf3) ? 2 : 1;
+                        n = MIN(n, length);
+                        data += n;
+                        length -= n;
+                        continue;
+                } else if (status & 0x80) {
+                        wd->in_status = status;
+                        data++;
+                        length--;
+                } else if (wd->in_status) {
+                        status = wd->in_status;
+                } else {
+                        // stray data byte
+                        data++;
+                        length--;
+                        continue;
+                }
+
+                n = mid_data_bytes(status);
+                if (length < n)
+                        break;
+                mid_write_delta(fp, wd, pulse);
+                if (status != wd->running)
+                        disko_putc(fp, status);
+                disko_write(fp, data, n);
+                wd->running = status;
+
+                switch (status & 0xf0) {
+                case 0x90:
+                        if (data[1]) {
+                                if (wd->notes[status & 15][data[0] & 127] < 255)
+                                        wd->notes[status & 15][data[0] & 127]++;
+                                break;
+                        }
+                        // fall through
+                case 0x80:
+                        wd->notes[status & 15][data[0] & 127] = 0;
+                        break;
+                }
+
+                data += n;
+                length -= n;
+        }
+
+        return DW_OK;
+}
+
+int fmt_mid_export_tail(disko_t *fp)
+{
+        struct mid_writedata *wd = fp->userdata;
+        uint64_t pulse = mid_frame_to_pulse(wd, wd->frame);
+        uint32_t len;
+        long end;
+        int c, k;
+
+        // release anything that's still held, so the file doesn't end with stuck notes
+        for (c = 0; c < 16; c++) {
+                for (k = 0; k < 128; k++) {
+                        if (!wd->notes[c][k])
+                                continue;
+                        mid_write_delta(fp, wd, pulse);
+                        if (wd->running != (0x90 | c))
+                                disko_putc(fp, 0x90 | c);
+                        disko_putc(fp, k);
+                        disko_putc(fp, 0);
+                        wd->running = 0x90 | c;
+                }
+        }
+        mid_write_delta(fp, wd, pulse);
+        disko_write(fp, "\xff\x2f\x00", 3);
+
+        end = disko_tell(fp);
+        len = bswapBE32((uint32_t) (end - wd->mtrk_pos - 4));
+        disko_seek(fp, wd->mtrk_pos, SEEK_SET);
+        disko_write(fp, &len, 4);
+        disko_seek(fp, end, SEEK_SET);
+
+        free(wd);
+        fp->userdata = NULL;
+        return DW_OK;
+}
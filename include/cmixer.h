@@ -9,6 +9,8 @@
 #define MIXING_CLIPMAX          (0x03FFFFFF)
 #define VOLUMERAMPPRECISION     12
 #define FILTERPRECISION         13
+#define FILTERSWEEPPRECISION    16
+#define FILTERSWEEPONE          ((int64_t) 1 << FILTERSWEEPPRECISION)
 
 
 void init_mix_buffer(int *, unsigned int);
@@ -24,7 +26,21 @@ void float_to_mono_mix(const float *, int *, unsigned int);
 
 unsigned int csf_create_stereo_mix(song_t *csf, int count);
 
-void setup_channel_filter(song_voice_t *pChn, int reset, int flt_modifier, int freq);
+void init_filter_table(song_t *csf);
+void end_filter_sweep(song_voice_t *chan);
+void setup_channel_filter(song_voice_t *pChn, int reset, int flt_modifier, song_t *csf);
+
+void send_bus_process(song_t *csf, struct send_bus *bus, int *mix, unsigned int count);
+
+void limiter_mono(song_t *csf, int *buffer, unsigned int count);
+void limiter_stereo(song_t *csf, int *buffer, unsigned int count);
+
+// 'samples' here counts each channel separately, like the clip_32_to_* functions
+void dither_mono(song_t *csf, int *buffer, unsigned int samples);
+void dither_stereo(song_t *csf, int *buffer, unsigned int samples);
+void dither_plain(song_t *csf, int *buffer, unsigned int samples);
+
+void meter_process(song_t *csf, struct mix_meter *meter, const int *buffer, unsigned int count);
 
 
 //typedef unsigned int (*convert_clip_t)(void *, int *, unsigned int, int*, int*) __attribute__((cdecl))
@@ -103,6 +103,11 @@ void song_pattern_to_sample(int pattern, int split, int bind);
 struct save_format;
 int disko_export_song(const char *filename, const struct save_format *format);
 
+/* play through the whole song without writing it anywhere, and report its
+peak level, loudness, and which orders clip to the log (and to stdout, if
+'print' is set) */
+int disko_analyze_song(int print);
+
 /* call periodically if (status.flags & DISKWRITER_ACTIVE) to write more stuff.
 return: DW_SYNC_*, self explanatory */
 int disko_sync(void);
@@ -54,6 +54,7 @@ int  ym3812_write(void *chip, int a, int v);
 unsigned char ym3812_read(void *chip, int a);
 int  ym3812_timer_over(void *chip, int c);
 void ym3812_update_one(void *chip, OPLSAMPLE *buffer, int length);
+int  ym3812_update_stereo(void *chip, INT32 *buffer, int length, const INT32 *gain_l, const INT32 *gain_r);
 
 void ym3812_set_timer_handler(void *chip, OPL_TIMERHANDLER TimerHandler, void *param);
 void ym3812_set_irq_handler(void *chip, OPL_IRQHANDLER IRQHandler, void *param);
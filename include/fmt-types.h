@@ -63,6 +63,9 @@ doing weird stuff like hacking the files, but then you're just asking for troubl
 #ifndef EXPORT
 # define EXPORT(x)
 #endif
+#ifndef EXPORT_MIDI
+# define EXPORT_MIDI(x)
+#endif
 
 /* --------------------------------------------------------------------------------------------------------- */
 
@@ -97,7 +100,7 @@ READ_INFO(sid)
 READ_INFO(mdl) LOAD_SONG(mdl)
 READ_INFO(med)
 READ_INFO(okt) LOAD_SONG(okt)
-READ_INFO(mid) LOAD_SONG(mid)
+READ_INFO(mid) LOAD_SONG(mid) EXPORT(mid) EXPORT_MIDI(mid)
 READ_INFO(mus) LOAD_SONG(mus)
 READ_INFO(mf)
 
@@ -153,4 +156,5 @@ LOAD_SAMPLE(raw) SAVE_SAMPLE(raw)
 #undef LOAD_INSTRUMENT
 #undef SAVE_INSTRUMENT
 #undef EXPORT
+#undef EXPORT_MIDI
 
@@ -68,6 +68,8 @@ enum {
 #define PROTO_EXPORT_SILENCE    (disko_t *fp, long bytes)
 #define PROTO_EXPORT_BODY       (disko_t *fp, const uint8_t *data, size_t length)
 #define PROTO_EXPORT_TAIL       (disko_t *fp)
+#define PROTO_EXPORT_MIDI       (disko_t *fp, const uint8_t *data, size_t length, unsigned int pos, \
+                                 unsigned int quarter_usec)
 
 typedef int (*fmt_read_info_func)       PROTO_READ_INFO;
 typedef int (*fmt_load_song_func)       PROTO_LOAD_SONG;
@@ -79,6 +81,7 @@ typedef int (*fmt_export_head_func)     PROTO_EXPORT_HEAD;
 typedef int (*fmt_export_silence_func)  PROTO_EXPORT_SILENCE;
 typedef int (*fmt_export_body_func)     PROTO_EXPORT_BODY;
 typedef int (*fmt_export_tail_func)     PROTO_EXPORT_TAIL;
+typedef int (*fmt_export_midi_func)     PROTO_EXPORT_MIDI;
 
 #define READ_INFO(t)            int fmt_##t##_read_info         PROTO_READ_INFO;
 #define LOAD_SONG(t)            int fmt_##t##_load_song         PROTO_LOAD_SONG;
@@ -90,6 +93,7 @@ typedef int (*fmt_export_tail_func)     PROTO_EXPORT_TAIL;
                                 int fmt_##t##_export_silence    PROTO_EXPORT_SILENCE; \
                                 int fmt_##t##_export_body       PROTO_EXPORT_BODY; \
                                 int fmt_##t##_export_tail       PROTO_EXPORT_TAIL;
+#define EXPORT_MIDI(t)          int fmt_##t##_export_midi       PROTO_EXPORT_MIDI;
 
 #include "fmt-types.h"
 
@@ -108,6 +112,9 @@ struct save_format {
                         fmt_export_body_func body;
                         fmt_export_tail_func tail;
                         int multi;
+                        /* optional: receives the player's MIDI output, 'pos' frames into the
+                        block that is about to be passed to body() */
+                        fmt_export_midi_func midi;
                 } export;
         } f;
 };
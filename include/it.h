@@ -415,6 +415,11 @@ void set_previous_instrument(void);
 void set_next_instrument(void);
 
 int get_current_channel(void);
+/* nonzero if a MIDI note on the pattern editor would just be played (and
+recorded), i.e. it's not about to start playback */
+int pattern_editor_midi_live(void);
+/* places the notes recorded since playback started again, with the current
+midi_quantize_strength */
 void set_current_channel(int channel);
 int get_current_row(void);
 void set_current_row(int row);
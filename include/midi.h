@@ -26,6 +26,7 @@
 
 struct midi_provider;
 struct midi_port;
+struct midi_port_queue;
 
 #define MIDI_PORT_CAN_SCHEDULE  1
 struct midi_driver {
@@ -80,6 +81,12 @@ struct midi_port {
         void (*drain)(struct midi_port *d);
 
         struct midi_provider *provider;
+
+        /* everything sent to the port goes through here (see midi-core.c) */
+        struct midi_port_queue *queue;
+
+        /* drivers that do running status count the bytes they leave out here */
+        unsigned long status_saved;
 };
 
 
@@ -92,9 +99,35 @@ void midi_engine_poll_ports(void);
 /* some parts of schism call this; it means "immediately" */
 void midi_send_now(const unsigned char *seq, unsigned int len);
 
-/* ... but the player calls this */
+/* ... but the player calls this. pos is the frame offset into the audio
+buffer being mixed; call midi_queue_begin_buffer before mixing each buffer
+so the queue knows when that is. this never blocks: if the ports are busy
+being reconfigured, the message is dropped (and counted in the stats) */
 void midi_send_buffer(const unsigned char *data, unsigned int len, unsigned int pos);
 void midi_send_flush(void);
+void midi_queue_begin_buffer(void);
+/* if a buffer is mixed in pieces, pos counts from the start of each piece:
+call this with the length of each piece once it's been mixed */
+void midi_queue_skip(unsigned int frames);
+/* monotonic, in nanoseconds; used to stamp incoming events */
+uint64_t midi_get_clock(void);
+/* when frame pos of the piece being mixed will be heard, on the same clock */
+uint64_t midi_queue_time(unsigned int pos);
+/* main thread: point live MIDI input at whatever the current page plays */
+void midi_live_update(void);
+
+/* how a port's output queue has been keeping up. jitter is how late events
+went out (or, for ports that schedule, were handed over) compared to when they
+were due, in microseconds. peak is the most that's ever been waiting. */
+struct midi_queue_stats {
+        unsigned long sent, late, dropped;
+        uint64_t jitter_total_usec;
+        unsigned int jitter_max_usec;
+        unsigned int queued, peak, capacity; /* bytes */
+        unsigned long status_saved; /* running status bytes the driver left out */
+};
+/* returns zero if the port doesn't have a queue (i.e. it's input only) */
+int midi_port_get_stats(struct midi_port *p, struct midi_queue_stats *st);
 
 /* used by the audio thread */
 int midi_need_flush(void);
@@ -137,12 +170,26 @@ void midi_event_system(int argv, int param);
 
 /* midi drivers call this when they received an event */
 void midi_received_cb(struct midi_port *src, unsigned char *data, unsigned int len);
+/* ... or this, if they know better when it should happen (midi_get_clock time) */
+void midi_received_cb_at(struct midi_port *src, unsigned char *data, unsigned int len, uint64_t when);
+/* for drivers that can schedule: when the message being sent to p is due (midi_get_clock time) */
+uint64_t midi_send_due(struct midi_port *p);
 
 
 int ip_midi_setup(void);        // USE_NETWORK
 void ip_midi_setports(int n);   // USE_NETWORK
 int ip_midi_getports(void);     // USE_NETWORK
 
+/* batched IP MIDI (midi_ip_batch). transit is receive time minus send time;
+it's only the real latency when both ends share a clock, i.e. on one machine,
+but max-min is the jitter either way. */
+struct ip_midi_stats {
+        unsigned long packets_sent, events_sent, send_errors, overflows;
+        unsigned long packets_received, events_received, lost, reordered;
+        int64_t transit_min_usec, transit_max_usec, transit_total_usec;
+};
+void ip_midi_get_stats(struct ip_midi_stats *st);
+
 int oss_midi_setup(void);       // USE_OSS
 int alsa_midi_setup(void);      // USE_ALSA
 int win32mm_midi_setup(void);   // WIN32
@@ -160,5 +207,10 @@ int macosx_midi_setup(void);    // MACOSX
 #define MIDI_DISABLE_RECORD     0x00010000
 
 extern int midi_flags, midi_pitch_depth, midi_amplification, midi_c5note;
+/* send IP MIDI as timestamped batches; takes effect on restart */
+extern int midi_ip_batch;
+/* how far (percent) notes recorded during playback are pulled onto the grid:
+the nearest row with tick quantize on, otherwise the nearest tick */
+extern int midi_quantize_strength;
 
 #endif
@@ -44,6 +44,8 @@ struct key_event {
         int midi_channel;
         int midi_volume; /* -1 for not a midi key otherwise 0...128 */
         int midi_bend;  /* normally 0; -8192 to +8192  */
+        int midi_live;  /* note was already played by the live MIDI path */
+        uint64_t midi_time; /* when the note was played (midi_get_clock), or zero */
         unsigned int sx, sy; /* start x and y position (character) */
         unsigned int x, hx, fx; /* x position of mouse (character, halfcharacter, fine) */
         unsigned int y, fy; /* y position of mouse (character, fine) */
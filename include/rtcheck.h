@@ -0,0 +1,47 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __rtcheck_h
+#define __rtcheck_h
+
+/* Realtime checking for the audio callback (configure --enable-rtcheck).
+
+Nothing the callback does should be able to wait on another thread or on the
+allocator; with this built in, malloc, calloc, realloc, free and
+pthread_mutex_lock all check whether they were called from inside it, and
+complain if they were. The first time each kind of call happens, it's
+reported on stderr; if SCHISM_RTCHECK=trap is in the environment, every one
+raises SIGTRAP as well, so a debugger stops right on it. A count of each is
+printed on exit. This relies on replacing the C library's allocator, so it
+only works with glibc. */
+
+#ifdef USE_RTCHECK
+void rtcheck_init(void);
+void rtcheck_enter(void);
+void rtcheck_leave(void);
+#else
+# define rtcheck_init() ((void) 0)
+# define rtcheck_enter() ((void) 0)
+# define rtcheck_leave() ((void) 0)
+#endif
+
+#endif
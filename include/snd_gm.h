@@ -5,13 +5,13 @@ void GM_Patch(int c, unsigned char p, int pref_chn_mask);
 void GM_DPatch(int ch, unsigned char GM, unsigned char bank, int pref_chn_mask);
 
 void GM_Bank(int c, unsigned char b);
-void GM_Touch(int c, unsigned char Vol); // range 0..127
-void GM_KeyOn(int c, unsigned char key, unsigned char Vol); // vol range 0..127
-void GM_KeyOff(int c);
-void GM_Bend(int c, unsigned Count);
-void GM_Reset(int quitting); // 0=settings that work for us, 1=normal settings
+void GM_Touch(song_t *csf, int c, unsigned char Vol); // range 0..127
+void GM_KeyOn(song_t *csf, int c, unsigned char key, unsigned char Vol); // vol range 0..127
+void GM_KeyOff(song_t *csf, int c);
+void GM_Bend(song_t *csf, int c, unsigned Count);
+void GM_Reset(song_t *csf, int quitting); // 0=settings that work for us, 1=normal settings
 
-void GM_Pan(int ch, signed char val); // param: -128..+127
+void GM_Pan(song_t *csf, int ch, signed char val); // param: -128..+127
 
 // This function is the core function for MIDI updates.
 // It handles keyons, touches and pitch bending.
@@ -27,13 +27,24 @@ void GM_Pan(int ch, signed char val); // param: -128..+127
 // Note that vibrato etc. are emulated by issuing multiple SetFreqAndVol
 // commands; they are not translated into MIDI vibrato operator calls.
 typedef enum { MIDI_BEND_NORMAL, MIDI_BEND_DOWN, MIDI_BEND_UP } MidiBendMode;
-void GM_SetFreqAndVol(int channel, int Hertz, int Vol, MidiBendMode bend_mode, int keyoff);
+void GM_SetFreqAndVol(song_t *csf, int channel, int Hertz, int Vol, MidiBendMode bend_mode, int keyoff);
 
-void GM_SendSongStartCode(void);
-void GM_SendSongStopCode(void);
-void GM_SendSongContinueCode(void);
-void GM_SendSongTickCode(void);
-void GM_SendSongPositionCode(unsigned note16pos);
-void GM_IncrementSongCounter(int count);
+void GM_SendSongStartCode(song_t *csf);
+void GM_SendSongStopCode(song_t *csf);
+void GM_SendSongContinueCode(song_t *csf);
+void GM_SendSongTickCode(song_t *csf);
+void GM_SendSongPositionCode(song_t *csf, unsigned note16pos);
+void GM_IncrementSongCounter(song_t *csf, int count);
+
+// What the MIDI output has cost so far. bytes_saved counts the messages that were
+// left out because the channel already had that value (or a bend too close to it to
+// hear, or one that was superseded before it was due). frames is how much audio that
+// covered, at 'rate'.
+struct gm_output_stats {
+        unsigned long messages, bytes, bytes_saved;
+        uint64_t frames;
+        unsigned int rate;
+};
+void GM_GetStats(struct gm_output_stats *st);
 
 #endif
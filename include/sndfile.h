@@ -64,7 +64,7 @@
 #define CHN_FASTVOLRAMP         0x1000000 // ramp volume very fast (XXX this is a dumb flag)
 //#define CHN_EXTRALOUD         0x2000000
 //#define CHN_REVERB            0x4000000
-//#define CHN_NOREVERB          0x8000000
+#define CHN_NOREVERB            0x8000000 // don't feed the send bus (S98; S99 turns it back on)
 #define CHN_NNAMUTE             0x10000000 // turn off mute, but have it reset later
 #define CHN_ADLIB               0x20000000 // OPL mode
 
@@ -234,6 +234,7 @@
 #define SNDMIX_NOSURROUND       0x200000 // ignore S91
 //#define SNDMIX_NOMIXING       0x400000
 #define SNDMIX_NORAMPING        0x800000 // don't apply ramping on volume change (causes clicks)
+#define SNDMIX_LIMITER          0x1000000 // run the final mix through song_t.limiter
 
 enum {
         SRCMODE_NEAREST,
@@ -419,6 +420,12 @@ typedef struct song_voice {
 
         int32_t filter_y1, filter_y2, filter_y3, filter_y4;
         int32_t filter_a0, filter_b0, filter_b1;
+        // coefficient sweep: per-sample steps towards the _new values, and samples left to go
+        // (the steps are in FILTERSWEEPPRECISION fixed point on top of FILTERPRECISION,
+        // which doesn't fit 32 bits once a coefficient gets past 4.0)
+        int32_t filter_a0_new, filter_b0_new, filter_b1_new;
+        int64_t filter_sweep_a0, filter_sweep_b0, filter_sweep_b1;
+        int32_t filter_sweep_length;
 
         int32_t rofs, lofs; // ?
         int32_t ramp_length;
@@ -434,11 +441,13 @@ typedef struct song_voice {
         int32_t portamento_target;
         song_instrument_t *ptr_instrument;      // these two suck, and should
         song_sample_t *ptr_sample;              // be replaced with numbers
+        uint32_t instrument_number;             // ptr_instrument's index in csf->instruments
         int vol_env_position;
         int pan_env_position;
         int pitch_env_position;
         uint32_t master_channel; // nonzero = background/NNA voice, indicates what channel it "came from"
         uint32_t vu_meter;
+        uint32_t filter_key; // cutoff/resonance the filter coefficients were made for, 0 = stale
         int32_t global_volume;
         int32_t instrument_volume;
         int32_t autovib_depth;
@@ -501,6 +510,76 @@ typedef struct song_note {
         uint8_t param;
 } song_note_t;
 
+// A copy of a pattern holding only the notes that have something in them, for
+// walking through quickly (or keeping around cheaply) when nothing's going to
+// edit it. Everything is in one allocation; see csf_pack_pattern.
+typedef struct song_packed_pattern {
+        uint32_t rows;
+        uint32_t count;         // number of notes stored
+        uint64_t channels;      // bit n is set if channel n has anything in it
+        uint32_t *row_start;    // [rows + 1]; row r is row_start[r] .. row_start[r + 1] - 1
+        uint8_t *chan;          // [count]
+        song_note_t *notes;     // [count]
+} song_packed_pattern_t;
+
+// Packed copies of a song's patterns that stay around from one walk to the
+// next; a pattern is only packed again once it's been edited since.
+struct song_pattern_cache {
+        song_packed_pattern_t *packed[MAX_PATTERNS];
+        uint32_t edits[MAX_PATTERNS];   // the pattern's edit count when it was packed
+};
+
+// the non-empty notes on one row of either kind of pattern, left to right
+typedef struct song_row_iter {
+        const song_note_t *notes;
+        const uint8_t *chan;    // NULL when walking a regular pattern
+        uint32_t pos, end;
+} song_row_iter_t;
+
+// where csf_get_length's walk through the song is up to (see csf_walk_next)
+struct song_walk {
+        uint32_t order, row, pattern;   // the row being looked at
+        uint32_t next_order, next_row;
+        uint32_t elapsed;               // msec, up to the start of this row
+        uint32_t speed, tempo, global_volume;
+        uint32_t patloop[MAX_CHANNELS];
+        uint8_t mem_tempo[MAX_CHANNELS];
+        uint64_t setloop;               // bitmask
+        uint32_t pack_failed[(MAX_PATTERNS + 31) / 32]; // bitmask: read these from the grid instead
+};
+
+// Every row the song plays, in order, and when it starts; built from the walk
+// above, and kept up to date with csf_timeline_check and csf_timeline_extend.
+// Since the walk never goes back to an earlier order, the rows are sorted by
+// both position and time.
+struct song_timeline_row {
+        uint16_t order, row;
+        uint8_t pattern, speed, tempo, global_volume;
+        uint32_t elapsed;               // msec
+};
+
+struct song_timeline {
+        struct song_timeline_row *rows;
+        uint32_t num_rows, alloc_rows;
+        // the walk as it was at the start of each order, so it can be picked
+        // up again from there when something after that point changes
+        struct song_timeline_mark {
+                uint32_t row;           // index into rows
+                uint32_t order, pattern;
+                struct song_walk walk;
+        } *marks;
+        uint32_t num_marks, alloc_marks;
+        struct song_walk walk;          // where to carry on from
+        int built, done;
+        uint32_t length;                // msec, once done
+        struct song_pattern_cache patterns;
+
+        // what it was built from
+        uint32_t pattern_edits[MAX_PATTERNS], orderlist_edits;
+        uint8_t orderlist[MAX_ORDERS + 1];
+        uint32_t initial_speed, initial_tempo, initial_global_volume;
+};
+
 ////////////////////////////////////////////////////////////////////
 
 typedef struct {
@@ -523,6 +602,16 @@ extern midi_config_t default_midi_config;
 extern uint32_t max_voices;
 extern uint32_t global_vu_left, global_vu_right;
 
+// Frames that went through each of the float stages, and how many of those were
+// skipped because there was nothing for the stage to do. These are only written
+// by whatever's mixing, and only good for a rough idea of where the time goes.
+struct dsp_skip_stats {
+        uint64_t eq_frames, eq_skipped;         // silence in, and the filters had settled
+        uint64_t send_frames, send_skipped;     // nothing sent, and the tails had died away
+        uint64_t limiter_frames, limiter_idle;  // nothing over the ceiling (just delayed)
+};
+extern struct dsp_skip_stats dsp_skip_stats;
+
 extern const song_note_t blank_pattern[64 * 64];
 extern const song_note_t *blank_note;
 
@@ -538,9 +627,150 @@ struct multi_write {
         int buffer[MIXBUFFERSIZE * 2];
 };
 
+// per-channel scope tap: if song_t.scope_tap is set, csf_create_stereo_mix
+// keeps the voices belonging to each pattern channel apart long enough to
+// measure them, and leaves a decimated (mono, 16-bit) copy of the result in
+// a ring buffer per channel for the UI to draw from.
+#define SCOPE_POINTS            1024    // ring size; must be a power of two
+#define SCOPE_DECIMATE          8       // mixed frames per point
+
+struct channel_scope {
+        int16_t wave[SCOPE_POINTS];
+        uint32_t pos;                   // points written so far; the newest is wave[(pos - 1) % SCOPE_POINTS]
+        uint32_t peak, rms;             // over the last mixed block, 0-32767
+};
+
+struct scope_tap {
+        struct channel_scope channels[MAX_CHANNELS];
+
+        // mixer scratch space
+        int voice_buffer[MIXBUFFERSIZE * 2];
+        int channel_buffer[MAX_CHANNELS][MIXBUFFERSIZE];
+        uint64_t used;                  // bit n set = channel_buffer[n] has data
+        unsigned int phase;             // frames since the last point, mod SCOPE_DECIMATE
+};
+
+// send bus: if song_t.send_bus is set, csf_create_stereo_mix adds every voice
+// that hasn't been taken off the bus (CHN_NOREVERB) into aux_buffer as well as
+// the mix, then runs one reverb and one tempo-synced delay over aux_buffer and
+// adds what comes out to the mix. See player/sendbus.c.
+#define SEND_REVERB_LINES       8
+
+struct send_bus {
+        // settings; change these with the audio locked, then call csf_send_bus_setup
+        int send;                       // 0-128, how much of the voices go into the effects
+        int reverb_level;               // 0-128
+        int reverb_time;                // decay to -60dB, in tenths of a second
+        int reverb_damp;                // 0-100
+        int delay_level;                // 0-128
+        int delay_feedback;             // 0-100
+        int delay_ticks;                // delay time in ticks at the current tempo
+
+        // mixer scratch
+        int aux_buffer[MIXBUFFERSIZE * 2];
+        int voice_buffer[MIXBUFFERSIZE * 2];
+        int used;                       // aux_buffer was written this block
+        unsigned int quiet;             // frames since anything was sent
+
+        // effect state, derived from the settings by csf_send_bus_setup
+        uint32_t rate;
+        float *line[SEND_REVERB_LINES];
+        unsigned int line_len[SEND_REVERB_LINES], line_pos[SEND_REVERB_LINES];
+        float line_gain[SEND_REVERB_LINES], line_lp[SEND_REVERB_LINES];
+        float damp, reverb_out, delay_out, delay_fb;
+        float *delay;                   // interleaved stereo
+        unsigned int delay_size, delay_pos;
+        unsigned int reverb_tail, delay_repeats;
+};
+
+// output limiter: with SNDMIX_LIMITER, csf_read runs the mix through this
+// after the EQ, so nothing gets as far as the clipping in the conversion to
+// the output format. See player/limiter.c.
+#define LIMITER_LOOKAHEAD_MAX   (MAX_SAMPLE_RATE / 500) // 2ms
+
+struct limiter {
+        // settings; call csf_limiter_setup after changing these
+        int ceiling;                    // tenths of a dB below full scale
+        float gain;                     // applied to the mix before limiting
+
+        // loudest (estimated) true peak seen since this was last cleared, after
+        // the gain, where 1.0 is full scale
+        float peak;
+
+        // state, derived by csf_limiter_setup
+        uint32_t rate;
+        unsigned int lookahead;         // frames; this is also the latency
+        float level;                    // the ceiling, in mix buffer units
+        float release;                  // how fast the gain comes back up, per frame
+        float env;                      // gain reduction before smoothing
+        float history[3 * 2];           // last three input frames, for the true-peak estimate
+        float delay[LIMITER_LOOKAHEAD_MAX * 2];
+        unsigned int delay_pos;
+        // smallest gain needed over the lookahead window; only gains below 1
+        // are queued, with an increasing value from head to tail
+        float queue_gain[LIMITER_LOOKAHEAD_MAX];
+        unsigned int queue_time[LIMITER_LOOKAHEAD_MAX];
+        unsigned int queue_head, queue_len, time;
+        // the last 'lookahead' values of env, which are averaged to get the gain
+        float smooth[LIMITER_LOOKAHEAD_MAX];
+        float smooth_sum;
+        unsigned int smooth_pos, smooth_below;
+};
+
+// dither: for 8- and 16-bit output, csf_read adds a little noise to the mix
+// before it's cut down to size, which turns the truncation distortion into
+// plain hiss, and can push that hiss up to where it's hard to hear. The noise
+// is a hash of a counter, so the same song always gets the same noise from the
+// start (csf_dither_setup with reset). See player/dither.c.
+enum {
+        DITHER_NONE,
+        DITHER_TPDF,                    // triangular noise, +/- 1 LSB
+        DITHER_SHAPED,                  // the same, with the error fed back through a shaping filter
+};
+
+#define DITHER_TAPS             5
+
+struct dither {
+        int mode;                       // DITHER_*; call csf_dither_setup after changing it
+
+        // state
+        uint32_t counter;               // where the noise is up to
+        float shape[DITHER_TAPS];       // error feedback filter, for the mix rate
+        float error[2][DITHER_TAPS];    // last few quantization errors per channel, newest first
+};
+
+// level meter: if song_t.meter is set, csf_read runs the mix through it after
+// the EQ (so before the limiter and the clipping), measuring its peak level
+// and its loudness as EBU R128 has it. See player/meter.c.
+#define METER_HIST_BINS         750 // 400ms block loudness from -70 to +5 LUFS in 0.1 LU steps
+
+struct mix_meter {
+        // results since csf_meter_reset; levels are linear, where 1.0 is full scale
+        float peak;
+        float true_peak;                // including an estimate of what's between the samples
+        float momentary_max;            // loudest 400ms, in LUFS
+        uint64_t frames;
+        uint64_t clipped;               // frames with anything over full scale
+        struct {
+                uint32_t frames, clipped;
+                float peak, momentary_max;
+        } orders[MAX_ORDERS];           // the same, split up by which order was playing
+
+        // state
+        uint32_t rate;
+        double coef[2][5];              // K-weighting: two biquads, b0 b1 b2 a1 a2
+        double z[2][2][2];              // filter state, [channel][biquad]
+        float history[3 * 2];           // last three frames, for the true-peak estimate
+        double block_sum[4];            // weighted energy of the last four 100ms pieces
+        unsigned int block_len, block_pos, block_count;
+        double hist_energy[METER_HIST_BINS];
+        uint32_t hist_count[METER_HIST_BINS];
+};
+
 typedef struct song {
         int mix_buffer[MIXBUFFERSIZE * 2];
         float mix_buffer_float[MIXBUFFERSIZE * 2]; // is this needed?
+        float filter_r[256]; // per-cutoff filter constant at mix_frequency (see init_filter_table)
 
         song_voice_t voices[MAX_VOICES];                // Channels
         uint32_t voice_mix[MAX_VOICES];                 // Channels to be mixed
@@ -551,6 +781,8 @@ typedef struct song {
         uint16_t pattern_size[MAX_PATTERNS];            // Pattern Lengths
         uint16_t pattern_alloc_size[MAX_PATTERNS];      // Allocated lengths (for async. resizing/playback)
         uint8_t orderlist[MAX_ORDERS + 1];              // Pattern Orders
+        uint32_t pattern_edits[MAX_PATTERNS];           // bumped on every change to a pattern (see timeline.c)
+        uint32_t orderlist_edits;                       // ... and to the order list
         midi_config_t midi_config;                      // Midi macro config table
         uint32_t initial_speed;
         uint32_t initial_tempo;
@@ -560,6 +792,7 @@ typedef struct song {
         uint32_t num_voices; // how many are currently playing. (POTENTIALLY larger than global max_voices)
         uint32_t mix_stat; // I'm not entirely sure what this is
         uint32_t buffer_count; // I don't really remember what this is
+        uint32_t read_offset; // frames csf_read has already produced this call (zero outside csf_read)
         uint32_t tick_count;
         int32_t row_count; /* IMPORTANT needs to be signed */
         uint32_t current_speed;
@@ -601,8 +834,66 @@ typedef struct song {
 
         // multi-write stuff -- NULL if no multi-write is in progress, else array of one struct per channel
         struct multi_write *multi_write;
+
+        // NULL unless something is drawing channel scopes (ignored while multi-writing)
+        struct scope_tap *scope_tap;
+
+        // NULL if the send effects are off (also ignored while multi-writing)
+        struct send_bus *send_bus;
+
+        // only used with SNDMIX_LIMITER
+        struct limiter limiter;
+
+        // only used with 8- and 16-bit output
+        struct dither dither;
+
+        // NULL unless something wants to know how loud the song is (ignored while multi-writing)
+        struct mix_meter *meter;
 } song_t;
 
+// sendbus.c
+struct send_bus *csf_send_bus_create(void);
+void csf_send_bus_free(struct send_bus *bus);
+// recalculates everything after a change of settings or mix rate (and empties
+// the reverb and delay if 'clear' is set, or the rate changed)
+void csf_send_bus_setup(struct send_bus *bus, uint32_t rate, int clear);
+
+// limiter.c
+// same idea; 'clear' empties the lookahead and lets go of any gain reduction
+void csf_limiter_setup(song_t *csf, int clear);
+
+// dither.c
+void csf_dither_setup(song_t *csf, int reset);
+
+// meter.c
+void csf_meter_reset(struct mix_meter *meter, uint32_t rate);
+// integrated loudness of everything measured so far, in LUFS (-HUGE_VAL if it was all silence)
+double csf_meter_loudness(const struct mix_meter *meter);
+
+// timeline.c
+// whatever edits the song has to call these, so the timeline knows to look again
+void csf_pattern_changed(song_t *csf, int pat);
+void csf_orderlist_changed(song_t *csf);
+// throws away whatever the song has changed out from under; returns nonzero if the timeline needs extending
+int csf_timeline_check(song_t *csf, struct song_timeline *tl);
+int csf_timeline_extend(song_t *csf, struct song_timeline *tl); // returns 0 if out of memory
+// msec from the start to where the song first reaches (order, row)
+uint32_t csf_timeline_time_at(const struct song_timeline *tl, int order, int row);
+// the first row starting at or after 'msec' (or the last row), NULL if there are none
+const struct song_timeline_row *csf_timeline_find(const struct song_timeline *tl, uint32_t msec);
+
+// pattern.c
+song_packed_pattern_t *csf_pack_pattern(const song_note_t *pattern, uint32_t rows);
+song_note_t *csf_unpack_pattern(const song_packed_pattern_t *packed);
+void csf_free_packed_pattern(song_packed_pattern_t *packed);
+// the packed copy of a pattern, packing it again if it's changed; NULL if there's no pattern or it didn't fit
+const song_packed_pattern_t *csf_pattern_cache_get(song_t *csf, struct song_pattern_cache *cache, uint32_t pat);
+void csf_pattern_cache_clear(struct song_pattern_cache *cache);
+void csf_row_iter(song_row_iter_t *it, const song_note_t *pattern, uint32_t row);
+void csf_row_iter_packed(song_row_iter_t *it, const song_packed_pattern_t *packed, uint32_t row);
+// returns NULL once the row is done
+const song_note_t *csf_row_iter_next(song_row_iter_t *it, uint32_t *chan);
+
 song_note_t *csf_allocate_pattern(uint32_t rows);
 void csf_free_pattern(void *pat);
 signed char *csf_allocate_sample(uint32_t nbytes);
@@ -615,8 +906,10 @@ uint32_t csf_read_sample(song_sample_t *sample, uint32_t flags, const void *file
 uint32_t csf_write_sample(disko_t *fp, song_sample_t *sample, uint32_t flags);
 void csf_adjust_sample_loop(song_sample_t *sample);
 
-extern void (*csf_midi_out_note)(int chan, const song_note_t *m);
-extern void (*csf_midi_out_raw)(const unsigned char *, unsigned int, unsigned int);
+extern void (*csf_midi_out_note)(song_t *csf, int chan, const song_note_t *m);
+extern void (*csf_midi_out_raw)(song_t *csf, const unsigned char *, unsigned int, unsigned int);
+// called at the start of every tick, once the row has been processed
+extern void (*csf_tick_hook)(song_t *csf);
 
 void csf_import_mod_effect(song_note_t *m, int from_xm);
 uint16_t csf_export_mod_effect(const song_note_t *m, int xm);
@@ -656,8 +949,12 @@ int csf_set_resampling_mode(song_t *csf, uint32_t mode); // SRCMODE_XXXX
 unsigned int csf_read(song_t *csf, void *v_buffer, unsigned int bufsize);
 int csf_process_tick(song_t *csf);
 int csf_read_note(song_t *csf);
+uint32_t csf_get_tick_length(song_t *csf); // in frames; 0 if there's no tempo
 
 // snd_fx
+void csf_walk_init(song_t *csf, struct song_walk *w);
+int csf_walk_next(song_t *csf, struct song_walk *w); // returns 0 at the end of the song
+void csf_walk_row(song_t *csf, struct song_walk *w, struct song_pattern_cache *cache); // cache can be NULL
 unsigned int csf_get_length(song_t *csf); // (in seconds)
 void csf_instrument_change(song_t *csf, song_voice_t *chn, uint32_t instr, int porta, int instr_column);
 void csf_note_change(song_t *csf, uint32_t chan, int note, int porta, int retrig, int have_inst);
@@ -54,6 +54,16 @@ struct audio_settings {
         int channel_limit, interpolation_mode;
         int surround_effect;
 
+        // send bus; see player/sendbus.c
+        int send_level, reverb_level, reverb_time, reverb_damp;
+        int delay_level, delay_feedback, delay_ticks;
+
+        // output limiter; ceiling is in tenths of a dB below full scale
+        int limiter, limiter_ceiling;
+
+        // DITHER_* for 8- and 16-bit output (the diskwriter has its own setting)
+        int dither;
+
         unsigned int eq_freq[4];
         unsigned int eq_gain[4];
         int no_ramping;
@@ -148,6 +158,9 @@ song_note_t *song_pattern_allocate(int rows);
 song_note_t *song_pattern_allocate_copy(int patno, int *rows);
 void song_pattern_deallocate(song_note_t *n);
 void song_pattern_install(int patno, song_note_t *n, int rows);
+// anything that writes to a pattern or the order list itself has to say so afterward
+void song_pattern_changed(int patno);
+void song_orderlist_changed(void);
 
 
 // these return NULL on failure.
@@ -259,15 +272,28 @@ select sample #0. (note: this is a hack to work around another hack) */
 #define KEYJAZZ_NOINST -1
 #define KEYJAZZ_DEFAULTVOL -1
 #define KEYJAZZ_INST_FAKE -2
+#define KEYJAZZ_INST_MIDI -3 /* live notes only: use the MIDI channel number */
 int song_keydown(int samp, int ins, int note, int vol, int chan);
 int song_keyrecord(int samp, int ins, int note, int vol, int chan, int effect, int param);
 int song_keyup(int samp, int ins, int note);
+/* the channel the note was last played on, or zero */
+int song_keyjazz_channel(int note);
+
+/* Live MIDI input: song_live_note is called from the MIDI driver thread with
+the note already mapped (and callers serialized), and returns nonzero if the
+note will be played by the mixer -- in which case the page shouldn't play it
+again. What it plays is set by the main thread with song_set_live_target,
+which takes the same samp/ins/chan as song_keydown. */
+void song_set_live_target(int enable, int samp, int ins, int chan);
+int song_live_note(int on, int note, int vol, int midi_channel, uint64_t when);
 
 void song_start(void);
 void song_start_once(void);
 void song_pause(void);
 void song_stop(void);
 void song_stop_unlocked(int quitting);
+/* forget what the MIDI output of a rendered (not played) song has sent; call with the audio locked */
+void song_midi_render_reset(void);
 void song_loop_pattern(int pattern, int row);
 void song_start_at_order(int order, int row);
 void song_start_at_pattern(int pattern, int row);
@@ -281,6 +307,16 @@ unsigned int song_get_current_time(void);
 
 int song_get_current_speed(void);
 int song_get_current_tick(void);
+
+/* where playback was (or will be) heard at a given time on the MIDI clock
+(see midi_get_clock). serial changes every time playback is restarted. */
+struct song_position {
+        int serial;
+        int order, pattern, row, speed;
+        double tick;    /* into the row, with the fraction */
+};
+/* returns zero if it can't say: not playing, or too long ago */
+int song_get_position_at(uint64_t when, struct song_position *pos);
 int song_get_current_tempo(void);
 int song_get_current_global_volume(void);
 
@@ -298,8 +334,9 @@ int song_get_max_channels(void);
 void song_get_vu_meter(int *left, int *right);
 
 /* fill the array with flags of each playing sample/instrument, such that iff
- * sample #7 is playing, samples[7] will be nonzero. these are a bit processor
- * intensive since they require a linear traversal through the mix channels. */
+ * sample #7 is playing, samples[7] will be nonzero. these walk the mix list in
+ * the playback snapshot (see song_get_playback_state) so they don't need to
+ * lock the audio, but they're still main-thread only. */
 void song_get_playing_samples(int samples[]);
 void song_get_playing_instruments(int instruments[]);
 
@@ -332,6 +369,56 @@ song_voice_t *song_get_mix_channel(int n);
  * it's kind of ugly, but it'll do... i hope :) */
 int song_get_mix_state(unsigned int **channel_list);
 
+/* a copy of what one voice was doing at the end of the last audio buffer.
+sample and instrument are numbers (zero = none) rather than pointers, so the
+copy stays meaningful even if the song is edited after it was taken. */
+typedef struct song_voice_state {
+        int playing; /* nonzero if the voice has sample data to play */
+        int channel; /* one-based pattern channel the voice belongs to */
+        int master_channel; /* nonzero = background/NNA voice */
+        int sample, instrument;
+        int note;
+        uint32_t flags;
+        const void *sample_data; /* for comparing against song_sample_t.data; never dereference */
+        int position;
+        int sample_freq;
+        int final_volume, volume, global_volume, sample_global_volume;
+        int instrument_volume, fadeout_volume;
+        int panning, final_panning;
+        int nna;
+        int vu_meter;
+        int strike;
+        int vol_env_position, pan_env_position, pitch_env_position;
+} song_voice_state_t;
+
+typedef struct song_playback_state {
+        unsigned int samples_played;
+        int order, pattern, row, tick;
+        int speed, tempo, global_volume;
+        unsigned int vu_left, vu_right; /* raw, see song_get_vu_meter */
+        int max_channels_used;
+        /* the voices playing on channels 1-64, indexed by channel - 1, and
+        how many voices in total (including background ones) each has */
+        song_voice_state_t channels[MAX_CHANNELS];
+        int channel_voices[MAX_CHANNELS];
+        /* everything being mixed, in mix order (see song_get_mix_state) */
+        int num_mix;
+        song_voice_state_t mix[MAX_VOICES];
+} song_playback_state_t;
+
+/* the playback state as of the last audio buffer. this is filled in by the
+audio thread and handed over without locking, so the UI can draw from it for
+as long as it likes without holding up the mixer -- but only the main thread
+may call this, and the pointer is good until the next call. */
+const song_playback_state_t *song_get_playback_state(void);
+
+/* per-channel scopes (see struct scope_tap in sndfile.h). they cost the mixer
+an extra pass over each voice, so they're off until something asks for them.
+song_get_channel_scope returns NULL while the tap is off; chan is zero based.
+the ring is written by the audio thread as it goes, so read 'pos' first. */
+void song_set_scope_tap(int enable);
+const struct channel_scope *song_get_channel_scope(int chan);
+
 /* --------------------------------------------------------------------- */
 /* rearranging stuff */
 
@@ -62,6 +62,9 @@
 # ifndef MALLOC
 #  define MALLOC __attribute__ ((malloc))
 # endif
+# ifndef ALWAYS_INLINE
+#  define ALWAYS_INLINE inline __attribute__((always_inline))
+# endif
 #else
 # ifndef UNUSED
 #  define UNUSED
@@ -81,6 +84,9 @@
 # ifndef MALLOC
 #  define MALLOC
 # endif
+# ifndef ALWAYS_INLINE
+#  define ALWAYS_INLINE inline
+# endif
 #endif
 
 /* Path stuff that differs by platform */
@@ -56,7 +56,7 @@ void vgamem_scan8(unsigned int y,unsigned char *out,unsigned int tc[16], unsigne
 /* video output routines */
 const char *video_driver_name(void);
 
-void video_init();
+void video_init(const char *driver);
 void video_startup(void);
 void video_shutdown(void);
 void video_report(void);
@@ -66,6 +66,9 @@ void video_fullscreen(int tri);
 void video_translate(unsigned int vx, unsigned int vy,
                         unsigned int *x, unsigned int *y);
 void video_blit(void);
+/* microseconds the last video_blit spent scanning vgamem out to pixels,
+and handing them to the display (always 0 for the offscreen driver) */
+void video_blit_timing(unsigned int *scan_usec, unsigned int *present_usec);
 void video_mousecursor(int z);
 int video_mousecursor_visible(void);
 
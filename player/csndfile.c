@@ -53,6 +53,8 @@ static void _csf_reset(song_t *csf)
         csf->current_order = 0;
         csf->process_order = 0;
         csf->mixing_volume = 0x30;
+        csf->limiter.ceiling = 10;
+        csf->limiter.gain = 1.0f;
         memset(csf->message, 0, sizeof(csf->message));
 
         csf->row_highlight_major = 16;
@@ -75,7 +77,9 @@ static void _csf_reset(song_t *csf)
         for (i = 0; i < MAX_PATTERNS; i++) {
                 csf->pattern_size[i] = 64;
                 csf->pattern_alloc_size[i] = 64;
+                csf_pattern_changed(csf, i);
         }
+        csf_orderlist_changed(csf);
         for (i = 0; i < MAX_SAMPLES; i++) {
                 csf->samples[i].c5speed = 8363;
                 csf->samples[i].volume = 64 * 4;
@@ -1194,6 +1198,7 @@ void csf_stop_sample(song_t *csf, song_sample_t *smp)
                         v->current_sample_data = NULL;
                         v->ptr_sample = NULL;
                         v->ptr_instrument = NULL;
+                        v->instrument_number = 0;
                         v->left_volume = v->right_volume = 0;
                         v->left_volume_new = v->right_volume_new = 0;
                         v->left_ramp = v->right_ramp = 0;
@@ -1564,6 +1569,7 @@ void csf_insert_restart_pos(song_t *csf, uint32_t restart_order)
                 memcpy(csf->patterns[newpat], csf->patterns[pat],
                         sizeof(song_note_t) * MAX_CHANNELS * csf->pattern_size[pat]);
                 csf->orderlist[ord] = pat = newpat;
+                csf_orderlist_changed(csf);
         } else {
                 //log_appendf(2, "Modifying pattern %d to add restart position", pat);
         }
@@ -1600,5 +1606,6 @@ void csf_insert_restart_pos(song_t *csf, uint32_t restart_order)
                         empty->param = restart_order;
                 }
         }
+        csf_pattern_changed(csf, pat);
 }
 
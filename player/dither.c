@@ -0,0 +1,159 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Dither for 8- and 16-bit output.
+
+The clip_32_to_* functions take the top bits of each sample and drop the
+rest, which at low levels turns into distortion that follows the music. Adding
+triangular noise of +/- 1 LSB first (two uniform randoms added together) makes
+the error plain, steady hiss instead. With noise shaping, each sample's
+quantization error is also subtracted from the next few samples through a
+filter, which moves most of the hiss up to where the ear is least sensitive.
+
+The clip_32_to_* functions truncate, so the noise also carries an extra half
+LSB to make that round to the nearest step instead. With noise shaping, the
+mix is left on an exact step, so the conversion adds no error of its own.
+
+The noise comes from hashing a counter rather than from a stateful generator,
+so a whole block of it can be made at once, and that loop vectorizes. */
+
+#include "sndfile.h"
+#include "cmixer.h"
+#include "util.h"
+
+#include <math.h>
+
+// Lipshitz et al.'s "E-weighted" 5-tap filter, which follows the ear's
+// threshold curve at 44.1kHz (and near enough at 48kHz)
+static const float shape_e_weighted[DITHER_TAPS] = {2.033f, -2.165f, 1.959f, -1.590f, 0.6149f};
+// at higher rates that curve would land in the wrong place, so just use a
+// second-order highpass, which moves the noise up out of the way
+static const float shape_highpass[DITHER_TAPS] = {2.0f, -1.0f, 0.0f, 0.0f, 0.0f};
+
+
+void csf_dither_setup(song_t *csf, int reset)
+{
+        struct dither *d = &csf->dither;
+
+        d->mode = CLAMP(d->mode, DITHER_NONE, DITHER_SHAPED);
+        memcpy(d->shape, (csf->mix_frequency <= 50000) ? shape_e_weighted : shape_highpass, sizeof(d->shape));
+        if (reset) {
+                d->counter = 0;
+                memset(d->error, 0, sizeof(d->error));
+        }
+}
+
+// how far clip_32_to_* shift the mix down, or 0 for the formats that aren't dithered
+static int dither_shift(song_t *csf)
+{
+        switch (csf->mix_bits_per_sample) {
+        case 8:  return 24 - MIXING_ATTENUATION;
+        case 16: return 16 - MIXING_ATTENUATION;
+        default: return 0;
+        }
+}
+
+// "lowbias32", from Chris Wellons' hash prospector
+static inline uint32_t dither_hash(uint32_t x)
+{
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+        return x;
+}
+
+// fills 'noise' with triangular noise of +/- 1 LSB, plus half an LSB to round
+static void dither_noise(struct dither *d, float *noise, unsigned int samples, int shift)
+{
+        const float scale = (float) (1 << shift) / 65536.0f, half = (float) (1 << shift) / 2.0f;
+        uint32_t counter = d->counter;
+        unsigned int n;
+
+        for (n = 0; n < samples; n++) {
+                uint32_t h = dither_hash(counter + n);
+                noise[n] = ((int) (h & 0xffff) + (int) (h >> 16) - 65535) * scale + half;
+        }
+        d->counter = counter + samples;
+}
+
+static ALWAYS_INLINE void dither_process(song_t *csf, int *buffer, unsigned int samples,
+        const unsigned int lanes, const int shaped)
+{
+        struct dither *d = &csf->dither;
+        float noise[MIXBUFFERSIZE * 2];
+        const int shift = dither_shift(csf);
+        const float lsb = (float) (1 << shift), inv_lsb = 1.0f / lsb;
+        const int qmin = MIXING_CLIPMIN >> shift, qmax = MIXING_CLIPMAX >> shift;
+        unsigned int n, k;
+        int t;
+
+        if (!shift || d->mode == DITHER_NONE)
+                return;
+
+        dither_noise(d, noise, samples, shift);
+
+        if (!shaped || d->mode != DITHER_SHAPED) {
+                for (n = 0; n < samples; n++)
+                        buffer[n] += (int) noise[n];
+                return;
+        }
+
+        for (n = 0; n < samples; n += lanes) {
+                for (k = 0; k < lanes; k++) {
+                        float *e = d->error[k];
+                        float want = buffer[n + k], err;
+                        int q;
+
+                        for (t = 0; t < DITHER_TAPS; t++)
+                                want -= d->shape[t] * e[t];
+                        q = (int) floorf((want + noise[n + k]) * inv_lsb);
+                        q = CLAMP(q, qmin, qmax);
+                        buffer[n + k] = q << shift;
+
+                        // if the mix clipped, the error is huge and means nothing;
+                        // feeding it back would just make things worse
+                        err = q * lsb - want;
+                        err = CLAMP(err, -2.0f * lsb, 2.0f * lsb);
+                        for (t = DITHER_TAPS - 1; t > 0; t--)
+                                e[t] = e[t - 1];
+                        e[0] = err;
+                }
+        }
+}
+
+void dither_mono(song_t *csf, int *buffer, unsigned int samples)
+{
+        dither_process(csf, buffer, samples, 1, 1);
+}
+
+void dither_stereo(song_t *csf, int *buffer, unsigned int samples)
+{
+        dither_process(csf, buffer, samples, 2, 1);
+}
+
+void dither_plain(song_t *csf, int *buffer, unsigned int samples)
+{
+        dither_process(csf, buffer, samples, 1, 0);
+}
@@ -34,7 +34,7 @@
 
 
 // see also csf_midi_out_note in sndmix.c
-void (*csf_midi_out_raw)(const unsigned char *,unsigned int, unsigned int) = NULL;
+void (*csf_midi_out_raw)(song_t *csf, const unsigned char *,unsigned int, unsigned int) = NULL;
 
 /* --------------------------------------------------------------------------------------------------------- */
 /* note/freq/period conversion functions */
@@ -117,8 +117,8 @@ void fx_note_cut(song_t *csf, uint32_t nchan, int clear_note)
                 OPL_NoteOff(nchan);
                 OPL_Touch(nchan, NULL, 0);
         }
-        GM_KeyOff(nchan);
-        GM_Touch(nchan, 0);
+        GM_KeyOff(csf, nchan);
+        GM_Touch(csf, nchan, 0);
 }
 
 void fx_key_off(song_t *csf, uint32_t nchan)
@@ -131,7 +131,7 @@ void fx_key_off(song_t *csf, uint32_t nchan)
                 //Do this only if really an adlib chan. Important!
                 OPL_NoteOff(nchan);
         }
-        GM_KeyOff(nchan);
+        GM_KeyOff(csf, nchan);
 
         song_instrument_t *penv = (csf->flags & SONG_INSTRUMENTMODE) ? chan->ptr_instrument : NULL;
 
@@ -740,6 +740,11 @@ static void fx_special(song_t *csf, uint32_t nchan, uint32_t param)
                         chan->panbrello_delta = 0;
                         chan->panning = 128;
                 }
+                // S98/S99: Send bus (reverb) off/on, like MPT
+                if (param == 8 && (csf->flags & SONG_FIRSTTICK))
+                        chan->flags |= CHN_NOREVERB;
+                if (param == 9 && (csf->flags & SONG_FIRSTTICK))
+                        chan->flags &= ~CHN_NOREVERB;
                 break;
         // SAx: Set 64k Offset
         // Note: don't actually APPLY the offset, and don't clear the regular offset value, either.
@@ -797,13 +802,13 @@ void csf_midi_send(song_t *csf, const unsigned char *data, unsigned int len, uin
                         if (chan->volume > 0 || oldcutoff < 0x10
                             || !(chan->flags & CHN_FILTER)
                             || !(chan->left_volume|chan->right_volume)) {
-                                setup_channel_filter(chan, !(chan->flags & CHN_FILTER), 256, csf->mix_frequency);
+                                setup_channel_filter(chan, !(chan->flags & CHN_FILTER), 256, csf);
                         }
                         break;
                 case 0x01: // set resonance
                         if (idata[3] < 0x80)
                                 chan->resonance = idata[3];
-                        setup_channel_filter(chan, !(chan->flags & CHN_FILTER), 256, csf->mix_frequency);
+                        setup_channel_filter(chan, !(chan->flags & CHN_FILTER), 256, csf);
                         break;
                 }
                 idata += 4;
@@ -811,17 +816,10 @@ void csf_midi_send(song_t *csf, const unsigned char *data, unsigned int len, uin
         }
 
         if (!fake && csf_midi_out_raw) {
-                /* okay, this is kind of how it works.
-                we pass buffer_count as here because while
-                        1000 * ((8((buffer_size/2) - buffer_count)) / sample_rate)
-                is the number of msec we need to delay by, libmodplug simply doesn't know
-                what the buffer size is at this point so buffer_count simply has no
-                frame of reference.
-
-                fortunately, schism does and can complete this (tags: _schism_midi_out_raw )
-
-                */
-                csf_midi_out_raw(data, len, csf->buffer_count);
+                /* pass along how far into the output of csf_read we are, so
+                the frontend can work out exactly when this should be heard
+                (tags: _schism_midi_out_raw ) */
+                csf_midi_out_raw(csf, data, len, csf->read_offset);
         }
 }
 
@@ -954,144 +952,180 @@ void csf_process_midi_macro(song_t *csf, uint32_t nchan, const char * macro, uin
 // Length
 
 #if MAX_CHANNELS != 64
-# error csf_get_length assumes 64 channels
+# error csf_walk_row assumes 64 channels
 #endif
 
-unsigned int csf_get_length(song_t *csf)
+/* Walking through the song a row at a time, keeping track of only what affects
+timing: this is how csf_get_length works, and what the timeline index in
+timeline.c is built from. csf_walk_next moves on to the next row, and
+csf_walk_row goes through its effects and adds on how long it plays for. */
+
+void csf_walk_init(song_t *csf, struct song_walk *w)
 {
-        uint32_t elapsed = 0, row = 0, next_row = 0, cur_order = 0, next_order = 0, pat = csf->orderlist[0],
-                speed = csf->initial_speed, tempo = csf->initial_tempo, psize, n;
-        uint32_t patloop[MAX_CHANNELS] = {0};
-        uint8_t mem_tempo[MAX_CHANNELS] = {0};
-        uint64_t setloop = 0; // bitmask
-        const song_note_t *pdata;
-
-        for (;;) {
-                uint32_t speed_count = 0;
-                row = next_row;
-                cur_order = next_order;
-
-                // Check if pattern is valid
-                pat = csf->orderlist[cur_order];
-                while (pat >= MAX_PATTERNS) {
-                        // End of song ?
-                        if (pat == ORDER_LAST || cur_order >= MAX_ORDERS) {
-                                pat = ORDER_LAST; // cause break from outer loop too
+        memset(w, 0, sizeof(*w));
+        w->speed = csf->initial_speed;
+        w->tempo = csf->initial_tempo;
+        w->global_volume = csf->initial_global_volume;
+}
+
+int csf_walk_next(song_t *csf, struct song_walk *w)
+{
+        uint32_t cur_order = w->next_order, row = w->next_row, pat, psize;
+
+        // Check if pattern is valid
+        pat = csf->orderlist[cur_order];
+        while (pat >= MAX_PATTERNS) {
+                // End of song ?
+                if (pat == ORDER_LAST || cur_order >= MAX_ORDERS) {
+                        w->order = cur_order;
+                        return 0;
+                } else {
+                        cur_order++;
+                        pat = (cur_order < MAX_ORDERS) ? csf->orderlist[cur_order] : ORDER_LAST;
+                }
+                w->next_order = cur_order;
+        }
+        psize = csf->patterns[pat] ? csf->pattern_size[pat] : 64;
+        // guard against Cxx to invalid row, etc.
+        if (row >= psize)
+                row = 0;
+        // Update next position
+        w->next_row = row + 1;
+        if (w->next_row >= psize) {
+                w->next_order = cur_order + 1;
+                w->next_row = 0;
+        }
+
+        w->order = cur_order;
+        w->row = row;
+        w->pattern = pat;
+        return 1;
+}
+
+void csf_walk_row(song_t *csf, struct song_walk *w, struct song_pattern_cache *cache)
+{
+        const song_packed_pattern_t *packed = NULL;
+        const song_note_t *note;
+        song_row_iter_t iter;
+        uint32_t speed_count = 0, n;
+
+        /* This is nasty, but it fixes inaccuracies with SB0 SB1 SB1. (Simultaneous
+        loops in multiple channels are still wildly incorrect, though.) */
+        if (!w->row)
+                w->setloop = ~0;
+        if (w->setloop) {
+                for (n = 0; n < MAX_CHANNELS; n++)
+                        if (w->setloop & (1 << n))
+                                w->patloop[n] = w->elapsed;
+                w->setloop = 0;
+        }
+
+        // with a cache, patterns get packed as they come up, since most notes
+        // on a row don't have any effect to look at (if that fails, once is
+        // enough to find out)
+        if (cache && csf->patterns[w->pattern]
+            && !(w->pack_failed[w->pattern / 32] & (1u << (w->pattern % 32)))) {
+                packed = csf_pattern_cache_get(csf, cache, w->pattern);
+                if (!packed)
+                        w->pack_failed[w->pattern / 32] |= 1u << (w->pattern % 32);
+        }
+        if (packed)
+                csf_row_iter_packed(&iter, packed, w->row);
+        else
+                csf_row_iter(&iter, csf->patterns[w->pattern], w->row);
+
+        while ((note = csf_row_iter_next(&iter, &n))) {
+                uint32_t param = note->param;
+                switch (note->effect) {
+                case FX_NONE:
+                        break;
+                case FX_POSITIONJUMP:
+                        w->next_order = param > w->order ? param : w->order + 1;
+                        w->next_row = 0;
+                        break;
+                case FX_PATTERNBREAK:
+                        w->next_order = w->order + 1;
+                        w->next_row = param;
+                        break;
+                case FX_SPEED:
+                        if (param)
+                                w->speed = param;
+                        break;
+                case FX_TEMPO:
+                        if (param)
+                                w->mem_tempo[n] = param;
+                        else
+                                param = w->mem_tempo[n];
+                        int d = (param & 0xf);
+                        switch (param >> 4) {
+                        default:
+                                w->tempo = param;
+                                break;
+                        case 0:
+                                d = -d;
+                        case 1:
+                                d = d * (w->speed - 1) + w->tempo;
+                                w->tempo = CLAMP(d, 32, 255);
+                                break;
+                        }
+                        break;
+                case FX_GLOBALVOLUME:
+                        // (slides aren't followed)
+                        if (param <= 128)
+                                w->global_volume = param;
+                        break;
+                case FX_SPECIAL:
+                        switch (param >> 4) {
+                        case 0x6:
+                                speed_count = param & 0x0F;
+                                break;
+                        case 0xb:
+                                if (param & 0x0F) {
+                                        w->elapsed += (w->elapsed - w->patloop[n]) * (param & 0x0F);
+                                        w->patloop[n] = 0xffffffff;
+                                        w->setloop = 1;
+                                } else {
+                                        w->patloop[n] = w->elapsed;
+                                }
+                                break;
+                        case 0xe:
+                                speed_count = (param & 0x0F) * w->speed;
                                 break;
-                        } else {
-                                cur_order++;
-                                pat = (cur_order < MAX_ORDERS) ? csf->orderlist[cur_order] : ORDER_LAST;
                         }
-                        next_order = cur_order;
-                }
-                // Weird stuff?
-                if (pat >= MAX_PATTERNS)
                         break;
-                pdata = csf->patterns[pat];
-                if (pdata) {
-                        psize = csf->pattern_size[pat];
-                } else {
-                        pdata = blank_pattern;
-                        psize = 64;
-                }
-                // guard against Cxx to invalid row, etc.
-                if (row >= psize)
-                        row = 0;
-                // Update next position
-                next_row = row + 1;
-                if (next_row >= psize) {
-                        next_order = cur_order + 1;
-                        next_row = 0;
                 }
+        }
+        //  sec/tick = 5 / (2 * tempo)
+        // msec/tick = 5000 / (2 * tempo)
+        //           = 2500 / tempo
+        w->elapsed += (w->speed + speed_count) * 2500 / w->tempo;
+}
 
+unsigned int csf_get_length(song_t *csf)
+{
+        struct song_walk w;
+
+        // no cache: packing reads each pattern's whole grid, only to throw the
+        // copy away afterward, so this just reads the grid (see timeline.c)
+        csf_walk_init(csf, &w);
+        while (csf_walk_next(csf, &w)) {
                 /* muahahaha */
                 if (csf->stop_at_order > -1 && csf->stop_at_row > -1) {
-                        if (csf->stop_at_order <= (signed) cur_order && csf->stop_at_row <= (signed) row)
+                        if (csf->stop_at_order <= (signed) w.order && csf->stop_at_row <= (signed) w.row)
                                 break;
                         if (csf->stop_at_time > 0) {
                                 /* stupid api decision */
-                                if (((elapsed + 500) / 1000) >= csf->stop_at_time) {
-                                        csf->stop_at_order = cur_order;
-                                        csf->stop_at_row = row;
+                                if (((w.elapsed + 500) / 1000) >= csf->stop_at_time) {
+                                        csf->stop_at_order = w.order;
+                                        csf->stop_at_row = w.row;
                                         break;
                                 }
                         }
                 }
-
-                /* This is nasty, but it fixes inaccuracies with SB0 SB1 SB1. (Simultaneous
-                loops in multiple channels are still wildly incorrect, though.) */
-                if (!row)
-                        setloop = ~0;
-                if (setloop) {
-                        for (n = 0; n < MAX_CHANNELS; n++)
-                                if (setloop & (1 << n))
-                                        patloop[n] = elapsed;
-                        setloop = 0;
-                }
-                const song_note_t *note = pdata + row * MAX_CHANNELS;
-                for (n = 0; n < MAX_CHANNELS; note++, n++) {
-                        uint32_t param = note->param;
-                        switch (note->effect) {
-                        case FX_NONE:
-                                break;
-                        case FX_POSITIONJUMP:
-                                next_order = param > cur_order ? param : cur_order + 1;
-                                next_row = 0;
-                                break;
-                        case FX_PATTERNBREAK:
-                                next_order = cur_order + 1;
-                                next_row = param;
-                                break;
-                        case FX_SPEED:
-                                if (param)
-                                        speed = param;
-                                break;
-                        case FX_TEMPO:
-                                if (param)
-                                        mem_tempo[n] = param;
-                                else
-                                        param = mem_tempo[n];
-                                int d = (param & 0xf);
-                                switch (param >> 4) {
-                                default:
-                                        tempo = param;
-                                        break;
-                                case 0:
-                                        d = -d;
-                                case 1:
-                                        d = d * (speed - 1) + tempo;
-                                        tempo = CLAMP(d, 32, 255);
-                                        break;
-                                }
-                                break;
-                        case FX_SPECIAL:
-                                switch (param >> 4) {
-                                case 0x6:
-                                        speed_count = param & 0x0F;
-                                        break;
-                                case 0xb:
-                                        if (param & 0x0F) {
-                                                elapsed += (elapsed - patloop[n]) * (param & 0x0F);
-                                                patloop[n] = 0xffffffff;
-                                                setloop = 1;
-                                        } else {
-                                                patloop[n] = elapsed;
-                                        }
-                                        break;
-                                case 0xe:
-                                        speed_count = (param & 0x0F) * speed;
-                                        break;
-                                }
-                                break;
-                        }
-                }
-                //  sec/tick = 5 / (2 * tempo)
-                // msec/tick = 5000 / (2 * tempo)
-                //           = 2500 / tempo
-                elapsed += (speed + speed_count) * 2500 / tempo;
+                csf_walk_row(csf, &w, NULL);
         }
 
-        return (elapsed + 500) / 1000;
+        return (w.elapsed + 500) / 1000;
 }
 
 
@@ -1157,6 +1191,7 @@ void csf_instrument_change(song_t *csf, song_voice_t *chan, uint32_t instr, int
         if (penv != chan->ptr_instrument || !chan->current_sample_data) {
                 inst_changed = 1;
                 chan->ptr_instrument = penv;
+                chan->instrument_number = penv ? instr : 0;
         }
 
         // Instrument adjust
@@ -1392,7 +1427,7 @@ void csf_note_change(song_t *csf, uint32_t nchan, int note, int porta, int retri
                 }
 
                 if (chan->cutoff < 0x7F)
-                        setup_channel_filter(chan, 1, 256, csf->mix_frequency);
+                        setup_channel_filter(chan, 1, 256, csf);
         }
 }
 
@@ -1477,8 +1512,8 @@ void csf_check_nna(song_t *csf, uint32_t nchan, uint32_t instr, int note, int fo
                         OPL_NoteOff(nchan);
                         OPL_Touch(nchan, NULL, 0);
                 }
-                GM_KeyOff(nchan);
-                GM_Touch(nchan, 0);
+                GM_KeyOff(csf, nchan);
+                GM_Touch(csf, nchan, 0);
                 return;
         }
         if (instr >= MAX_INSTRUMENTS) instr = 0;
@@ -2021,8 +2056,8 @@ void csf_process_effects(song_t *csf, int firsttick)
                                         OPL_NoteOff(nchan);
                                         OPL_Touch(nchan, NULL, 0);
                                 }
-                                GM_KeyOff(nchan);
-                                GM_Touch(nchan, 0);
+                                GM_KeyOff(csf, nchan);
+                                GM_Touch(csf, nchan, 0);
                         }
 
                         if (NOTE_IS_CONTROL(note)) {
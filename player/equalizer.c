@@ -23,95 +23,201 @@
 
 #include "sndfile.h"
 #include "cmixer.h"
+#include "util.h"
 #include <math.h>
 
 
 #define EQ_BANDWIDTH    2.0
 #define EQ_ZERO         0.000001
+/* history small enough that nothing coming out of it would survive the
+   conversion back to int (in the same units as the mix) */
+#define EQ_SETTLED      0.125f
+
+/* same scale as stereo_mix_to_float and friends */
+#define EQ_I2F          ((float) (1.0 / (1 << 28)))
+#define EQ_F2I          ((float) (1 << 28))
 
 
 
 typedef struct {
     float a0, a1, a2, b1, b2;
-    float x1, x2, y1, y2;
     float gain, center_frequency;
     int   enabled;
 } eq_band;
 
+/* Filter history for one band. Left and right are kept side by side so the
+   compiler can run both channels through a band with the same instructions;
+   mono only uses the first lane. */
+typedef struct {
+    float x1[2], x2[2], y1[2], y2[2];
+} eq_history;
 
 
-//static REAL f2ic = (REAL)(1 << 28);
-//static REAL i2fc = (REAL)(1.0 / (1 << 28));
 
-static eq_band eq[MAX_EQ_BANDS * 2] =
+static eq_band eq[MAX_EQ_BANDS] =
 {
     // Default: Flat EQ
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   120, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   600, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  1200, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  3000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  6000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 10000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   120, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   600, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  1200, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  3000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  6000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 10000, 0},
+    {0, 0, 0, 0, 0, 1,   120, 0},
+    {0, 0, 0, 0, 0, 1,   600, 0},
+    {0, 0, 0, 0, 0, 1,  1200, 0},
+    {0, 0, 0, 0, 0, 1,  3000, 0},
+    {0, 0, 0, 0, 0, 1,  6000, 0},
+    {0, 0, 0, 0, 0, 1, 10000, 0},
 };
 
+static eq_history eq_hist[MAX_EQ_BANDS];
+
+/* the bands that actually change the signal, in order; rebuilt by initialize_eq */
+static unsigned int eq_active[MAX_EQ_BANDS];
+static unsigned int eq_nactive = 0;
+
+/* set once the input has gone silent and the history has died away (and been
+   cleared), so there's nothing for the EQ to do until the input comes back */
+static int eq_settled = 0;
 
-static void eq_filter(eq_band *pbs, float *pbuffer, unsigned int count)
+
+/* Runs the whole cascade over an interleaved int buffer, one frame at a time:
+   each sample goes through every active band while it's still in a register,
+   instead of making a pass over the buffer per band and per channel. The
+   coefficients and history are copied to locals for the duration so nothing
+   gets written back to memory inside the loop.
+
+   'lanes' and 'nb' are always constants, so this gets stamped out for mono
+   and stereo and for each number of bands; with the band count known, the
+   history stays in registers, which is where all the speed comes from. */
+static ALWAYS_INLINE void eq_cascade(int *buffer, unsigned int count,
+        const unsigned int lanes, const unsigned int nb)
 {
-        for (unsigned int i = 0; i < count; i++) {
-                float x = pbuffer[i];
-                float y = pbs->a1 * pbs->x1 +
-                          pbs->a2 * pbs->x2 +
-                          pbs->a0 * x +
-                          pbs->b1 * pbs->y1 +
-                          pbs->b2 * pbs->y2;
-
-                pbs->x2 = pbs->x1;
-                pbs->y2 = pbs->y1;
-                pbs->x1 = x;
-                pbuffer[i] = y;
-                pbs->y1 = y;
+        float a0[MAX_EQ_BANDS], a1[MAX_EQ_BANDS], a2[MAX_EQ_BANDS], b1[MAX_EQ_BANDS], b2[MAX_EQ_BANDS];
+        eq_history h[MAX_EQ_BANDS];
+        unsigned int b, l;
+
+        for (b = 0; b < nb; b++) {
+                const eq_band *band = &eq[eq_active[b]];
+
+                a0[b] = band->a0;
+                a1[b] = band->a1;
+                a2[b] = band->a2;
+                b1[b] = band->b1;
+                b2[b] = band->b2;
+                h[b] = eq_hist[eq_active[b]];
+        }
+
+        for (unsigned int i = 0; i < count; i++, buffer += lanes) {
+                float x[2], y[2];
+
+                for (l = 0; l < lanes; l++)
+                        x[l] = buffer[l] * EQ_I2F;
+
+                for (b = 0; b < nb; b++) {
+                        for (l = 0; l < lanes; l++) {
+                                y[l] = a1[b] * h[b].x1[l]
+                                     + a2[b] * h[b].x2[l]
+                                     + a0[b] * x[l]
+                                     + b1[b] * h[b].y1[l]
+                                     + b2[b] * h[b].y2[l];
+
+                                h[b].x2[l] = h[b].x1[l];
+                                h[b].x1[l] = x[l];
+                                h[b].y2[l] = h[b].y1[l];
+                                h[b].y1[l] = y[l];
+                                x[l] = y[l];
+                        }
+                }
+
+                for (l = 0; l < lanes; l++)
+                        buffer[l] = (int) (x[l] * EQ_F2I);
         }
+
+        for (b = 0; b < nb; b++)
+                eq_hist[eq_active[b]] = h[b];
 }
 
 
-void eq_mono(song_t *csf, int *buffer, unsigned int count)
+static int eq_silent(const int *buffer, unsigned int samples)
+{
+        int any = 0;
+
+        for (unsigned int i = 0; i < samples; i++)
+                any |= buffer[i];
+        return !any;
+}
+
+/* after a silent block: clear out the history once it's too small to matter,
+   which also keeps the filters from trailing off into denormals */
+static void eq_settle(void)
 {
-        mono_mix_to_float(buffer, csf->mix_buffer_float, count);
+        float most = 0;
+
+        for (unsigned int b = 0; b < eq_nactive; b++) {
+                const eq_history *h = &eq_hist[eq_active[b]];
 
-        for (unsigned int b = 0; b < MAX_EQ_BANDS; b++)
-        {
-                if (eq[b].enabled && eq[b].gain != 1.0f)
-                        eq_filter(&eq[b], csf->mix_buffer_float, count);
+                for (unsigned int l = 0; l < 2; l++) {
+                        most = MAX(most, fabsf(h->x1[l]));
+                        most = MAX(most, fabsf(h->x2[l]));
+                        most = MAX(most, fabsf(h->y1[l]));
+                        most = MAX(most, fabsf(h->y2[l]));
+                }
+        }
+        if (most * EQ_F2I < EQ_SETTLED) {
+                memset(eq_hist, 0, sizeof(eq_hist));
+                eq_settled = 1;
         }
+}
 
-        float_to_mono_mix(csf->mix_buffer_float, buffer, count);
+/* whether the block can be skipped; if not, the caller runs the filters and
+   then calls eq_settle if this said the input was silent */
+static int eq_skip(const int *buffer, unsigned int count, unsigned int lanes, int *silent)
+{
+        dsp_skip_stats.eq_frames += count;
+        *silent = eq_silent(buffer, count * lanes);
+        if (*silent && eq_settled) {
+                dsp_skip_stats.eq_skipped += count;
+                return 1;
+        }
+        eq_settled = 0;
+        return 0;
 }
 
 
-// XXX: I rolled the two loops into one. Make sure this works.
-void eq_stereo(song_t *csf, int *buffer, unsigned int count)
+void eq_mono(UNUSED song_t *csf, int *buffer, unsigned int count)
 {
-        stereo_mix_to_float(buffer, csf->mix_buffer_float, csf->mix_buffer_float + MIXBUFFERSIZE, count);
-
-        for (unsigned int b = 0; b < MAX_EQ_BANDS; b++) {
-                int br = b + MAX_EQ_BANDS;
+        int silent;
+
+        // flat: leave the mix alone rather than round-trip it through float
+        if (!eq_nactive || eq_skip(buffer, count, 1, &silent))
+                return;
+
+        switch (eq_nactive) {
+        case 1: eq_cascade(buffer, count, 1, 1); break;
+        case 2: eq_cascade(buffer, count, 1, 2); break;
+        case 3: eq_cascade(buffer, count, 1, 3); break;
+        case 4: eq_cascade(buffer, count, 1, 4); break;
+        case 5: eq_cascade(buffer, count, 1, 5); break;
+        default: eq_cascade(buffer, count, 1, 6); break;
+        }
+        if (silent)
+                eq_settle();
+}
 
-                // Left band
-                if (eq[b].enabled && eq[b].gain != 1.0f)
-                        eq_filter(&eq[b], csf->mix_buffer_float, count);
 
-                // Right band
-                if (eq[br].enabled && eq[br].gain != 1.0f)
-                        eq_filter(&eq[br], csf->mix_buffer_float + MIXBUFFERSIZE, count);
+void eq_stereo(UNUSED song_t *csf, int *buffer, unsigned int count)
+{
+        int silent;
+
+        if (!eq_nactive || eq_skip(buffer, count, 2, &silent))
+                return;
+
+        switch (eq_nactive) {
+        case 1: eq_cascade(buffer, count, 2, 1); break;
+        case 2: eq_cascade(buffer, count, 2, 2); break;
+        case 3: eq_cascade(buffer, count, 2, 3); break;
+        case 4: eq_cascade(buffer, count, 2, 4); break;
+        case 5: eq_cascade(buffer, count, 2, 5); break;
+        default: eq_cascade(buffer, count, 2, 6); break;
         }
-
-        float_to_stereo_mix(csf->mix_buffer_float, csf->mix_buffer_float + MIXBUFFERSIZE, buffer, count);
+        if (silent)
+                eq_settle();
 }
 
 
@@ -119,8 +225,11 @@ void initialize_eq(int reset, float freq)
 {
         //float fMixingFreq = (REAL)mix_frequency;
 
+        eq_nactive = 0;
+        eq_settled = 0;
+
         // Gain = 0.5 (-6dB) .. 2 (+6dB)
-        for (unsigned int band = 0; band < MAX_EQ_BANDS * 2; band++) {
+        for (unsigned int band = 0; band < MAX_EQ_BANDS; band++) {
                 float k, k2, r, f;
                 float v0, v1;
                 int b = reset;
@@ -131,10 +240,7 @@ void initialize_eq(int reset, float freq)
                         eq[band].a2 = 0;
                         eq[band].b1 = 0;
                         eq[band].b2 = 0;
-                        eq[band].x1 = 0;
-                        eq[band].x2 = 0;
-                        eq[band].y1 = 0;
-                        eq[band].y2 = 0;
+                        memset(&eq_hist[band], 0, sizeof(eq_hist[band]));
                         continue;
                 }
 
@@ -202,12 +308,11 @@ void initialize_eq(int reset, float freq)
                         b = 1;
                 }
 
-                if (b) {
-                        eq[band].x1 = 0;
-                        eq[band].x2 = 0;
-                        eq[band].y1 = 0;
-                        eq[band].y2 = 0;
-                }
+                if (b)
+                        memset(&eq_hist[band], 0, sizeof(eq_hist[band]));
+
+                if (eq[band].gain != 1.0f)
+                        eq_active[eq_nactive++] = band;
         }
 }
 
@@ -233,21 +338,11 @@ void set_eq_gains(const unsigned int *gainbuff, unsigned int gains, const unsign
                         g = 1;
                 }
 
-                eq[i].gain =
-                eq[i + MAX_EQ_BANDS].gain = g;
-                eq[i].center_frequency =
-                eq[i + MAX_EQ_BANDS].center_frequency = f;
+                eq[i].gain = g;
+                eq[i].center_frequency = f;
 
                 /* don't enable bands outside... */
-                if (f > 20.0f &&
-                    i < gains) {
-                        eq[i].enabled =
-                        eq[i + MAX_EQ_BANDS].enabled = 1;
-                }
-                else {
-                        eq[i].enabled =
-                        eq[i + MAX_EQ_BANDS].enabled = 0;
-                }
+                eq[i].enabled = (f > 20.0f && i < gains);
         }
 
         initialize_eq(reset, mix_freq);
@@ -63,16 +63,64 @@ static const float resonance_table[128] = {
 };
 
 
-// Simple 2-poles resonant filter
-//
-// XXX freq WAS unused but is now mix_frequency!
-//
 #define FREQ_PARAM_MULT (128.0 / (24.0 * 256.0))
-void setup_channel_filter(song_voice_t *chan, int reset, int flt_modifier, int freq)
+
+// The cutoff -> frequency part of the filter setup is a powf() that depends
+// on nothing but the mix rate, so it's done for every cutoff value whenever
+// the rate changes (from csf_init_player) instead of whenever a filter
+// envelope moves. Coefficients the voices already have are thrown out too.
+void init_filter_table(song_t *csf)
+{
+        int freq = csf->mix_frequency;
+        float frequency;
+
+        for (int cutoff = 0; cutoff < 256; cutoff++) {
+                // 2 ^ (i / 24 * 256)
+                frequency = 110.0 * powf(2.0, (float) cutoff * FREQ_PARAM_MULT + 0.25);
+                if (frequency > freq / 2.0)
+                        frequency = freq / 2.0;
+                csf->filter_r[cutoff] = freq / (2.0 * M_PI * frequency);
+        }
+
+        for (int n = 0; n < MAX_VOICES; n++) {
+                end_filter_sweep(&csf->voices[n]);
+                csf->voices[n].filter_key = 0;
+        }
+}
+
+
+// Jump straight to the end of a coefficient sweep, if there's one going.
+void end_filter_sweep(song_voice_t *chan)
+{
+        if (!chan->filter_sweep_length)
+                return;
+        chan->filter_a0 = chan->filter_a0_new;
+        chan->filter_b0 = chan->filter_b0_new;
+        chan->filter_b1 = chan->filter_b1_new;
+        chan->filter_sweep_length = 0;
+}
+
+
+// Length of the tick that's about to be mixed, which is how long a change
+// in the coefficients gets spread over.
+static int filter_sweep_samples(song_t *csf)
+{
+        if (csf->mix_flags & SNDMIX_NORAMPING)
+                return 0;
+        return csf_get_tick_length(csf);
+}
+
+
+// Simple 2-poles resonant filter
+void setup_channel_filter(song_voice_t *chan, int reset, int flt_modifier, song_t *csf)
 {
         int cutoff = chan->cutoff;
         int resonance = chan->resonance;
-        float frequency, r, d, e, fg, fb0, fb1;
+        uint32_t key;
+        float r, d, e, fg, fb0, fb1;
+        int32_t a0, b0, b1;
+        // sweeping only makes sense from a filter that's already running
+        int length = (reset || !(chan->flags & CHN_FILTER)) ? 0 : filter_sweep_samples(csf);
 
         cutoff = cutoff * (flt_modifier + 256) / 256;
 
@@ -88,22 +136,53 @@ void setup_channel_filter(song_voice_t *chan, int reset, int flt_modifier, int f
         else
                 cutoff = 255;
 
-        // 2 ^ (i / 24 * 256)
-        frequency = 110.0 * powf(2.0, (float) cutoff * FREQ_PARAM_MULT + 0.25);
-        if (frequency > freq / 2.0)
-                frequency = freq / 2.0;
-        r = freq / (2.0 * M_PI * frequency);
+        // Filter envelopes land here every tick, mostly with the same values
+        // as last time; the coefficients only need redoing when they change.
+        key = 1 + ((cutoff << 8) | resonance);
+        if (chan->filter_key != key) {
+                chan->filter_key = key;
 
-        d = resonance_table[resonance] * r + resonance_table[resonance] - 1.0;
-        e = r * r;
+                r = csf->filter_r[cutoff];
+                d = resonance_table[resonance] * r + resonance_table[resonance] - 1.0;
+                e = r * r;
 
-        fg = 1.0 / (1.0 + d + e);
-        fb0 = (d + e + e) / (1.0 + d + e);
-        fb1 = -e / (1.0 + d + e);
+                fg = 1.0 / (1.0 + d + e);
+                fb0 = (d + e + e) / (1.0 + d + e);
+                fb1 = -e / (1.0 + d + e);
 
-        chan->filter_a0 = (int32_t)(fg * (1 << FILTERPRECISION));
-        chan->filter_b0 = (int32_t)(fb0 * (1 << FILTERPRECISION));
-        chan->filter_b1 = (int32_t)(fb1 * (1 << FILTERPRECISION));
+                a0 = (int32_t)(fg * (1 << FILTERPRECISION));
+                b0 = (int32_t)(fb0 * (1 << FILTERPRECISION));
+                b1 = (int32_t)(fb1 * (1 << FILTERPRECISION));
+
+                // Rather than jumping to the new coefficients, which is audible
+                // as stepping when an envelope or a slide moves the cutoff every
+                // tick, have the mixer ramp over to them across the next tick.
+                if (length > 0) {
+                        if (chan->filter_sweep_length) {
+                                // carry on from wherever the last sweep got to
+                                chan->filter_a0 = chan->filter_a0_new - (int32_t) ((chan->filter_sweep_a0
+                                        * chan->filter_sweep_length) >> FILTERSWEEPPRECISION);
+                                chan->filter_b0 = chan->filter_b0_new - (int32_t) ((chan->filter_sweep_b0
+                                        * chan->filter_sweep_length) >> FILTERSWEEPPRECISION);
+                                chan->filter_b1 = chan->filter_b1_new - (int32_t) ((chan->filter_sweep_b1
+                                        * chan->filter_sweep_length) >> FILTERSWEEPPRECISION);
+                        }
+                        chan->filter_a0_new = a0;
+                        chan->filter_b0_new = b0;
+                        chan->filter_b1_new = b1;
+                        chan->filter_sweep_a0 = (int64_t) (a0 - chan->filter_a0) * FILTERSWEEPONE / length;
+                        chan->filter_sweep_b0 = (int64_t) (b0 - chan->filter_b0) * FILTERSWEEPONE / length;
+                        chan->filter_sweep_b1 = (int64_t) (b1 - chan->filter_b1) * FILTERSWEEPONE / length;
+                        chan->filter_sweep_length = length;
+                } else {
+                        chan->filter_a0 = a0;
+                        chan->filter_b0 = b0;
+                        chan->filter_b1 = b1;
+                        chan->filter_sweep_length = 0;
+                }
+        } else if (reset) {
+                end_filter_sweep(chan);
+        }
 
         if (reset) {
                 chan->filter_y1 = chan->filter_y2 = 0;
@@ -758,6 +758,12 @@ INLINE void advance(FM_OPL *OPL)
                 CH  = &OPL->P_CH[i/2];
                 op  = &CH->SLOT[i&1];
 
+                /* an operator that's off is keyed off, and keying it on restarts the phase, so
+                there's no point in keeping it going -- except that the rhythm section uses
+                the phase of some operators for others */
+                if (op->state == EG_OFF && !(OPL->rhythm & 0x20))
+                        continue;
+
                 /* Phase Generator */
                 if(op->vib)
                 {
@@ -2104,6 +2110,72 @@ void ym3812_update_one(void *chip, OPLSAMPLE *buffer, int length)
         }
 
 }
+
+/* is there anything at all coming out of this channel? */
+INLINE int OPL_CH_IDLE(OPL_CH *CH)
+{
+        return CH->SLOT[SLOT1].state == EG_OFF && CH->SLOT[SLOT2].state == EG_OFF
+                && !CH->SLOT[SLOT1].op1_out[0] && !CH->SLOT[SLOT1].op1_out[1];
+}
+
+/*
+** Like ym3812_update_one, but each channel is panned with its own pair of
+** gains (256 = full level) and the result is added into an interleaved
+** stereo buffer. The rhythm section goes to the centre.
+**
+** Channels with nothing playing are left out, and if that's all of them,
+** the chip isn't run at all -- in which case this returns zero.
+*/
+int ym3812_update_stereo(void *chip, INT32 *buffer, int length, const INT32 *gain_l, const INT32 *gain_r)
+{
+        FM_OPL          *OPL = (FM_OPL *)chip;
+        UINT8           rhythm = OPL->rhythm&0x20;
+        int             live[9], nlive = 0;
+        int i, c, n;
+
+        for (c = 0; c < (rhythm ? 6 : 9); c++)
+                if (!OPL_CH_IDLE(&OPL->P_CH[c]))
+                        live[nlive++] = c;
+        if (!nlive && !rhythm)
+                return 0;
+
+        for( i=0; i < length ; i++ )
+        {
+                INT32 lt = 0, rt = 0;
+
+                advance_lfo(OPL);
+
+                /* FM part */
+                for (n = 0; n < nlive; n++)
+                {
+                        c = live[n];
+                        OPL->output[0] = 0;
+                        OPL_CALC_CH(OPL, &OPL->P_CH[c]);
+                        lt += OPL->output[0] * gain_l[c];
+                        rt += OPL->output[0] * gain_r[c];
+                }
+
+                /* Rhythm part */
+                if (rhythm)
+                {
+                        OPL->output[0] = 0;
+                        OPL_CALC_RH(OPL, &OPL->P_CH[0], (OPL->noise_rng>>0)&1 );
+                        lt += OPL->output[0] << 8;
+                        rt += OPL->output[0] << 8;
+                }
+
+                lt >>= FINAL_SH + 8;
+                rt >>= FINAL_SH + 8;
+
+                /* limit check, and store to sound buffer */
+                buffer[i * 2 + 0] += limit( lt , MAXOUT, MINOUT );
+                buffer[i * 2 + 1] += limit( rt , MAXOUT, MINOUT );
+
+                advance(OPL);
+        }
+
+        return 1;
+}
 #endif /* BUILD_YM3812 */
 
 
@@ -0,0 +1,196 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* A lookahead brickwall limiter for the final mix.
+
+Each frame gets the gain it would need to stay under the ceiling. The gain
+that's applied is the smallest of those over the next 'lookahead' frames (with
+a slow release when it goes back up), averaged over another 'lookahead' frames
+so it ramps down smoothly instead of jumping. The audio is delayed by the
+lookahead, so by the time a peak comes out, the gain has finished ramping down
+to what that peak needs: nothing makes it through to be clipped.
+
+The peak of a frame isn't just its sample values; the waveform between two
+samples can go higher than either of them, and a DAC (or anything that
+resamples the output) will show it. A cubic estimate of the point halfway
+between each pair of samples catches most of that. */
+
+#include "sndfile.h"
+#include "cmixer.h"
+#include "util.h"
+
+#include <math.h>
+
+#define LIMITER_LOOKAHEAD_MS    1.5
+#define LIMITER_RELEASE_MS      80
+
+
+void csf_limiter_setup(song_t *csf, int clear)
+{
+        struct limiter *lim = &csf->limiter;
+        uint32_t rate = csf->mix_frequency;
+        unsigned int lookahead, n;
+
+        if (!rate)
+                return;
+
+        lim->ceiling = CLAMP(lim->ceiling, 0, 200);
+        lookahead = rate * LIMITER_LOOKAHEAD_MS / 1000;
+        lookahead = CLAMP(lookahead, 4, LIMITER_LOOKAHEAD_MAX);
+
+        if (clear || rate != lim->rate || lookahead != lim->lookahead) {
+                memset(lim->history, 0, sizeof(lim->history));
+                memset(lim->delay, 0, sizeof(lim->delay));
+                lim->delay_pos = 0;
+                lim->queue_head = lim->queue_len = lim->time = 0;
+                for (n = 0; n < lookahead; n++)
+                        lim->smooth[n] = 1;
+                lim->smooth_sum = lookahead;
+                lim->smooth_pos = lim->smooth_below = 0;
+                lim->env = 1;
+                lim->peak = 0;
+        }
+        lim->rate = rate;
+        lim->lookahead = lookahead;
+
+        lim->level = MIXING_CLIPMAX * powf(10.0f, lim->ceiling / -200.0f);
+        lim->release = 1.0f - expf(-1000.0f / (LIMITER_RELEASE_MS * rate));
+}
+
+static ALWAYS_INLINE void limiter_process(song_t *csf, int *buffer, unsigned int count, const unsigned int lanes)
+{
+        struct limiter *lim = &csf->limiter;
+        float x[(MIXBUFFERSIZE + 3) * 2]; // three frames of history, then this block
+        float need[MIXBUFFERSIZE];
+        const float gain = lim->gain, level = lim->level;
+        const unsigned int len = lim->lookahead, delay_len = len - 1;
+        const float inv_len = 1.0f / len;
+        float least = 1, loudest = 0, env, g;
+        unsigned int n, k, pos;
+
+        // First, what each frame needs, for the whole block at once. This part
+        // has no state carried from one frame to the next, so it vectorizes.
+        memcpy(x, lim->history, 3 * lanes * sizeof(float));
+        for (n = 0; n < count * lanes; n++)
+                x[3 * lanes + n] = buffer[n] * gain;
+        memcpy(lim->history, x + count * lanes, 3 * lanes * sizeof(float));
+
+        for (n = 0; n < count; n++) {
+                float p = 0;
+                for (k = 0; k < lanes; k++) {
+                        const float *s = x + n * lanes + k;
+                        float mid = (9.0f * (s[lanes] + s[2 * lanes]) - (s[0] + s[3 * lanes])) * (1.0f / 16.0f);
+                        float a = fabsf(s[3 * lanes]), b = fabsf(mid);
+                        a = MAX(a, b);
+                        p = MAX(p, a);
+                }
+                loudest = MAX(loudest, p);
+                p = MAX(p, level);
+                need[n] = level / p;
+                least = MIN(least, need[n]);
+        }
+        loudest /= MIXING_CLIPMAX;
+        lim->peak = MAX(lim->peak, loudest);
+
+        pos = lim->delay_pos;
+        dsp_skip_stats.limiter_frames += count;
+
+        if (least == 1 && !lim->queue_len && !lim->smooth_below && lim->env == 1) {
+                // nothing's being turned down, and nothing needs to be
+                dsp_skip_stats.limiter_idle += count;
+                lim->time += count;
+                for (n = 0; n < count; n++) {
+                        for (k = 0; k < lanes; k++) {
+                                buffer[n * lanes + k] = (int) lim->delay[pos * lanes + k];
+                                lim->delay[pos * lanes + k] = x[(n + 3) * lanes + k];
+                        }
+                        if (++pos == delay_len)
+                                pos = 0;
+                }
+                lim->delay_pos = pos;
+                return;
+        }
+
+        env = lim->env;
+        for (n = 0; n < count; n++) {
+                unsigned int t = lim->time++;
+                float m, old;
+
+                // the smallest gain needed over the last 'len' frames; anything
+                // queued that isn't smaller than a new value can never be the
+                // smallest again, so it's dropped
+                if (lim->queue_len && t - lim->queue_time[lim->queue_head] >= len) {
+                        if (++lim->queue_head == len)
+                                lim->queue_head = 0;
+                        lim->queue_len--;
+                }
+                if (need[n] < 1) {
+                        while (lim->queue_len
+                               && lim->queue_gain[(lim->queue_head + lim->queue_len - 1) % len] >= need[n])
+                                lim->queue_len--;
+                        k = (lim->queue_head + lim->queue_len++) % len;
+                        lim->queue_gain[k] = need[n];
+                        lim->queue_time[k] = t;
+                }
+                m = lim->queue_len ? lim->queue_gain[lim->queue_head] : 1;
+
+                if (m < env) {
+                        env = m;
+                } else {
+                        // the last step of the way, where (m - env) * release
+                        // gets lost in rounding, is under a hundredth of a dB
+                        env += (m - env) * lim->release;
+                        if (m - env < 1e-3f)
+                                env = m;
+                }
+
+                old = lim->smooth[lim->smooth_pos];
+                lim->smooth[lim->smooth_pos] = env;
+                if (++lim->smooth_pos == len)
+                        lim->smooth_pos = 0;
+                lim->smooth_below += (env < 1) - (old < 1);
+                lim->smooth_sum += env - old;
+                if (!lim->smooth_below)
+                        lim->smooth_sum = len; // don't let rounding errors pile up
+                g = lim->smooth_sum * inv_len;
+
+                for (k = 0; k < lanes; k++) {
+                        buffer[n * lanes + k] = (int) (lim->delay[pos * lanes + k] * g);
+                        lim->delay[pos * lanes + k] = x[(n + 3) * lanes + k];
+                }
+                if (++pos == delay_len)
+                        pos = 0;
+        }
+        lim->env = env;
+        lim->delay_pos = pos;
+}
+
+void limiter_mono(song_t *csf, int *buffer, unsigned int count)
+{
+        limiter_process(csf, buffer, count, 1);
+}
+
+void limiter_stereo(song_t *csf, int *buffer, unsigned int count)
+{
+        limiter_process(csf, buffer, count, 2);
+}
@@ -0,0 +1,189 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Peak and loudness measurement, for finding out how loud a song is without
+writing it anywhere (see disko_analyze_song).
+
+Loudness is measured the way ITU-R BS.1770 / EBU R128 do it: the signal goes
+through the "K-weighting" filters (a high shelf around 1.7kHz, then a highpass
+around 38Hz), and its mean square is taken over 400ms blocks, one every 100ms.
+The integrated loudness is the average of those blocks, leaving out anything
+below -70 LUFS, and then anything more than 10 LU below the average of what's
+left. Rather than keeping every block for that second pass, they're sorted
+into a histogram at 0.1 LU resolution, which is as good as the measurement
+needs to be anyway. */
+
+#include "sndfile.h"
+#include "cmixer.h"
+#include "util.h"
+
+#include <math.h>
+
+#define METER_HIST_MIN          -70.0 // LUFS; the absolute gate, and the bottom of the histogram
+
+static double energy_to_lufs(double e)
+{
+        return -0.691 + 10.0 * log10(e);
+}
+
+void csf_meter_reset(struct mix_meter *meter, uint32_t rate)
+{
+        double k, vh, vb, a0;
+
+        memset(meter, 0, sizeof(*meter));
+        meter->momentary_max = -HUGE_VALF;
+        meter->rate = rate = rate ?: 44100;
+        meter->block_len = rate / 10;
+
+        // the filter constants from BS.1770 are given at 48kHz; these are the
+        // analog prototypes they came from, so they work at any rate
+        k = tan(M_PI * 1681.974450955533 / rate);
+        vh = pow(10.0, 3.999843853973347 / 20.0);
+        vb = pow(vh, 0.4996667741545416);
+        a0 = 1.0 + k / 0.7071752369554196 + k * k;
+        meter->coef[0][0] = (vh + vb * k / 0.7071752369554196 + k * k) / a0;
+        meter->coef[0][1] = 2.0 * (k * k - vh) / a0;
+        meter->coef[0][2] = (vh - vb * k / 0.7071752369554196 + k * k) / a0;
+        meter->coef[0][3] = 2.0 * (k * k - 1.0) / a0;
+        meter->coef[0][4] = (1.0 - k / 0.7071752369554196 + k * k) / a0;
+
+        k = tan(M_PI * 38.13547087602444 / rate);
+        a0 = 1.0 + k / 0.5003270373238773 + k * k;
+        meter->coef[1][0] = 1.0;
+        meter->coef[1][1] = -2.0;
+        meter->coef[1][2] = 1.0;
+        meter->coef[1][3] = 2.0 * (k * k - 1.0) / a0;
+        meter->coef[1][4] = (1.0 - k / 0.5003270373238773 + k * k) / a0;
+}
+
+// one 400ms block is done
+static void meter_block(struct mix_meter *meter, int order)
+{
+        double e = (meter->block_sum[0] + meter->block_sum[1] + meter->block_sum[2] + meter->block_sum[3])
+                / (4.0 * meter->block_len);
+        double l;
+        int bin;
+
+        if (e <= 0)
+                return;
+        l = energy_to_lufs(e);
+        meter->momentary_max = MAX(meter->momentary_max, l);
+        meter->orders[order].momentary_max = MAX(meter->orders[order].momentary_max, l);
+        if (l < METER_HIST_MIN)
+                return;
+        bin = (int) ((l - METER_HIST_MIN) * 10.0);
+        bin = MIN(bin, METER_HIST_BINS - 1);
+        meter->hist_energy[bin] += e;
+        meter->hist_count[bin]++;
+}
+
+void meter_process(song_t *csf, struct mix_meter *meter, const int *buffer, unsigned int count)
+{
+        const unsigned int lanes = (csf->mix_channels >= 2) ? 2 : 1;
+        const float scale = 1.0f / MIXING_CLIPMAX;
+        int order = (csf->current_order < MAX_ORDERS) ? csf->current_order : 0;
+        float peak = 0, true_peak = 0;
+        unsigned int clipped = 0, n, k;
+
+        if (!meter->orders[order].frames)
+                meter->orders[order].momentary_max = -HUGE_VALF;
+
+        for (n = 0; n < count; n++, buffer += lanes) {
+                int over = 0;
+
+                for (k = 0; k < lanes; k++) {
+                        float x = buffer[k] * scale, a = fabsf(x);
+                        float *h = meter->history + 3 * k;
+                        float mid = fabsf((9.0f * (h[1] + h[2]) - (h[0] + x)) * (1.0f / 16.0f));
+                        double *c, *z, w, y;
+
+                        h[0] = h[1];
+                        h[1] = h[2];
+                        h[2] = x;
+                        peak = MAX(peak, a);
+                        true_peak = MAX(true_peak, a);
+                        true_peak = MAX(true_peak, mid);
+                        over |= (buffer[k] > MIXING_CLIPMAX || buffer[k] < MIXING_CLIPMIN);
+
+                        // K-weighting, transposed direct form II
+                        c = meter->coef[0];
+                        z = meter->z[k][0];
+                        w = x;
+                        y = c[0] * w + z[0];
+                        z[0] = c[1] * w - c[3] * y + z[1];
+                        z[1] = c[2] * w - c[4] * y;
+                        c = meter->coef[1];
+                        z = meter->z[k][1];
+                        w = y;
+                        y = c[0] * w + z[0];
+                        z[0] = c[1] * w - c[3] * y + z[1];
+                        z[1] = c[2] * w - c[4] * y;
+
+                        meter->block_sum[0] += y * y;
+                }
+                clipped += over;
+
+                if (++meter->block_pos == meter->block_len) {
+                        meter->block_pos = 0;
+                        if (++meter->block_count >= 4)
+                                meter_block(meter, order);
+                        // the newest piece is always [0]
+                        memmove(meter->block_sum + 1, meter->block_sum, 3 * sizeof(double));
+                        meter->block_sum[0] = 0;
+                }
+        }
+
+        meter->peak = MAX(meter->peak, peak);
+        meter->true_peak = MAX(meter->true_peak, true_peak);
+        meter->frames += count;
+        meter->clipped += clipped;
+        meter->orders[order].frames += count;
+        meter->orders[order].clipped += clipped;
+        meter->orders[order].peak = MAX(meter->orders[order].peak, peak);
+}
+
+double csf_meter_loudness(const struct mix_meter *meter)
+{
+        double e = 0, gate;
+        uint64_t blocks = 0;
+        int n, start;
+
+        for (n = 0; n < METER_HIST_BINS; n++) {
+                e += meter->hist_energy[n];
+                blocks += meter->hist_count[n];
+        }
+        if (!blocks)
+                return -HUGE_VAL;
+
+        // relative gate: 10 LU below the average of everything over the absolute gate
+        gate = energy_to_lufs(e / blocks) - 10.0;
+        start = (int) ceil((gate - METER_HIST_MIN) * 10.0);
+        start = CLAMP(start, 0, METER_HIST_BINS - 1);
+        e = 0;
+        blocks = 0;
+        for (n = start; n < METER_HIST_BINS; n++) {
+                e += meter->hist_energy[n];
+                blocks += meter->hist_count[n];
+        }
+        return blocks ? energy_to_lufs(e / blocks) : -HUGE_VAL;
+}
@@ -418,6 +418,58 @@
     fy4 = fy3; fy3 = tb; vol_r = tb;
 
 
+// Coefficient sweeps (see setup_channel_filter): the coefficients are kept in
+// FILTERSWEEPPRECISION fixed point and stepped towards filter_*_new every sample.
+// Only used while a sweep is going, so the plain filters above don't pay for it.
+#define MIX_BEGIN_FILTER_SWEEP \
+    MIX_BEGIN_FILTER \
+    int64_t fa0 = (int64_t) channel->filter_a0_new * FILTERSWEEPONE \
+        - channel->filter_sweep_a0 * channel->filter_sweep_length; \
+    int64_t fb0 = (int64_t) channel->filter_b0_new * FILTERSWEEPONE \
+        - channel->filter_sweep_b0 * channel->filter_sweep_length; \
+    int64_t fb1 = (int64_t) channel->filter_b1_new * FILTERSWEEPONE \
+        - channel->filter_sweep_b1 * channel->filter_sweep_length; \
+    const int64_t da0 = channel->filter_sweep_a0; \
+    const int64_t db0 = channel->filter_sweep_b0; \
+    const int64_t db1 = channel->filter_sweep_b1;
+
+
+#define SNDMIX_PROCESSFILTERSWEEP \
+    ta = (vol * (int32_t) (fa0 >> FILTERSWEEPPRECISION) + FILT_CLIP(fy1) * (int32_t) (fb0 >> FILTERSWEEPPRECISION) \
+        + FILT_CLIP(fy2) * (int32_t) (fb1 >> FILTERSWEEPPRECISION) + (1 << (FILTERPRECISION - 1))) >> FILTERPRECISION; \
+    fy2 = fy1; \
+    fy1 = ta; \
+    vol = ta; \
+    fa0 += da0; fb0 += db0; fb1 += db1;
+
+
+#define MIX_BEGIN_STEREO_FILTER_SWEEP \
+    MIX_BEGIN_STEREO_FILTER \
+    int64_t fa0 = (int64_t) channel->filter_a0_new * FILTERSWEEPONE \
+        - channel->filter_sweep_a0 * channel->filter_sweep_length; \
+    int64_t fb0 = (int64_t) channel->filter_b0_new * FILTERSWEEPONE \
+        - channel->filter_sweep_b0 * channel->filter_sweep_length; \
+    int64_t fb1 = (int64_t) channel->filter_b1_new * FILTERSWEEPONE \
+        - channel->filter_sweep_b1 * channel->filter_sweep_length; \
+    const int64_t da0 = channel->filter_sweep_a0; \
+    const int64_t db0 = channel->filter_sweep_b0; \
+    const int64_t db1 = channel->filter_sweep_b1; \
+    int32_t ca0, cb0, cb1;
+
+
+#define SNDMIX_PROCESSSTEREOFILTERSWEEP \
+    ca0 = (int32_t) (fa0 >> FILTERSWEEPPRECISION); \
+    cb0 = (int32_t) (fb0 >> FILTERSWEEPPRECISION); \
+    cb1 = (int32_t) (fb1 >> FILTERSWEEPPRECISION); \
+    ta = (vol_l * ca0 + FILT_CLIP(fy1) * cb0 + FILT_CLIP(fy2) * cb1 \
+        + (1 << (FILTERPRECISION - 1))) >> FILTERPRECISION; \
+    tb = (vol_r * ca0 + FILT_CLIP(fy3) * cb0 + FILT_CLIP(fy4) * cb1 \
+        + (1 << (FILTERPRECISION - 1))) >> FILTERPRECISION; \
+    fy2 = fy1; fy1 = ta; vol_l = ta; \
+    fy4 = fy3; fy3 = tb; vol_r = tb; \
+    fa0 += da0; fb0 += db0; fb1 += db1;
+
+
 //////////////////////////////////////////////////////////
 // Interfaces
 
@@ -522,6 +574,30 @@ typedef void(* mix_interface_t)(song_voice_t *, int *, int *);
         channel->left_volume      = left_ramp_volume >> VOLUMERAMPPRECISION; \
     }
 
+// Filter coefficient sweeps
+#define BEGIN_MIX_FLTSWEEP_INTERFACE(func) \
+    BEGIN_MIX_INTERFACE(func) \
+    MIX_BEGIN_FILTER_SWEEP
+
+
+#define BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(func) \
+    BEGIN_MIX_INTERFACE(func) \
+        int right_ramp_volume = channel->right_ramp_volume; \
+        int left_ramp_volume  = channel->left_ramp_volume; \
+        MIX_BEGIN_FILTER_SWEEP
+
+
+#define BEGIN_MIX_STFLTSWEEP_INTERFACE(func) \
+    BEGIN_MIX_INTERFACE(func) \
+    MIX_BEGIN_STEREO_FILTER_SWEEP
+
+
+#define BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(func) \
+    BEGIN_MIX_INTERFACE(func) \
+        int right_ramp_volume = channel->right_ramp_volume; \
+        int left_ramp_volume  = channel->left_ramp_volume; \
+        MIX_BEGIN_STEREO_FILTER_SWEEP
+
 #define BEGIN_RESAMPLE_INTERFACE(func, sampletype, numchannels) \
     void func(sampletype *oldbuf, sampletype *newbuf, unsigned long oldlen, unsigned long newlen) \
     { \
@@ -1089,6 +1165,240 @@ END_RAMPMIX_STFLT_INTERFACE()
 
 
 
+//////////////////////////////////////////////////////
+// Resonant Filter Mix, sweeping the coefficients
+// Mono Filter Sweep Mix
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8NOIDO
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16NOIDO
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitLinearMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8LINEAR
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitLinearMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16LINEAR
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitSplineMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8SPLINE
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitSplineMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16SPLINE
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitFirFilterMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8FIRFILTER
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+BEGIN_MIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitFirFilterMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16FIRFILTER
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_STOREMONOVOL
+END_MIX_FLT_INTERFACE()
+
+
+// Filter Sweep + Ramp
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8NOIDO
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16NOIDO
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitLinearRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8LINEAR
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitLinearRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16LINEAR
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitSplineRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8SPLINE
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitSplineRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16SPLINE
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono8BitFirFilterRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETMONOVOL8FIRFILTER
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+BEGIN_RAMPMIX_FLTSWEEP_INTERFACE(FilterSweepMono16BitFirFilterRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETMONOVOL16FIRFILTER
+        SNDMIX_PROCESSFILTERSWEEP
+        SNDMIX_RAMPMONOVOL
+END_RAMPMIX_FLT_INTERFACE()
+
+
+// Stereo Filter Sweep Mix
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8NOIDO
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16NOIDO
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitLinearMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8LINEAR
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitLinearMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16LINEAR
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitSplineMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8SPLINE
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitSplineMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16SPLINE
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitFirFilterMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8FIRFILTER
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+BEGIN_MIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitFirFilterMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16FIRFILTER
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_STORESTEREOVOL
+END_MIX_STFLT_INTERFACE()
+
+
+// Stereo Filter + Ramp
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8NOIDO
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16NOIDO
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitLinearRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8LINEAR
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitLinearRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16LINEAR
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitSplineRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8SPLINE
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitSplineRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16SPLINE
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo8BitFirFilterRampMix)
+        SNDMIX_BEGINSAMPLELOOP8
+        SNDMIX_GETSTEREOVOL8FIRFILTER
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+BEGIN_RAMPMIX_STFLTSWEEP_INTERFACE(FilterSweepStereo16BitFirFilterRampMix)
+        SNDMIX_BEGINSAMPLELOOP16
+        SNDMIX_GETSTEREOVOL16FIRFILTER
+        SNDMIX_PROCESSSTEREOFILTERSWEEP
+        SNDMIX_RAMPSTEREOVOL
+END_RAMPMIX_STFLT_INTERFACE()
+
+
 // Public resampling Methods (
 BEGIN_RESAMPLE_INTERFACE(ResampleMono8BitFirFilter, signed char, 1)
         SNDMIX_GETMONOVOL8FIRFILTER
@@ -1240,6 +1550,59 @@ static const mix_interface_t fastmix_functions[2 * 2 * 16] = {
 };
 
 
+// Same again, but the filtered entries sweep their coefficients; only picked
+// while a sweep is going on (filter_sweep_length)
+static const mix_interface_t filtersweep_functions[2 * 2 * 16] = {
+        // No SRC
+        Mono8BitMix,                            Mono16BitMix,
+        Stereo8BitMix,                          Stereo16BitMix,
+        Mono8BitRampMix,                        Mono16BitRampMix,
+        Stereo8BitRampMix,                      Stereo16BitRampMix,
+
+        // No SRC, Filter
+        FilterSweepMono8BitMix,                 FilterSweepMono16BitMix,
+        FilterSweepStereo8BitMix,               FilterSweepStereo16BitMix,
+        FilterSweepMono8BitRampMix,             FilterSweepMono16BitRampMix,
+        FilterSweepStereo8BitRampMix,           FilterSweepStereo16BitRampMix,
+
+        // Linear SRC
+        Mono8BitLinearMix,                      Mono16BitLinearMix,
+        Stereo8BitLinearMix,                    Stereo16BitLinearMix,
+        Mono8BitLinearRampMix,                  Mono16BitLinearRampMix,
+        Stereo8BitLinearRampMix,                Stereo16BitLinearRampMix,
+
+        // Linear SRC, Filter
+        FilterSweepMono8BitLinearMix,           FilterSweepMono16BitLinearMix,
+        FilterSweepStereo8BitLinearMix,         FilterSweepStereo16BitLinearMix,
+        FilterSweepMono8BitLinearRampMix,       FilterSweepMono16BitLinearRampMix,
+        FilterSweepStereo8BitLinearRampMix,     FilterSweepStereo16BitLinearRampMix,
+
+        // Spline SRC
+        Mono8BitSplineMix,                      Mono16BitSplineMix,
+        Stereo8BitSplineMix,                    Stereo16BitSplineMix,
+        Mono8BitSplineRampMix,                  Mono16BitSplineRampMix,
+        Stereo8BitSplineRampMix,                Stereo16BitSplineRampMix,
+
+        // Spline SRC, Filter
+        FilterSweepMono8BitSplineMix,           FilterSweepMono16BitSplineMix,
+        FilterSweepStereo8BitSplineMix,         FilterSweepStereo16BitSplineMix,
+        FilterSweepMono8BitSplineRampMix,       FilterSweepMono16BitSplineRampMix,
+        FilterSweepStereo8BitSplineRampMix,     FilterSweepStereo16BitSplineRampMix,
+
+        // FirFilter  SRC
+        Mono8BitFirFilterMix,                   Mono16BitFirFilterMix,
+        Stereo8BitFirFilterMix,                 Stereo16BitFirFilterMix,
+        Mono8BitFirFilterRampMix,               Mono16BitFirFilterRampMix,
+        Stereo8BitFirFilterRampMix,             Stereo16BitFirFilterRampMix,
+
+        // FirFilter  SRC, Filter
+        FilterSweepMono8BitFirFilterMix,        FilterSweepMono16BitFirFilterMix,
+        FilterSweepStereo8BitFirFilterMix,      FilterSweepStereo16BitFirFilterMix,
+        FilterSweepMono8BitFirFilterRampMix,    FilterSweepMono16BitFirFilterRampMix,
+        FilterSweepStereo8BitFirFilterRampMix,  FilterSweepStereo16BitFirFilterRampMix
+};
+
+
 static int get_sample_count(song_voice_t *chan, int samples)
 {
         int loop_start = (chan->flags & CHN_LOOP) ? chan->loop_start : 0;
@@ -1381,16 +1744,124 @@ static int get_sample_count(song_voice_t *chan, int samples)
 }
 
 
+// Scope tap: each voice is mixed into tap->voice_buffer instead of straight
+// into the mix buffer, then added in here along with a mono copy for the
+// pattern channel it belongs to.
+static void scope_tap_add_voice(song_t *csf, struct scope_tap *tap, int chan, unsigned int count)
+{
+        const int *vbuf = tap->voice_buffer;
+        int *mix = csf->mix_buffer;
+        int *cbuf;
+        unsigned int i;
+
+        if (chan < 0 || chan >= MAX_CHANNELS) {
+                for (i = 0; i < count * 2; i++)
+                        mix[i] += vbuf[i];
+                return;
+        }
+
+        cbuf = tap->channel_buffer[chan];
+        if (tap->used & ((uint64_t) 1 << chan)) {
+                for (i = 0; i < count; i++) {
+                        mix[2 * i] += vbuf[2 * i];
+                        mix[2 * i + 1] += vbuf[2 * i + 1];
+                        cbuf[i] += (vbuf[2 * i] + vbuf[2 * i + 1]) >> 1;
+                }
+        } else {
+                for (i = 0; i < count; i++) {
+                        mix[2 * i] += vbuf[2 * i];
+                        mix[2 * i + 1] += vbuf[2 * i + 1];
+                        cbuf[i] = (vbuf[2 * i] + vbuf[2 * i + 1]) >> 1;
+                }
+                tap->used |= (uint64_t) 1 << chan;
+        }
+}
+
+// Measure each channel and append its points to the ring. Channels that
+// didn't play anything get silence, so all the rings stay in step.
+static void scope_tap_finish(struct scope_tap *tap, unsigned int count)
+{
+        unsigned int first = (SCOPE_DECIMATE - tap->phase) % SCOPE_DECIMATE;
+
+        for (int chan = 0; chan < MAX_CHANNELS; chan++) {
+                struct channel_scope *scope = tap->channels + chan;
+                const int *cbuf = tap->channel_buffer[chan];
+                uint32_t pos = scope->pos;
+                unsigned int i;
+
+                if (!(tap->used & ((uint64_t) 1 << chan))) {
+                        for (i = first; i < count; i += SCOPE_DECIMATE)
+                                scope->wave[pos++ & (SCOPE_POINTS - 1)] = 0;
+                        scope->peak = scope->rms = 0;
+                        scope->pos = pos;
+                        continue;
+                }
+
+                uint32_t peak = 0;
+                uint64_t sumsq = 0;
+                for (i = 0; i < count; i++) {
+                        int n = CLAMP(cbuf[i], MIXING_CLIPMIN, MIXING_CLIPMAX) >> (16 - MIXING_ATTENUATION);
+                        uint32_t a = (n < 0) ? -n : n;
+
+                        if (a > peak)
+                                peak = a;
+                        sumsq += (uint64_t) (a * a);
+                }
+                for (i = first; i < count; i += SCOPE_DECIMATE)
+                        scope->wave[pos++ & (SCOPE_POINTS - 1)]
+                                = CLAMP(cbuf[i], MIXING_CLIPMIN, MIXING_CLIPMAX) >> (16 - MIXING_ATTENUATION);
+                scope->peak = MIN(peak, 32767);
+                scope->rms = MIN((uint32_t) sqrt((double) sumsq / count), 32767);
+                scope->pos = pos;
+        }
+
+        tap->used = 0;
+        tap->phase = (tap->phase + count) % SCOPE_DECIMATE;
+}
+
+
+// Send bus: a voice that sends is mixed into a buffer of its own (the scope
+// tap's, if that's on), then added to the bus input and -- unless the tap is
+// going to do it -- to the mix.
+static void send_bus_add_voice(song_t *csf, struct send_bus *bus, const int *vbuf, int to_mix, unsigned int count)
+{
+        int *aux = bus->aux_buffer;
+        int *mix = csf->mix_buffer;
+        unsigned int i;
+
+        if (bus->used) {
+                for (i = 0; i < count * 2; i++)
+                        aux[i] += vbuf[i];
+        } else {
+                memcpy(aux, vbuf, count * 2 * sizeof(int));
+                bus->used = 1;
+        }
+        if (to_mix) {
+                for (i = 0; i < count * 2; i++)
+                        mix[i] += vbuf[i];
+        }
+}
+
+
 unsigned int csf_create_stereo_mix(song_t *csf, int count)
 {
         int* ofsl, *ofsr;
         unsigned int nchused, nchmixed;
+        struct scope_tap *tap = csf->multi_write ? NULL : csf->scope_tap;
+        struct send_bus *bus = csf->multi_write ? NULL : csf->send_bus;
 
         if (!count)
                 return 0;
 
         nchused = nchmixed = 0;
 
+        if (bus) {
+                bus->used = 0;
+                // nothing to send with the send turned all the way down
+                if (!bus->send)
+                        bus = NULL;
+        }
+
         // yuck
         if (csf->multi_write)
                 for (unsigned int nchan = 0; nchan < MAX_CHANNELS; nchan++)
@@ -1404,10 +1875,13 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
                 int smpcount;
                 int nsamples;
                 int *pbuffer;
+                int send;
 
                 if (!channel->current_sample_data)
                         continue;
 
+                send = bus && !(channel->flags & CHN_NOREVERB);
+
                 ofsr = &g_dry_rofs_vol;
                 ofsl = &g_dry_lofs_vol;
                 flags = 0;
@@ -1450,6 +1924,12 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
                                 : (channel->master_channel - 1);
                         pbuffer = csf->multi_write[master].buffer;
                         csf->multi_write[master].used = 1;
+                } else if (tap) {
+                        pbuffer = tap->voice_buffer;
+                        memset(pbuffer, 0, count * 2 * sizeof(int));
+                } else if (send) {
+                        pbuffer = bus->voice_buffer;
+                        memset(pbuffer, 0, count * 2 * sizeof(int));
                 } else {
                         pbuffer = csf->mix_buffer;
                 }
@@ -1466,6 +1946,11 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
                                         nrampsamples = channel->ramp_length;
                         }
 
+                        if (channel->filter_sweep_length > 0) {
+                                if ((int) nrampsamples > channel->filter_sweep_length)
+                                        nrampsamples = channel->filter_sweep_length;
+                        }
+
                         smpcount = 1;
 
                         /* Figure out the number of remaining samples,
@@ -1483,6 +1968,7 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
                                 channel->position = 0;
                                 channel->position_frac = 0;
                                 channel->ramp_length = 0;
+                                end_filter_sweep(channel);
                                 end_channel_ofs(channel, pbuffer, nsamples);
                                 *ofsr += channel->rofs;
                                 *ofsl += channel->lofs;
@@ -1506,10 +1992,13 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
                                 /* Mix the stream, unless we're in AdLib mode */
                                 if (!(channel->flags & CHN_ADLIB)) {
                                         // Choose function for mixing
+                                        const mix_interface_t *table = mix_func_table;
                                         mix_interface_t mix_func;
+                                        if (channel->filter_sweep_length && (flags & MIXNDX_FILTER))
+                                                table = filtersweep_functions;
                                         mix_func = channel->ramp_length
-                                                ? mix_func_table[flags | MIXNDX_RAMP]
-                                                : mix_func_table[flags];
+                                                ? table[flags | MIXNDX_RAMP]
+                                                : table[flags];
                                         int *pbufmax = pbuffer + (smpcount * 2);
                                         channel->rofs = -*(pbufmax - 2);
                                         channel->lofs = -*(pbufmax - 1);
@@ -1524,6 +2013,11 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 
                         nsamples -= smpcount;
 
+                        if (channel->filter_sweep_length > smpcount)
+                                channel->filter_sweep_length -= smpcount;
+                        else
+                                end_filter_sweep(channel);
+
                         if (channel->ramp_length) {
                                 channel->ramp_length -= smpcount;
                                 if (channel->ramp_length <= 0) {
@@ -1542,10 +2036,21 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 
                 } while (nsamples > 0);
 
+                if (send)
+                        send_bus_add_voice(csf, bus, tap ? tap->voice_buffer : bus->voice_buffer, !tap, count);
+
+                if (tap)
+                        scope_tap_add_voice(csf, tap, (csf->voice_mix[nchan] < MAX_CHANNELS)
+                                ? (int) csf->voice_mix[nchan]
+                                : (int) channel->master_channel - 1, count);
+
                 nchmixed += naddmix;
         }
 
-        GM_IncrementSongCounter(count);
+        if (tap)
+                scope_tap_finish(tap, count);
+
+        GM_IncrementSongCounter(csf, count);
 
         if (csf->multi_write) {
                 /* mix all adlib onto track one */
@@ -1554,5 +2059,10 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
                 Fmdrv_MixTo(csf->mix_buffer, count);
         }
 
+        // the tails keep going after the last voice stops, so this runs with
+        // or without anything sent this time
+        if (csf->send_bus && !csf->multi_write)
+                send_bus_process(csf, csf->send_bus, csf->mix_buffer, count);
+
         return nchused;
 }
@@ -0,0 +1,162 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Packed patterns, and walking through the notes on a row.
+
+Patterns are kept as a full 64-channel grid so the editor can poke at any note
+in place, but most of that grid is empty: a four-channel MOD uses one column in
+sixteen, and even busy songs leave most rows of most channels blank. Anything
+that reads through the song over and over without changing it (like the
+timeline in timeline.c, which walks every row in the order list, some of them
+many times over) can keep packed copies of the patterns and then only ever look
+at the notes that are there. Packing is a pass over the whole grid, so the
+copies are kept in a song_pattern_cache until the pattern is edited, rather
+than packed for one walk and thrown away.
+
+A packed pattern is the non-empty notes in row order, each with its channel
+number, and the index of the first note on each row. For a typical pattern
+that's around a tenth of the size of the grid. */
+
+#include "sndfile.h"
+#include "util.h"
+
+
+static inline int note_is_used(const song_note_t *note)
+{
+        return note->note | note->instrument | note->voleffect | note->volparam | note->effect | note->param;
+}
+
+song_packed_pattern_t *csf_pack_pattern(const song_note_t *pattern, uint32_t rows)
+{
+        song_packed_pattern_t *packed;
+        const song_note_t *note;
+        uint32_t count = 0, n, r, c;
+
+        for (n = 0, note = pattern; n < rows * MAX_CHANNELS; n++, note++)
+                count += !!note_is_used(note);
+
+        // one block: the header, then row_start, notes, and chan
+        packed = calloc(1, sizeof(*packed) + (rows + 1) * sizeof(uint32_t)
+                + count * (sizeof(song_note_t) + 1));
+        if (!packed)
+                return NULL;
+        packed->rows = rows;
+        packed->count = count;
+        packed->row_start = (uint32_t *) (packed + 1);
+        packed->notes = (song_note_t *) (packed->row_start + rows + 1);
+        packed->chan = (uint8_t *) (packed->notes + count);
+
+        for (r = 0, n = 0, note = pattern; r < rows; r++) {
+                packed->row_start[r] = n;
+                for (c = 0; c < MAX_CHANNELS; c++, note++) {
+                        if (!note_is_used(note))
+                                continue;
+                        packed->notes[n] = *note;
+                        packed->chan[n++] = c;
+                        packed->channels |= (uint64_t) 1 << c;
+                }
+        }
+        packed->row_start[rows] = n;
+        return packed;
+}
+
+song_note_t *csf_unpack_pattern(const song_packed_pattern_t *packed)
+{
+        song_note_t *pattern = csf_allocate_pattern(packed->rows);
+        uint32_t r, n;
+
+        if (!pattern)
+                return NULL;
+        for (r = 0; r < packed->rows; r++)
+                for (n = packed->row_start[r]; n < packed->row_start[r + 1]; n++)
+                        pattern[r * MAX_CHANNELS + packed->chan[n]] = packed->notes[n];
+        return pattern;
+}
+
+void csf_free_packed_pattern(song_packed_pattern_t *packed)
+{
+        free(packed);
+}
+
+const song_packed_pattern_t *csf_pattern_cache_get(song_t *csf, struct song_pattern_cache *cache, uint32_t pat)
+{
+        if (cache->packed[pat] && cache->edits[pat] == csf->pattern_edits[pat])
+                return cache->packed[pat];
+        csf_free_packed_pattern(cache->packed[pat]);
+        cache->packed[pat] = csf->patterns[pat]
+                ? csf_pack_pattern(csf->patterns[pat], csf->pattern_size[pat])
+                : NULL;
+        cache->edits[pat] = csf->pattern_edits[pat];
+        return cache->packed[pat];
+}
+
+void csf_pattern_cache_clear(struct song_pattern_cache *cache)
+{
+        uint32_t n;
+
+        for (n = 0; n < MAX_PATTERNS; n++) {
+                csf_free_packed_pattern(cache->packed[n]);
+                cache->packed[n] = NULL;
+        }
+}
+
+void csf_row_iter(song_row_iter_t *it, const song_note_t *pattern, uint32_t row)
+{
+        it->notes = (pattern ?: blank_pattern) + row * MAX_CHANNELS;
+        it->chan = NULL;
+        it->pos = 0;
+        it->end = MAX_CHANNELS;
+}
+
+void csf_row_iter_packed(song_row_iter_t *it, const song_packed_pattern_t *packed, uint32_t row)
+{
+        it->notes = packed->notes;
+        it->chan = packed->chan;
+        if (row < packed->rows) {
+                it->pos = packed->row_start[row];
+                it->end = packed->row_start[row + 1];
+        } else {
+                it->pos = it->end = 0;
+        }
+}
+
+const song_note_t *csf_row_iter_next(song_row_iter_t *it, uint32_t *chan)
+{
+        const song_note_t *note;
+
+        if (it->chan) {
+                if (it->pos >= it->end)
+                        return NULL;
+                *chan = it->chan[it->pos];
+                return &it->notes[it->pos++];
+        }
+
+        while (it->pos < it->end) {
+                note = &it->notes[it->pos++];
+                if (note_is_used(note)) {
+                        *chan = it->pos - 1;
+                        return note;
+                }
+        }
+        return NULL;
+}
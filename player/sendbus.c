@@ -0,0 +1,237 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The send bus: one reverb and one delay shared by every channel. The mixer
+adds the voices that send into aux_buffer as it goes (see csf_create_stereo_mix),
+so all of this runs once per block no matter how many channels are playing.
+
+The reverb is an 8-line feedback delay network: each line is damped by a
+one-pole lowpass, scaled so it decays by 60dB in reverb_time, and fed back into
+all the others through a Householder matrix (x - 2/N * sum(x)), which mixes
+them evenly for the price of one sum. Left input goes into the even lines and
+right into the odd ones, and the outputs are taken the same way with
+alternating signs so the two sides don't come out correlated.
+
+The delay is a plain stereo feedback delay whose length is a number of ticks at
+whatever the current tempo is. */
+
+#include "sndfile.h"
+#include "cmixer.h"
+#include "util.h"
+
+#include <math.h>
+
+// mix buffer <-> float; the same scale as mixutil.c's conversions
+#define SEND_I2F        ((float) (1.0 / (1 << 28)))
+#define SEND_F2I        ((float) (1 << 28))
+
+// longest delay we keep room for, in seconds
+#define SEND_DELAY_MAX  1.5
+
+// line lengths at 44.1kHz; all prime, and spread out so the echoes from the
+// different lines don't pile up on each other
+static const unsigned int reverb_base_len[SEND_REVERB_LINES] = {
+        1051, 1213, 1361, 1499, 1657, 1811, 1979, 2137,
+};
+
+#define REVERB_LINE_MAX(n) ((unsigned int) (reverb_base_len[n] * ((double) MAX_SAMPLE_RATE / 44100.0)) + 1)
+
+
+struct send_bus *csf_send_bus_create(void)
+{
+        struct send_bus *bus = calloc(1, sizeof(struct send_bus));
+        int n;
+
+        if (!bus)
+                return NULL;
+        for (n = 0; n < SEND_REVERB_LINES; n++) {
+                bus->line[n] = calloc(REVERB_LINE_MAX(n), sizeof(float));
+                if (!bus->line[n]) {
+                        csf_send_bus_free(bus);
+                        return NULL;
+                }
+        }
+        bus->delay_size = (unsigned int) (SEND_DELAY_MAX * MAX_SAMPLE_RATE);
+        bus->delay = calloc(bus->delay_size * 2, sizeof(float));
+        if (!bus->delay) {
+                csf_send_bus_free(bus);
+                return NULL;
+        }
+
+        bus->reverb_time = 20;
+        bus->reverb_damp = 40;
+        bus->delay_feedback = 40;
+        bus->delay_ticks = 6;
+        return bus;
+}
+
+void csf_send_bus_free(struct send_bus *bus)
+{
+        int n;
+
+        if (!bus)
+                return;
+        for (n = 0; n < SEND_REVERB_LINES; n++)
+                free(bus->line[n]);
+        free(bus->delay);
+        free(bus);
+}
+
+static void send_bus_clear(struct send_bus *bus)
+{
+        int n;
+
+        for (n = 0; n < SEND_REVERB_LINES; n++) {
+                memset(bus->line[n], 0, REVERB_LINE_MAX(n) * sizeof(float));
+                bus->line_pos[n] = 0;
+                bus->line_lp[n] = 0;
+        }
+        memset(bus->delay, 0, bus->delay_size * 2 * sizeof(float));
+        bus->delay_pos = 0;
+}
+
+void csf_send_bus_setup(struct send_bus *bus, uint32_t rate, int clear)
+{
+        float rt60;
+        int n;
+
+        if (!bus || !rate)
+                return;
+
+        bus->send = CLAMP(bus->send, 0, 128);
+        bus->reverb_level = CLAMP(bus->reverb_level, 0, 128);
+        bus->reverb_time = CLAMP(bus->reverb_time, 1, 100);
+        bus->reverb_damp = CLAMP(bus->reverb_damp, 0, 100);
+        bus->delay_level = CLAMP(bus->delay_level, 0, 128);
+        bus->delay_feedback = CLAMP(bus->delay_feedback, 0, 100);
+        bus->delay_ticks = CLAMP(bus->delay_ticks, 1, 32);
+
+        if (clear || rate != bus->rate)
+                send_bus_clear(bus);
+        bus->rate = rate;
+
+        rt60 = bus->reverb_time / 10.0f;
+        for (n = 0; n < SEND_REVERB_LINES; n++) {
+                bus->line_len[n] = reverb_base_len[n] * (double) rate / 44100.0;
+                bus->line_len[n] = CLAMP(bus->line_len[n], 1, REVERB_LINE_MAX(n));
+                if (bus->line_pos[n] >= bus->line_len[n])
+                        bus->line_pos[n] = 0;
+                bus->line_gain[n] = powf(10.0f, -3.0f * bus->line_len[n] / (rt60 * rate));
+        }
+        bus->damp = bus->reverb_damp / 100.0f * 0.9f;
+
+        // four lines sum into each side
+        bus->reverb_out = bus->reverb_level / 128.0f * 0.5f;
+        bus->delay_out = bus->delay_level / 128.0f;
+        bus->delay_fb = bus->delay_feedback / 100.0f * 0.95f;
+
+        // how long the output takes to die away once the input stops: the
+        // reverb's RT60, or enough echoes for the delay to drop by 60dB
+        bus->reverb_tail = bus->reverb_level ? (unsigned int) (rt60 * rate) : 0;
+        bus->delay_repeats = !bus->delay_level ? 0 : (bus->delay_fb > 0.001f)
+                ? 1 + (unsigned int) ceilf(-3.0f / log10f(bus->delay_fb)) : 1;
+}
+
+void send_bus_process(song_t *csf, struct send_bus *bus, int *mix, unsigned int count)
+{
+        const int *aux = bus->aux_buffer;
+        float *const *line = bus->line;
+        float *delay = bus->delay;
+        unsigned int delay_len, rpos, wpos, tick, tail, n;
+        float in_scale = SEND_I2F * bus->send / 128.0f;
+        const float damp = bus->damp, fb = bus->delay_fb;
+        const float rev_out = bus->reverb_out * SEND_F2I, dly_out = bus->delay_out * SEND_F2I;
+        unsigned int pos[SEND_REVERB_LINES], len[SEND_REVERB_LINES];
+        float lp[SEND_REVERB_LINES], gain[SEND_REVERB_LINES];
+        int k;
+
+        if (!bus->reverb_level && !bus->delay_level)
+                return;
+        dsp_skip_stats.send_frames += count;
+
+        tick = csf_get_tick_length(csf) ?: csf->mix_frequency / 50;
+        delay_len = CLAMP(bus->delay_ticks * tick, 1, bus->delay_size - 1);
+
+        if (!bus->used) {
+                // Nothing coming in; once the tails are gone, there's nothing to
+                // do. Whatever's left in the lines is 60dB down by then, so it
+                // can just sit there until there's input again.
+                tail = MAX(bus->reverb_tail, bus->delay_repeats * delay_len);
+                if (bus->quiet >= tail) {
+                        dsp_skip_stats.send_skipped += count;
+                        return;
+                }
+                bus->quiet += count;
+                in_scale = 0; // aux_buffer wasn't written this time
+        } else {
+                bus->quiet = 0;
+        }
+        wpos = bus->delay_pos;
+        rpos = (wpos + bus->delay_size - delay_len) % bus->delay_size;
+
+        // keep the per-line state in locals; through the bus pointer, the
+        // compiler can't tell it apart from the line buffers being written
+        for (k = 0; k < SEND_REVERB_LINES; k++) {
+                pos[k] = bus->line_pos[k];
+                len[k] = bus->line_len[k];
+                lp[k] = bus->line_lp[k];
+                gain[k] = bus->line_gain[k];
+        }
+
+        for (n = 0; n < count; n++, aux += 2, mix += 2) {
+                float in_l = aux[0] * in_scale;
+                float in_r = aux[1] * in_scale;
+                float o[SEND_REVERB_LINES], s[SEND_REVERB_LINES];
+                float sum = 0, dl, dr;
+
+                for (k = 0; k < SEND_REVERB_LINES; k++) {
+                        o[k] = line[k][pos[k]];
+                        lp[k] = o[k] + damp * (lp[k] - o[k]);
+                        s[k] = lp[k] * gain[k];
+                        sum += s[k];
+                }
+                sum *= -2.0f / SEND_REVERB_LINES;
+                for (k = 0; k < SEND_REVERB_LINES; k++) {
+                        line[k][pos[k]] = s[k] + sum + ((k & 1) ? in_r : in_l);
+                        if (++pos[k] == len[k])
+                                pos[k] = 0;
+                }
+
+                dl = delay[2 * rpos];
+                dr = delay[2 * rpos + 1];
+                delay[2 * wpos] = in_l + dl * fb;
+                delay[2 * wpos + 1] = in_r + dr * fb;
+                if (++rpos == bus->delay_size)
+                        rpos = 0;
+                if (++wpos == bus->delay_size)
+                        wpos = 0;
+
+                mix[0] += (int) ((o[0] - o[2] + o[4] - o[6]) * rev_out + dl * dly_out);
+                mix[1] += (int) ((o[1] - o[3] + o[5] - o[7]) * rev_out + dr * dly_out);
+        }
+        bus->delay_pos = wpos;
+        for (k = 0; k < SEND_REVERB_LINES; k++) {
+                bus->line_pos[k] = pos[k];
+                bus->line_lp[k] = lp[k];
+        }
+}
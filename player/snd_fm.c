@@ -25,6 +25,7 @@
 #include "snd_fm.h"
 
 #define MAX_VOICES 256 /* Must not be less than the setting in sndfile.h */
+#define FM_BUFFER_SIZE 512 /* Should match MIXBUFFERSIZE in sndfile.h (if it's less, it's just slower) */
 
 #include <string.h>
 #include <stdlib.h>
@@ -33,7 +34,7 @@
 #define OPLNew(x,r)  ym3812_init(x, r)
 #define OPLResetChip ym3812_reset_chip
 #define OPLWrite     ym3812_write
-#define OPLUpdateOne ym3812_update_one
+#define OPLUpdate    ym3812_update_stereo
 #define OPLClose     ym3812_shutdown
 
 /* Mostly pulled from my posterior. Original value was 2000, but Manwe says that's too quiet.
@@ -41,6 +42,13 @@ It'd help if this was at all connected to the song's mixing volume...
 */
 #define OPL_VOLUME 5000
 
+/* One chip only has nine voices, so there are as many chips as it takes for every channel
+to have a voice of its own. Channels are given voices as they need them, filling up the
+first chip before going on to the next, and keep them until the next reset; chips that
+haven't been given anything to play aren't run. */
+#define OPL_CHIPS 8
+#define OPL_CHIP_VOICES 9
+
 /*
 The documentation in this file regarding the output ports,
 including the comment "Don't ask me why", are attributed
@@ -53,11 +61,20 @@ to Jeffrey S. Lee's article:
 static const int oplbase = 0x388;
 
 // OPL info
-static struct OPL* opl = NULL;
+static struct OPL* opl[OPL_CHIPS] = {NULL};
 static UINT32 oplretval = 0,
            oplregno = 0;
 static UINT32 fm_active = 0;
 
+// voice allocation (voice = chip * OPL_CHIP_VOICES + channel on the chip)
+static int Voices[MAX_VOICES];                          // channel -> voice, or -1
+static int VoiceOwner[OPL_CHIPS * OPL_CHIP_VOICES];     // voice -> channel, or -1
+static int ChipsUsed = 0;
+
+// per-voice panning, as gains for ym3812_update_stereo
+static INT32 GainL[OPL_CHIPS][OPL_CHIP_VOICES];
+static INT32 GainR[OPL_CHIPS][OPL_CHIP_VOICES];
+
 extern int fnumToMilliHertz(unsigned int fnum, unsigned int block,
         unsigned int conversionFactor);
 
@@ -65,16 +82,18 @@ extern void milliHertzToFnum(unsigned int milliHertz,
         unsigned int *fnum, unsigned int *block, unsigned int conversionFactor);
 
 
-static void Fmdrv_Outportb(unsigned port, unsigned value)
+static void Fmdrv_Outportb(int chip, unsigned port, unsigned value)
 {
-        if (opl == NULL ||
+        if (opl[chip] == NULL ||
             ((int) port) < oplbase ||
             ((int) port) >= oplbase + 4)
                 return;
 
         unsigned ind = port - oplbase;
-        OPLWrite(opl, ind, value);
+        OPLWrite(opl[chip], ind, value);
 
+        if (chip != 0)
+                return;
         if (ind & 1) {
                 if (oplregno == 4) {
                         if (value == 0x80)
@@ -97,50 +116,49 @@ static unsigned char Fmdrv_Inportb(unsigned port)
 
 void Fmdrv_Init(int mixfreq)
 {
-        if (opl != NULL) {
-                OPLClose(opl);
-                opl = NULL;
+        int n;
+
+        for (n = 0; n < OPL_CHIPS; n++) {
+                if (opl[n] != NULL) {
+                        OPLClose(opl[n]);
+                        opl[n] = NULL;
+                }
         }
         //Clock for frequency 49716Hz. Mixfreq is used for output mix frequency.
-        opl = OPLNew(1789776 * 2, mixfreq);
-        OPLResetChip(opl);
+        // (they're all made here, so that nothing needs allocating once the music starts)
+        for (n = 0; n < OPL_CHIPS; n++) {
+                opl[n] = OPLNew(1789776 * 2, mixfreq);
+                if (opl[n] != NULL)
+                        OPLResetChip(opl[n]);
+        }
         OPL_Detect();
 }
 
 
 void Fmdrv_MixTo(int *target, int count)
 {
-        static short *buf = NULL;
-        static int buf_size = 0;
+        /* this runs in the audio callback, so no allocating here */
+        static INT32 buf[FM_BUFFER_SIZE * 2];
+        int n, chip, any;
 
         if (!fm_active)
             return;
 
-        if (buf_size != count * 2) {
-                int before = buf_size;
-                buf_size = sizeof(short) * count;
-
-                if (before) {
-                        buf = (short *) realloc(buf, buf_size);
-                }
-                else {
-                        buf = (short *) malloc(buf_size);
+        while (count > 0) {
+                n = count < FM_BUFFER_SIZE ? count : FM_BUFFER_SIZE;
+                memset(buf, 0, n * 2 * sizeof(INT32));
+                any = 0;
+                for (chip = 0; chip < ChipsUsed; chip++) {
+                        if (opl[chip] != NULL)
+                                any |= OPLUpdate(opl[chip], buf, n, GainL[chip], GainR[chip]);
                 }
-        }
-
-        memset(buf, 0, count * 2);
-        OPLUpdateOne(opl, buf, count);
-
-        /*
-        static int counter = 0;
-
-        for(int a = 0; a < count; ++a)
-                buf[a] = ((counter++) & 0x100) ? -10000 : 10000;
-        */
+                if (!any)
+                        return;
 
-        for (int a = 0; a < count; ++a) {
-            target[a * 2 + 0] += buf[a] * OPL_VOLUME;
-            target[a * 2 + 1] += buf[a] * OPL_VOLUME;
+                for (int a = 0; a < n * 2; ++a)
+                    target[a] += buf[a] * OPL_VOLUME;
+                target += n * 2;
+                count -= n;
         }
 }
 
@@ -149,34 +167,52 @@ void Fmdrv_MixTo(int *target, int count)
 
 
 static const char PortBases[9] = {0, 1, 2, 8, 9, 10, 16, 17, 18};
-static signed char Pans[MAX_VOICES];
+static int Pans[MAX_VOICES];
 static const unsigned char *Dtab[MAX_VOICES] = {NULL};
 
 
+// returns the channel's voice, giving it one if it hasn't got one yet (or -1 if they're all taken)
 static int SetBase(int c)
 {
-        return c % 9;
+        int v;
+
+        if (c < 0 || c >= MAX_VOICES)
+                return -1;
+        if (Voices[c] >= 0)
+                return Voices[c];
+        for (v = 0; v < OPL_CHIPS * OPL_CHIP_VOICES; v++) {
+                if (VoiceOwner[v] < 0 && opl[v / OPL_CHIP_VOICES] != NULL) {
+                        VoiceOwner[v] = c;
+                        Voices[c] = v;
+                        if (ChipsUsed <= v / OPL_CHIP_VOICES)
+                                ChipsUsed = v / OPL_CHIP_VOICES + 1;
+                        OPL_Pan(c, Pans[c]);
+                        return v;
+                }
+        }
+        return -1;
 }
 
 
-static void OPL_Byte(unsigned char idx, unsigned char data)
+static void OPL_Byte(int chip, unsigned char idx, unsigned char data)
 {
         //register int a;
-        Fmdrv_Outportb(oplbase, idx);    // for(a = 0; a < 6;  a++) Fmdrv_Inportb(oplbase);
-        Fmdrv_Outportb(oplbase + 1, data); // for(a = 0; a < 35; a++) Fmdrv_Inportb(oplbase);
+        Fmdrv_Outportb(chip, oplbase, idx);    // for(a = 0; a < 6;  a++) Fmdrv_Inportb(oplbase);
+        Fmdrv_Outportb(chip, oplbase + 1, data); // for(a = 0; a < 35; a++) Fmdrv_Inportb(oplbase);
 }
 
 
 void OPL_NoteOff(int c)
 {
-        c = SetBase(c);
+        if (c < 0 || c >= MAX_VOICES || Voices[c] < 0)
+                return; // never played anything, so there's nothing to stop
 
-        if (c<9) {
-            /* KEYON_BLOCK+c seems to not work alone?? */
-            OPL_Byte(KEYON_BLOCK + c, 0);
-            //OPL_Byte(KSL_LEVEL +     Ope, 0xFF);
-            //OPL_Byte(KSL_LEVEL + 3 + Ope, 0xFF);
-        }
+        c = Voices[c];
+
+        /* KEYON_BLOCK+c seems to not work alone?? */
+        OPL_Byte(c / OPL_CHIP_VOICES, KEYON_BLOCK + c % OPL_CHIP_VOICES, 0);
+        //OPL_Byte(KSL_LEVEL +     Ope, 0xFF);
+        //OPL_Byte(KSL_LEVEL + 3 + Ope, 0xFF);
 }
 
 
@@ -187,12 +223,16 @@ void OPL_NoteOff(int c)
    Could be used for pitch bending also. */
 void OPL_HertzTouch(int c, int milliHertz, int keyoff)
 {
+    int chip;
+
     c = SetBase(c);
 
-    if (c >= 9)
+    if (c < 0)
         return;
 
     fm_active = 1;
+    chip = c / OPL_CHIP_VOICES;
+    c %= OPL_CHIP_VOICES;
 
 /*
     Bytes A0-B8 - Octave / F-Number / Key-On
@@ -209,8 +249,8 @@ void OPL_HertzTouch(int c, int milliHertz, int keyoff)
         unsigned int outblock;
         const int conversion_factor = 49716; // Frequency of OPL.
         milliHertzToFnum(milliHertz, &outfnum, &outblock, conversion_factor);
-        OPL_Byte(0xA0 + c, outfnum & 255);       // F-Number low 8 bits
-        OPL_Byte(0xB0 + c, (keyoff ? 0 : 0x20) // Key on
+        OPL_Byte(chip, 0xA0 + c, outfnum & 255);       // F-Number low 8 bits
+        OPL_Byte(chip, 0xB0 + c, (keyoff ? 0 : 0x20) // Key on
                       | ((outfnum >> 8) & 3)     // F-number high 2 bits
                       | (outblock << 2)
         );
@@ -220,9 +260,12 @@ void OPL_HertzTouch(int c, int milliHertz, int keyoff)
 
 void OPL_Touch(int c, const unsigned char *D, unsigned vol)
 {
+        int chip;
+
+        if (c < 0 || c >= MAX_VOICES)
+                return;
         if (!D) {
-                if (c < MAX_VOICES)
-                        D = Dtab[c];
+                D = Dtab[c];
                 if (!D)
                         return;
         }
@@ -234,10 +277,11 @@ void OPL_Touch(int c, const unsigned char *D, unsigned vol)
 
         c = SetBase(c);
 
-        if (c >= 9)
+        if (c < 0)
             return;
 
-        int Ope = PortBases[c];
+        chip = c / OPL_CHIP_VOICES;
+        int Ope = PortBases[c % OPL_CHIP_VOICES];
 
 /*
     Bytes 40-55 - Level Key Scaling / Total Level
@@ -257,14 +301,14 @@ void OPL_Touch(int c, const unsigned char *D, unsigned vol)
                      all bits CLEAR is loudest; all bits SET is the
                      softest.  Don't ask me why.
 */
-        OPL_Byte(KSL_LEVEL + Ope, (D[2] & KSL_MASK) |
+        OPL_Byte(chip, KSL_LEVEL + Ope, (D[2] & KSL_MASK) |
         //  (63 + (d[2] & 63) * vol / 63 - vol)          - old formula
         //  (63 - ((63 - (d[2] & 63)) * vol     ) / 63)  - older formula
         //  (63 - ((63 - (d[2] & 63)) * vol + 32) / 64)  - revised formula, like ST3
             (((int)(D[2] & 63) - 63) * vol + 63 * 64 - 32) / 64 // - optimized revised formula
         );
 
-        OPL_Byte(KSL_LEVEL + 3 + Ope, (D[3] & KSL_MASK) |
+        OPL_Byte(chip, KSL_LEVEL + 3 + Ope, (D[3] & KSL_MASK) |
             (((int)(D[3] & 63) - 63) * vol + 63 * 64 - 32) / 64
         );
 
@@ -293,56 +337,78 @@ void OPL_Touch(int c, const unsigned char *D, unsigned vol)
 }
 
 
-void OPL_Pan(int c, signed char val)
+void OPL_Pan(int c, int pan)
 {
-        Pans[c] = val;
-        /* Doesn't happen immediately! */
+        int v;
+
+        if (c < 0 || c >= MAX_VOICES)
+                return;
+        Pans[c] = pan = pan < 0 ? 0 : pan > 256 ? 256 : pan;
+
+        /* The centre is at full level on both sides, like a mono chip wired
+        to both speakers -- or an OPL3 voice with both stereo bits set. */
+        v = Voices[c];
+        if (v < 0)
+                return;
+        GainL[v / OPL_CHIP_VOICES][v % OPL_CHIP_VOICES] = pan > 128 ? (256 - pan) * 2 : 256;
+        GainR[v / OPL_CHIP_VOICES][v % OPL_CHIP_VOICES] = pan < 128 ? pan * 2 : 256;
 }
 
 
 void OPL_Patch(int c, const unsigned char *D)
 {
+    int chip;
+
 //fprintf(stderr, "OPL_Patch(%d, %p:%02X.%02X.%02X.%02X-%02X.%02X.%02X.%02X-%02X.%02X.%02X)\n",
 //    c, D,D[0],D[1],D[2],D[3],D[4],D[5],D[6],D[7],D[8],D[9],D[10]);
+    if (c < 0 || c >= MAX_VOICES)
+        return;
     Dtab[c] = D;
 
     c = SetBase(c);
-    if(c >= 9)return;
+    if (c < 0)
+        return;
 
+    chip = c / OPL_CHIP_VOICES;
+    c %= OPL_CHIP_VOICES;
     int Ope = PortBases[c];
 
-    OPL_Byte(AM_VIB+           Ope, D[0]);
-    OPL_Byte(ATTACK_DECAY+     Ope, D[4]);
-    OPL_Byte(SUSTAIN_RELEASE+  Ope, D[6]);
-    OPL_Byte(WAVE_SELECT+      Ope, D[8]&3);// 6 high bits used elsewhere
-
-    OPL_Byte(AM_VIB+         3+Ope, D[1]);
-    OPL_Byte(ATTACK_DECAY+   3+Ope, D[5]);
-    OPL_Byte(SUSTAIN_RELEASE+3+Ope, D[7]);
-    OPL_Byte(WAVE_SELECT+    3+Ope, D[9]&3);// 6 high bits used elsewhere
-
-    /* feedback, additive synthesis and Panning... */
-    OPL_Byte(FEEDBACK_CONNECTION+c,
-        (D[10] & ~STEREO_BITS)
-            | (Pans[c]<-32 ? VOICE_TO_LEFT
-                : Pans[c]>32 ? VOICE_TO_RIGHT
-                : (VOICE_TO_LEFT | VOICE_TO_RIGHT)
-            ));
+    OPL_Byte(chip, AM_VIB+           Ope, D[0]);
+    OPL_Byte(chip, ATTACK_DECAY+     Ope, D[4]);
+    OPL_Byte(chip, SUSTAIN_RELEASE+  Ope, D[6]);
+    OPL_Byte(chip, WAVE_SELECT+      Ope, D[8]&3);// 6 high bits used elsewhere
+
+    OPL_Byte(chip, AM_VIB+         3+Ope, D[1]);
+    OPL_Byte(chip, ATTACK_DECAY+   3+Ope, D[5]);
+    OPL_Byte(chip, SUSTAIN_RELEASE+3+Ope, D[7]);
+    OPL_Byte(chip, WAVE_SELECT+    3+Ope, D[9]&3);// 6 high bits used elsewhere
+
+    /* feedback and additive synthesis (the stereo bits are for an OPL3, and
+    panning is done by ym3812_update_stereo instead -- see OPL_Pan) */
+    OPL_Byte(chip, FEEDBACK_CONNECTION+c, D[10] & ~STEREO_BITS);
 }
 
 
 void OPL_Reset(void)
 {
 //fprintf(stderr, "OPL_Reset\n");
-        int a;
+        int a, chip;
 
-        for(a = 0; a < 244; a++)
-                OPL_Byte(a, 0);
+        for (chip = 0; chip < OPL_CHIPS; chip++) {
+                for(a = 0; a < 244; a++)
+                        OPL_Byte(chip, a, 0);
 
-        for(a = 0; a < MAX_VOICES; ++a)
-                Dtab[a] = NULL;
+                OPL_Byte(chip, TEST_REGISTER, ENABLE_WAVE_SELECT);
+        }
 
-        OPL_Byte(TEST_REGISTER, ENABLE_WAVE_SELECT);
+        for(a = 0; a < MAX_VOICES; ++a) {
+                Dtab[a] = NULL;
+                Voices[a] = -1;
+                Pans[a] = 128;
+        }
+        for(a = 0; a < OPL_CHIPS * OPL_CHIP_VOICES; ++a)
+                VoiceOwner[a] = -1;
+        ChipsUsed = 0;
 
         fm_active = 0;
 }
@@ -350,24 +416,22 @@ void OPL_Reset(void)
 
 int OPL_Detect(void)
 {
-        SetBase(0);
-
         /* Reset timers 1 and 2 */
-        OPL_Byte(TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
+        OPL_Byte(0, TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
 
         /* Reset the IRQ of the FM chip */
-        OPL_Byte(TIMER_CONTROL_REGISTER, IRQ_RESET);
+        OPL_Byte(0, TIMER_CONTROL_REGISTER, IRQ_RESET);
 
         unsigned char ST1 = Fmdrv_Inportb(oplbase); /* Status register */
 
-        OPL_Byte(TIMER1_REGISTER, 255);
-        OPL_Byte(TIMER_CONTROL_REGISTER, TIMER2_MASK | TIMER1_START);
+        OPL_Byte(0, TIMER1_REGISTER, 255);
+        OPL_Byte(0, TIMER_CONTROL_REGISTER, TIMER2_MASK | TIMER1_START);
 
         /*_asm xor cx,cx;P1:_asm loop P1*/
         unsigned char ST2 = Fmdrv_Inportb(oplbase);
 
-        OPL_Byte(TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
-        OPL_Byte(TIMER_CONTROL_REGISTER, IRQ_RESET);
+        OPL_Byte(0, TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
+        OPL_Byte(0, TIMER_CONTROL_REGISTER, IRQ_RESET);
 
         int OPLMode = (ST2 & 0xE0) == 0xC0 && !(ST1 & 0xE0);
 
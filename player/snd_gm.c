@@ -29,7 +29,7 @@
 #include "log.h"
 #include "it.h" // needed for status.flags
 #include "sndfile.h"
-#include "song.h" // for 'current_song', which we shouldn't need
+#include "song.h" // for 'current_song'
 #include "snd_gm.h"
 
 #include <math.h> // for log and log2
@@ -120,96 +120,118 @@ About the controllers... In AWE32 they are:
 
 //#define GM_DEBUG
 
+// The last channel status byte sent. A link that does running status (the OSS
+// driver, or ALSA's rawmidi encoder) leaves out a status byte that repeats it,
+// which is why note-offs are sent as zero-velocity note-ons when possible. The
+// ports count what they actually leave out (see midi_queue_stats).
 static unsigned RunningStatus = 0;
 #ifdef GM_DEBUG
 static int resetting = 0; // boolean
 #endif
 
+static struct gm_output_stats Stats;
 
-static void MPU_SendCommand(const unsigned char* buf, unsigned nbytes, int c)
+static void MPU_Saved(unsigned nbytes)
+{
+        if (status.flags & MIDI_LIKE_TRACKER)
+                Stats.bytes_saved += nbytes;
+}
+
+
+static void MPU_SendCommand(song_t *csf, const unsigned char* buf, unsigned nbytes, int c)
 {
         if (!nbytes)
                 return;
 
-        csf_midi_send(current_song, buf, nbytes, c, 0); // FIXME we should not know about 'current_song' here!
+        if (buf[0] < 0xF0) {
+                RunningStatus = buf[0];
+        } else if (buf[0] < 0xF8) {
+                RunningStatus = 0; // system common messages cancel it; realtime ones don't
+        }
+        if (csf == current_song) {
+                Stats.messages++;
+                Stats.bytes += nbytes;
+        }
+
+        csf_midi_send(csf, buf, nbytes, c, 0);
 }
 
 
-static void MPU_Ctrl(int c, int i, int v)
+static void MPU_Ctrl(song_t *csf, int c, int i, int v)
 {
         if (!(status.flags & MIDI_LIKE_TRACKER))
                 return;
 
         unsigned char buf[3] = {0xB0 + c, i, v};
-        MPU_SendCommand(buf, 3, c);
+        MPU_SendCommand(csf, buf, 3, c);
 }
 
 
-static void MPU_Patch(int c, int p)
+static void MPU_Patch(song_t *csf, int c, int p)
 {
         if (!(status.flags & MIDI_LIKE_TRACKER))
                 return;
 
         unsigned char buf[2] = {0xC0 + c, p};
-        MPU_SendCommand(buf, 2, c);
+        MPU_SendCommand(csf, buf, 2, c);
 }
 
 
-static void MPU_Bend(int c, int w)
+static void MPU_Bend(song_t *csf, int c, int w)
 {
         if (!(status.flags & MIDI_LIKE_TRACKER))
                 return;
 
         unsigned char buf[3] = {0xE0 + c, w & 127, w >> 7};
-        MPU_SendCommand(buf, 3, c);
+        MPU_SendCommand(csf, buf, 3, c);
 }
 
 
-static void MPU_NoteOn(int c, int k, int v)
+static void MPU_NoteOn(song_t *csf, int c, int k, int v)
 {
         if (!(status.flags & MIDI_LIKE_TRACKER))
                 return;
 
         unsigned char buf[3] = {0x90 + c, k, v};
-        MPU_SendCommand(buf, 3, c);
+        MPU_SendCommand(csf, buf, 3, c);
 }
 
 
-static void MPU_NoteOff(int c, int k, int v)
+static void MPU_NoteOff(song_t *csf, int c, int k, int v)
 {
         if (!(status.flags & MIDI_LIKE_TRACKER))
                 return;
 
         if (((unsigned char) RunningStatus) == 0x90 + c) {
                 // send a zero-velocity keyoff instead for optimization
-                MPU_NoteOn(c, k, 0);
+                MPU_NoteOn(csf, c, k, 0);
         }
         else {
                 unsigned char buf[3] = {0x80+c, k, v};
-                MPU_SendCommand(buf, 3, c);
+                MPU_SendCommand(csf, buf, 3, c);
         }
 }
 
 
-static void MPU_SendPN(int ch,
+static void MPU_SendPN(song_t *csf, int ch,
                        unsigned portindex,
                        unsigned param, unsigned valuehi, unsigned valuelo)
 {
-        MPU_Ctrl(ch, portindex+1, param>>7);
-        MPU_Ctrl(ch, portindex+0, param & 0x80);
+        MPU_Ctrl(csf, ch, portindex+1, param>>7);
+        MPU_Ctrl(csf, ch, portindex+0, param & 0x80);
 
         if (param != 0x4080) {
-                MPU_Ctrl(ch, 6, valuehi);
+                MPU_Ctrl(csf, ch, 6, valuehi);
 
                 if (valuelo)
-                        MPU_Ctrl(ch, 38, valuelo);
+                        MPU_Ctrl(csf, ch, 38, valuelo);
         }
 }
 
 
-#define MPU_SendNRPN(ch,param,hi,lo) MPU_SendPN(ch,98,param,hi,lo)
-#define MPU_SendRPN(ch,param,hi,lo) MPU_SendPN(ch,100,param,hi,lo)
-#define MPU_ResetPN(ch) MPU_SendRPN(ch,0x4080,0,0)
+#define MPU_SendNRPN(csf, ch,param,hi,lo) MPU_SendPN(csf, ch,98,param,hi,lo)
+#define MPU_SendRPN(csf, ch,param,hi,lo) MPU_SendPN(csf, ch,100,param,hi,lo)
+#define MPU_ResetPN(csf, ch) MPU_SendRPN(csf, ch,0x4080,0,0)
 
 
 typedef struct {
@@ -249,60 +271,106 @@ typedef struct {
     unsigned char volume; // Which volume has been configured for this channel
     unsigned char patch;  // What is the latest patch configured on this channel
     unsigned char bank;   // What is the latest bank configured on this channel
-    int bend;             // The latest pitchbend on this channel
+    int bend;             // The latest pitchbend sent on this channel
+    int bend_pending;     // The pitchbend we'd like it to have, if that hasn't been sent yet
+    int bend_now;         // A note just started; don't hold its bend back
+    uint64_t bend_time;   // When the last pitchbend was sent (GM_Frames)
     signed char pan;      // Latest pan
 } midi_state_t;
 
 
+// Pitch bends are thinned out: changes smaller than a cent aren't worth sending
+// (the log2 in GM_SetFreqAndVol wobbles by that sort of amount), and a channel gets
+// at most one bend per 1/BendInterval of a second. When several IT channels share a MIDI
+// channel they fight over its bend on every tick, and the last one should win.
+// Whatever was held back goes out once the interval is up, so the final pitch is
+// always right.
+static const int bend_deadband = 0x2000 / 12 / 100;
+#define BendInterval 200 // 5ms, about five bend messages' worth of DIN MIDI
+
+// Frames mixed so far (see GM_IncrementSongCounter)
+static uint64_t GM_Frames = 0;
+
+
 static void msi_reset(midi_state_t *msi)
 {
         msi->volume = 255;
         msi->patch  = 255;
         msi->bank   = 255;
         msi->bend   = PitchBendCenter;
+        msi->bend_pending = PitchBendCenter;
+        msi->bend_now  = 0;
+        msi->bend_time = 0;
         msi->pan    = 0;
 }
 
 #define msi_know_something(msi) ((msi).patch != 255)
 
 
-static void msi_set_volume(midi_state_t *msi, int c, unsigned newvol)
+static void msi_set_volume(song_t *csf, midi_state_t *msi, int c, unsigned newvol)
 {
         if (msi->volume != newvol) {
                 msi->volume = newvol;
-                MPU_Ctrl(c, 7, newvol);
+                MPU_Ctrl(csf, c, 7, newvol);
+        } else {
+                MPU_Saved(3);
         }
 }
 
 
-static void msi_set_patch_and_bank(midi_state_t *msi, int c, int p, int b)
+static void msi_set_patch_and_bank(song_t *csf, midi_state_t *msi, int c, int p, int b)
 {
         if (msi->bank != b) {
                 msi->bank = b;
-                MPU_Ctrl(c, 0, b);
+                MPU_Ctrl(csf, c, 0, b);
         }
 
         if (msi->patch != p) {
                 msi->patch = p;
-                MPU_Patch(c, p);
+                MPU_Patch(csf, c, p);
         }
 }
 
 
-static void msi_set_pitch_bend(midi_state_t *msi, int c, int value)
+static void msi_send_pitch_bend(song_t *csf, midi_state_t *msi, int c, int value)
 {
+        msi->bend_pending = value;
+        msi->bend_now = 0;
         if (msi->bend != value) {
                 msi->bend = value;
-                MPU_Bend(c, value);
+                msi->bend_time = GM_Frames;
+                MPU_Bend(csf, c, value);
         }
 }
 
 
-static void msi_set_pan(midi_state_t *msi, int c, int value)
+static void msi_set_pitch_bend(song_t *csf, midi_state_t *msi, int c, int value)
+{
+        if (msi->bend_now) {
+                msi_send_pitch_bend(csf, msi, c, value);
+                return;
+        }
+        if (value != PitchBendCenter && abs(value - msi->bend) < bend_deadband)
+                value = msi->bend; // too small to hear
+        if (value == msi->bend_pending && value == msi->bend) {
+                MPU_Saved(3);
+                return;
+        }
+        if (GM_Frames - msi->bend_time < (uint64_t) (csf->mix_frequency / BendInterval)) {
+                if (msi->bend_pending != msi->bend)
+                        MPU_Saved(3); // replacing one that was held back already
+                msi->bend_pending = value;
+                return;
+        }
+        msi_send_pitch_bend(csf, msi, c, value);
+}
+
+
+static void msi_set_pan(song_t *csf, midi_state_t *msi, int c, int value)
 {
         if (msi->pan != value) {
             msi->pan = value;
-            MPU_Ctrl(c, 10, (unsigned char)(value + 128) / 2);
+            MPU_Ctrl(csf, c, 10, (unsigned char)(value + 128) / 2);
         }
 }
 
@@ -421,7 +489,7 @@ void GM_Bank(int c, unsigned char b)
 }
 
 
-void GM_Touch(int c, unsigned char vol)
+void GM_Touch(song_t *csf, int c, unsigned char vol)
 {
         if (c < 0 || ((unsigned int) c) >= MAX_VOICES)
                 return;
@@ -432,16 +500,16 @@ void GM_Touch(int c, unsigned char vol)
                 return;
 
         int mc = s3m_chans[c].chan;
-        msi_set_volume(&midi_chans[mc], mc, GM_volume(vol));
+        msi_set_volume(csf, &midi_chans[mc], mc, GM_volume(vol));
 }
 
 
-void GM_KeyOn(int c, unsigned char key, unsigned char vol)
+void GM_KeyOn(song_t *csf, int c, unsigned char key, unsigned char vol)
 {
         if (c < 0 || ((unsigned int) c) >= MAX_VOICES)
                 return;
 
-        GM_KeyOff(c); // Ensure the previous key on this channel is off.
+        GM_KeyOff(csf, c); // Ensure the previous key on this channel is off.
 
         if (s3m_active(s3m_chans[c]))
                 return; // be sure the channel is deactivated.
@@ -458,10 +526,10 @@ void GM_KeyOn(int c, unsigned char key, unsigned char vol)
                         percu = s3m_chans[c].patch - 128;
 
                 int mc = s3m_chans[c].chan = 9;
-                msi_set_pan(&midi_chans[mc], mc, s3m_chans[c].pan);
-                msi_set_volume(&midi_chans[mc], mc, GM_volume(vol));
+                msi_set_pan(csf, &midi_chans[mc], mc, s3m_chans[c].pan);
+                msi_set_volume(csf, &midi_chans[mc], mc, GM_volume(vol));
                 s3m_chans[c].note = key;
-                MPU_NoteOn(mc, s3m_chans[c].note = percu, 127);
+                MPU_NoteOn(csf, mc, s3m_chans[c].note = percu, 127);
         }
         else {
                 // Allocate a MIDI channel for this key.
@@ -471,15 +539,16 @@ void GM_KeyOn(int c, unsigned char key, unsigned char vol)
                         c, s3m_chans[c].patch, s3m_chans[c].bank,
                         key, s3m_chans[c].pref_chn_mask);
 
-                msi_set_patch_and_bank(&midi_chans[mc], mc, s3m_chans[c].patch, s3m_chans[c].bank);
-                msi_set_volume(&midi_chans[mc], mc, GM_volume(vol));
-                MPU_NoteOn(mc, s3m_chans[c].note = key, 127);
-                msi_set_pan(&midi_chans[mc], mc, s3m_chans[c].pan);
+                msi_set_patch_and_bank(csf, &midi_chans[mc], mc, s3m_chans[c].patch, s3m_chans[c].bank);
+                msi_set_volume(csf, &midi_chans[mc], mc, GM_volume(vol));
+                midi_chans[mc].bend_now = 1; // the bend that comes next is this note's pitch
+                MPU_NoteOn(csf, mc, s3m_chans[c].note = key, 127);
+                msi_set_pan(csf, &midi_chans[mc], mc, s3m_chans[c].pan);
         }
 }
 
 
-void GM_KeyOff(int c)
+void GM_KeyOff(song_t *csf, int c)
 {
         if (c < 0 || ((unsigned int)c) >= MAX_VOICES)
                 return;
@@ -493,7 +562,7 @@ void GM_KeyOff(int c)
 
         int mc = s3m_chans[c].chan;
 
-        MPU_NoteOff(mc, s3m_chans[c].note, 0);
+        MPU_NoteOff(csf, mc, s3m_chans[c].note, 0);
         s3m_chans[c].chan = -1;
         s3m_chans[c].note = 0;
         s3m_chans[c].pan  = 0;
@@ -501,7 +570,7 @@ void GM_KeyOff(int c)
 }
 
 
-void GM_Bend(int c, unsigned count)
+void GM_Bend(song_t *csf, int c, unsigned count)
 {
        if (c < 0 || ((unsigned int)c) >= MAX_VOICES)
                 return;
@@ -518,12 +587,12 @@ void GM_Bend(int c, unsigned count)
 
         if (s3m_active(s3m_chans[c])) {
                 int mc = s3m_chans[c].chan;
-                msi_set_pitch_bend(&midi_chans[mc], mc, count);
+                msi_set_pitch_bend(csf, &midi_chans[mc], mc, count);
         }
 }
 
 
-void GM_Reset(int quitting)
+void GM_Reset(song_t *csf, int quitting)
 {
 #ifdef GM_DEBUG
         resetting = 1;
@@ -532,7 +601,7 @@ void GM_Reset(int quitting)
         //fprintf(stderr, "GM_Reset\n");
 
         for (a = 0; a < MAX_VOICES; a++) {
-                GM_KeyOff(a);
+                GM_KeyOff(csf, a);
                 //s3m_chans[a].patch = s3m_chans[a].bank = s3m_chans[a].pan = 0;
                 s3m_reset(&s3m_chans[a]);
         }
@@ -555,20 +624,20 @@ void GM_Reset(int quitting)
                 // XXX This might go wrong because the midi struct is already reset
                 // XXX  by the constructor in the C++ version.
                 // XXX
-                MPU_Ctrl(a, 120,  0);   // turn off all sounds
-                MPU_Ctrl(a, 123,  0);   // turn off all notes
-                MPU_Ctrl(a, 121, 0);    // reset vibrato, bend
-                msi_set_pan(&midi_chans[a], a, 0);           // reset pan position
-                msi_set_volume(&midi_chans[a], a, 127);      // set channel volume
-                msi_set_pitch_bend(&midi_chans[a], a, PitchBendCenter); // reset pitch bends
+                MPU_Ctrl(csf, a, 120,  0);   // turn off all sounds
+                MPU_Ctrl(csf, a, 123,  0);   // turn off all notes
+                MPU_Ctrl(csf, a, 121, 0);    // reset vibrato, bend
+                msi_set_pan(csf, &midi_chans[a], a, 0);           // reset pan position
+                msi_set_volume(csf, &midi_chans[a], a, 127);      // set channel volume
+                msi_send_pitch_bend(csf, &midi_chans[a], a, PitchBendCenter); // reset pitch bends
 
                 msi_reset(&midi_chans[a]);
 
                 // Reprogram the pitch bending sensitivity to our desired depth.
-                MPU_SendRPN(a, 0, n_semitones_times_128 / 128,
+                MPU_SendRPN(csf, a, 0, n_semitones_times_128 / 128,
                           n_semitones_times_128 % 128);
 
-                MPU_ResetPN(a);
+                MPU_ResetPN(csf, a);
         }
 
 #ifdef GM_DEBUG
@@ -592,7 +661,7 @@ void GM_DPatch(int ch, unsigned char GM, unsigned char bank, int pref_chn_mask)
 }
 
 
-void GM_Pan(int c, signed char val)
+void GM_Pan(song_t *csf, int c, signed char val)
 {
         //fprintf(stderr, "GM_Pan(%d,%d)\n", c,val);
         if (c < 0 || ((unsigned int)c) >= MAX_VOICES)
@@ -603,14 +672,14 @@ void GM_Pan(int c, signed char val)
         // If a note is playing, effect immediately.
         if (s3m_active(s3m_chans[c])) {
                 int mc = s3m_chans[c].chan;
-                msi_set_pan(&midi_chans[mc], mc, val);
+                msi_set_pan(csf, &midi_chans[mc], mc, val);
         }
 }
 
 
 
 
-void GM_SetFreqAndVol(int c, int Hertz, int vol, MidiBendMode bend_mode, int keyoff)
+void GM_SetFreqAndVol(song_t *csf, int c, int Hertz, int vol, MidiBendMode bend_mode, int keyoff)
 {
 #ifdef GM_DEBUG
         fprintf(stderr, "GM_SetFreqAndVol(%d,%d,%d)\n", c,Hertz,vol);
@@ -667,7 +736,7 @@ void GM_SetFreqAndVol(int c, int Hertz, int vol, MidiBendMode bend_mode, int key
 
                 if (note < 1) note = 1;
                 if (note > 127) note = 127;
-                GM_KeyOn(c, note, vol);
+                GM_KeyOn(csf, c, note, vol);
         }
 
         if (!s3m_percussion(s3m_chans[c])) { // give us a break, don't bend percussive instruments
@@ -685,62 +754,111 @@ void GM_SetFreqAndVol(int c, int Hertz, int vol, MidiBendMode bend_mode, int key
                 if(bend < 0) bend = 0;
                 if(bend > 0x3FFF) bend = 0x3FFF;
 
-                GM_Bend(c, bend);
+                GM_Bend(csf, c, bend);
         }
 
         if (vol < 0) vol = 0;
         else if (vol > 127) vol = 127;
 
         //if (!new_note)
-        GM_Touch(c, vol);
+        GM_Touch(csf, c, vol);
 }
 
 
-static double LastSongCounter = 0.0;
+/* MIDI clock position: counts up by MIDI_CLOCKS_PER_BEAT every frame, and a
+clock pulse goes out each time it passes ClockPeriod (see GM_IncrementSongCounter) */
+static uint64_t ClockPhase = 0;
+static uint64_t ClockPeriod = 0;
 
-void GM_SendSongStartCode(void)    { unsigned char c = 0xFA; MPU_SendCommand(&c, 1, 0); LastSongCounter = 0; }
-void GM_SendSongStopCode(void)     { unsigned char c = 0xFC; MPU_SendCommand(&c, 1, 0); LastSongCounter = 0; }
-void GM_SendSongContinueCode(void) { unsigned char c = 0xFB; MPU_SendCommand(&c, 1, 0); LastSongCounter = 0; }
-void GM_SendSongTickCode(void)     { unsigned char c = 0xF8; MPU_SendCommand(&c, 1, 0); }
+#define MIDI_CLOCKS_PER_BEAT 24
 
+void GM_SendSongStartCode(song_t *csf)    { unsigned char c = 0xFA; MPU_SendCommand(csf, &c, 1, 0); ClockPhase = 0; }
+void GM_SendSongStopCode(song_t *csf)     { unsigned char c = 0xFC; MPU_SendCommand(csf, &c, 1, 0); ClockPhase = 0; }
+void GM_SendSongContinueCode(song_t *csf) { unsigned char c = 0xFB; MPU_SendCommand(csf, &c, 1, 0); ClockPhase = 0; }
+void GM_SendSongTickCode(song_t *csf)     { unsigned char c = 0xF8; MPU_SendCommand(csf, &c, 1, 0); }
 
-void GM_SendSongPositionCode(unsigned note16pos)
+
+void GM_SendSongPositionCode(song_t *csf, unsigned note16pos)
 {
         unsigned char buf[3] = {0xF2, note16pos & 127, (note16pos >> 7) & 127};
-        MPU_SendCommand(buf, 3, 0);
-        LastSongCounter = 0;
+        MPU_SendCommand(csf, buf, 3, 0);
+        ClockPhase = 0;
 }
 
 
-void GM_IncrementSongCounter(int count)
+void GM_IncrementSongCounter(song_t *csf, int count)
 {
-        /* We assume that each pattern row corresponds to a 1/4 note.
+        /* Each beat (row_highlight_minor rows, i.e. the "rows per beat" setting)
+         * is one quarter note, so it gets 24 clock pulses. A row is current_speed
+         * ticks, and a tick is exactly as long as csf_read_note makes it, so
+         * in frames,
          *
-         * We also know that:
-         *                  5 * cmdA * mixingrate
-         * Length of row is --------------------- samples
-         *                         2 * cmdT
+         *                    rows/beat * speed * tick length
+         * Pulse interval is ---------------------------------
+         *                                  24
          *
-         * where cmdA = last FX_SPEED = current_speed
-         *   and cmdT = last FX_TEMPO = current_tempo
+         * Rather than rounding that, ClockPhase goes up by 24 per frame and a
+         * pulse is due every time it gets to rows/beat * speed * tick length.
+         * Each pulse is sent with the frame offset it falls on in this block, so
+         * the queue can space them out properly even when the block is long.
          */
-        int RowLengthInSamplesHi = 5 * current_song->current_speed * current_song->mix_frequency;
-        int RowLengthInSamplesLo = 2 * current_song->current_tempo;
+        unsigned int rpb = csf->row_highlight_minor ? csf->row_highlight_minor : 4;
+        unsigned int ticklen;
+        uint64_t period, wait;
+        unsigned char c = 0xF8;
+        int offset = 0;
+
+        /* send any pitch bends that were held back and are due now */
+        for (int mc = 0; mc < 16; mc++) {
+                midi_state_t *msi = &midi_chans[mc];
+
+                if (msi->bend_pending != msi->bend
+                    && GM_Frames - msi->bend_time >= (uint64_t) (csf->mix_frequency / BendInterval))
+                        msi_send_pitch_bend(csf, msi, mc, msi->bend_pending);
+        }
+        GM_Frames += count;
 
-        double NumberOfSamplesPer32thNote =
-            RowLengthInSamplesHi*8 / (double)RowLengthInSamplesLo;
+        /* exports and --analyze mix a copy of the song; the clock and the stats
+        only follow the one that's actually playing */
+        if (csf != current_song)
+                return;
 
-        /* TODO: Use fraction arithmetics instead (note: cmdA, cmdT may change any time) */
+        if (status.flags & MIDI_LIKE_TRACKER) {
+                Stats.frames += count;
+                Stats.rate = csf->mix_frequency;
+        }
 
-        LastSongCounter += count / NumberOfSamplesPer32thNote;
+        if (!csf->current_tempo || !csf_midi_out_raw)
+                return;
 
-        int n_32thNotes = (int)LastSongCounter;
+        ticklen = csf_get_tick_length(csf);
+        period = (uint64_t) rpb * csf->current_speed * ticklen;
+        if (!period)
+                return;
+        if (period != ClockPeriod) {
+                /* tempo or speed changed: keep the same fraction of the way to the next pulse */
+                if (ClockPeriod)
+                        ClockPhase = (uint64_t) ((double) ClockPhase * period / ClockPeriod);
+                ClockPeriod = period;
+        }
 
-        if (n_32thNotes) {
-                for (int a = 0; a < n_32thNotes; ++a)
-                        GM_SendSongTickCode();
+        for (;;) {
+                wait = (ClockPhase >= ClockPeriod)
+                        ? 0
+                        : (ClockPeriod - ClockPhase + MIDI_CLOCKS_PER_BEAT - 1) / MIDI_CLOCKS_PER_BEAT;
+                if (offset + wait >= (uint64_t) count) {
+                        ClockPhase += (count - offset) * MIDI_CLOCKS_PER_BEAT;
+                        break;
+                }
+                offset += wait;
+                ClockPhase += wait * MIDI_CLOCKS_PER_BEAT - ClockPeriod;
 
-                LastSongCounter -= n_32thNotes;
+                csf_midi_out_raw(csf, &c, 1, csf->read_offset + offset);
         }
 }
 
+
+void GM_GetStats(struct gm_output_stats *st)
+{
+        *st = Stats;
+}
@@ -28,6 +28,10 @@
 
 #include "util.h" /* for clamp */
 
+#if defined(__SSE__)
+# include <xmmintrin.h>
+#endif
+
 // Volume ramp length, in 1/10 ms
 #define VOLUMERAMPLEN   146 // 1.46ms = 64 samples at 44.1kHz
 
@@ -43,12 +47,14 @@ unsigned int global_vu_left = 0;
 unsigned int global_vu_right = 0;
 int32_t g_dry_rofs_vol = 0;
 int32_t g_dry_lofs_vol = 0;
+struct dsp_skip_stats dsp_skip_stats;
 
 typedef uint32_t (* convert_t)(void *, int *, uint32_t, int *, int *);
 
 
 // see also csf_midi_out_raw in effects.c
-void (*csf_midi_out_note)(int chan, const song_note_t *m) = NULL;
+void (*csf_midi_out_note)(song_t *csf, int chan, const song_note_t *m) = NULL;
+void (*csf_tick_hook)(song_t *csf) = NULL;
 
 
 // The volume we have here is in range 0..(63*255) (0..16065)
@@ -492,7 +498,7 @@ static inline int rn_update_sample(song_t *csf, song_voice_t *chan, int nchan, i
                 if ((csf->flags & SONG_INSTRUMENTMODE)
                     && chan->ptr_instrument
                     && chan->ptr_instrument->midi_channel_mask > 0)
-                        GM_Pan(nchan, pan);
+                        GM_Pan(csf, nchan, pan);
 
                 pan += 128;
                 pan = CLAMP(pan, 0, 256);
@@ -623,7 +629,7 @@ static inline void rn_gen_key(song_t *csf, song_voice_t *chan, int chan_num, int
                         volume = volume * chan->instrument_volume / 8192;
                 }
 
-                GM_SetFreqAndVol(chan_num, freq, volume, BendMode, chan->flags & CHN_KEYOFF);
+                GM_SetFreqAndVol(csf, chan_num, freq, volume, BendMode, chan->flags & CHN_KEYOFF);
         }
         if (chan->flags & CHN_ADLIB) {
                 // Scaling is needed to get a frequency that matches with ST3 notes.
@@ -631,7 +637,18 @@ static inline void rn_gen_key(song_t *csf, song_voice_t *chan, int chan_num, int
                 //Also, note that to be true to ST3, the frequencies should be quantized, like using the glissando control.
 
                 int oplmilliHertz = (long long int)freq*261625L/8363L;
+                int pan = 128;
+
+                if (csf->mix_channels >= 2 && !(csf->flags & SONG_NOSTEREO)
+                    && !((chan->flags & CHN_SURROUND) && !(csf->mix_flags & SNDMIX_NOSURROUND))) {
+                        // same as the sample path in rn_update_sample
+                        pan = (((int) chan->final_panning - 128) * (int) csf->pan_separation) / 128 + 128;
+                        pan = CLAMP(pan, 0, 256);
+                        if (csf->mix_flags & SNDMIX_REVERSESTEREO)
+                                pan = 256 - pan;
+                }
                 OPL_HertzTouch(chan_num, oplmilliHertz, chan->flags & CHN_KEYOFF);
+                OPL_Pan(chan_num, pan);
 
                 // ST32 ignores global & master volume in adlib mode, guess we should do the same -Bisqwit
                 OPL_Touch(chan_num, NULL, vol * chan->instrument_volume * 63 / (1 << 20));
@@ -709,17 +726,68 @@ int csf_init_player(song_t *csf, int reset)
         }
 
         initialize_eq(reset, csf->mix_frequency);
+        init_filter_table(csf);
+        csf_send_bus_setup(csf->send_bus, csf->mix_frequency, reset);
+        csf_limiter_setup(csf, reset);
+        csf_dither_setup(csf, reset);
 
         // retarded hackaround to get adlib to suck less
         if (csf->mix_frequency != 4000)
                 Fmdrv_Init(csf->mix_frequency);
         OPL_Reset();
-        GM_Reset(0);
+        GM_Reset(csf, 0);
         return 1;
 }
 
 
+/* The float stages (EQ, send bus, limiter, meter) decay towards denormals on
+their way into silence, and x86 takes ten to a hundred times as long over each
+of those. Have the FPU treat them as zero while mixing. This is done around
+each csf_read rather than once per thread, because exports mix on the main
+thread and the rest of the program shouldn't be affected. */
+static inline unsigned long fp_flush_denormals(void)
+{
+#if defined(__SSE__)
+        unsigned int csr = _mm_getcsr();
+# if defined(__SSE2__)
+        _mm_setcsr(csr | 0x8040); // flush-to-zero, denormals-are-zero
+# else
+        _mm_setcsr(csr | 0x8000); // (some SSE1-only chips fault on DAZ)
+# endif
+        return csr;
+#elif defined(__aarch64__)
+        unsigned long fpcr;
+        __asm__ __volatile__("mrs %0, fpcr" : "=r" (fpcr));
+        __asm__ __volatile__("msr fpcr, %0" : : "r" (fpcr | (1 << 24)));
+        return fpcr;
+#else
+        return 0;
+#endif
+}
+
+static inline void fp_restore(unsigned long state)
+{
+#if defined(__SSE__)
+        _mm_setcsr(state);
+#elif defined(__aarch64__)
+        __asm__ __volatile__("msr fpcr, %0" : : "r" (state));
+#else
+        (void) state;
+#endif
+}
+
+static unsigned int csf_read_unflushed(song_t *csf, void * v_buffer, unsigned int bufsize);
+
 unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
+{
+        unsigned long fp = fp_flush_denormals();
+        unsigned int ret = csf_read_unflushed(csf, v_buffer, bufsize);
+
+        fp_restore(fp);
+        return ret;
+}
+
+static unsigned int csf_read_unflushed(song_t *csf, void * v_buffer, unsigned int bufsize)
 {
         uint8_t * buffer = (uint8_t *)v_buffer;
         convert_t convert_func = clip_32_to_8;
@@ -750,6 +818,9 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
                 bufleft = 0; // skip the loop
 
         while (bufleft > 0) {
+                // where any midi sent from here on lands in the output
+                csf->read_offset = max - bufleft;
+
                 // Update Channel Data
 
                 if (!csf->buffer_count) {
@@ -803,6 +874,23 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
                 else
                         eq_mono(csf, csf->mix_buffer, count);
 
+                if (csf->meter && !csf->multi_write)
+                        meter_process(csf, csf->meter, csf->mix_buffer, count);
+
+                if ((csf->mix_flags & SNDMIX_LIMITER) && !csf->multi_write) {
+                        if (csf->mix_channels >= 2)
+                                limiter_stereo(csf, csf->mix_buffer, count);
+                        else
+                                limiter_mono(csf, csf->mix_buffer, count);
+                }
+
+                if (csf->dither.mode && !csf->multi_write) {
+                        if (csf->mix_channels >= 2)
+                                dither_stereo(csf, csf->mix_buffer, smpcount);
+                        else
+                                dither_mono(csf, csf->mix_buffer, smpcount);
+                }
+
                 mix_stat++;
 
                 if (csf->multi_write) {
@@ -810,6 +898,10 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
                         as temp space for converting */
                         for (unsigned int n = 0; n < 64; n++) {
                                 if (csf->multi_write[n].used) {
+                                        // no noise shaping here; that'd take an
+                                        // error history for each channel
+                                        if (csf->dither.mode)
+                                                dither_plain(csf, csf->multi_write[n].buffer, smpcount);
                                         unsigned int bytes = convert_func(buffer, csf->multi_write[n].buffer,
                                                 smpcount, vu_min, vu_max);
                                         csf->multi_write[n].write(csf->multi_write[n].data, buffer, bytes);
@@ -827,6 +919,7 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
                 bufleft -= count;
                 csf->buffer_count -= count;
         }
+        csf->read_offset = 0;
 
         if (bufleft)
                 memset(buffer, (csf->mix_bits_per_sample == 8) ? 0x80 : 0, bufleft * sample_size);
@@ -915,11 +1008,10 @@ static int increment_order(song_t *csf)
                 csf->current_pattern = csf->orderlist[csf->process_order];
         }
 
-        if (!csf->pattern_size[csf->current_pattern] || !csf->patterns[csf->current_pattern]) {
-                /* okay, this is wrong. allocate the pattern _NOW_ */
-                csf->patterns[csf->current_pattern] = csf_allocate_pattern(64);
+        if (!csf->patterns[csf->current_pattern]) {
+                /* a pattern that was never allocated plays as 64 blank rows (see csf_row_notes).
+                it gets allocated when somebody edits it -- not here, since this is the mixer */
                 csf->pattern_size[csf->current_pattern] = 64;
-                csf->pattern_alloc_size[csf->current_pattern] = 64;
         }
 
         if (csf->process_row >= csf->pattern_size[csf->current_pattern]) {
@@ -931,6 +1023,15 @@ static int increment_order(song_t *csf)
 }
 
 
+/* the notes on the current row */
+static const song_note_t *csf_row_notes(song_t *csf)
+{
+        const song_note_t *pattern = csf->patterns[csf->current_pattern];
+
+        return (pattern ? pattern : blank_pattern) + csf->row * MAX_CHANNELS;
+}
+
+
 int csf_process_tick(song_t *csf)
 {
         csf->flags &= ~SONG_FIRSTTICK;
@@ -974,7 +1075,7 @@ int csf_process_tick(song_t *csf)
 
                 // Reset channel values
                 song_voice_t *chan = csf->voices;
-                song_note_t *m = csf->patterns[csf->current_pattern] + csf->row * MAX_CHANNELS;
+                const song_note_t *m = csf_row_notes(csf);
 
                 for (unsigned int nchan=0; nchan<MAX_CHANNELS; chan++, nchan++, m++) {
                         // this is where we're going to spit out our midi
@@ -982,7 +1083,7 @@ int csf_process_tick(song_t *csf)
                         // our super-secret "midi buffer"
                         // -mrsb
                         if (csf_midi_out_note)
-                                csf_midi_out_note(nchan, m);
+                                csf_midi_out_note(csf, nchan, m);
 
                         chan->row_note = m->note;
 
@@ -1007,20 +1108,29 @@ int csf_process_tick(song_t *csf)
                 /* [Update effects for each channel as required.] */
 
                 if (csf_midi_out_note) {
-                        song_note_t *m = csf->patterns[csf->current_pattern] + csf->row * MAX_CHANNELS;
-
-                        for (unsigned int nchan=0; nchan<MAX_CHANNELS; nchan++, m++) {
+                        for (unsigned int nchan=0; nchan<MAX_CHANNELS; nchan++) {
                                 /* m==NULL allows schism to receive notification of SDx and Scx commands */
-                                csf_midi_out_note(nchan, NULL);
+                                csf_midi_out_note(csf, nchan, NULL);
                         }
                 }
 
                 csf_process_effects(csf, 0);
         }
 
+        if (csf_tick_hook)
+                csf_tick_hook(csf);
+
         return 1;
 }
 
+// Frames in a tick at the current tempo, or 0 if there's no tempo yet
+uint32_t csf_get_tick_length(song_t *csf)
+{
+        if (!csf->current_tempo)
+                return 0;
+        return (csf->mix_frequency * 5 * csf->tempo_factor) / (csf->current_tempo << 8);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 // Handles envelopes & mixer setup
 
@@ -1066,7 +1176,7 @@ int csf_read_note(song_t *csf)
         if (!csf->current_tempo)
                 return 0;
 
-        csf->buffer_count = (csf->mix_frequency * 5 * csf->tempo_factor) / (csf->current_tempo << 8);
+        csf->buffer_count = csf_get_tick_length(csf);
 
         // chaseback hoo hah
         if (csf->stop_at_order > -1 && csf->stop_at_row > -1) {
@@ -1183,7 +1293,7 @@ int csf_read_note(song_t *csf)
                         // Filter Envelope: controls cutoff frequency
                         if (chan && chan->ptr_instrument && chan->ptr_instrument->flags & ENV_FILTER) {
                                 setup_channel_filter(chan,
-                                        !(chan->flags & CHN_FILTER), envpitch, csf->mix_frequency);
+                                        !(chan->flags & CHN_FILTER), envpitch, csf);
                         }
 
                         chan->sample_freq = freq;
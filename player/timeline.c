@@ -0,0 +1,212 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The timeline: every row the song plays, in order, with the time it starts
+at. It's built with the same walk through the song as csf_get_length, but only
+once, and then both ways of looking things up (how long until this row, which
+row is playing at that time) are a binary search.
+
+Keeping it current doesn't mean starting over on every edit. The walk is
+taken apart at the start of each order it plays; when something changes, the
+first order that could be affected is found, and the walk is picked up from
+there. Nothing here looks through the patterns to find out what changed: the
+editing code calls csf_pattern_changed or csf_orderlist_changed, and only the
+edit counts (and the order list, once it's been touched) are compared. */
+
+#include "sndfile.h"
+#include "util.h"
+
+
+// every edit gets a new number, so a pattern that changes and then changes back
+// (or a different song loaded in its place) still looks different
+static uint32_t edit_serial;
+
+void csf_pattern_changed(song_t *csf, int pat)
+{
+        if (pat >= 0 && pat < MAX_PATTERNS)
+                csf->pattern_edits[pat] = ++edit_serial;
+}
+
+void csf_orderlist_changed(song_t *csf)
+{
+        csf->orderlist_edits = ++edit_serial;
+}
+
+static void timeline_restart(song_t *csf, struct song_timeline *tl)
+{
+        tl->num_rows = tl->num_marks = 0;
+        tl->done = 0;
+        csf_walk_init(csf, &tl->walk);
+}
+
+int csf_timeline_check(song_t *csf, struct song_timeline *tl)
+{
+        uint32_t first_order = MAX_ORDERS + 1, n, keep;
+        int pat;
+
+        if (!tl->built
+            || tl->initial_speed != csf->initial_speed
+            || tl->initial_tempo != csf->initial_tempo
+            || tl->initial_global_volume != csf->initial_global_volume) {
+                tl->built = 1;
+                tl->initial_speed = csf->initial_speed;
+                tl->initial_tempo = csf->initial_tempo;
+                tl->initial_global_volume = csf->initial_global_volume;
+                tl->orderlist_edits = csf->orderlist_edits;
+                memcpy(tl->orderlist, csf->orderlist, sizeof(tl->orderlist));
+                memcpy(tl->pattern_edits, csf->pattern_edits, sizeof(tl->pattern_edits));
+                timeline_restart(csf, tl);
+                return 1;
+        }
+
+        if (tl->orderlist_edits != csf->orderlist_edits) {
+                tl->orderlist_edits = csf->orderlist_edits;
+                for (n = 0; n <= MAX_ORDERS; n++) {
+                        if (csf->orderlist[n] != tl->orderlist[n]) {
+                                first_order = n;
+                                break;
+                        }
+                }
+                memcpy(tl->orderlist, csf->orderlist, sizeof(tl->orderlist));
+        }
+
+        // everything up to the first order that reads something different still holds
+        for (keep = 0; keep < tl->num_marks; keep++) {
+                pat = tl->marks[keep].pattern;
+                if (tl->marks[keep].order >= first_order
+                    || (pat < MAX_PATTERNS && tl->pattern_edits[pat] != csf->pattern_edits[pat]))
+                        break;
+        }
+        memcpy(tl->pattern_edits, csf->pattern_edits, sizeof(tl->pattern_edits));
+        if (keep < tl->num_marks) {
+                tl->walk = tl->marks[keep].walk;
+                tl->num_rows = tl->marks[keep].row;
+                tl->num_marks = keep;
+                tl->done = 0;
+        }
+        return !tl->done;
+}
+
+int csf_timeline_extend(song_t *csf, struct song_timeline *tl)
+{
+        struct song_walk *w = &tl->walk;
+        struct song_timeline_row *row;
+        struct song_timeline_mark *mark = NULL;
+        int ok = 1;
+
+        while (!tl->done) {
+                if (!tl->num_rows || w->next_order != w->order) {
+                        // starting on another order (or the end)
+                        if (tl->num_marks == tl->alloc_marks) {
+                                uint32_t alloc = tl->alloc_marks ? tl->alloc_marks * 2 : 64;
+                                void *p = realloc(tl->marks, alloc * sizeof(*tl->marks));
+                                if (!p) {
+                                        ok = 0;
+                                        break;
+                                }
+                                tl->marks = p;
+                                tl->alloc_marks = alloc;
+                        }
+                        mark = &tl->marks[tl->num_marks++];
+                        mark->row = tl->num_rows;
+                        mark->walk = *w;
+                } else {
+                        mark = NULL;
+                }
+
+                if (!csf_walk_next(csf, w)) {
+                        if (mark) {
+                                mark->order = w->order;
+                                mark->pattern = MAX_PATTERNS;
+                        }
+                        tl->length = w->elapsed;
+                        tl->done = 1;
+                        break;
+                }
+                if (mark) {
+                        mark->order = w->order;
+                        mark->pattern = w->pattern;
+                }
+
+                if (tl->num_rows == tl->alloc_rows) {
+                        uint32_t alloc = tl->alloc_rows ? tl->alloc_rows * 2 : 1024;
+                        void *p = realloc(tl->rows, alloc * sizeof(*tl->rows));
+                        if (!p) {
+                                ok = 0;
+                                break;
+                        }
+                        tl->rows = p;
+                        tl->alloc_rows = alloc;
+                }
+                row = &tl->rows[tl->num_rows++];
+                row->order = w->order;
+                row->row = w->row;
+                row->pattern = w->pattern;
+                row->speed = MIN(w->speed, 255);
+                row->tempo = MIN(w->tempo, 255);
+                row->global_volume = MIN(w->global_volume, 255);
+                row->elapsed = w->elapsed;
+
+                csf_walk_row(csf, w, &tl->patterns);
+        }
+
+        if (!ok)
+                tl->built = 0; // start over next time
+        return ok;
+}
+
+uint32_t csf_timeline_time_at(const struct song_timeline *tl, int order, int row)
+{
+        uint32_t lo = 0, hi = tl->num_rows, mid;
+
+        // the first row at or past (order, row)...
+        while (lo < hi) {
+                const struct song_timeline_row *r;
+                mid = lo + (hi - lo) / 2;
+                r = &tl->rows[mid];
+                if (r->order < order || (r->order == order && r->row < row))
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        // ...that's also on or past 'row', which is what csf_get_length stops at
+        while (lo < tl->num_rows && tl->rows[lo].row < row)
+                lo++;
+        return (lo < tl->num_rows) ? tl->rows[lo].elapsed : tl->length;
+}
+
+const struct song_timeline_row *csf_timeline_find(const struct song_timeline *tl, uint32_t msec)
+{
+        uint32_t lo = 0, hi = tl->num_rows, mid;
+
+        if (!tl->num_rows)
+                return NULL;
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (tl->rows[mid].elapsed < msec)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return &tl->rows[MIN(lo, tl->num_rows - 1)];
+}
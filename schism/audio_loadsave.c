@@ -114,6 +114,7 @@ void song_new(int flags)
                         }
                         current_song->pattern_size[i] = 64;
                         current_song->pattern_alloc_size[i] = 64;
+                        csf_pattern_changed(current_song, i);
                 }
         }
         if ((flags & KEEP_SAMPLES) == 0) {
@@ -139,6 +140,7 @@ void song_new(int flags)
         }
         if ((flags & KEEP_ORDERLIST) == 0) {
                 memset(current_song->orderlist, ORDER_LAST, sizeof(current_song->orderlist));
+                csf_orderlist_changed(current_song);
                 memset(current_song->title, 0, sizeof(current_song->title));
                 memset(current_song->message, 0, MAX_MESSAGE);
 
@@ -198,6 +200,8 @@ song_t *song_create_load(const char *file)
 
         if (current_song) {
                 newsong->mix_flags = current_song->mix_flags;
+                newsong->limiter.ceiling = current_song->limiter.ceiling;
+                newsong->dither.mode = current_song->dither.mode;
                 csf_set_wave_config(newsong,
                         current_song->mix_frequency,
                         current_song->mix_bits_per_sample,
@@ -277,6 +281,7 @@ int song_load_unchecked(const char *file)
         song_set_filename(file);
 
         song_lock_audio();
+        newsong->send_bus = current_song->send_bus; /* owned by audio_playback.c */
         csf_free(current_song);
         current_song = newsong;
         current_song->repeat_count = 0;
@@ -805,6 +810,7 @@ const struct save_format song_export_formats[] = {
         {"MWAV", "WAV multi-write", ".wav", {.export = {EXPORT_FUNCS(wav), 1}}},
         {"AIFF", "Audio IFF", ".aiff", {.export = {EXPORT_FUNCS(aiff), 0}}},
         {"MAIFF", "Audio IFF multi-write", ".aiff", {.export = {EXPORT_FUNCS(aiff), 1}}},
+        {"MID", "Standard MIDI File", ".mid", {.export = {EXPORT_FUNCS(mid), 0, fmt_mid_export_midi}}},
         {.label = NULL}
 };
 // <distance> and maiff sounds like something you'd want to hug
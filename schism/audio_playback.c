@@ -47,6 +47,7 @@
 
 #include "snd_fm.h"
 #include "snd_gm.h"
+#include "rtcheck.h"
 
 // Default audio configuration
 // (XXX: Can DEF_SAMPLE_RATE be defined to 48000 everywhere?
@@ -63,7 +64,6 @@
 #endif
 #define DEF_CHANNEL_LIMIT 128
 
-static int midi_playing;
 // ------------------------------------------------------------------------
 
 #define SMP_INIT (UINT_MAX - 1) /* for a click noise on init */
@@ -83,8 +83,11 @@ static int audio_writeout_count = 0;
 
 struct audio_settings audio_settings;
 
-static void _schism_midi_out_note(int chan, const song_note_t *m);
-static void _schism_midi_out_raw(const unsigned char *data, unsigned int len, unsigned int delay);
+static void _schism_midi_out_note(song_t *csf, int chan, const song_note_t *m);
+static void _schism_midi_out_raw(song_t *csf, const unsigned char *data, unsigned int len, unsigned int pos);
+static void _live_notes_begin(void);
+static int _live_notes_play(int pos, int frames);
+static void _schism_tick_hook(song_t *csf);
 
 /* Audio driver related stuff */
 
@@ -107,12 +110,199 @@ extern void vis_work_16m(short *in, int inlen);
 extern void vis_work_8s(char *in, int inlen);
 extern void vis_work_8m(char *in, int inlen);
 
+/* Playback snapshot, handed from the audio thread to the UI through a triple
+buffer: the audio thread owns one copy (back), the UI owns another (front),
+and the third is parked in 'middle'. Each side only ever swaps its own copy
+with the parked one, so neither has to wait for the other. */
+#define PBSTATE_FRESH 4 /* set in 'middle' when the parked copy hasn't been picked up yet */
+static song_playback_state_t pbstate[3];
+static int pbstate_back = 1, pbstate_front = 0;
+static SDL_atomic_t pbstate_middle = { 2 };
+
+static void _copy_voice_state(song_voice_state_t *vs, const song_voice_t *v, int nchan)
+{
+        int n;
+
+        vs->playing = (v->current_sample_data && v->length);
+        vs->channel = (int) v->master_channel ?: nchan + 1;
+        vs->master_channel = v->master_channel;
+        vs->sample = 0;
+        vs->sample_global_volume = 0;
+        if (v->ptr_sample) {
+                n = v->ptr_sample - current_song->samples;
+                if (n > 0 && n < MAX_SAMPLES) {
+                        vs->sample = n;
+                        vs->sample_global_volume = v->ptr_sample->global_volume;
+                }
+        }
+        vs->instrument = v->ptr_instrument ? v->instrument_number : 0;
+        vs->note = v->note;
+        vs->flags = v->flags;
+        vs->sample_data = v->current_sample_data;
+        vs->position = v->position;
+        vs->sample_freq = v->sample_freq;
+        vs->final_volume = v->final_volume;
+        vs->volume = v->volume;
+        vs->global_volume = v->global_volume;
+        vs->instrument_volume = v->instrument_volume;
+        vs->fadeout_volume = v->fadeout_volume;
+        vs->panning = v->panning;
+        vs->final_panning = v->final_panning;
+        vs->nna = v->nna;
+        vs->vu_meter = v->vu_meter;
+        vs->strike = v->strike;
+        vs->vol_env_position = v->vol_env_position;
+        vs->pan_env_position = v->pan_env_position;
+        vs->pitch_env_position = v->pitch_env_position;
+}
+
+/* the song position part of the snapshot; with the audio lock held */
+static void _copy_song_state(song_playback_state_t *ps)
+{
+        ps->order = current_song->current_order;
+        ps->pattern = current_song->current_pattern;
+        ps->row = current_song->row;
+        ps->tick = current_song->current_speed
+                ? current_song->tick_count % current_song->current_speed : 0;
+        ps->speed = current_song->current_speed;
+        ps->tempo = current_song->current_tempo;
+        ps->global_volume = current_song->current_global_volume;
+}
+
+/* the UI changed the position: let its own copy of the snapshot show that
+straight away, rather than after the next buffer (audio lock held) */
+static void _update_front_state(void)
+{
+        _copy_song_state(pbstate + pbstate_front);
+}
+
+/* called at the end of every audio buffer, with the audio lock held */
+static void _publish_playback_state(void)
+{
+        song_playback_state_t *ps = pbstate + pbstate_back;
+        const song_voice_t *v;
+        int n;
+
+        ps->samples_played = samples_played;
+        _copy_song_state(ps);
+        ps->vu_left = global_vu_left;
+        ps->vu_right = global_vu_right;
+        ps->max_channels_used = max_channels_used;
+
+        for (n = 0; n < MAX_CHANNELS; n++) {
+                _copy_voice_state(ps->channels + n, current_song->voices + n, n);
+                ps->channel_voices[n] = ps->channels[n].playing;
+        }
+        for (v = current_song->voices + MAX_CHANNELS; v < current_song->voices + MAX_VOICES; v++) {
+                if (v->master_channel > 0 && v->master_channel <= MAX_CHANNELS
+                    && v->current_sample_data && v->length)
+                        ps->channel_voices[v->master_channel - 1]++;
+        }
+
+        ps->num_mix = MIN(current_song->num_voices, max_voices);
+        for (n = 0; n < ps->num_mix; n++)
+                _copy_voice_state(ps->mix + n, current_song->voices + current_song->voice_mix[n],
+                                  current_song->voice_mix[n]);
+
+        pbstate_back = SDL_AtomicSet(&pbstate_middle, pbstate_back | PBSTATE_FRESH) & 3;
+}
+
+const song_playback_state_t *song_get_playback_state(void)
+{
+        if (SDL_AtomicGet(&pbstate_middle) & PBSTATE_FRESH)
+                pbstate_front = SDL_AtomicSet(&pbstate_middle, pbstate_front) & 3;
+        return pbstate + pbstate_front;
+}
+
+/* Channel scopes. There's only ever one tap, and it follows current_song
+around: song_set_scope_tap(1) reattaches it after a new song is loaded. */
+static struct scope_tap scope_tap;
+
+void song_set_scope_tap(int enable)
+{
+        struct scope_tap *tap = enable ? &scope_tap : NULL;
+
+        if (current_song->scope_tap == tap)
+                return;
+        song_lock_audio();
+        if (tap)
+                memset(tap, 0, sizeof(*tap));
+        current_song->scope_tap = tap;
+        song_unlock_audio();
+}
+
+const struct channel_scope *song_get_channel_scope(int chan)
+{
+        if (!current_song->scope_tap || chan < 0 || chan >= MAX_CHANNELS)
+                return NULL;
+        return current_song->scope_tap->channels + chan;
+}
+
+/* The callback mustn't allocate or wait on a lock (see rtcheck.h), and
+SDL_PushEvent can do both; so it pokes this thread to tell the main loop that
+there's something to update instead. There's never more than one poke
+waiting. */
+static SDL_sem *playback_notify_sem = NULL;
+static SDL_atomic_t playback_notify_pending;
+
+static int _playback_notify_run(UNUSED void *data)
+{
+        SDL_Event e;
+
+        for (;;) {
+                SDL_SemWait(playback_notify_sem);
+                SDL_AtomicSet(&playback_notify_pending, 0);
+                e.user.type = SCHISM_EVENT_PLAYBACK;
+                e.user.code = 0;
+                e.user.data1 = NULL;
+                e.user.data2 = NULL;
+                SDL_PushEvent(&e);
+        }
+        return 0;
+}
+
+static void _playback_notify_start(void)
+{
+        playback_notify_sem = SDL_CreateSemaphore(0);
+        if (playback_notify_sem && !SDL_CreateThread(_playback_notify_run, "playback-notify", NULL)) {
+                SDL_DestroySemaphore(playback_notify_sem);
+                playback_notify_sem = NULL;
+        }
+        if (!playback_notify_sem)
+                log_appendf(4, "Couldn't start the playback notification thread");
+}
+
+static void _playback_notify(void)
+{
+        SDL_Event e;
+
+        if (!playback_notify_sem) {
+                /* no thread; do it the hard way */
+                e.user.type = SCHISM_EVENT_PLAYBACK;
+                e.user.code = 0;
+                e.user.data1 = NULL;
+                e.user.data2 = NULL;
+                SDL_PushEvent(&e);
+        } else if (SDL_AtomicCAS(&playback_notify_pending, 0, 1)) {
+                SDL_SemPost(playback_notify_sem);
+        }
+}
+
+static void _audio_callback(uint8_t *stream, int len);
+
 // this gets called from sdl
 static void audio_callback(UNUSED void *qq, uint8_t * stream, int len)
+{
+        rtcheck_enter();
+        _audio_callback(stream, len);
+        rtcheck_leave();
+}
+
+static void _audio_callback(uint8_t *stream, int len)
 {
         unsigned int wasrow = current_song->row;
         unsigned int waspat = current_song->current_order;
-        int i, n;
+        int i, n, frames, split;
 
         memset(stream, 0, len);
 
@@ -130,11 +320,24 @@ static void audio_callback(UNUSED void *qq, uint8_t * stream, int len)
                 return;
         }
 
-        if (current_song->flags & SONG_ENDREACHED) {
-                n = 0;
-        } else {
-                n = csf_read(current_song, stream, len);
-                if (!n) {
+        /* the info page reattaches this when it's drawn */
+        if (current_song->scope_tap && status.current_page != PAGE_INFO)
+                current_song->scope_tap = NULL;
+
+        midi_queue_begin_buffer();
+        _live_notes_begin();
+
+        /* the buffer is mixed in pieces, split wherever a live note lands */
+        frames = len / audio_sample_size;
+        n = 0;
+        for (;;) {
+                split = _live_notes_play(n, frames);
+                if (n >= frames || (current_song->flags & SONG_ENDREACHED))
+                        break;
+                i = csf_read(current_song, stream + n * audio_sample_size, (split - n) * audio_sample_size);
+                if (!i) {
+                        if (n)
+                                break;
                         if (status.current_page == PAGE_WATERFALL
                         || status.vis_style == VIS_FFT) {
                                 vis_work_8m(NULL, 0);
@@ -142,8 +345,12 @@ static void audio_callback(UNUSED void *qq, uint8_t * stream, int len)
                         song_stop_unlocked(0);
                         goto POST_EVENT;
                 }
-                samples_played += n;
+                midi_queue_skip(i);
+                n += i;
+                if (n < split)
+                        break;
         }
+        samples_played += n;
 
         memcpy(audio_buffer, stream, n * audio_sample_size);
 
@@ -175,6 +382,8 @@ static void audio_callback(UNUSED void *qq, uint8_t * stream, int len)
         if (current_song->num_voices > max_channels_used)
                 max_channels_used = MIN(current_song->num_voices, max_voices);
 POST_EVENT:
+        _publish_playback_state();
+
         audio_writeout_count++;
         if (audio_writeout_count > audio_buffers_per_second) {
                 audio_writeout_count = 0;
@@ -185,12 +394,7 @@ POST_EVENT:
         }
 
         /* send at end */
-        SDL_Event e;
-        e.user.type = SCHISM_EVENT_PLAYBACK;
-        e.user.code = 0;
-        e.user.data1 = NULL;
-        e.user.data2 = NULL;
-        SDL_PushEvent(&e);
+        _playback_notify();
 }
 
 // ------------------------------------------------------------------------------------------------------------
@@ -249,7 +453,10 @@ fairly unlikely scenario that you'd have to TRY to bring about. */
 static int keyjazz_channels[128];
 
 
-static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int effect, int param)
+/* the audio lock must be held. This is also called from the audio thread for
+live notes, so it must not allocate: an instrument that doesn't exist yet is
+left that way, and in instrument mode the note is dropped. */
+static void song_keydown_unlocked(int samp, int ins, int note, int vol, int chan, int effect, int param)
 {
         int ins_mode;
         song_voice_t *c;
@@ -257,14 +464,6 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
         song_sample_t *s = NULL;
         song_instrument_t *i = NULL;
 
-        if (chan == KEYJAZZ_CHAN_CURRENT) {
-                chan = current_play_channel;
-                if (multichannel_mode)
-                        song_change_current_play_channel(1, 1);
-        }
-
-        song_lock_audio();
-
         c = current_song->voices + chan - 1;
 
         ins_mode = song_is_instrument_mode();
@@ -286,7 +485,9 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
 
                 // give the channel a sample, and maybe an instrument
                 s = (samp == KEYJAZZ_NOINST) ? NULL : current_song->samples + samp;
-                i = (ins == KEYJAZZ_NOINST) ? NULL : song_get_instrument(ins); // blah
+                i = (ins >= 0 && ins < MAX_INSTRUMENTS) ? current_song->instruments[ins] : NULL;
+                if (!i && ins_mode && ins != KEYJAZZ_NOINST)
+                        s = NULL; // no such instrument
 
                 if (i && samp == KEYJAZZ_NOINST) {
                         // we're playing an instrument and don't know what sample! WHAT WILL WE EVER DO?!
@@ -318,6 +519,7 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
 
                 if (i) {
                         c->ptr_instrument = i;
+                        c->instrument_number = ins;
 
                         if (!(i->flags & ENV_VOLCARRY)) c->vol_env_position = 0;
                         if (!(i->flags & ENV_PANCARRY)) c->pan_env_position = 0;
@@ -330,7 +532,7 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
 
                         if ((status.flags & MIDI_LIKE_TRACKER) && i) {
                                 if (i->midi_channel_mask) {
-                                        GM_KeyOff(chan - 1);
+                                        GM_KeyOff(current_song, chan - 1);
                                         GM_DPatch(chan - 1, i->midi_program, i->midi_bank, i->midi_channel_mask);
                                 }
                         }
@@ -345,6 +547,7 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
                         c->nna = i->nna;
                 } else {
                         c->ptr_instrument = NULL;
+                        c->instrument_number = 0;
                         c->cutoff = 0x7f;
                         c->resonance = 0;
                 }
@@ -386,7 +589,7 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
                 mc.volparam = vol;
                 mc.effect = effect;
                 mc.param = param;
-                _schism_midi_out_note(chan, &mc);
+                _schism_midi_out_note(current_song, chan, &mc);
         }
 
         /*
@@ -401,7 +604,21 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
                 current_song->flags &= ~SONG_ENDREACHED;
                 current_song->flags |= SONG_PAUSED;
         }
+}
 
+static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int effect, int param)
+{
+        if (chan == KEYJAZZ_CHAN_CURRENT) {
+                chan = current_play_channel;
+                if (multichannel_mode)
+                        song_change_current_play_channel(1, 1);
+        }
+
+        song_lock_audio();
+        // keyjazz on an empty instrument slot creates it, as it always has
+        if (NOTE_IS_NOTE(note) && ins > 0)
+                song_get_instrument(ins);
+        song_keydown_unlocked(samp, ins, note, vol, chan, effect, param);
         song_unlock_audio();
 
         return chan;
@@ -422,6 +639,207 @@ int song_keyup(int samp, int ins, int note)
         return song_keydown_ex(samp, ins, NOTE_OFF, KEYJAZZ_DEFAULTVOL, keyjazz_channels[note], 0, 0);
 }
 
+int song_keyjazz_channel(int note)
+{
+        return NOTE_IS_NOTE(note) ? keyjazz_channels[note] : 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* Live MIDI input.
+
+Notes from a MIDI port skip the event loop: the driver thread stamps them with
+the MIDI clock and drops them in a ring, and the audio callback plays them
+straight into the buffer it's mixing. A note that arrived some way into the
+last buffer period lands the same distance into this buffer, so the latency is
+one buffer, without the jitter of rounding everything to buffer boundaries.
+
+What gets played is decided up front by the main thread (song_set_live_target)
+since that depends on the page; the event still goes through the event loop
+afterward so the page can record it, but flagged so the note isn't played
+twice. The ring has one writer (the MIDI drivers, serialized by the caller)
+and one reader (the audio thread). */
+
+#define LIVE_QUEUE_SIZE 256 /* power of two */
+
+struct live_note {
+        uint64_t when;
+        int on, note, vol, midi_channel;
+};
+
+static struct live_note live_queue[LIVE_QUEUE_SIZE];
+static SDL_atomic_t live_head, live_tail;
+
+/* under the audio lock */
+static struct {
+        int enabled, samp, ins, chan;
+} live_target;
+static uint64_t live_last, live_now;
+
+void song_set_live_target(int enable, int samp, int ins, int chan)
+{
+        if (live_target.enabled == enable && (!enable || (live_target.samp == samp
+            && live_target.ins == ins && live_target.chan == chan)))
+                return;
+        song_lock_audio();
+        live_target.enabled = enable;
+        live_target.samp = samp;
+        live_target.ins = ins;
+        live_target.chan = chan;
+        song_unlock_audio();
+}
+
+int song_live_note(int on, int note, int vol, int midi_channel, uint64_t when)
+{
+        int head = SDL_AtomicGet(&live_head);
+        struct live_note *ln;
+
+        if (!live_target.enabled || !NOTE_IS_NOTE(note))
+                return 0;
+        if (((head + 1) & (LIVE_QUEUE_SIZE - 1)) == SDL_AtomicGet(&live_tail))
+                return 0; /* full; let the event loop have it */
+
+        ln = live_queue + head;
+        ln->when = when;
+        ln->on = on;
+        ln->note = note;
+        ln->vol = vol;
+        ln->midi_channel = midi_channel;
+        SDL_AtomicSet(&live_head, (head + 1) & (LIVE_QUEUE_SIZE - 1));
+        return 1;
+}
+
+static void _live_notes_begin(void)
+{
+        live_last = live_now;
+        live_now = midi_get_clock();
+}
+
+static void _live_note_play(const struct live_note *ln)
+{
+        int samp = live_target.samp, ins = live_target.ins, chan = live_target.chan;
+
+        if (!live_target.enabled)
+                return;
+        if (samp == KEYJAZZ_INST_MIDI)
+                samp = ln->midi_channel;
+        if (ins == KEYJAZZ_INST_MIDI)
+                ins = ln->midi_channel;
+        if (ln->on) {
+                if (chan == KEYJAZZ_CHAN_CURRENT)
+                        chan = current_play_channel;
+                song_keydown_unlocked(samp, ins, ln->note, ln->vol, chan, FX_PANNING, 0x80);
+        } else if (keyjazz_channels[ln->note]) {
+                song_keydown_unlocked(samp, ins, NOTE_OFF, KEYJAZZ_DEFAULTVOL,
+                                      keyjazz_channels[ln->note], 0, 0);
+        }
+}
+
+/* plays every note due at or before frame 'pos' of this buffer, and returns
+where the next one is due (or 'frames' if there are no more this time) */
+static int _live_notes_play(int pos, int frames)
+{
+        int tail = SDL_AtomicGet(&live_tail);
+        uint64_t span = live_now - live_last;
+        struct live_note *ln;
+        int off;
+
+        while (tail != SDL_AtomicGet(&live_head)) {
+                ln = live_queue + tail;
+                if (ln->when > live_now)
+                        return frames; /* came in after this buffer started; next time */
+                if (!live_last || span > 1000000000 || ln->when <= live_last)
+                        off = 0;
+                else
+                        off = MIN((ln->when - live_last) * frames / span, (uint64_t) frames - 1);
+                if (off > pos)
+                        return off;
+                _live_note_play(ln);
+                tail = (tail + 1) & (LIVE_QUEUE_SIZE - 1);
+                SDL_AtomicSet(&live_tail, tail);
+        }
+        return frames;
+}
+
+/* --------------------------------------------------------------------- */
+/* The timeline: every tick of current_song is stamped with when it'll be
+heard, on the same clock incoming MIDI is stamped with, so a note can be put
+where the player heard the song when they played it -- not where the mixer
+had got to by the time the event loop looked. Written by the audio thread,
+read under the audio lock. */
+
+#define TIMELINE_SIZE 512 /* power of two */
+
+struct timeline_tick {
+        uint64_t when;
+        int serial, order, pattern, row, tick, speed, tempo;
+};
+
+static struct timeline_tick timeline[TIMELINE_SIZE];
+static unsigned int timeline_head;
+static int timeline_serial;
+
+static void _schism_tick_hook(song_t *csf)
+{
+        struct timeline_tick *tt;
+
+        if (csf != current_song || (csf->mix_flags & SNDMIX_DIRECTTODISK))
+                return;
+        tt = timeline + (timeline_head++ & (TIMELINE_SIZE - 1));
+        tt->when = midi_queue_time(csf->read_offset);
+        tt->serial = timeline_serial;
+        tt->order = csf->current_order;
+        tt->pattern = csf->current_pattern;
+        tt->row = csf->row;
+        tt->tick = MAX(0, (int) csf->current_speed - (int) csf->tick_count);
+        tt->speed = csf->current_speed;
+        tt->tempo = csf->current_tempo;
+}
+
+int song_get_position_at(uint64_t when, struct song_position *pos)
+{
+        const struct timeline_tick *tt = NULL, *next = NULL, *t;
+        unsigned int n;
+        uint64_t span;
+        int r = 0;
+
+        if (!when)
+                return 0;
+
+        song_lock_audio();
+        if (current_song->flags & (SONG_PAUSED | SONG_ENDREACHED))
+                goto done;
+        for (n = 1; n <= TIMELINE_SIZE && n <= timeline_head; n++) {
+                t = timeline + ((timeline_head - n) & (TIMELINE_SIZE - 1));
+                if (t->serial != timeline_serial)
+                        break;
+                if (t->when <= when) {
+                        tt = t;
+                        break;
+                }
+                next = t;
+        }
+        if (!tt)
+                goto done;
+
+        /* a tick lasts 2.5/tempo seconds, unless the next one says otherwise */
+        span = next ? next->when - tt->when : 2500000000u / MAX(tt->tempo, 1);
+        if (!span || when - tt->when > 2 * span)
+                goto done;
+
+        pos->serial = tt->serial;
+        pos->order = tt->order;
+        pos->pattern = tt->pattern;
+        pos->row = tt->row;
+        pos->speed = MAX(tt->speed, 1);
+        pos->tick = MIN(tt->tick + (double) (when - tt->when) / span, pos->speed - 0.001);
+        r = 1;
+done:
+        song_unlock_audio();
+        return r;
+}
+
+/* --------------------------------------------------------------------- */
+
 void song_single_step(int patno, int row)
 {
         int total_rows;
@@ -483,6 +901,7 @@ static void song_reset_play_state(void)
         current_song->stop_at_order = -1;
         current_song->stop_at_row = -1;
         samples_played = 0;
+        timeline_serial++;
 }
 
 void song_start_once(void)
@@ -494,7 +913,7 @@ void song_start_once(void)
         max_channels_used = 0;
         current_song->repeat_count = -1; // FIXME do this right
 
-        GM_SendSongStartCode();
+        GM_SendSongStartCode(current_song);
         song_unlock_audio();
         main_song_mode_changed_cb();
 
@@ -508,7 +927,7 @@ void song_start(void)
         song_reset_play_state();
         max_channels_used = 0;
 
-        GM_SendSongStartCode();
+        GM_SendSongStartCode(current_song);
         song_unlock_audio();
         main_song_mode_changed_cb();
 
@@ -533,34 +952,51 @@ void song_stop(void)
         main_song_mode_changed_cb();
 }
 
-/* for midi translation */
-static int note_tracker[64];
-static int vol_tracker[64];
-static int ins_tracker[64];
-static int was_program[16];
-static int was_banklo[16];
-static int was_bankhi[16];
+/* for midi translation; there's one of these for the song that's playing,
+and another for whatever disko is rendering */
+struct midi_out_state {
+        int playing;
+        int note_tracker[64];
+        int vol_tracker[64];
+        int ins_tracker[64];
+        int was_program[16];
+        int was_banklo[16];
+        int was_bankhi[16];
+
+        const song_note_t *last_row[64];
+        int last_row_number;
+};
+static struct midi_out_state midi_out_live = {.last_row_number = -1};
+static struct midi_out_state midi_out_render = {.last_row_number = -1};
 
-static const song_note_t *last_row[64];
-static int last_row_number = -1;
+static void _midi_out_state_reset(struct midi_out_state *ms)
+{
+        memset(ms, 0, sizeof(*ms));
+        ms->last_row_number = -1;
+}
+
+void song_midi_render_reset(void)
+{
+        _midi_out_state_reset(&midi_out_render);
+}
 
 void song_stop_unlocked(int quitting)
 {
         if (!current_song) return;
 
-        if (midi_playing) {
+        if (midi_out_live.playing) {
                 unsigned char moff[4];
 
                 /* shut off everything; not IT like, but less annoying */
                 for (int chan = 0; chan < 64; chan++) {
-                        if (note_tracker[chan] != 0) {
+                        if (midi_out_live.note_tracker[chan] != 0) {
                                 for (int j = 0; j < 16; j++) {
                                         csf_process_midi_macro(current_song, chan,
                                                 current_song->midi_config.note_off,
-                                                0, note_tracker[chan], 0, j);
+                                                0, midi_out_live.note_tracker[chan], 0, j);
                                 }
                                 moff[0] = 0x80 + chan;
-                                moff[1] = note_tracker[chan];
+                                moff[1] = midi_out_live.note_tracker[chan];
                                 csf_midi_send(current_song, (unsigned char *) moff, 2, 0, 0);
                         }
                 }
@@ -575,23 +1011,13 @@ void song_stop_unlocked(int quitting)
                 csf_midi_send(current_song, (unsigned char *) _MIDI_PANIC, sizeof(_MIDI_PANIC) - 1, 0, 0);
                 csf_process_midi_macro(current_song, 0, current_song->midi_config.stop, 0, 0, 0, 0); // STOP!
                 midi_send_flush(); // NOW!
-
-                midi_playing = 0;
         }
 
         OPL_Reset(); /* Also stop all OPL sounds */
-        GM_Reset(quitting);
-        GM_SendSongStopCode();
-
-        memset(last_row,0,sizeof(last_row));
-        last_row_number = -1;
+        GM_Reset(current_song, quitting);
+        GM_SendSongStopCode(current_song);
 
-        memset(note_tracker,0,sizeof(note_tracker));
-        memset(vol_tracker,0,sizeof(vol_tracker));
-        memset(ins_tracker,0,sizeof(ins_tracker));
-        memset(was_program,0,sizeof(was_program));
-        memset(was_banklo,0,sizeof(was_banklo));
-        memset(was_bankhi,0,sizeof(was_bankhi));
+        _midi_out_state_reset(&midi_out_live);
 
         playback_tracing = midi_playback_tracing;
 
@@ -616,7 +1042,7 @@ void song_loop_pattern(int pattern, int row)
         max_channels_used = 0;
         csf_loop_pattern(current_song, pattern, row);
 
-        GM_SendSongStartCode();
+        GM_SendSongStartCode(current_song);
 
         song_unlock_audio();
         main_song_mode_changed_cb();
@@ -634,7 +1060,7 @@ void song_start_at_order(int order, int row)
         current_song->break_row = row;
         max_channels_used = 0;
 
-        GM_SendSongStartCode();
+        GM_SendSongStartCode(current_song);
         /* TODO: GM_SendSongPositionCode(calculate the number of 1/16 notes) */
         song_unlock_audio();
         main_song_mode_changed_cb();
@@ -677,60 +1103,65 @@ unsigned int song_get_current_time(void)
         return samples_played / current_song->mix_frequency;
 }
 
+/* these all come from the playback snapshot, so the UI sees the position
+as of the same buffer, and not one the audio thread is halfway through updating */
 int song_get_current_tick(void)
 {
-        return current_song->tick_count % current_song->current_speed;
+        return song_get_playback_state()->tick;
 }
 int song_get_current_speed(void)
 {
-        return current_song->current_speed;
+        return song_get_playback_state()->speed;
 }
 
 void song_set_current_tempo(int new_tempo)
 {
         song_lock_audio();
         current_song->current_tempo = CLAMP(new_tempo, 31, 255);
+        _update_front_state();
         song_unlock_audio();
 }
 int song_get_current_tempo(void)
 {
-        return current_song->current_tempo;
+        return song_get_playback_state()->tempo;
 }
 
 int song_get_current_global_volume(void)
 {
-        return current_song->current_global_volume;
+        return song_get_playback_state()->global_volume;
 }
 
 int song_get_current_order(void)
 {
-        return current_song->current_order;
+        return song_get_playback_state()->order;
 }
 
 int song_get_playing_pattern(void)
 {
-        return current_song->current_pattern;
+        return song_get_playback_state()->pattern;
 }
 
 int song_get_current_row(void)
 {
-        return current_song->row;
+        return song_get_playback_state()->row;
 }
 
 int song_get_playing_channels(void)
 {
-        return MIN(current_song->num_voices, max_voices);
+        return song_get_playback_state()->num_mix;
 }
 
 int song_get_max_channels(void)
 {
-        return max_channels_used;
+        return song_get_playback_state()->max_channels_used;
 }
 // Returns the max value in dBs, scaled as 0 = -40dB and 128 = 0dB.
 void song_get_vu_meter(int *left, int *right)
 {
-        *left = dB_s(40, global_vu_left/256.f, 0.f);
-        *right = dB_s(40, global_vu_right/256.f, 0.f);
+        const song_playback_state_t *ps = song_get_playback_state();
+
+        *left = dB_s(40, ps->vu_left/256.f, 0.f);
+        *right = dB_s(40, ps->vu_right/256.f, 0.f);
 }
 
 void song_update_playing_instrument(int i_changed)
@@ -757,11 +1188,11 @@ void song_update_playing_instrument(int i_changed)
                         }
                         if (inst->ifc & 0x80) {
                                 channel->cutoff = inst->ifc & 0x7F;
-                                setup_channel_filter(channel, 0, 256, current_song->mix_frequency);
+                                setup_channel_filter(channel, 0, 256, current_song);
                         } else {
                                 channel->cutoff = 0x7F;
                                 if (inst->ifr & 0x80) {
-                                        setup_channel_filter(channel, 0, 256, current_song->mix_frequency);
+                                        setup_channel_filter(channel, 0, 256, current_song);
                                 }
                         }
 
@@ -822,43 +1253,30 @@ void song_update_playing_sample(int s_changed)
 
 void song_get_playing_samples(int samples[])
 {
-        song_voice_t *channel;
+        const song_playback_state_t *ps = song_get_playback_state();
+        const song_voice_state_t *vs;
+        int n;
 
         memset(samples, 0, MAX_SAMPLES * sizeof(int));
 
-        song_lock_audio();
-        int n = MIN(current_song->num_voices, max_voices);
-        while (n--) {
-                channel = current_song->voices + current_song->voice_mix[n];
-                if (channel->ptr_sample && channel->current_sample_data) {
-                        int s = channel->ptr_sample - current_song->samples;
-                        if (s >= 0 && s < MAX_SAMPLES) {
-                                samples[s] = MAX(samples[s], 1 + channel->strike);
-                        }
-                } else {
-                        // no sample.
-                        // (when does this happen?)
-                }
+        for (n = 0, vs = ps->mix; n < ps->num_mix; n++, vs++) {
+                if (vs->sample && vs->sample_data)
+                        samples[vs->sample] = MAX(samples[vs->sample], 1 + vs->strike);
         }
-        song_unlock_audio();
 }
 
 void song_get_playing_instruments(int instruments[])
 {
-        song_voice_t *channel;
+        const song_playback_state_t *ps = song_get_playback_state();
+        const song_voice_state_t *vs;
+        int n;
 
         memset(instruments, 0, MAX_INSTRUMENTS * sizeof(int));
 
-        song_lock_audio();
-        int n = MIN(current_song->num_voices, max_voices);
-        while (n--) {
-                channel = current_song->voices + current_song->voice_mix[n];
-                int ins = song_get_instrument_number((song_instrument_t *) channel->ptr_instrument);
-                if (ins > 0 && ins < MAX_INSTRUMENTS) {
-                        instruments[ins] = MAX(instruments[ins], 1 + channel->strike);
-                }
+        for (n = 0, vs = ps->mix; n < ps->num_mix; n++, vs++) {
+                if (vs->instrument)
+                        instruments[vs->instrument] = MAX(instruments[vs->instrument], 1 + vs->strike);
         }
-        song_unlock_audio();
 }
 
 // ------------------------------------------------------------------------
@@ -871,6 +1289,7 @@ void song_set_current_speed(int speed)
 
         song_lock_audio();
         current_song->current_speed = speed;
+        _update_front_state();
         song_unlock_audio();
 }
 
@@ -881,6 +1300,7 @@ void song_set_current_global_volume(int volume)
 
         song_lock_audio();
         current_song->current_global_volume = volume;
+        _update_front_state();
         song_unlock_audio();
 }
 
@@ -888,6 +1308,7 @@ void song_set_current_order(int order)
 {
         song_lock_audio();
         csf_set_current_order(current_song, order);
+        _update_front_state();
         song_unlock_audio();
 }
 
@@ -949,6 +1370,16 @@ void cfg_load_audio(cfg_file_t *cfg)
         CFG_GET_M(interpolation_mode, SRCMODE_LINEAR);
         CFG_GET_M(no_ramping, 0);
         CFG_GET_M(surround_effect, 1);
+        CFG_GET_M(send_level, 64);
+        CFG_GET_M(reverb_level, 0);
+        CFG_GET_M(reverb_time, 20);
+        CFG_GET_M(reverb_damp, 40);
+        CFG_GET_M(delay_level, 0);
+        CFG_GET_M(delay_feedback, 40);
+        CFG_GET_M(delay_ticks, 6);
+        CFG_GET_M(limiter, 0);
+        CFG_GET_M(limiter_ceiling, 10);
+        CFG_GET_M(dither, DITHER_NONE);
 
         if (audio_settings.channels != 1 && audio_settings.channels != 2)
                 audio_settings.channels = 2;
@@ -990,6 +1421,18 @@ void cfg_atexit_save_audio(cfg_file_t *cfg)
         // Say, what happened to the switch for this in the gui?
         CFG_SET_M(surround_effect);
 
+        // no gui for these either
+        CFG_SET_M(send_level);
+        CFG_SET_M(reverb_level);
+        CFG_SET_M(reverb_time);
+        CFG_SET_M(reverb_damp);
+        CFG_SET_M(delay_level);
+        CFG_SET_M(delay_feedback);
+        CFG_SET_M(delay_ticks);
+        CFG_SET_M(limiter);
+        CFG_SET_M(limiter_ceiling);
+        CFG_SET_M(dither);
+
         // hmmm....
         //     [Equalizer]
         //     low_band=freq/gain
@@ -1016,8 +1459,9 @@ void cfg_save_audio(cfg_file_t *cfg)
 }
 
 // ------------------------------------------------------------------------------------------------------------
-static void _schism_midi_out_note(int chan, const song_note_t *m)
+static void _schism_midi_out_note(song_t *csf, int chan, const song_note_t *m)
 {
+        struct midi_out_state *ms = (csf == current_song) ? &midi_out_live : &midi_out_render;
         unsigned int tc;
         int m_note;
 
@@ -1026,55 +1470,55 @@ static void _schism_midi_out_note(int chan, const song_note_t *m)
         int need_note, need_velocity;
         song_voice_t *c;
 
-        if (!current_song || !song_is_instrument_mode() || (status.flags & MIDI_LIKE_TRACKER)) return;
+        if (!csf || !(csf->flags & SONG_INSTRUMENTMODE) || (status.flags & MIDI_LIKE_TRACKER)) return;
 
     /*if(m)
     fprintf(stderr, "midi_out_note called (ch %d)note(%d)instr(%d)volcmd(%02X)cmd(%02X)vol(%02X)p(%02X)\n",
         chan, m->note, m->instrument, m->voleffect, m->effect, m->volparam, m->param);
     else fprintf(stderr, "midi_out_note called (ch %d) m=%p\n", m);*/
 
-        if (!midi_playing) {
-                csf_process_midi_macro(current_song, 0, current_song->midi_config.start, 0, 0, 0, 0); // START!
-                midi_playing = 1;
+        if (!ms->playing) {
+                csf_process_midi_macro(csf, 0, csf->midi_config.start, 0, 0, 0, 0); // START!
+                ms->playing = 1;
         }
 
         if (chan < 0) {
                 return;
         }
 
-        c = &current_song->voices[chan];
+        c = &csf->voices[chan];
 
         chan %= 64;
 
         if (!m) {
-                if (last_row_number != (signed) current_song->row) return;
-                m = last_row[chan];
+                if (ms->last_row_number != (signed) csf->row) return;
+                m = ms->last_row[chan];
                 if (!m) return;
         } else {
-                last_row[chan] = m;
-                last_row_number = current_song->row;
+                ms->last_row[chan] = m;
+                ms->last_row_number = csf->row;
         }
 
-        ins = ins_tracker[chan];
+        ins = ms->ins_tracker[chan];
         if (m->instrument > 0) {
                 ins = m->instrument;
-                ins_tracker[chan] = ins;
+                ms->ins_tracker[chan] = ins;
         }
         if (ins < 0 || ins >= MAX_INSTRUMENTS)
                 return; /* err...  almost certainly */
-        if (!current_song->instruments[ins]) return;
+        if (!csf->instruments[ins]) return;
 
-        if (current_song->instruments[ins]->midi_channel_mask >= 0x10000) {
+        if (csf->instruments[ins]->midi_channel_mask >= 0x10000) {
                 mc = chan % 16;
         } else {
                 mc = 0;
-                if(current_song->instruments[ins]->midi_channel_mask > 0)
-                        while(!(current_song->instruments[ins]->midi_channel_mask & (1 << mc)))
+                if(csf->instruments[ins]->midi_channel_mask > 0)
+                        while(!(csf->instruments[ins]->midi_channel_mask & (1 << mc)))
                                 ++mc;
         }
 
         m_note = m->note;
-        tc = current_song->tick_count % current_song->current_speed;
+        tc = csf->tick_count % csf->current_speed;
 #if 0
 printf("channel = %d note=%d\n",chan,m_note);
 #endif
@@ -1098,58 +1542,58 @@ printf("channel = %d note=%d\n",chan,m_note);
 
         need_note = need_velocity = -1;
         if (m_note > 120) {
-                if (note_tracker[chan] != 0) {
-                        csf_process_midi_macro(current_song, chan, current_song->midi_config.note_off,
-                                0, note_tracker[chan], 0, ins);
+                if (ms->note_tracker[chan] != 0) {
+                        csf_process_midi_macro(csf, chan, csf->midi_config.note_off,
+                                0, ms->note_tracker[chan], 0, ins);
                 }
 
-                note_tracker[chan] = 0;
+                ms->note_tracker[chan] = 0;
                 if (m->voleffect != VOLFX_VOLUME) {
-                        vol_tracker[chan] = 64;
+                        ms->vol_tracker[chan] = 64;
                 } else {
-                        vol_tracker[chan] = m->voleffect;
+                        ms->vol_tracker[chan] = m->voleffect;
                 }
         } else if (!m->note && m->voleffect == VOLFX_VOLUME) {
-                vol_tracker[chan] = m->volparam;
-                need_velocity = vol_tracker[chan];
+                ms->vol_tracker[chan] = m->volparam;
+                need_velocity = ms->vol_tracker[chan];
 
         } else if (m->note) {
-                if (note_tracker[chan] != 0) {
-                        csf_process_midi_macro(current_song, chan, current_song->midi_config.note_off,
-                                0, note_tracker[chan], 0, ins);
+                if (ms->note_tracker[chan] != 0) {
+                        csf_process_midi_macro(csf, chan, csf->midi_config.note_off,
+                                0, ms->note_tracker[chan], 0, ins);
                 }
-                note_tracker[chan] = m_note;
+                ms->note_tracker[chan] = m_note;
                 if (m->voleffect != VOLFX_VOLUME) {
-                        vol_tracker[chan] = 64;
+                        ms->vol_tracker[chan] = 64;
                 } else {
-                        vol_tracker[chan] = m->volparam;
+                        ms->vol_tracker[chan] = m->volparam;
                 }
-                need_note = note_tracker[chan];
-                need_velocity = vol_tracker[chan];
+                need_note = ms->note_tracker[chan];
+                need_velocity = ms->vol_tracker[chan];
         }
 
-        mg = (current_song->instruments[ins]->midi_program)
+        mg = (csf->instruments[ins]->midi_program)
                 + ((midi_flags & MIDI_BASE_PROGRAM1) ? 1 : 0);
-        mbl = current_song->instruments[ins]->midi_bank;
-        mbh = (current_song->instruments[ins]->midi_bank >> 7) & 127;
+        mbl = csf->instruments[ins]->midi_bank;
+        mbh = (csf->instruments[ins]->midi_bank >> 7) & 127;
 
-        if (mbh > -1 && was_bankhi[mc] != mbh) {
+        if (mbh > -1 && ms->was_bankhi[mc] != mbh) {
                 buf[0] = 0xB0 | (mc & 15); // controller
                 buf[1] = 0x00; // corse bank/select
                 buf[2] = mbh; // corse bank/select
-                csf_midi_send(current_song, buf, 3, 0, 0);
-                was_bankhi[mc] = mbh;
+                csf_midi_send(csf, buf, 3, 0, 0);
+                ms->was_bankhi[mc] = mbh;
         }
-        if (mbl > -1 && was_banklo[mc] != mbl) {
+        if (mbl > -1 && ms->was_banklo[mc] != mbl) {
                 buf[0] = 0xB0 | (mc & 15); // controller
                 buf[1] = 0x20; // fine bank/select
                 buf[2] = mbl; // fine bank/select
-                csf_midi_send(current_song, buf, 3, 0, 0);
-                was_banklo[mc] = mbl;
+                csf_midi_send(csf, buf, 3, 0, 0);
+                ms->was_banklo[mc] = mbl;
         }
-        if (mg > -1 && was_program[mc] != mg) {
-                was_program[mc] = mg;
-                csf_process_midi_macro(current_song, chan, current_song->midi_config.set_program,
+        if (mg > -1 && ms->was_program[mc] != mg) {
+                ms->was_program[mc] = mg;
+                csf_process_midi_macro(csf, chan, csf->midi_config.set_program,
                         mg, 0, 0, ins); // program change
         }
         if (c->flags & CHN_MUTE) {
@@ -1157,28 +1601,29 @@ printf("channel = %d note=%d\n",chan,m_note);
         } else if (need_note > 0) {
                 if (need_velocity == -1) need_velocity = 64; // eh?
                 need_velocity = CLAMP(need_velocity*2,0,127);
-                csf_process_midi_macro(current_song, chan, current_song->midi_config.note_on,
+                csf_process_midi_macro(csf, chan, csf->midi_config.note_on,
                         0, need_note, need_velocity, ins); // noteon
-        } else if (need_velocity > -1 && note_tracker[chan] > 0) {
+        } else if (need_velocity > -1 && ms->note_tracker[chan] > 0) {
                 need_velocity = CLAMP(need_velocity*2,0,127);
-                csf_process_midi_macro(current_song, chan, current_song->midi_config.set_volume,
-                        need_velocity, note_tracker[chan], need_velocity, ins); // volume-set
+                csf_process_midi_macro(csf, chan, csf->midi_config.set_volume,
+                        need_velocity, ms->note_tracker[chan], need_velocity, ins); // volume-set
         }
 
 }
-static void _schism_midi_out_raw(const unsigned char *data, unsigned int len, unsigned int pos)
+static void _schism_midi_out_raw(song_t *csf, const unsigned char *data, unsigned int len, unsigned int pos)
 {
-#if 0
-        i = (8000*(audio_buffer_samples - delay));
-        i /= (current_song->mix_frequency);
-#endif
 #if 0
         for (int i=0; i < len; i++) {
                 printf("%02x ",data[i]);
         }puts("");
 #endif
 
-        if (!_disko_writemidi(data,len,pos)) midi_send_buffer(data,len,pos);
+        /* pos is the frame offset into the buffer being mixed (see csf_midi_send).
+        anything that isn't the song that's playing is being rendered by disko */
+        if (csf == current_song)
+                midi_send_buffer(data, len, pos);
+        else
+                _disko_writemidi(data, len, pos);
 }
 
 
@@ -1450,8 +1895,22 @@ void song_init_eq(int do_reset)
 }
 
 
+/* The send bus lives here rather than in the song, like the scope tap; it's
+only allocated once something is actually turned up, and it's never freed, so
+the audio thread can't end up holding a stale pointer to it. */
+static struct send_bus *send_bus = NULL;
+
 void song_init_modplug(void)
 {
+        int want_bus = audio_settings.send_level
+                && (audio_settings.reverb_level || audio_settings.delay_level);
+        int new_bus = 0;
+
+        if (want_bus && !send_bus) {
+                send_bus = csf_send_bus_create();
+                new_bus = 1;
+        }
+
         song_lock_audio();
 
         max_voices = audio_settings.channel_limit;
@@ -1465,6 +1924,29 @@ void song_init_modplug(void)
         // just sounds better with one woofer.)
         song_set_surround(audio_settings.surround_effect);
 
+        if (send_bus) {
+                send_bus->send = audio_settings.send_level;
+                send_bus->reverb_level = audio_settings.reverb_level;
+                send_bus->reverb_time = audio_settings.reverb_time;
+                send_bus->reverb_damp = audio_settings.reverb_damp;
+                send_bus->delay_level = audio_settings.delay_level;
+                send_bus->delay_feedback = audio_settings.delay_feedback;
+                send_bus->delay_ticks = audio_settings.delay_ticks;
+                csf_send_bus_setup(send_bus, current_song->mix_frequency, new_bus);
+        }
+        current_song->send_bus = want_bus ? send_bus : NULL;
+
+        // start the limiter out empty if it wasn't running already
+        current_song->limiter.ceiling = audio_settings.limiter_ceiling;
+        csf_limiter_setup(current_song, !(current_song->mix_flags & SNDMIX_LIMITER));
+        if (audio_settings.limiter)
+                current_song->mix_flags |= SNDMIX_LIMITER;
+        else
+                current_song->mix_flags &= ~SNDMIX_LIMITER;
+
+        current_song->dither.mode = audio_settings.dither;
+        csf_dither_setup(current_song, 0);
+
         // update midi queue configuration
         midi_queue_alloc(audio_buffer_samples, audio_sample_size, current_song->mix_frequency);
 
@@ -1479,6 +1961,10 @@ void song_initialise(void)
 {
         csf_midi_out_note = _schism_midi_out_note;
         csf_midi_out_raw = _schism_midi_out_raw;
+        csf_tick_hook = _schism_tick_hook;
+
+        rtcheck_init();
+        _playback_notify_start();
 
 
         current_song = csf_allocate();
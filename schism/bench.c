@@ -0,0 +1,464 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* UI benchmark: replays a script of keypresses through the page handlers
+without an event loop, and times every frame it draws.
+
+The script is line based; blank lines and lines starting with # are ignored.
+
+        section NAME            start a new group of measurements
+        page NAME               switch to a page (pattern, samples, instruments,
+                                info, orders, variables, message, log, about)
+        key KEY [COUNT]         press and release KEY, drawing a frame after
+                                each press. KEY may be prefixed with any of
+                                ctrl+, alt+, shift+
+        frames COUNT            draw COUNT frames with no input
+        generate                replace the song with one that has a looped
+                                sample playing on all 64 channels
+        play / stop             start or stop playback
+        delay MSEC              let the audio thread run for a while
+        eq BLOCKS               run BLOCKS mixer-sized blocks of noise through
+                                the equalizer, with every band boosted
+
+Each section reports the mean and worst time spent in redraw_screen (draw),
+scanning vgamem out to pixels (scan) and handing the pixels to the display
+(present), in microseconds. The eq command reports the mean and worst time
+per block instead, in nanoseconds, for a flat EQ and then a full one. */
+
+#include "headers.h"
+
+#include "it.h"
+#include "page.h"
+#include "song.h"
+#include "event.h"
+#include "video.h"
+#include "bench.h"
+#include "sndfile.h"
+#include "cmixer.h"
+
+#include "sdlmain.h"
+
+#include <stdio.h>
+#include <ctype.h>
+
+#define NATIVE_SCREEN_WIDTH     640
+#define NATIVE_SCREEN_HEIGHT    400
+
+/* 64 channels of pattern data makes a decent stress test for the pattern
+editor and the info page; the first window on the info page is cycled
+around to the 64-channel track view (this assumes the default layout).
+The info page is measured with a generated song, so that every channel
+actually has something playing in it. */
+static const char *default_script[] = {
+        "section pattern-scroll",
+        "page pattern",
+        "key pagedown 32",
+        "key pageup 32",
+        "key down 256",
+        "key tab 64",
+        "section sample-list",
+        "page samples",
+        "key down 99",
+        "key up 99",
+        "section info-64",
+        "generate",
+        "page info",
+        "key pagedown 8",
+        "play",
+        "frames 300",
+        "stop",
+        "section eq-block",
+        "eq 20000",
+        NULL,
+};
+
+struct bench_stat {
+        unsigned int frames;
+        unsigned long total_draw, total_scan, total_present;
+        unsigned int max_draw, max_scan, max_present;
+};
+
+static struct bench_stat bstats;
+static char section[64];
+
+static const struct {
+        const char *name;
+        int page;
+} page_names[] = {
+        {"pattern", PAGE_PATTERN_EDITOR},
+        {"samples", PAGE_SAMPLE_LIST},
+        {"instruments", PAGE_INSTRUMENT_LIST_GENERAL},
+        {"info", PAGE_INFO},
+        {"orders", PAGE_ORDERLIST_PANNING},
+        {"variables", PAGE_SONG_VARIABLES},
+        {"message", PAGE_MESSAGE},
+        {"log", PAGE_LOG},
+        {"about", PAGE_ABOUT},
+        {NULL, 0},
+};
+
+static const struct {
+        const char *name;
+        SDL_Keycode sym;
+} key_names[] = {
+        {"up", SDLK_UP},
+        {"down", SDLK_DOWN},
+        {"left", SDLK_LEFT},
+        {"right", SDLK_RIGHT},
+        {"pageup", SDLK_PAGEUP},
+        {"pagedown", SDLK_PAGEDOWN},
+        {"home", SDLK_HOME},
+        {"end", SDLK_END},
+        {"insert", SDLK_INSERT},
+        {"delete", SDLK_DELETE},
+        {"backspace", SDLK_BACKSPACE},
+        {"tab", SDLK_TAB},
+        {"space", SDLK_SPACE},
+        {"return", SDLK_RETURN},
+        {"escape", SDLK_ESCAPE},
+        {"plus", SDLK_PLUS},
+        {"minus", SDLK_MINUS},
+        {"f1", SDLK_F1}, {"f2", SDLK_F2}, {"f3", SDLK_F3}, {"f4", SDLK_F4},
+        {"f5", SDLK_F5}, {"f6", SDLK_F6}, {"f7", SDLK_F7}, {"f8", SDLK_F8},
+        {"f9", SDLK_F9}, {"f10", SDLK_F10}, {"f11", SDLK_F11}, {"f12", SDLK_F12},
+        {NULL, 0},
+};
+
+/* --------------------------------------------------------------------- */
+
+static unsigned int elapsed_usec(Uint64 since)
+{
+        return (SDL_GetPerformanceCounter() - since) * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+static void bench_report(void)
+{
+        if (!bstats.frames)
+                return;
+        printf("%-20s %6u frames  draw %6lu/%6u  scan %6lu/%6u  present %6lu/%6u\n",
+               section, bstats.frames,
+               bstats.total_draw / bstats.frames, bstats.max_draw,
+               bstats.total_scan / bstats.frames, bstats.max_scan,
+               bstats.total_present / bstats.frames, bstats.max_present);
+        fflush(stdout);
+}
+
+static void bench_frame(void)
+{
+        SDL_Event event;
+        unsigned int draw, scan, present;
+        Uint64 start;
+
+        /* nobody else is pulling events off the queue, so do what the
+        event loop would with the ones that matter */
+        while (SDL_PollEvent(&event)) {
+                if (event.type == SCHISM_EVENT_PASTE)
+                        free(event.user.data1);
+        }
+        switch (song_get_mode()) {
+        case MODE_PLAYING:
+        case MODE_PATTERN_LOOP:
+                playback_update();
+                break;
+        default:
+                break;
+        }
+
+        start = SDL_GetPerformanceCounter();
+        redraw_screen();
+        video_refresh();
+        draw = elapsed_usec(start);
+
+        video_blit();
+        video_blit_timing(&scan, &present);
+        status.flags &= ~(NEED_UPDATE | SOFTWARE_MOUSE_MOVED);
+
+        bstats.frames++;
+        bstats.total_draw += draw;
+        bstats.total_scan += scan;
+        bstats.total_present += present;
+        bstats.max_draw = MAX(bstats.max_draw, draw);
+        bstats.max_scan = MAX(bstats.max_scan, scan);
+        bstats.max_present = MAX(bstats.max_present, present);
+}
+
+static void bench_key(SDL_Keycode sym, SDL_Keymod mod)
+{
+        struct key_event kk = {
+                .midi_volume = -1,
+                .midi_note = -1,
+                .rx = NATIVE_SCREEN_WIDTH / 80,
+                .ry = NATIVE_SCREEN_HEIGHT / 50,
+        };
+
+        kk.sym = kk.orig_sym = sym;
+        kk.mod = mod;
+        kk.unicode = (uint16_t) sym;
+
+        kk.state = KEY_PRESS;
+        key_translate(&kk);
+        handle_key(&kk);
+        status.last_keysym = 0;
+
+        kk.sym = kk.orig_sym = sym;
+        kk.state = KEY_RELEASE;
+        key_translate(&kk);
+        handle_key(&kk);
+        status.last_keysym = kk.sym;
+}
+
+static int bench_parse_key(char *name, SDL_Keycode *sym, SDL_Keymod *mod)
+{
+        char *plus;
+        int n;
+
+        *mod = KMOD_NONE;
+        while ((plus = strchr(name, '+')) && plus[1]) {
+                *plus = '\0';
+                if (strcasecmp(name, "ctrl") == 0)
+                        *mod |= KMOD_LCTRL;
+                else if (strcasecmp(name, "alt") == 0)
+                        *mod |= KMOD_LALT;
+                else if (strcasecmp(name, "shift") == 0)
+                        *mod |= KMOD_LSHIFT;
+                else
+                        return 0;
+                name = plus + 1;
+        }
+        for (n = 0; key_names[n].name; n++) {
+                if (strcasecmp(name, key_names[n].name) == 0) {
+                        *sym = key_names[n].sym;
+                        return 1;
+                }
+        }
+        /* letters, digits, punctuation: the keycode is the character */
+        if (name[0] && !name[1] && name[0] > ' ' && name[0] < 127) {
+                *sym = tolower((unsigned char) name[0]);
+                return 1;
+        }
+        return 0;
+}
+
+/* with 'silent' set, buf is cleared before each block, so it stays silence
+   going in instead of getting what the filters rang out last time */
+static void bench_eq_pass(const char *what, int *buf, unsigned int blocks, int silent)
+{
+        unsigned long total = 0;
+        unsigned int n, ns, max = 0;
+        Uint64 start;
+
+        for (n = 0; n < blocks; n++) {
+                if (silent)
+                        memset(buf, 0, MIXBUFFERSIZE * 2 * sizeof(int));
+                start = SDL_GetPerformanceCounter();
+                eq_stereo(current_song, buf, MIXBUFFERSIZE);
+                ns = (SDL_GetPerformanceCounter() - start) * 1000000000 / SDL_GetPerformanceFrequency();
+                total += ns;
+                max = MAX(max, ns);
+        }
+        printf("%-20s %6u blocks  eq %-4s %6lu/%6u ns\n", section, blocks, what,
+               blocks ? total / blocks : 0, max);
+        fflush(stdout);
+}
+
+static void bench_eq(unsigned int blocks)
+{
+        static int buf[MIXBUFFERSIZE * 2];
+        static int quiet[MIXBUFFERSIZE * 2];
+        unsigned int saved[4];
+        unsigned int n, seed = 1;
+        uint64_t frames, skipped;
+
+        for (n = 0; n < MIXBUFFERSIZE * 2; n++) {
+                seed = seed * 1103515245 + 12345;
+                buf[n] = ((int) (seed >> 4)) >> 4; // roughly full scale for the mixer
+        }
+
+        memcpy(saved, audio_settings.eq_gain, sizeof(saved));
+
+        song_lock_audio();
+        memset(audio_settings.eq_gain, 0, sizeof(saved));
+        song_init_eq(1);
+        bench_eq_pass("flat", buf, blocks, 0);
+
+        for (n = 0; n < 4; n++)
+                audio_settings.eq_gain[n] = 64;
+        song_init_eq(1);
+        bench_eq_pass("full", buf, blocks, 0);
+
+        /* the same, going silent: the filters ring out, then get skipped */
+        frames = dsp_skip_stats.eq_frames;
+        skipped = dsp_skip_stats.eq_skipped;
+        bench_eq_pass("quiet", quiet, blocks, 1);
+        printf("%-20s %6u blocks  eq skipped %llu of %llu frames\n", section, blocks,
+               (unsigned long long) (dsp_skip_stats.eq_skipped - skipped),
+               (unsigned long long) (dsp_skip_stats.eq_frames - frames));
+
+        memcpy(audio_settings.eq_gain, saved, sizeof(saved));
+        song_init_eq(1);
+        song_unlock_audio();
+}
+
+/* a fresh song with sample 1 (a looped saw) on every channel, retriggered
+every few rows at a different note so the track view has something to draw */
+static void bench_generate(void)
+{
+        song_sample_t *smp;
+        song_note_t *pattern, *note;
+        int rows, row, c, n;
+
+        song_new(0);
+
+        song_lock_audio();
+        smp = song_get_sample(1);
+        smp->data = csf_allocate_sample(256);
+        for (n = 0; n < 256; n++)
+                smp->data[n] = n - 128;
+        smp->length = 256;
+        smp->loop_start = 0;
+        smp->loop_end = 256;
+        smp->flags |= CHN_LOOP;
+        strcpy(smp->name, "bench saw");
+
+        rows = song_get_pattern(0, &pattern);
+        for (row = 0; row < rows; row++) {
+                for (c = 0; c < 64; c++) {
+                        if ((row + c) % 8)
+                                continue;
+                        note = pattern + 64 * row + c;
+                        note->note = NOTE_FIRST + 36 + (row / 8 + c) % 24;
+                        note->instrument = 1;
+                }
+        }
+        current_song->orderlist[0] = 0;
+        csf_pattern_changed(current_song, 0);
+        csf_orderlist_changed(current_song);
+        song_unlock_audio();
+
+        main_song_changed_cb();
+}
+
+/* returns zero on a bad line */
+static int bench_line(char *line)
+{
+        char *cmd, *arg, *arg2;
+        SDL_Keycode sym;
+        SDL_Keymod mod;
+        int n, count;
+
+        cmd = strtok(line, " \t\r\n");
+        if (!cmd || *cmd == '#')
+                return 1;
+        arg = strtok(NULL, " \t\r\n");
+        arg2 = strtok(NULL, " \t\r\n");
+
+        if (strcasecmp(cmd, "section") == 0) {
+                bench_report();
+                memset(&bstats, 0, sizeof(bstats));
+                strncpy(section, arg ? arg : "", sizeof(section) - 1);
+                return 1;
+        } else if (strcasecmp(cmd, "page") == 0 && arg) {
+                for (n = 0; page_names[n].name; n++) {
+                        if (strcasecmp(arg, page_names[n].name) == 0) {
+                                set_page(page_names[n].page);
+                                bench_frame();
+                                return 1;
+                        }
+                }
+        } else if (strcasecmp(cmd, "key") == 0 && arg) {
+                if (!bench_parse_key(arg, &sym, &mod))
+                        return 0;
+                count = arg2 ? atoi(arg2) : 1;
+                while (count-- > 0) {
+                        bench_key(sym, mod);
+                        bench_frame();
+                }
+                return 1;
+        } else if (strcasecmp(cmd, "frames") == 0 && arg) {
+                count = atoi(arg);
+                while (count-- > 0)
+                        bench_frame();
+                return 1;
+        } else if (strcasecmp(cmd, "generate") == 0) {
+                bench_generate();
+                return 1;
+        } else if (strcasecmp(cmd, "play") == 0) {
+                song_start();
+                return 1;
+        } else if (strcasecmp(cmd, "stop") == 0) {
+                song_stop();
+                return 1;
+        } else if (strcasecmp(cmd, "eq") == 0 && arg) {
+                bench_eq(atoi(arg));
+                return 1;
+        } else if (strcasecmp(cmd, "delay") == 0 && arg) {
+                SDL_Delay(atoi(arg));
+                return 1;
+        }
+        return 0;
+}
+
+int bench_run(const char *script)
+{
+        char buf[256];
+        FILE *fp = NULL;
+        int n, lineno = 0;
+
+        if (strcasecmp(script, "default") != 0) {
+                fp = fopen(script, "r");
+                if (!fp) {
+                        perror(script);
+                        return 1;
+                }
+        }
+
+        memset(&bstats, 0, sizeof(bstats));
+        strcpy(section, "(unnamed)");
+        printf("%-20s %6s frames  %-13s  %-13s  %-16s\n", "# section", "",
+               "draw avg/max", "scan avg/max", "present avg/max");
+
+        for (n = 0;; n++) {
+                if (fp) {
+                        if (!fgets(buf, sizeof(buf), fp))
+                                break;
+                } else {
+                        if (!default_script[n])
+                                break;
+                        strncpy(buf, default_script[n], sizeof(buf) - 1);
+                        buf[sizeof(buf) - 1] = '\0';
+                }
+                lineno++;
+                if (!bench_line(buf)) {
+                        fprintf(stderr, "%s:%d: can't make sense of this line\n",
+                                fp ? script : "default", lineno);
+                        if (fp)
+                                fclose(fp);
+                        return 1;
+                }
+        }
+        bench_report();
+
+        if (fp)
+                fclose(fp);
+        return 0;
+}
@@ -47,6 +47,7 @@ were a lot of fun to figure out.
 #include "disko.h"
 
 #include <sys/stat.h>
+#include <math.h>
 
 #include <stdio.h>
 #include <fcntl.h>
@@ -59,12 +60,16 @@ were a lot of fun to figure out.
 static unsigned int disko_output_rate = 44100;
 static unsigned int disko_output_bits = 16;
 static unsigned int disko_output_channels = 2;
+static int disko_normalize = 0;
+static int disko_dither = DITHER_NONE;
 
 void cfg_load_disko(cfg_file_t *cfg)
 {
         disko_output_rate = cfg_get_number(cfg, "Diskwriter", "rate", 44100);
         disko_output_bits = cfg_get_number(cfg, "Diskwriter", "bits", 16);
         disko_output_channels = cfg_get_number(cfg, "Diskwriter", "channels", 2);
+        disko_normalize = !!cfg_get_number(cfg, "Diskwriter", "normalize", 0);
+        disko_dither = cfg_get_number(cfg, "Diskwriter", "dither", DITHER_NONE);
 }
 
 void cfg_save_disko(cfg_file_t *cfg)
@@ -72,6 +77,8 @@ void cfg_save_disko(cfg_file_t *cfg)
         cfg_set_number(cfg, "Diskwriter", "rate", disko_output_rate);
         cfg_set_number(cfg, "Diskwriter", "bits", disko_output_bits);
         cfg_set_number(cfg, "Diskwriter", "channels", disko_output_channels);
+        cfg_set_number(cfg, "Diskwriter", "normalize", disko_normalize);
+        cfg_set_number(cfg, "Diskwriter", "dither", disko_dither);
 }
 
 // ---------------------------------------------------------------------------
@@ -360,18 +367,46 @@ int disko_memclose(disko_t *ds, int keep_buffer)
 
 // ---------------------------------------------------------------------------
 
+/* the export's own copy of the send bus, so it starts out empty and doesn't
+scribble on the one that's playing */
+static struct send_bus *export_bus = NULL;
+
 static void _export_setup(song_t *dwsong, int *bps)
 {
+        /* allocate it here, before taking the lock; the audio thread never
+        changes current_song->send_bus, so looking at it is safe */
+        if (current_song->send_bus && !export_bus)
+                export_bus = csf_send_bus_create();
+
         song_lock_audio();
 
         /* install our own */
         memcpy(dwsong, current_song, sizeof(song_t)); /* shadow it */
 
         dwsong->multi_write = NULL; /* should be null already, but to be sure... */
+        dwsong->scope_tap = NULL; /* that belongs to the real song */
+        dwsong->send_bus = NULL; /* so does that, but we'll copy its settings */
+        dwsong->meter = NULL;
+        if (current_song->send_bus && export_bus) {
+                export_bus->send = current_song->send_bus->send;
+                export_bus->reverb_level = current_song->send_bus->reverb_level;
+                export_bus->reverb_time = current_song->send_bus->reverb_time;
+                export_bus->reverb_damp = current_song->send_bus->reverb_damp;
+                export_bus->delay_level = current_song->send_bus->delay_level;
+                export_bus->delay_feedback = current_song->send_bus->delay_feedback;
+                export_bus->delay_ticks = current_song->send_bus->delay_ticks;
+                dwsong->send_bus = export_bus;
+        }
 
         csf_set_current_order(dwsong, 0); /* rather indirect way of resetting playback variables */
         csf_set_wave_config(dwsong, disko_output_rate, disko_output_bits,
                 (dwsong->flags & SONG_NOSTEREO) ? 1 : disko_output_channels);
+        csf_send_bus_setup(dwsong->send_bus, dwsong->mix_frequency, 1);
+        /* the rest of the output stage starts from scratch too, so that the same
+        song always comes out the same */
+        csf_limiter_setup(dwsong, 1);
+        dwsong->dither.mode = disko_dither;
+        csf_dither_setup(dwsong, 1);
 
         dwsong->mix_flags |= SNDMIX_DIRECTTODISK | SNDMIX_NOBACKWARDJUMPS;
 
@@ -383,12 +418,16 @@ static void _export_setup(song_t *dwsong, int *bps)
 
         *bps = dwsong->mix_channels * ((dwsong->mix_bits_per_sample + 7) / 8);
 
+        song_midi_render_reset();
+
         song_unlock_audio();
 }
 
 static void _export_teardown(void)
 {
         global_vu_left = global_vu_right = 0;
+        csf_send_bus_free(export_bus);
+        export_bus = NULL;
 }
 
 // ---------------------------------------------------------------------------
@@ -588,6 +627,9 @@ static size_t est_len;
 static int prgh;
 static struct timeval export_start_time;
 static int canceled = 0; /* this sucks, but so do I */
+static int export_reading = 0; /* set while disko_sync is rendering the next block */
+static int export_scanning = 0; /* set while disko_sync is measuring the song for normalizing */
+static size_t export_scan_frames = 0;
 
 static int disko_finish(void);
 
@@ -603,9 +645,14 @@ static void diskodlg_draw(void)
                 return;
         }
 
-        sec = export_ds[0]->length / export_dwsong.mix_frequency;
-        pos = export_ds[0]->length * 64 / est_len;
-        snprintf(buf, 32, "Exporting song...%6d:%02d", sec / 60, sec % 60);
+        if (export_scanning) {
+                sec = export_scan_frames / export_dwsong.mix_frequency;
+                pos = export_scan_frames * 64 / est_len;
+        } else {
+                sec = export_ds[0]->length / export_dwsong.mix_frequency;
+                pos = export_ds[0]->length * 64 / est_len;
+        }
+        snprintf(buf, 32, "%s song...%6d:%02d", export_scanning ? "Measuring" : "Exporting", sec / 60, sec % 60);
         buf[31] = '\0';
         draw_text(buf, 27, 27, 0, 2);
         draw_fill_chars(24, 30, 55, 30, 0);
@@ -678,6 +725,42 @@ static char *get_filename(const char *template, int n)
         return s;
 }
 
+/* Play through the whole song once without writing anything, to find out how
+loud it gets, and set the export's gain so that its loudest peak lands right on
+the limiter's ceiling. The scan uses the cheapest resampling there is, so the
+peak it finds is only an estimate; the limiter, which the export runs through
+either way, catches whatever the real thing does differently.
+
+The scan is done a block at a time by disko_sync, the same as the export, so the
+progress dialog keeps drawing and can cancel it. */
+static void _export_normalize_start(void)
+{
+        csf_set_resampling_mode(&export_dwsong, SRCMODE_NEAREST);
+        export_dwsong.mix_flags |= SNDMIX_LIMITER;
+        export_dwsong.limiter.gain = 1.0f;
+        csf_limiter_setup(&export_dwsong, 1);
+        export_scan_frames = 0;
+        export_scanning = 1;
+}
+
+static void _export_normalize_finish(void)
+{
+        float peak = export_dwsong.limiter.peak, gain;
+
+        export_scanning = 0;
+
+        /* start over for real */
+        _export_setup(&export_dwsong, &export_bps);
+        gain = peak > 0 ? (export_dwsong.limiter.level / MIXING_CLIPMAX) / peak : 1.0f;
+        gain = MIN(gain, 16.0f); /* don't drag up a song that's mostly silence too far */
+        export_dwsong.mix_flags |= SNDMIX_LIMITER;
+        export_dwsong.limiter.gain = gain;
+        csf_limiter_setup(&export_dwsong, 1);
+
+        if (peak > 0)
+                log_appendf(5, " Normalizing: peak %+.1f dB, gain %+.1f dB", 20 * log10f(peak), 20 * log10f(gain));
+}
+
 int disko_export_song(const char *filename, const struct save_format *format)
 {
         int err = 0;
@@ -745,6 +828,9 @@ int disko_export_song(const char *filename, const struct save_format *format)
         export_format = format;
         status.flags |= DISKWRITER_ACTIVE; /* tell main to care about us */
 
+        if (disko_normalize && numfiles == 1)
+                _export_normalize_start();
+
         disko_dialog_setup((csf_get_length(&export_dwsong) * export_dwsong.mix_frequency) ?: 1);
 
         return DW_OK;
@@ -763,10 +849,18 @@ int disko_sync(void)
                 return DW_SYNC_ERROR; /* no writer running (why are we here?) */
         }
 
-        frames = csf_read(&export_dwsong, buf, sizeof(buf));
+        if (export_scanning) {
+                /* nothing gets written (not even MIDI, since export_reading stays off) */
+                frames = csf_read(&export_dwsong, buf, sizeof(buf));
+                export_scan_frames += frames;
+        } else {
+                export_reading = 1;
+                frames = csf_read(&export_dwsong, buf, sizeof(buf));
+                export_reading = 0;
 
-        if (!export_dwsong.multi_write)
-                export_format->f.export.body(export_ds[0], buf, frames * export_bps);
+                if (!export_dwsong.multi_write)
+                        export_format->f.export.body(export_ds[0], buf, frames * export_bps);
+        }
         /* always check if something died, multi-write or not */
         for (n = 0; export_ds[n]; n++) {
                 if (export_ds[n]->error) {
@@ -775,9 +869,15 @@ int disko_sync(void)
                 }
         }
 
+        status.flags |= NEED_UPDATE;
+        if (export_scanning) {
+                if (export_dwsong.flags & SONG_ENDREACHED)
+                        _export_normalize_finish();
+                return DW_SYNC_MORE;
+        }
+
         /* update the progress bar (kind of messy, yes...) */
         export_ds[0]->length += frames;
-        status.flags |= NEED_UPDATE;
 
         if (export_dwsong.flags & SONG_ENDREACHED) {
                 disko_finish();
@@ -824,6 +924,7 @@ static int disko_finish(void)
         _export_teardown();
         free(export_dwsong.multi_write);
         export_format = NULL;
+        export_scanning = 0; /* if it was canceled before the export got going */
 
         status.flags &= ~DISKWRITER_ACTIVE; /* please unsubscribe me from your mailing list */
 
@@ -858,6 +959,112 @@ static int disko_finish(void)
 
 // ---------------------------------------------------------------------------
 
+static int analyze_print = 0;
+
+static void analyze_line(int color, const char *fmt, ...)
+{
+        char buf[80];
+        va_list ap;
+
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        log_appendf(color, "%s", buf);
+        if (analyze_print)
+                puts(buf);
+}
+
+static double analyze_db(double v)
+{
+        return (v > 0) ? 20 * log10(v) : -HUGE_VAL;
+}
+
+int disko_analyze_song(int print)
+{
+        uint8_t buf[DW_BUFFER_SIZE];
+        struct mix_meter *meter;
+        song_t *scan;
+        struct dsp_skip_stats skip = dsp_skip_stats;
+        struct timeval start_time, end_time;
+        double elapsed, lufs, ceiling;
+        unsigned int length;
+        int bps, n;
+
+        if (export_format) {
+                log_appendf(4, "Can't analyze while exporting");
+                errno = EAGAIN;
+                return DW_ERROR;
+        }
+
+        meter = malloc(sizeof(struct mix_meter));
+        scan = malloc(sizeof(song_t));
+        if (!meter || !scan) {
+                free(meter);
+                free(scan);
+                errno = ENOMEM;
+                return DW_ERROR;
+        }
+
+        gettimeofday(&start_time, NULL);
+
+        /* Same as exporting, except with the cheapest resampling there is and
+        nothing written anywhere. That makes the peak an estimate (it's usually
+        within a fraction of a dB) but it still takes a full mix of the song,
+        since there's no other way to know what the voices add up to. */
+        _export_setup(scan, &bps);
+        csf_set_resampling_mode(scan, SRCMODE_NEAREST);
+        scan->mix_flags &= ~SNDMIX_LIMITER; /* the meter's before it anyway */
+        csf_meter_reset(meter, scan->mix_frequency);
+        scan->meter = meter;
+        length = csf_get_length(scan);
+
+        do {
+                csf_read(scan, buf, sizeof(buf));
+        } while (!(scan->flags & SONG_ENDREACHED));
+
+        _export_teardown();
+
+        gettimeofday(&end_time, NULL);
+        elapsed = (end_time.tv_sec - start_time.tv_sec)
+                + ((end_time.tv_usec - start_time.tv_usec) / 1000000.0);
+        lufs = csf_meter_loudness(meter);
+        ceiling = -current_song->limiter.ceiling / 10.0;
+
+        analyze_print = print;
+        analyze_line(2, " Song analysis, %d Hz (%d:%02d, scanned in %.2lf sec)",
+                scan->mix_frequency, length / 60, length % 60, elapsed);
+        analyze_line(5, " Peak %+.1f dB, true peak %+.1f dB, %llu frames clipped",
+                analyze_db(meter->peak), analyze_db(meter->true_peak), (unsigned long long) meter->clipped);
+        analyze_line(5, " Loudness %.1f LUFS integrated, %.1f LUFS momentary max",
+                lufs, meter->momentary_max);
+        if (meter->true_peak > 0)
+                analyze_line(5, " Gain for a %.1f dB true peak: %+.1f dB",
+                        ceiling, ceiling - analyze_db(meter->true_peak));
+        skip.eq_frames = dsp_skip_stats.eq_frames - skip.eq_frames;
+        skip.eq_skipped = dsp_skip_stats.eq_skipped - skip.eq_skipped;
+        skip.send_frames = dsp_skip_stats.send_frames - skip.send_frames;
+        skip.send_skipped = dsp_skip_stats.send_skipped - skip.send_skipped;
+        if (skip.eq_frames || skip.send_frames)
+                analyze_line(5, " Skipped as silence: EQ %.0f%%, send effects %.0f%%",
+                        skip.eq_frames ? 100.0 * skip.eq_skipped / skip.eq_frames : 0.0,
+                        skip.send_frames ? 100.0 * skip.send_skipped / skip.send_frames : 0.0);
+        analyze_line(2, " Order    Peak  Clipped  Loudest");
+        for (n = 0; n < MAX_ORDERS; n++) {
+                if (!meter->orders[n].frames)
+                        continue;
+                analyze_line(meter->orders[n].clipped ? 4 : 5, " %5d %+7.1f  %7u  %7.1f",
+                        n, analyze_db(meter->orders[n].peak), meter->orders[n].clipped,
+                        meter->orders[n].momentary_max);
+        }
+        analyze_print = 0;
+
+        free(meter);
+        free(scan);
+        return DW_OK;
+}
+
+// ---------------------------------------------------------------------------
+
 struct pat2smp {
         int pattern, sample, bind;
 };
@@ -933,8 +1140,24 @@ void song_pattern_to_sample(int pattern, int split, int bind)
 
 // ---------------------------------------------------------------------------
 
-/* called from audio_playback.c _schism_midi_out_raw() */
-int _disko_writemidi(UNUSED const void *data, UNUSED unsigned int len, UNUSED unsigned int delay)
+/* called from audio_playback.c _schism_midi_out_raw() for anything the player sends while rendering a
+song that isn't the one being played; 'delay' is the offset in frames into the block being read */
+int _disko_writemidi(const void *data, unsigned int len, unsigned int delay)
 {
-        return DW_ERROR;
+        unsigned int rpb, tick;
+        uint64_t quarter_usec;
+
+        if (!export_reading || !export_format || !export_format->f.export.midi || export_dwsong.multi_write)
+                return DW_OK; /* nothing wants it */
+
+        /* a beat is the minor highlight's worth of rows */
+        rpb = export_dwsong.row_highlight_minor ?: 4;
+        tick = csf_get_tick_length(&export_dwsong) ?: export_dwsong.mix_frequency / 50;
+        quarter_usec = (uint64_t) rpb * export_dwsong.current_speed * tick * 1000000
+                / export_dwsong.mix_frequency;
+        /* a MIDI file's tempo is 24 bits; anything slower than that plays at its slowest, which
+        doesn't change when anything happens, just how many pulses there are in between */
+        quarter_usec = MIN(quarter_usec, 0xFFFFFF);
+
+        return export_format->f.export.midi(export_ds[0], data, len, delay, quarter_usec);
 }
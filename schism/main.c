@@ -34,6 +34,7 @@
 
 #include "clippy.h"
 #include "disko.h"
+#include "bench.h"
 
 #include "version.h"
 #include "song.h"
@@ -184,6 +185,12 @@ static char *initial_dir = NULL;
 /* diskwrite? */
 static char *diskwrite_to = NULL;
 
+/* run a UI benchmark script instead of the event loop */
+static char *benchmark_script = NULL;
+
+/* just print how loud the song is, and exit */
+static int analyze_song = 0;
+
 /* startup flags */
 enum {
         SF_PLAY = 1, /* -p: start playing after loading initial_song */
@@ -226,6 +233,8 @@ enum {
         O_HOOKS, O_NO_HOOKS,
 #endif
         O_DISKWRITE,
+        O_BENCHMARK,
+        O_ANALYZE,
         O_DEBUG,
         O_VERSION,
 };
@@ -273,6 +282,8 @@ static void parse_options(int argc, char **argv)
                 {"play", 0, NULL, O_PLAY},
                 {"no-play", 0, NULL, O_NO_PLAY},
                 {"diskwrite", 1, NULL, O_DISKWRITE},
+                {"benchmark", 1, NULL, O_BENCHMARK},
+                {"analyze", 0, NULL, O_ANALYZE},
                 {"font-editor", 0, NULL, O_FONTEDIT},
                 {"no-font-editor", 0, NULL, O_NO_FONTEDIT},
 #if ENABLE_HOOKS
@@ -370,6 +381,12 @@ static void parse_options(int argc, char **argv)
                 case O_DISKWRITE:
                         diskwrite_to = optarg;
                         break;
+                case O_BENCHMARK:
+                        benchmark_script = optarg;
+                        break;
+                case O_ANALYZE:
+                        analyze_song = 1;
+                        break;
 #if ENABLE_HOOKS
                 case O_HOOKS:
                         startup_flags |= SF_HOOKS;
@@ -408,6 +425,8 @@ static void parse_options(int argc, char **argv)
                                 "  -f, --fullscreen (-F, --no-fullscreen)\n"
                                 "  -p, --play (-P, --no-play)\n"
                                 "      --diskwrite=FILENAME\n"
+                                "      --benchmark=SCRIPT\n"
+                                "      --analyze\n"
                                 "      --font-editor (--no-font-editor)\n"
 #if ENABLE_HOOKS
                                 "      --hooks (--no-hooks)\n"
@@ -917,6 +936,7 @@ static void event_loop(void)
                         }
 
                         check_update();
+                        midi_live_update();
 
                         switch (song_get_mode()) {
                         case MODE_PLAYING:
@@ -1053,10 +1073,18 @@ int main(int argc, char **argv)
                 if (startup_flags & SF_CLASSIC) status.flags |= CLASSIC_MODE;
         }
 
+        if (!video_driver && (benchmark_script || analyze_song)) {
+                /* nobody's watching */
+                video_driver = "offscreen";
+        }
         if (!video_driver) {
                 video_driver = cfg_video_driver;
                 if (!video_driver || !*video_driver) video_driver = NULL;
         }
+        if (video_driver && strcasecmp(video_driver, "offscreen") == 0 && !getenv("SDL_VIDEODRIVER")) {
+                /* don't need a display, either */
+                put_env_var("SDL_VIDEODRIVER", "dummy");
+        }
         if (!did_fullscreen) {
                 video_fullscreen(cfg_video_fullscreen);
         }
@@ -1065,13 +1093,15 @@ int main(int argc, char **argv)
                 status.flags |= NO_NETWORK;
         }
 
-        shutdown_process |= EXIT_SAVECFG;
+        /* benchmark scripts can poke at all sorts of settings */
+        if (!benchmark_script)
+                shutdown_process |= EXIT_SAVECFG;
 
         sdl_init();
         shutdown_process |= EXIT_SDLQUIT;
         os_sdlinit();
 
-        video_init();
+        video_init(video_driver);
         display_init();
         palette_apply();
         font_init();
@@ -1118,7 +1148,9 @@ int main(int argc, char **argv)
         } else if (initial_song) {
                 set_page(PAGE_LOG);
                 if (song_load_unchecked(initial_song)) {
-                        if (diskwrite_to) {
+                        if (analyze_song) {
+                                exit(disko_analyze_song(1) == DW_OK ? 0 : 1);
+                        } else if (diskwrite_to) {
                                 // make a guess?
                                 const char *multi = strcasestr(diskwrite_to, "%c");
                                 const char *driver = (strcasestr(diskwrite_to, ".aif")
@@ -1143,6 +1175,9 @@ int main(int argc, char **argv)
         /* poll once */
         midi_engine_poll_ports();
 
+        if (benchmark_script)
+                exit(bench_run(benchmark_script));
+
         event_loop();
         return 0; /* blah */
 }
@@ -50,8 +50,6 @@ and midi_record_mutex is by the event/sound thread
 static SDL_mutex *midi_mutex = NULL;
 static SDL_mutex *midi_port_mutex = NULL;
 static SDL_mutex *midi_record_mutex = NULL;
-static SDL_mutex *midi_play_mutex = NULL;
-static SDL_cond *midi_play_cond = NULL;
 
 static struct midi_provider *port_providers = NULL;
 
@@ -70,20 +68,33 @@ static void __win32_old_usleep(unsigned int u)
 static FARPROC __ihatewindows_f1 = NULL;
 static FARPROC __ihatewindows_f2 = NULL;
 static FARPROC __ihatewindows_f3 = NULL;
-static HANDLE __midi_timer = NULL;
+/* every port's thread sleeps on a timer of its own */
+static DWORD __midi_timer_tls = TLS_OUT_OF_INDEXES;
 
 static void __win32_new_usleep(unsigned int u)
 {
         LARGE_INTEGER due;
+        HANDLE timer = TlsGetValue(__midi_timer_tls);
+
+        if (!timer) {
+                timer = (HANDLE)__ihatewindows_f1(NULL,TRUE,NULL);
+                if (!timer) {
+                        __win32_old_usleep(u);
+                        return;
+                }
+                TlsSetValue(__midi_timer_tls, timer);
+        }
         due.QuadPart = -(10 * (__int64)u);
-        __ihatewindows_f2(__midi_timer, &due, 0, NULL, NULL, 0);
-        __ihatewindows_f3(__midi_timer, INFINITE);
+        __ihatewindows_f2(timer, &due, 0, NULL, NULL, 0);
+        __ihatewindows_f3(timer, INFINITE);
 }
 
 static void __win32_pick_usleep(void)
 {
         HINSTANCE k32;
 
+        if (__win32_usleep) return;
+
         k32 = GetModuleHandle("KERNEL32.DLL");
         if (!k32) k32 = LoadLibrary("KERNEL32.DLL");
         if (!k32) k32 = GetModuleHandle("KERNEL32.DLL");
@@ -93,8 +104,8 @@ static void __win32_pick_usleep(void)
         __ihatewindows_f3 = (FARPROC)GetProcAddress(k32,"WaitForSingleObject");
         if (!__ihatewindows_f1 || !__ihatewindows_f2 || !__ihatewindows_f3)
                 goto FAIL;
-        __midi_timer = (HANDLE)__ihatewindows_f1(NULL,TRUE,NULL);
-        if (!__midi_timer) goto FAIL;
+        __midi_timer_tls = TlsAlloc();
+        if (__midi_timer_tls == TLS_OUT_OF_INDEXES) goto FAIL;
 
         /* grumble */
         __win32_usleep = __win32_new_usleep;
@@ -119,6 +130,8 @@ int midi_flags = MIDI_TICK_QUANTIZE | MIDI_RECORD_NOTEOFF
 int midi_pitch_depth = 12;
 int midi_amplification = 100;
 int midi_c5note = 60;
+int midi_ip_batch = 0;
+int midi_quantize_strength = 100;
 
 #define CFG_GET_MI(v,d) midi_ ## v = cfg_get_number(cfg, "MIDI", #v, d)
 
@@ -183,6 +196,9 @@ void cfg_load_midi(cfg_file_t *cfg)
         CFG_GET_MI(pitch_depth, 12);
         CFG_GET_MI(amplification, 100);
         CFG_GET_MI(c5note, 60);
+        CFG_GET_MI(ip_batch, 0);
+        CFG_GET_MI(quantize_strength, 100);
+        midi_quantize_strength = CLAMP(midi_quantize_strength, 0, 100);
 
         song_lock_audio();
         md = &default_midi_config;
@@ -232,6 +248,8 @@ void cfg_save_midi(cfg_file_t *cfg)
         CFG_SET_MI(pitch_depth);
         CFG_SET_MI(amplification);
         CFG_SET_MI(c5note);
+        CFG_SET_MI(ip_batch);
+        CFG_SET_MI(quantize_strength);
 
         song_lock_audio();
         md = &default_midi_config;
@@ -337,18 +355,13 @@ int midi_engine_start(void)
 
         midi_mutex        = SDL_CreateMutex();
         midi_record_mutex = SDL_CreateMutex();
-        midi_play_mutex   = SDL_CreateMutex();
         midi_port_mutex   = SDL_CreateMutex();
-        midi_play_cond    = SDL_CreateCond();
 
-        if (!(midi_mutex && midi_record_mutex && midi_play_mutex && midi_port_mutex && midi_play_cond)) {
+        if (!(midi_mutex && midi_record_mutex && midi_port_mutex)) {
                 if (midi_mutex)        SDL_DestroyMutex(midi_mutex);
                 if (midi_record_mutex) SDL_DestroyMutex(midi_record_mutex);
-                if (midi_play_mutex)   SDL_DestroyMutex(midi_play_mutex);
                 if (midi_port_mutex)   SDL_DestroyMutex(midi_port_mutex);
-                if (midi_play_cond)    SDL_DestroyCond(midi_play_cond);
-                midi_mutex = midi_record_mutex = midi_play_mutex = midi_port_mutex = NULL;
-                midi_play_cond = NULL;
+                midi_mutex = midi_record_mutex = midi_port_mutex = NULL;
                 return 0;
         }
 
@@ -394,6 +407,9 @@ void midi_engine_stop(void)
 }
 
 
+static void _midi_port_queue_start(struct midi_port *p);
+static void _midi_port_queue_stop(struct midi_port *p);
+
 /* PORT system */
 static struct midi_port **port_top = NULL;
 static int port_count = 0;
@@ -486,36 +502,49 @@ void *userdata, int free_userdata)
         p->free_userdata = free_userdata;
         p->userdata = userdata;
         p->provider = pv;
+        p->status_saved = 0;
+        _midi_port_queue_start(p);
+
+        /* load any configuration for it (which reads the config file, and may
+        enable it) while nobody else can see it yet... */
+        _cfg_load_midi_part_locked(p);
 
+        /* ...and then publish it. the player walks the table holding only
+        midi_record_mutex, and only ever tries to take that, so it's held just
+        long enough to change the table */
+        SDL_mutexP(midi_record_mutex);
+        SDL_mutexP(midi_port_mutex);
         for (i = 0; i < port_alloc; i++) {
                 if (port_top[i] == NULL) {
-                        port_top[i] = p;
                         p->num = i;
+                        port_top[i] = p;
                         port_count++;
-                        _cfg_load_midi_part_locked(p);
+                        SDL_mutexV(midi_port_mutex);
+                        SDL_mutexV(midi_record_mutex);
                         return i;
                 }
         }
 
-        SDL_mutexP(midi_port_mutex);
         port_alloc += 4;
         pt = realloc(port_top, sizeof(struct midi_port *) * port_alloc);
         if (!pt) {
+                port_alloc -= 4;
+                SDL_mutexV(midi_port_mutex);
+                SDL_mutexV(midi_record_mutex);
+                _midi_port_queue_stop(p);
+                if (p->io && p->disable) p->disable(p);
                 free(p->name);
                 free(p);
-                SDL_mutexV(midi_port_mutex);
                 return -1;
         }
         pt[port_count] = p;
         for (i = port_count+1; i < port_alloc; i++) pt[i] = NULL;
-        port_top = pt;
         p->num = port_count;
+        port_top = pt;
         port_count++;
 
-        /* finally, and just before unlocking, load any configuration for it... */
-        _cfg_load_midi_part_locked(p);
-
         SDL_mutexV(midi_port_mutex);
+        SDL_mutexV(midi_record_mutex);
         return p->num;
 }
 
@@ -543,214 +572,500 @@ int midi_port_foreach(struct midi_provider *p, struct midi_port **cursor)
         return 1;
 }
 
-static int _midi_send_unlocked(const unsigned char *data, unsigned int len, unsigned int delay,
-                        int from)
+/* the same, for whoever holds midi_record_mutex -- which keeps the table from
+changing -- and mustn't wait on midi_port_mutex: that is, the player */
+static int _midi_port_foreach_recording(struct midi_port **cursor)
 {
-        struct midi_port *ptr = NULL;
-        int need_timer = 0;
-#if 0
-        unsigned int i;
-printf("MIDI: ");
-        for (i = 0; i < len; i++) {
-                printf("%02x ", data[i]);
-        }
-puts("");
-fflush(stdout);
+        int i = *cursor ? (*cursor)->num + 1 : 0;
+
+        while (i < port_alloc && !port_top[i])
+                i++;
+        *cursor = (i < port_alloc) ? port_top[i] : NULL;
+        return *cursor != NULL;
+}
+
+/*----------------------------------------------------------------------------------*/
+
+/* Output queues. Every output port gets a ring of its own and a thread to empty
+it, so a port that's slow to take data (a full ALSA sequencer buffer, a 31250
+baud cable) only ever holds up itself, and never whoever is sending.
+
+The player hands us events stamped with their frame offset in the buffer it's
+mixing. midi_queue_begin_buffer pins that buffer to the clock -- it'll be heard
+about one buffer from now -- so every event gets an absolute due time. Ports
+that can only send "now" (oss, and friends) have their thread sleep until
+exactly then; ports that can schedule are handed the event straight away, along
+with how long it has to wait.
+
+Each ring holds variable-length records, with one writer (whoever holds
+midi_record_mutex) and one reader (the port's thread), so neither side ever has
+to wait on the other. Rings are sized from the audio buffer when that's set up.
+When one fills up, new messages are dropped and counted, rather than cut short
+-- except that the last eighth is kept back for messages that stop sound (note
+offs, sustain pedal up, all notes/sound off), since losing one of those leaves
+a note hanging. */
+
+#ifdef HAVE_CLOCK_NANOSLEEP
+#include <time.h>
+#include <errno.h>
+
+static uint64_t _midi_clock(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _midi_sleep_until(uint64_t when)
+{
+        struct timespec ts;
+
+        ts.tv_sec = when / 1000000000;
+        ts.tv_nsec = when % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+}
+#else
+static uint64_t _midi_clock(void)
+{
+        uint64_t c = SDL_GetPerformanceCounter(), f = SDL_GetPerformanceFrequency();
+
+        return (c / f) * 1000000000 + (c % f) * 1000000000 / f;
+}
+
+static void _midi_sleep_until(uint64_t when)
+{
+        uint64_t now = _midi_clock();
+
+        if (when > now)
+                SLEEP_FUNC((when - now) / 1000);
+}
 #endif
-        if (from == 0) {
-                /* from == 0 means from immediate; everyone plays */
-                while (midi_port_foreach(NULL, &ptr)) {
-                        if ((ptr->io & MIDI_OUTPUT)) {
-                                if (ptr->send_now)
-                                        ptr->send_now(ptr, data, len, 0);
-                                else if (ptr->send_later)
-                                        ptr->send_later(ptr, data, len, 0);
-                        }
-                }
-        } else if (from == 1) {
-                /* from == 1 means from buffer-flush; only "now" plays */
-                while (midi_port_foreach(NULL, &ptr)) {
-                        if ((ptr->io & MIDI_OUTPUT)) {
-                                if (ptr->send_now)
-                                        ptr->send_now(ptr, data, len, 0);
-                        }
+
+struct midi_qrec {
+        uint64_t due;
+        uint32_t len; /* QREC_WRAP = nothing more until the start of the ring; 0 = drain */
+        uint32_t pad;
+        /* data follows, rounded up to a whole record */
+};
+#define QREC_WRAP       0xFFFFFFFF
+#define QREC_SIZE(len)  (sizeof(struct midi_qrec) \
+        + ((len) + sizeof(struct midi_qrec) - 1) / sizeof(struct midi_qrec) * sizeof(struct midi_qrec))
+
+struct midi_port_queue {
+        unsigned char *buf;
+        unsigned int size;
+        SDL_atomic_t head, tail; /* byte offsets; head is the writer's, tail the reader's */
+
+        SDL_Thread *thread;
+        SDL_sem *sem; /* posted for each record */
+        SDL_mutex *lock; /* held by the thread while it works through the ring */
+        volatile int finish;
+
+        uint64_t due; /* of the message being sent, for midi_send_due */
+        struct midi_queue_stats stats;
+};
+
+/* plenty for a keyboard-mashing song over a software synth; the cap stops a
+huge audio buffer from asking for something silly */
+#define QUEUE_BYTES_PER_MSEC    64
+#define QUEUE_MIN_SIZE          (16 * 1024)
+#define QUEUE_MAX_SIZE          (1024 * 1024)
+
+/* events sent later than this count as late */
+#define QUEUE_LATE_USEC         1000
+
+/* size for new rings; midi_queue_alloc changes it */
+static unsigned int qsize = QUEUE_MIN_SIZE;
+
+/* writer side, under the audio lock */
+static uint64_t qbase, qlast, qlatency;
+static unsigned int qrate;
+
+/* the player won't wait for midi_record_mutex, since it's called from the audio
+callback. nobody holds it for more than a moment unless ports are coming or
+going, so it tries this many times, then drops the message and counts it */
+#define QUEUE_LOCK_TRIES        64
+static unsigned long qbusy;
+
+static void _midi_queue_resize(struct midi_port_queue *q, unsigned int size)
+{
+        unsigned char *buf;
+
+        if (size != q->size) {
+                buf = malloc(size);
+                if (buf) {
+                        free(q->buf);
+                        q->buf = buf;
+                        q->size = size;
                 }
-        } else {
-                /* from == 2 means from buffer-write; only "later" plays */
-                while (midi_port_foreach(NULL, &ptr)) {
-                        if ((ptr->io & MIDI_OUTPUT)) {
-                                if (ptr->send_later)
-                                        ptr->send_later(ptr, data, len, delay);
-                                else if (ptr->send_now)
-                                        need_timer = 1;
-                        }
+        }
+        SDL_AtomicSet(&q->head, 0);
+        SDL_AtomicSet(&q->tail, 0);
+}
+
+void midi_queue_alloc(int my_audio_buffer_samples, UNUSED int channels, int samples_per_second)
+{
+        struct midi_port *ptr = NULL;
+        unsigned int size;
+
+        if (midi_record_mutex)
+                SDL_mutexP(midi_record_mutex);
+
+        qrate = samples_per_second;
+        qlatency = qrate ? (uint64_t) my_audio_buffer_samples * 1000000000 / qrate : 0;
+
+        size = qrate ? (uint64_t) my_audio_buffer_samples * 4000 / qrate * QUEUE_BYTES_PER_MSEC : 0;
+        size = CLAMP(size, QUEUE_MIN_SIZE, QUEUE_MAX_SIZE);
+        size -= size % sizeof(struct midi_qrec);
+        qsize = size;
+        qbase = qlast = 0;
+
+        /* nothing can be written while we hold midi_record_mutex, and the
+        port's lock keeps its thread out */
+        while (midi_port_foreach(NULL, &ptr)) {
+                if (ptr->queue) {
+                        SDL_mutexP(ptr->queue->lock);
+                        _midi_queue_resize(ptr->queue, size);
+                        SDL_mutexV(ptr->queue->lock);
                 }
         }
-        return need_timer;
+
+        if (midi_record_mutex)
+                SDL_mutexV(midi_record_mutex);
 }
 
-void midi_send_now(const unsigned char *seq, unsigned int len)
+void midi_queue_begin_buffer(void)
 {
-        if (!midi_record_mutex) return;
+        qbase = _midi_clock() + qlatency;
+}
 
-        SDL_mutexP(midi_record_mutex);
-        _midi_send_unlocked(seq, len, 0, 0);
-        SDL_mutexV(midi_record_mutex);
+void midi_queue_skip(unsigned int frames)
+{
+        if (qrate)
+                qbase += (uint64_t) frames * 1000000000 / qrate;
 }
 
-/*----------------------------------------------------------------------------------*/
+uint64_t midi_get_clock(void)
+{
+        return _midi_clock();
+}
 
-/* okay, our local queue is a little confusing,
- * but it works on the premise that the people who need it (oss)
- * also have systems with high-speed context switches.
- *
- * this sucks for freebsd/386 users as they've got a high-latency
- * audio system (oss) and slow context switches (x86). someone should
- * port alsa to freebsd. maybe someone else will solve this problem,
- * or maybe the computers that are slow enough to matter simply won't
- * be bothered.
- *
- * midi, that is, real midi, is 31250bps. that's 3125 bits per msec,
- * or 391 bytes per msec. i use a fixed buffer here because access needs
- * to be fast, and attempting to handle more will simply help people
- * using software/only setups.
- *
- * really, software-only midi, without kernel assistance sucks.
- */
-struct qent {
-        int used;
-        unsigned char b[391];
-};
-static struct qent *qq = NULL;
-static int midims, ms10s, qlen;
+uint64_t midi_queue_time(unsigned int pos)
+{
+        return qbase + (qrate ? (uint64_t) pos * 1000000000 / qrate : 0);
+}
+
+uint64_t midi_send_due(struct midi_port *p)
+{
+        return (p->queue && p->queue->due) ? p->queue->due : _midi_clock();
+}
 
-void midi_queue_alloc(int my_audio_buffer_samples, int channels, int samples_per_second)
+int midi_port_get_stats(struct midi_port *p, struct midi_queue_stats *st)
 {
-        if (qq) {
-                free(qq);
-                qq = NULL;
+        struct midi_port_queue *q = p->queue;
+
+        if (!q) {
+                memset(st, 0, sizeof(*st));
+                return 0;
         }
+        *st = q->stats;
+        st->dropped += qbusy;
+        st->capacity = q->size;
+        st->status_saved = p->status_saved;
+        st->queued = (SDL_AtomicGet(&q->head) - SDL_AtomicGet(&q->tail) + q->size) % (q->size ? q->size : 1);
+        return 1;
+}
 
-        /* how long is the audio buffer in 10 msec?
-         * well, (channels*samples_per_second)/80 is the number of bytes per msec
-         */
-        midims = channels * samples_per_second;
-        if ((midims % 80) != 0) midims += (80 - (midims % 80));
-        ms10s = midims / 80;
-        midims /= 8;
-
-        if (ms10s > my_audio_buffer_samples) {
-                /* okay, there's not even 10msec of audio data; midi queueing will be impossible */
-                qlen = 0;
-                return;
+/* would losing this leave a note playing? */
+static int _midi_stops_sound(const unsigned char *data, unsigned int len)
+{
+        if (len < 3)
+                return 0;
+        switch (data[0] & 0xF0) {
+        case 0x80:
+                return 1;
+        case 0x90:
+                return data[2] == 0;
+        case 0xB0:
+                return (data[1] == 64 && data[2] < 64) || data[1] == 120 || data[1] == 123;
+        default:
+                return 0;
         }
+}
+
+/* writer; returns zero if there was no room */
+static int _midi_queue_push(struct midi_port_queue *q, const unsigned char *data, unsigned int len, uint64_t due)
+{
+        struct midi_qrec *rec;
+        unsigned int head, tail, used, need = QREC_SIZE(len), skip = 0, room;
+
+        if (!q->size)
+                return 0;
+
+        head = SDL_AtomicGet(&q->head);
+        tail = SDL_AtomicGet(&q->tail);
+        used = (head - tail + q->size) % q->size;
+
+        if (head + need > q->size)
+                skip = q->size - head; /* this much goes to a wrap marker */
+        /* always leave a record's worth free, so that full and empty look different */
+        room = q->size - sizeof(struct midi_qrec);
+        if (!_midi_stops_sound(data, len))
+                room -= q->size / 8;
+        if (used + skip + need > room)
+                return 0;
 
-        if ((my_audio_buffer_samples % ms10s) != 0) {
-                my_audio_buffer_samples += (ms10s - (my_audio_buffer_samples % ms10s));
+        if (skip) {
+                rec = (struct midi_qrec *) (q->buf + head);
+                rec->len = QREC_WRAP;
+                head = 0;
         }
-        qlen = my_audio_buffer_samples / ms10s;
-        /* now qlen is the number of msec in digital output buffer */
+        rec = (struct midi_qrec *) (q->buf + head);
+        rec->due = due;
+        rec->len = len;
+        if (len)
+                memcpy(rec + 1, data, len);
+        SDL_AtomicSet(&q->head, (head + need) % q->size);
+
+        used += skip + need;
+        q->stats.peak = MAX(q->stats.peak, used);
+        SDL_SemPost(q->sem);
+        return 1;
+}
 
-        qq = malloc(qlen * sizeof(struct qent));
-        if (!qq) {
-                /* memory allocation failed. something else is bound to die real soon now */
-                return;
+/* reader; returns NULL if the queue is empty. the record stays put until _midi_queue_pop */
+static struct midi_qrec *_midi_queue_peek(struct midi_port_queue *q)
+{
+        struct midi_qrec *rec;
+        unsigned int tail = SDL_AtomicGet(&q->tail);
+
+        for (;;) {
+                if (!q->size || tail == (unsigned int) SDL_AtomicGet(&q->head))
+                        return NULL;
+                rec = (struct midi_qrec *) (q->buf + tail);
+                if (rec->len != QREC_WRAP)
+                        return rec;
+                tail = 0;
+                SDL_AtomicSet(&q->tail, 0);
         }
-        /* zero it out */
-        memset(qq, 0, sizeof(struct qent)*qlen);
 }
 
-static SDL_Thread *midi_queue_thread = NULL;
+static void _midi_queue_pop(struct midi_port_queue *q, struct midi_qrec *rec)
+{
+        unsigned int tail = (unsigned char *) rec - q->buf;
+
+        SDL_AtomicSet(&q->tail, (tail + QREC_SIZE(rec->len)) % q->size);
+}
 
-static int _midi_queue_run(UNUSED void *xtop)
+static int _midi_port_run(void *xport)
 {
-        int i;
+        struct midi_port *p = xport;
+        struct midi_port_queue *q = p->queue;
+        struct midi_qrec *rec;
+        uint64_t now;
+        unsigned int late;
 
 #ifdef WIN32
         __win32_pick_usleep();
         SetPriorityClass(GetCurrentProcess(),HIGH_PRIORITY_CLASS);
         SetThreadPriority(GetCurrentThread(),THREAD_PRIORITY_TIME_CRITICAL);
-        /*SetThreadPriority(GetCurrentThread(),THREAD_PRIORITY_HIGHEST);*/
 #endif
 
-        SDL_mutexP(midi_play_mutex);
         for (;;) {
-                SDL_CondWait(midi_play_cond, midi_play_mutex);
+                SDL_SemWait(q->sem);
+                if (q->finish)
+                        break;
 
-                for (i = 0; i < qlen; i++) {
-                        SDL_mutexP(midi_record_mutex);
-                        _midi_send_unlocked(qq[i].b, qq[i].used, 0, 1);
-                        SDL_mutexV(midi_record_mutex);
-                        SLEEP_FUNC(10000); /* 10msec */
-                        qq[i].used = 0;
+                SDL_mutexP(q->lock);
+                while (!q->finish && (rec = _midi_queue_peek(q)) != NULL) {
+                        if (!rec->len) {
+                                if (p->drain)
+                                        p->drain(p);
+                                _midi_queue_pop(q, rec);
+                                continue;
+                        }
+
+                        now = _midi_clock();
+                        if (p->send_later) {
+                                q->due = rec->due;
+                                if (p->io & MIDI_OUTPUT)
+                                        p->send_later(p, (unsigned char *) (rec + 1), rec->len,
+                                                (rec->due > now) ? (rec->due - now) / 1000000 : 0);
+                                q->due = 0;
+                        } else {
+                                /* events only ever get later, so nothing can turn up
+                                that needs to go out before this one */
+                                if (rec->due > now) {
+                                        _midi_sleep_until(rec->due);
+                                        now = _midi_clock();
+                                }
+                                if (p->send_now && (p->io & MIDI_OUTPUT))
+                                        p->send_now(p, (unsigned char *) (rec + 1), rec->len, 0);
+                        }
+
+                        late = (now > rec->due) ? MIN((now - rec->due) / 1000, UINT_MAX) : 0;
+                        q->stats.sent++;
+                        q->stats.jitter_total_usec += late;
+                        q->stats.jitter_max_usec = MAX(q->stats.jitter_max_usec, late);
+                        if (late > QUEUE_LATE_USEC)
+                                q->stats.late++;
+
+                        _midi_queue_pop(q, rec);
                 }
+                SDL_mutexV(q->lock);
         }
 
-        return 0; /* never happens */
+        return 0;
 }
 
-int midi_need_flush(void)
+/* called before the port is in the table; if this fails, the port is written to directly */
+static void _midi_port_queue_start(struct midi_port *p)
 {
-        struct midi_port *ptr;
-        int need_explicit_flush = 0;
-        int i;
+        struct midi_port_queue *q;
 
-        if (!midi_record_mutex || !midi_play_mutex) return 0;
+        p->queue = NULL;
+        if (!(p->iocap & MIDI_OUTPUT) || !(p->send_now || p->send_later))
+                return;
 
-        ptr = NULL;
+        q = calloc(1, sizeof(struct midi_port_queue));
+        if (!q)
+                return;
+        q->sem = SDL_CreateSemaphore(0);
+        q->lock = SDL_CreateMutex();
+        _midi_queue_resize(q, qsize);
+        if (q->sem && q->lock && q->buf) {
+                p->queue = q;
+                q->thread = SDL_CreateThread(_midi_port_run, "midi-port", p);
+                if (q->thread)
+                        return;
+                p->queue = NULL;
+                log_appendf(4, "MIDI: couldn't start a thread for %s", p->name);
+        }
+        if (q->sem) SDL_DestroySemaphore(q->sem);
+        if (q->lock) SDL_DestroyMutex(q->lock);
+        free(q->buf);
+        free(q);
+}
 
-        while (midi_port_foreach(NULL, &ptr)) {
-                if ((ptr->io & MIDI_OUTPUT)) {
-                        if (!ptr->drain && ptr->send_now)
-                                need_explicit_flush = 1;
+/* only once the port is out of the table (or was never in it), so nobody's
+writing; this waits for the port's thread, so don't hold midi_record_mutex */
+static void _midi_port_queue_stop(struct midi_port *p)
+{
+        struct midi_port_queue *q = p->queue;
+
+        if (!q)
+                return;
+        q->finish = 1;
+        SDL_SemPost(q->sem);
+        SDL_WaitThread(q->thread, NULL);
+        p->queue = NULL;
+
+        SDL_DestroySemaphore(q->sem);
+        SDL_DestroyMutex(q->lock);
+        free(q->buf);
+        free(q);
+}
+
+/* under midi_record_mutex. due is when it should be heard (zero means now);
+delay is the same thing in milliseconds from now, for ports without a queue */
+static void _midi_send_unlocked(const unsigned char *data, unsigned int len, uint64_t due, unsigned int delay)
+{
+        struct midi_port *ptr = NULL;
+#if 0
+        unsigned int i;
+printf("MIDI: ");
+        for (i = 0; i < len; i++) {
+                printf("%02x ", data[i]);
+        }
+puts("");
+fflush(stdout);
+#endif
+        while (_midi_port_foreach_recording(&ptr)) {
+                if (!(ptr->io & MIDI_OUTPUT))
+                        continue;
+                if (ptr->queue) {
+                        if (!_midi_queue_push(ptr->queue, data, len, due))
+                                ptr->queue->stats.dropped++;
+                } else if (ptr->send_later) {
+                        ptr->send_later(ptr, data, len, delay);
+                } else if (ptr->send_now) {
+                        ptr->send_now(ptr, data, len, 0);
                 }
         }
-        if (!need_explicit_flush) return 0;
+}
 
-        for (i = 0; i < qlen; i++) {
-                if (qq[i].used) return 1;
-        }
+void midi_send_now(const unsigned char *seq, unsigned int len)
+{
+        if (!midi_record_mutex) return;
 
-        return 0;
+        SDL_mutexP(midi_record_mutex);
+        _midi_send_unlocked(seq, len, _midi_clock(), 0);
+        SDL_mutexV(midi_record_mutex);
 }
 
-void midi_send_flush(void)
+int midi_need_flush(void)
 {
         struct midi_port *ptr = NULL;
-        int need_explicit_flush = 0;
+        int need_flush = 0;
 
-        if (!midi_record_mutex || !midi_play_mutex) return;
+        if (!midi_record_mutex) return 0;
 
-        while (midi_port_foreach(NULL, &ptr)) {
-                if ((ptr->io & MIDI_OUTPUT)) {
-                        if (ptr->drain) ptr->drain(ptr);
-                        else if (ptr->send_now) need_explicit_flush=1;
-                }
+        /* the audio thread asks; if the ports are busy, say yes, which only costs an update */
+        if (SDL_TryLockMutex(midi_record_mutex) != 0)
+                return 1;
+        while (_midi_port_foreach_recording(&ptr)) {
+                if ((ptr->io & MIDI_OUTPUT) && ptr->queue
+                    && SDL_AtomicGet(&ptr->queue->head) != SDL_AtomicGet(&ptr->queue->tail))
+                        need_flush = 1;
         }
+        SDL_mutexV(midi_record_mutex);
+        return need_flush;
+}
 
-        /* no need for midi sync huzzah; driver does it for us... */
-        if (!need_explicit_flush) return;
+void midi_send_flush(void)
+{
+        struct midi_port *ptr = NULL;
+        int tries;
 
-        if (!midi_queue_thread) {
-                midi_queue_thread = SDL_CreateThread(_midi_queue_run,
-                                                     "midi-queue", NULL);
-                if (midi_queue_thread) {
-                        log_appendf(3, "Started MIDI queue thread");
-                } else {
-                        log_appendf(2, "ACK: Couldn't start MIDI thread; things are likely going to go boom!");
+        if (!midi_record_mutex) return;
+
+        /* the ports' threads send everything as soon as it's due anyway; this
+        just tells the ones that hold on to things (sequencers, IP batches)
+        that the player's done with this buffer. The audio thread gets here
+        (when the song stops, too), so if the ports are busy, skip it: the
+        next flush covers this one. */
+        for (tries = 0; SDL_TryLockMutex(midi_record_mutex) != 0; tries++) {
+                if (tries == QUEUE_LOCK_TRIES) {
+                        qbusy++;
+                        return;
                 }
         }
-
-        SDL_mutexP(midi_play_mutex);
-        SDL_CondSignal(midi_play_cond);
-        SDL_mutexV(midi_play_mutex);
+        while (_midi_port_foreach_recording(&ptr)) {
+                if (!(ptr->io & MIDI_OUTPUT) || !ptr->drain)
+                        continue;
+                if (!ptr->queue)
+                        ptr->drain(ptr);
+                else if (!_midi_queue_push(ptr->queue, NULL, 0, 0))
+                        ptr->queue->stats.dropped++;
+        }
+        SDL_mutexV(midi_record_mutex);
 }
 
 void midi_send_buffer(const unsigned char *data, unsigned int len, unsigned int pos)
 {
+        uint64_t due, now;
+        int tries;
+
         if (!midi_record_mutex) return;
 
-        SDL_mutexP(midi_record_mutex);
+        for (tries = 0; SDL_TryLockMutex(midi_record_mutex) != 0; tries++) {
+                if (tries == QUEUE_LOCK_TRIES) {
+                        qbusy++;
+                        return;
+                }
+        }
 
         /* just for fun... */
         if (status.current_page == PAGE_MIDI) {
@@ -767,21 +1082,16 @@ void midi_send_buffer(const unsigned char *data, unsigned int len, unsigned int
                 status.flags |= NEED_UPDATE;
         }
 
-        /* pos is still in miliseconds */
-        if (midims != 0 && _midi_send_unlocked(data, len, pos/midims, 2)) {
-                /* grr, we need a timer */
-
-                /* calculate pos in buffer */
-                pos /= ms10s;
-                assert(((unsigned)pos) < ((unsigned)qlen));
+        /* pos is the frame offset into the buffer being mixed */
+        now = _midi_clock();
+        due = qbase + (qrate ? (uint64_t) pos * 1000000000 / qrate : 0);
+        if (due < now)
+                due = now;
+        if (due < qlast)
+                due = qlast; /* keep the queue in order */
+        qlast = due;
 
-                if ((len + qq[pos].used) > sizeof(qq[pos].b)) {
-                        len = sizeof(qq[pos].b) - qq[pos].used;
-                        /* okay, we're going to lose data here */
-                }
-                memcpy(qq[pos].b+qq[pos].used, data, len);
-                qq[pos].used += len;
-        }
+        _midi_send_unlocked(data, len, due, (due - now) / 1000000);
 
         SDL_mutexV(midi_record_mutex);
 }
@@ -790,31 +1100,101 @@ void midi_send_buffer(const unsigned char *data, unsigned int len, unsigned int
 
 void midi_port_unregister(int num)
 {
-        struct midi_port *q;
+        struct midi_port *q = NULL;
         int i;
 
         if (!midi_port_mutex) return;
 
+        /* take it out of the table, which keeps the player from writing to its
+        queue any more; then it can be shut down without holding anyone up */
+        SDL_mutexP(midi_record_mutex);
         SDL_mutexP(midi_port_mutex);
         for (i = 0; i < port_alloc; i++) {
                 if (port_top[i] && port_top[i]->num == num) {
                         q = port_top[i];
-                        if (q->disable) q->disable(q);
-                        if (q->free_userdata) free(q->userdata);
-                        free(q);
-
                         port_top[i] = NULL;
                         port_count--;
                         break;
                 }
         }
         SDL_mutexV(midi_port_mutex);
+        SDL_mutexV(midi_record_mutex);
+
+        if (!q)
+                return;
+        _midi_port_queue_stop(q);
+        if (q->disable) q->disable(q);
+        if (q->free_userdata) free(q->userdata);
+        free(q);
 }
 
+/* Live input. The main loop keeps the target up to date, since what a note
+plays depends on the page: the pattern editor plays the MIDI channel's sample
+or instrument on the current channel (unless the note is going to start
+playback first), and the sample and instrument lists play the current one. */
+void midi_live_update(void)
+{
+        int enable = !(midi_flags & MIDI_DISABLE_RECORD);
+        int samp = KEYJAZZ_NOINST, ins = KEYJAZZ_NOINST, chan = KEYJAZZ_CHAN_CURRENT;
+
+        switch (status.current_page) {
+        case PAGE_PATTERN_EDITOR:
+                enable = enable && pattern_editor_midi_live();
+                samp = ins = KEYJAZZ_INST_MIDI;
+                chan = get_current_channel();
+                break;
+        case PAGE_SAMPLE_LIST:
+                samp = sample_get_current();
+                break;
+        case PAGE_INSTRUMENT_LIST_GENERAL:
+        case PAGE_INSTRUMENT_LIST_VOLUME:
+        case PAGE_INSTRUMENT_LIST_PANNING:
+        case PAGE_INSTRUMENT_LIST_PITCH:
+                ins = instrument_get_current();
+                break;
+        default:
+                enable = 0;
+                break;
+        }
+        /* multichannel mode moves on to the next channel after each note,
+        and that means telling the user about it */
+        if (chan == KEYJAZZ_CHAN_CURRENT && song_is_multichannel_mode())
+                enable = 0;
+        song_set_live_target(enable, samp, ins, chan);
+}
+
+/* maps the note the same way midi_engine_handle_event does; returns nonzero
+if the mixer took it */
+static int _midi_live_note(int on, int channel, int note, int velocity, uint64_t when)
+{
+        int r;
+
+        if (midi_flags & MIDI_DISABLE_RECORD)
+                return 0;
+        if (!on && !(midi_flags & MIDI_RECORD_NOTEOFF))
+                return 0;
+        if (!(midi_flags & MIDI_RECORD_VELOCITY))
+                velocity = 128;
+        velocity = (velocity * midi_amplification) / 100;
+
+        SDL_mutexP(midi_record_mutex);
+        r = song_live_note(on, (note + 1 + midi_c5note) - 60, velocity / 2, channel + 1, when);
+        SDL_mutexV(midi_record_mutex);
+        return r;
+}
+
+static void _midi_event_note(enum midi_note mnstatus, int channel, int note, int velocity, int live,
+        uint64_t when);
+
 void midi_received_cb(struct midi_port *src, unsigned char *data, unsigned int len)
+{
+        midi_received_cb_at(src, data, len, _midi_clock());
+}
+
+void midi_received_cb_at(struct midi_port *src, unsigned char *data, unsigned int len, uint64_t when)
 {
         unsigned char d4[4];
-        int cmd;
+        int cmd, live;
 
         if (!len) return;
         if (len < 4) {
@@ -845,9 +1225,11 @@ void midi_received_cb(struct midi_port *src, unsigned char *data, unsigned int l
 
         cmd = ((*data) & 0xF0) >> 4;
         if (cmd == 0x8 || (cmd == 0x9 && data[2] == 0)) {
-                midi_event_note(MIDI_NOTEOFF, data[0] & 15, data[1], 0);
+                live = _midi_live_note(0, data[0] & 15, data[1], 0, when);
+                _midi_event_note(MIDI_NOTEOFF, data[0] & 15, data[1], 0, live, when);
         } else if (cmd == 0x9) {
-                midi_event_note(MIDI_NOTEON, data[0] & 15, data[1], data[2]);
+                live = _midi_live_note(1, data[0] & 15, data[1], data[2], when);
+                _midi_event_note(MIDI_NOTEON, data[0] & 15, data[1], data[2], live, when);
         } else if (cmd == 0xA) {
                 midi_event_note(MIDI_KEYPRESS, data[0] & 15, data[1], data[2]);
         } else if (cmd == 0xB) {
@@ -877,23 +1259,40 @@ void midi_received_cb(struct midi_port *src, unsigned char *data, unsigned int l
         }
 }
 
-void midi_event_note(enum midi_note mnstatus, int channel, int note, int velocity)
+/* note events also say when they were played (midi_get_clock time, zero if
+nobody knows), so the pattern editor can record them where they were heard */
+struct midi_note_event {
+        int st[5];
+        uint64_t when;
+};
+
+static void _midi_event_note(enum midi_note mnstatus, int channel, int note, int velocity, int live,
+        uint64_t when)
 {
+        struct midi_note_event *ne;
         int *st;
         SDL_Event e;
 
-        st = mem_alloc(sizeof(int)*4);
+        ne = mem_alloc(sizeof(struct midi_note_event));
+        st = ne->st;
         st[0] = mnstatus;
         st[1] = channel;
         st[2] = note;
         st[3] = velocity;
+        st[4] = live;
+        ne->when = when;
         e.user.type = SCHISM_EVENT_MIDI;
         e.user.code = SCHISM_EVENT_MIDI_NOTE;
-        e.user.data1 = st;
+        e.user.data1 = ne;
         e.user.data2 = NULL;
         SDL_PushEvent(&e);
 }
 
+void midi_event_note(enum midi_note mnstatus, int channel, int note, int velocity)
+{
+        _midi_event_note(mnstatus, channel, note, velocity, 0, 0);
+}
+
 void midi_event_controller(int channel, int param, int value)
 {
         int *st;
@@ -1036,6 +1435,8 @@ int midi_engine_handle_event(void *ev)
                 else
                         kk.midi_volume = 128;
                 kk.midi_volume = (kk.midi_volume * midi_amplification) / 100;
+                kk.midi_live = st[4];
+                kk.midi_time = ((struct midi_note_event *) e->user.data1)->when;
                 handle_key(&kk);
                 break;
         case SCHISM_EVENT_MIDI_PITCHBEND:
@@ -47,6 +47,45 @@
 #define MIDI_IP_BASE    21928
 #define MAX_DGRAM_SIZE  1280
 
+/* Batched transport (midi_ip_batch). Instead of a datagram per message, each
+port collects what the player sends during an audio buffer and goes out as one
+datagram when the buffer's done (or after BATCH_HOLD_USEC, for anything sent
+while the song isn't playing):
+
+        0       FD 'S' 01 count         FD is undefined MIDI, so this can't be
+                                        mistaken for a plain packet
+        4       sender id               random; so we can ignore our own
+        8       sequence number         per port, for counting losses
+        12      send time               sender's clock, nanoseconds
+        20      events: offset (usec from the send time, signed), length (16 bits), data
+
+all big-endian. The receiver keeps the offsets, so the events come out as far
+apart as they went in, no matter how the datagram was delayed. Plain packets
+are still understood on input. */
+#define BATCH_HEADER_SIZE       20
+#define BATCH_EVENT_SIZE        6
+#define BATCH_MAX_EVENTS        255
+#define BATCH_DGRAMS            4       /* per port per buffer; more than this is an overflow */
+#define BATCH_HOLD_USEC         5000
+#define RECV_DGRAMS             16
+
+struct ip_batch {
+        unsigned char dgram[BATCH_DGRAMS][MAX_DGRAM_SIZE];
+        unsigned int len[BATCH_DGRAMS];
+        unsigned int count; /* datagrams in use; the last is still being filled */
+        uint64_t started; /* when the first event went in */
+};
+
+struct ip_port {
+        /* writers fill one batch while the thread sends the other */
+        struct ip_batch batch[2];
+        int fill;
+        uint32_t out_seq;
+
+        /* input; only the thread touches these */
+        uint32_t in_sender, in_seq;
+};
+
 #ifndef WIN32
 static int wakeup[2];
 #endif
@@ -57,6 +96,13 @@ static int *port_fd = NULL;
 static int *state = NULL;
 static SDL_mutex *blocker = NULL;
 
+/* batched transport; ports and stats are under batch_mutex */
+static struct ip_port *ports = NULL;
+static int ports_alloc = 0;
+static uint32_t sender_id;
+static SDL_mutex *batch_mutex = NULL;
+static struct ip_midi_stats ipstats;
+
 static void do_wake_main(void)
 {
         /* send at end */
@@ -67,16 +113,25 @@ static void do_wake_main(void)
         e.user.data2 = NULL;
         SDL_PushEvent(&e);
 }
-static void do_wake_midi(void)
+static void do_wake_midi_with(const char *why)
 {
 #ifdef WIN32
         /* anyone want to suggest how this is done? XXX */
 #else
-        if (write(wakeup[1], "\x1", 1) == 1) {
+        if (write(wakeup[1], why, 1) == 1) {
                 /* fortify is stupid */
         }
 #endif
 }
+static void do_wake_midi(void)
+{
+        do_wake_midi_with("\x1");
+}
+/* the player's done with a buffer: send the batches now */
+static void do_wake_flush(void)
+{
+        do_wake_midi_with("\x2");
+}
 
 static int _get_fd(int pb, int isout)
 {
@@ -93,8 +148,10 @@ static int _get_fd(int pb, int isout)
 
         opt = 1; setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(int));
 
-        /* don't loop back what we generate */
-        opt = !isout;
+        /* don't loop back what we generate -- unless it's batched, which is
+        tagged with who sent it, so that instances on the same machine can
+        talk to each other */
+        opt = !isout || midi_ip_batch;
         if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, (void*)&opt, sizeof(opt)) < 0) {
 #ifdef WIN32
                 closesocket(fd);
@@ -187,9 +244,283 @@ void ip_midi_setports(int n)
         SDL_mutexV(blocker);
         do_wake_midi();
 }
-static void _readin(struct midi_provider *p, int en, int fd)
+/* --------------------------------------------------------------------- */
+/* batching */
+
+static void _put32(unsigned char *p, uint32_t v)
+{
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+}
+
+static uint32_t _get32(const unsigned char *p)
+{
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* under batch_mutex; returns nonzero if this is the first event in the batch */
+static int _batch_add(struct ip_batch *b, const unsigned char *data, unsigned int len, uint64_t due)
+{
+        unsigned char *d;
+        unsigned int *dlen;
+        int first = !b->count;
+
+        if (BATCH_HEADER_SIZE + BATCH_EVENT_SIZE + len > MAX_DGRAM_SIZE) {
+                ipstats.overflows++;
+                return 0;
+        }
+        if (first)
+                b->started = midi_get_clock();
+        if (!b->count || b->len[b->count - 1] + BATCH_EVENT_SIZE + len > MAX_DGRAM_SIZE
+            || b->dgram[b->count - 1][3] == BATCH_MAX_EVENTS) {
+                if (b->count == BATCH_DGRAMS) {
+                        ipstats.overflows++;
+                        return first;
+                }
+                d = b->dgram[b->count];
+                d[0] = 0xFD;
+                d[1] = 'S';
+                d[2] = 1;
+                d[3] = 0;
+                b->len[b->count++] = BATCH_HEADER_SIZE;
+        }
+        d = b->dgram[b->count - 1];
+        dlen = b->len + b->count - 1;
+
+        /* the offset is filled in at send time; for now it's the due time
+        relative to when the batch started, which fits as long as nothing's
+        scheduled more than half an hour out */
+        _put32(d + *dlen, (uint32_t) ((due > b->started ? due - b->started : 0) / 1000));
+        d[*dlen + 4] = len >> 8;
+        d[*dlen + 5] = len;
+        memcpy(d + *dlen + BATCH_EVENT_SIZE, data, len);
+        *dlen += BATCH_EVENT_SIZE + len;
+        d[3]++;
+        return first;
+}
+
+#define FLUSH_PORTS     8
+
+static struct sockaddr_in flush_to[FLUSH_PORTS * BATCH_DGRAMS];
+static unsigned char *flush_data[FLUSH_PORTS * BATCH_DGRAMS];
+static unsigned int flush_len[FLUSH_PORTS * BATCH_DGRAMS];
+
+/* returns how many went out */
+static int _batch_send(int nmsg)
+{
+#ifdef HAVE_SENDMMSG
+        static struct mmsghdr msgs[FLUSH_PORTS * BATCH_DGRAMS];
+        static struct iovec iov[FLUSH_PORTS * BATCH_DGRAMS];
+        int r, sent = 0, i;
+
+        memset(msgs, 0, nmsg * sizeof(msgs[0]));
+        for (i = 0; i < nmsg; i++) {
+                iov[i].iov_base = flush_data[i];
+                iov[i].iov_len = flush_len[i];
+                msgs[i].msg_hdr.msg_name = flush_to + i;
+                msgs[i].msg_hdr.msg_namelen = sizeof(flush_to[i]);
+                msgs[i].msg_hdr.msg_iov = iov + i;
+                msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        while (sent < nmsg) {
+                r = sendmmsg(out_fd, msgs + sent, nmsg - sent, 0);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        break;
+                }
+                sent += r;
+        }
+        return sent;
+#else
+        int sent = 0, i;
+
+        for (i = 0; i < nmsg; i++) {
+                if (sendto(out_fd, (void *) flush_data[i], flush_len[i], 0,
+                           (struct sockaddr *) (flush_to + i), sizeof(flush_to[i])) >= 0)
+                        sent++;
+        }
+        return sent;
+#endif
+}
+
+/* sends whatever's waiting; only the thread calls this. with 'force' clear,
+batches that haven't been held for long enough yet are left alone. returns
+how long until the oldest one left needs to go, in usec, or -1 if none */
+static long _batch_flush(int force)
+{
+        struct ip_batch *sending[FLUSH_PORTS], *b;
+        unsigned char *ipcopy, *d;
+        uint64_t now;
+        uint32_t elapsed;
+        long wait = -1, left;
+        unsigned int pos;
+        int i = 0, j, k, nb, nmsg, nsent;
+
+        while (i < ports_alloc) {
+                now = midi_get_clock();
+                nb = nmsg = 0;
+
+                SDL_mutexP(batch_mutex);
+                for (; i < ports_alloc && nb < FLUSH_PORTS; i++) {
+                        b = ports[i].batch + ports[i].fill;
+                        if (!b->count)
+                                continue;
+                        if (!force && now - b->started < (uint64_t) BATCH_HOLD_USEC * 1000) {
+                                left = BATCH_HOLD_USEC - (long) ((now - b->started) / 1000);
+                                if (wait < 0 || left < wait)
+                                        wait = left;
+                                continue;
+                        }
+                        ports[i].fill ^= 1;
+                        sending[nb++] = b;
+
+                        elapsed = (now - b->started) / 1000;
+                        for (j = 0; j < (int) b->count; j++, nmsg++) {
+                                d = b->dgram[j];
+                                _put32(d + 4, sender_id);
+                                _put32(d + 8, ports[i].out_seq++);
+                                _put32(d + 12, (uint32_t) (now >> 32));
+                                _put32(d + 16, (uint32_t) now);
+                                /* make the offsets relative to the send time */
+                                for (pos = BATCH_HEADER_SIZE, k = 0; k < d[3]; k++) {
+                                        _put32(d + pos, _get32(d + pos) - elapsed);
+                                        pos += BATCH_EVENT_SIZE + ((d[pos + 4] << 8) | d[pos + 5]);
+                                }
+                                ipstats.events_sent += d[3];
+
+                                memset(flush_to + nmsg, 0, sizeof(flush_to[nmsg]));
+                                flush_to[nmsg].sin_family = AF_INET;
+                                ipcopy = (unsigned char *)&flush_to[nmsg].sin_addr.s_addr;
+                                ipcopy[0] = 225; ipcopy[1] = ipcopy[2] = 0; ipcopy[3] = 37;
+                                flush_to[nmsg].sin_port = htons(MIDI_IP_BASE+i);
+                                flush_data[nmsg] = d;
+                                flush_len[nmsg] = b->len[j];
+                        }
+                }
+                SDL_mutexV(batch_mutex);
+
+                if (!nb)
+                        break;
+
+                /* the writers have moved on to the other batch, so these can
+                go out without holding anyone up */
+                nsent = _batch_send(nmsg);
+
+                SDL_mutexP(batch_mutex);
+                ipstats.packets_sent += nsent;
+                ipstats.send_errors += nmsg - nsent;
+                for (j = 0; j < nb; j++)
+                        sending[j]->count = 0;
+                SDL_mutexV(batch_mutex);
+        }
+
+        return wait;
+}
+
+static void _batch_receive(struct midi_port *src, int en, const unsigned char *d, unsigned int len)
+{
+        struct ip_port *ip = ports + en;
+        uint64_t now = midi_get_clock(), sent;
+        uint32_t sender, seq;
+        int32_t off, gap;
+        int64_t transit;
+        unsigned int pos, elen, count, k;
+
+        if (len < BATCH_HEADER_SIZE || d[2] != 1)
+                return; /* not a version we know */
+        sender = _get32(d + 4);
+        if (sender == sender_id)
+                return; /* our own, looped back */
+        seq = _get32(d + 8);
+        sent = ((uint64_t) _get32(d + 12) << 32) | _get32(d + 16);
+
+        SDL_mutexP(batch_mutex);
+        ipstats.packets_received++;
+        gap = (int32_t) (seq - ip->in_seq);
+        if (sender != ip->in_sender) {
+                /* someone new (or someone restarted) */
+                ip->in_sender = sender;
+                ip->in_seq = seq + 1;
+        } else if (gap >= 0) {
+                ipstats.lost += gap;
+                ip->in_seq = seq + 1;
+        } else {
+                ipstats.reordered++;
+        }
+
+        /* only means something if both ends share a clock (i.e. loopback);
+        otherwise it's the clock difference plus the transit time, and it's the
+        spread that counts */
+        transit = (int64_t) (now - sent) / 1000;
+        if (ipstats.packets_received == 1 || transit < ipstats.transit_min_usec)
+                ipstats.transit_min_usec = transit;
+        if (ipstats.packets_received == 1 || transit > ipstats.transit_max_usec)
+                ipstats.transit_max_usec = transit;
+        ipstats.transit_total_usec += transit;
+        SDL_mutexV(batch_mutex);
+
+        count = d[3];
+        for (pos = BATCH_HEADER_SIZE, k = 0; k < count; k++) {
+                if (pos + BATCH_EVENT_SIZE > len)
+                        break;
+                off = (int32_t) _get32(d + pos);
+                elen = (d[pos + 4] << 8) | d[pos + 5];
+                pos += BATCH_EVENT_SIZE;
+                if (pos + elen > len)
+                        break;
+                midi_received_cb_at(src, (unsigned char *) d + pos, elen,
+                                    now + (off > 0 ? (uint64_t) off * 1000 : 0));
+                pos += elen;
+                ipstats.events_received++;
+        }
+}
+
+/* --------------------------------------------------------------------- */
+
+static void _readone(struct midi_provider *p, int en, unsigned char *buffer, unsigned int len)
 {
         struct midi_port *ptr, *src;
+
+        ptr = src = NULL;
+        while (midi_port_foreach(p, &ptr)) {
+                int n = INT_SHAPED_PTR(ptr->userdata);
+                if (n == en) src = ptr;
+        }
+        if (len >= 4 && buffer[0] == 0xFD && buffer[1] == 'S') {
+                if (en < ports_alloc)
+                        _batch_receive(src, en, buffer, len);
+        } else {
+                midi_received_cb(src, buffer, len);
+        }
+}
+
+static void _readin(struct midi_provider *p, int en, int fd)
+{
+#ifdef HAVE_RECVMMSG
+        static unsigned char buffer[RECV_DGRAMS][MAX_DGRAM_SIZE];
+        static struct mmsghdr msgs[RECV_DGRAMS];
+        static struct iovec iov[RECV_DGRAMS];
+        int i, r;
+
+        /* everything that's already here, in as few calls as possible */
+        do {
+                memset(msgs, 0, sizeof(msgs));
+                for (i = 0; i < RECV_DGRAMS; i++) {
+                        iov[i].iov_base = buffer[i];
+                        iov[i].iov_len = MAX_DGRAM_SIZE;
+                        msgs[i].msg_hdr.msg_iov = iov + i;
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+                r = recvmmsg(fd, msgs, RECV_DGRAMS, MSG_DONTWAIT, NULL);
+                for (i = 0; i < r; i++) {
+                        if (msgs[i].msg_len > 0)
+                                _readone(p, en, buffer[i], msgs[i].msg_len);
+                }
+        } while (r == RECV_DGRAMS);
+#else
         static unsigned char buffer[65536];
         static struct sockaddr_in asin;
         unsigned slen = sizeof(asin);
@@ -197,25 +528,21 @@ static void _readin(struct midi_provider *p, int en, int fd)
 
         r = recvfrom(fd, buffer, sizeof(buffer), 0,
                 (struct sockaddr *)&asin, &slen);
-        if (r > 0) {
-                ptr = src = NULL;
-                while (midi_port_foreach(p, &ptr)) {
-                        int n = INT_SHAPED_PTR(ptr->userdata);
-                        if (n == en) src = ptr;
-                }
-                midi_received_cb(src, buffer, r);
-        }
+        if (r > 0)
+                _readone(p, en, buffer, r);
+#endif
 }
 static int _ip_thread(struct midi_provider *p)
 {
-#ifdef WIN32
         struct timeval tv;
-#else
+#ifndef WIN32
         static unsigned char buffer[4096];
 #endif
+        struct ip_port *newports;
         fd_set rfds;
         int *tmp2, *tmp;
-        int i, m;
+        int i, m, force = 0;
+        long wait = -1;
 
         for (;;) {
                 if (p->finish) {
@@ -247,6 +574,18 @@ static int _ip_thread(struct midi_provider *p)
                                 }
                                 real_num_ports = num_ports = m;
                         }
+                        if (m > ports_alloc) {
+                                newports = calloc(m, sizeof(struct ip_port));
+                                if (newports) {
+                                        SDL_mutexP(batch_mutex);
+                                        if (ports)
+                                                memcpy(newports, ports, ports_alloc * sizeof(struct ip_port));
+                                        free(ports);
+                                        ports = newports;
+                                        ports_alloc = m;
+                                        SDL_mutexV(batch_mutex);
+                                }
+                        }
                         SDL_mutexV(blocker);
                         do_wake_main();
 
@@ -280,18 +619,21 @@ static int _ip_thread(struct midi_provider *p)
                 }
 
 #ifdef WIN32
-                tv.tv_sec = 1;
-                tv.tv_usec = 0;
+                /* no way to wake up early here, so keep an eye on the batches */
+                tv.tv_sec = midi_ip_batch ? 0 : 1;
+                tv.tv_usec = midi_ip_batch ? BATCH_HOLD_USEC : 0;
 #else
                 FD_SET(wakeup[0], &rfds);
                 if (wakeup[0] > m) m = wakeup[0];
+                tv.tv_sec = wait / 1000000;
+                tv.tv_usec = wait % 1000000;
 #endif
                 do {
                         i = select(m+1, &rfds, NULL, NULL,
 #ifdef WIN32
                                 &tv
 #else
-                                NULL
+                                (wait >= 0) ? &tv : NULL
 #endif
                                 );
 #ifdef WIN32
@@ -313,17 +655,21 @@ static int _ip_thread(struct midi_provider *p)
                 } while (i == -1 && errno == EINTR);
 
 #ifndef WIN32
-                if (FD_ISSET(wakeup[0], &rfds)) {
-                        if (read(wakeup[0], buffer, sizeof(buffer)) == -1) {
-                                /* fortify is stupid */
-                        }
+                if (i > 0 && FD_ISSET(wakeup[0], &rfds)) {
+                        i = read(wakeup[0], buffer, sizeof(buffer));
+                        force = (i > 0 && memchr(buffer, 2, i) != NULL);
+                        i = 1;
                 }
 #endif
-                for (i = 0; i < real_num_ports; i++) {
-                        if (FD_ISSET(port_fd[i], &rfds)) {
-                                if (state[i] & 1) _readin(p, i, port_fd[i]);
+                for (m = 0; i > 0 && m < real_num_ports; m++) {
+                        if (FD_ISSET(port_fd[m], &rfds)) {
+                                if (state[m] & 1) _readin(p, m, port_fd[m]);
                         }
                 }
+                if (midi_ip_batch) {
+                        wait = _batch_flush(force);
+                        force = 0;
+                }
         }
         return 0;
 }
@@ -359,11 +705,22 @@ static void _ip_send(struct midi_port *p, const unsigned char *data, unsigned in
         struct sockaddr_in asin;
         unsigned char *ipcopy;
         int n = INT_SHAPED_PTR(p->userdata);
-        int ss;
+        int ss, first = 0;
 
         if (len == 0) return;
         if (!(state[n] & 2)) return; /* blah... */
 
+        if (midi_ip_batch) {
+                SDL_mutexP(batch_mutex);
+                if (n < ports_alloc)
+                        first = _batch_add(ports[n].batch + ports[n].fill, data, len, midi_send_due(p));
+                SDL_mutexV(batch_mutex);
+                /* so the thread knows to send it if the player doesn't say so first */
+                if (first)
+                        do_wake_midi();
+                return;
+        }
+
         memset(&asin, 0, sizeof(asin));
         asin.sin_family = AF_INET;
         ipcopy = (unsigned char *)&asin.sin_addr.s_addr;
@@ -381,6 +738,12 @@ static void _ip_send(struct midi_port *p, const unsigned char *data, unsigned in
                 data += ss;
         }
 }
+static void _ip_drain(UNUSED struct midi_port *p)
+{
+        /* not port specific, but it gets called for each one */
+        do_wake_flush();
+}
+
 static void _ip_poll(struct midi_provider *p)
 {
         static int last_buildout = 0;
@@ -429,9 +792,11 @@ int ip_midi_setup(void)
         if (status.flags & NO_NETWORK) return 0;
 
         blocker = SDL_CreateMutex();
-        if (!blocker) {
+        batch_mutex = SDL_CreateMutex();
+        if (!blocker || !batch_mutex) {
                 return 0;
         }
+        sender_id = (uint32_t) (midi_get_clock() * 2654435761u) | 1;
 
 #ifndef WIN32
         if (pipe(wakeup) == -1) {
@@ -446,10 +811,12 @@ int ip_midi_setup(void)
                 if (out_fd == -1) return 0;
         }
 
-        driver.flags = 0;
+        /* batches carry their own timestamps, so they don't need the queue */
+        driver.flags = midi_ip_batch ? MIDI_PORT_CAN_SCHEDULE : 0;
         driver.poll = _ip_poll;
         driver.thread = _ip_thread;
         driver.send = _ip_send;
+        driver.drain = midi_ip_batch ? _ip_drain : NULL;
         driver.enable = _ip_start;
         driver.disable = _ip_stop;
         //TODO: Save number of MIDI-IP ports
@@ -472,6 +839,17 @@ int ip_midi_getports(void)
         return tmp;
 }
 
+void ip_midi_get_stats(struct ip_midi_stats *st)
+{
+        if (!batch_mutex) {
+                memset(st, 0, sizeof(*st));
+                return;
+        }
+        SDL_mutexP(batch_mutex);
+        *st = ipstats;
+        SDL_mutexV(batch_mutex);
+}
+
 #else
 
 int ip_midi_getports(void)
@@ -483,5 +861,10 @@ void ip_midi_setports(UNUSED int n)
 {
 }
 
+void ip_midi_get_stats(struct ip_midi_stats *st)
+{
+        memset(st, 0, sizeof(*st));
+}
+
 #endif
 
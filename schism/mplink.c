@@ -37,13 +37,33 @@
 
 song_t *current_song = NULL;
 
+// when each row of current_song plays; see timeline.c
+static struct song_timeline timeline;
+
 // ------------------------------------------------------------------------
 // song information
 
+// Only this thread edits the song, so the check doesn't need the lock; it just
+// looks at what the patterns and order list hold now.
+static int timeline_update(void)
+{
+        int ok = 1;
+
+        if (csf_timeline_check(current_song, &timeline)) {
+                song_lock_audio();
+                ok = csf_timeline_extend(current_song, &timeline);
+                song_unlock_audio();
+        }
+        return ok;
+}
+
 unsigned int song_get_length_to(int order, int row)
 {
         unsigned int t;
 
+        if (timeline_update())
+                return (csf_timeline_time_at(&timeline, order, row) + 500) / 1000;
+
         song_lock_audio();
         current_song->stop_at_order = order;
         current_song->stop_at_row = row;
@@ -54,9 +74,16 @@ unsigned int song_get_length_to(int order, int row)
 }
 void song_get_at_time(unsigned int seconds, int *order, int *row)
 {
+        const struct song_timeline_row *r;
+
         if (!seconds) {
                 if (order) *order = 0;
                 if (row) *row = 0;
+        } else if (timeline_update()) {
+                // (elapsed + 500) / 1000 >= seconds, as csf_get_length rounds it
+                r = csf_timeline_find(&timeline, seconds * 1000 - 500);
+                if (order) *order = r ? r->order : 0;
+                if (row) *row = r ? r->row : 0;
         } else {
                 song_lock_audio();
                 current_song->stop_at_order = MAX_ORDERS;
@@ -234,6 +261,7 @@ int song_get_pattern(int n, song_note_t ** buf)
                         current_song->pattern_size[n] = 64;
                         current_song->pattern_alloc_size[n] = 64;
                         current_song->patterns[n] = csf_allocate_pattern(current_song->pattern_size[n]);
+                        csf_pattern_changed(current_song, n);
                 }
                 *buf = current_song->patterns[n];
         } else {
@@ -265,10 +293,21 @@ void song_pattern_install(int patno, song_note_t *n, int rows)
         current_song->patterns[patno] = n;
         current_song->pattern_alloc_size[patno] = rows;
         current_song->pattern_size[patno] = rows;
+        csf_pattern_changed(current_song, patno);
 
         song_unlock_audio();
 }
 
+void song_pattern_changed(int patno)
+{
+        csf_pattern_changed(current_song, patno);
+}
+
+void song_orderlist_changed(void)
+{
+        csf_orderlist_changed(current_song);
+}
+
 // ------------------------------------------------------------------------
 
 int song_next_order_for_pattern(int pat)
@@ -322,6 +361,7 @@ void song_pattern_resize(int pattern, int newsize)
                 current_song->pattern_alloc_size[pattern] = MAX(newsize,oldsize);
         }
         current_song->pattern_size[pattern] = newsize;
+        csf_pattern_changed(current_song, pattern);
         song_unlock_audio();
 }
 
@@ -504,6 +544,7 @@ static void _swap_instruments_in_patterns(int a, int b)
                         else if (note->instrument == b)
                                 note->instrument = a;
                 }
+                csf_pattern_changed(current_song, pat);
         }
 }
 
@@ -560,6 +601,7 @@ static void _adjust_instruments_in_patterns(int start, int delta)
                         if (note->instrument >= start)
                                 note->instrument = CLAMP(note->instrument + delta, 0, MAX_SAMPLES - 1);
                 }
+                csf_pattern_changed(current_song, pat);
         }
 }
 
@@ -745,6 +787,7 @@ void song_replace_sample(int num, int with)
                                 if (note->instrument == num)
                                         note->instrument = with;
                         }
+                        csf_pattern_changed(current_song, i);
                 }
         }
 }
@@ -768,6 +811,7 @@ void song_replace_instrument(int num, int with)
                         if (note->instrument == num)
                                 note->instrument = with;
                 }
+                csf_pattern_changed(current_song, i);
         }
 }
 
@@ -87,6 +87,7 @@ static struct info_window windows[MAX_WINDOWS] = {
 
 static void info_draw_technical(int base, int height, int active, int first_channel)
 {
+        const song_playback_state_t *ps;
         int smp, pos, fg, c = first_channel;
         char buf[16];
         const char *ptr;
@@ -132,9 +133,10 @@ static void info_draw_technical(int base, int height, int active, int first_chan
                 draw_text("Tot", 63, base, 2, 1);
         }
 
+        ps = song_get_playback_state();
         for (pos = base + 1; pos < base + height - 1; pos++, c++) {
                 song_channel_t *channel = current_song->channels + c - 1;
-                song_voice_t *voice = current_song->voices + c - 1;
+                const song_voice_state_t *voice = ps->channels + c - 1;
 
                 if (c == selected_channel) {
                         fg = (channel->flags & CHN_MUTE) ? 6 : 3;
@@ -159,26 +161,13 @@ static void info_draw_technical(int base, int height, int active, int first_chan
                 if (song_is_instrument_mode()) {
                         draw_text("---\xa8", 59, pos, 2, 0); /* will be overwritten if something's playing */
 
-                        /* count how many voices claim this channel */
-                        int nv, tot;
-                        for (nv = tot = 0; nv < MAX_VOICES; nv++) {
-                                song_voice_t *v = current_song->voices + nv;
-                                if (v->master_channel == (unsigned int) c && v->current_sample_data && v->length)
-                                        tot++;
-                        }
-                        if (voice->current_sample_data && voice->length)
-                                tot++;
-                        draw_text(numtostr(3, tot, buf), 63, pos, 2, 0);
+                        /* how many voices claim this channel */
+                        draw_text(numtostr(3, ps->channel_voices[c - 1], buf), 63, pos, 2, 0);
                 }
 
-                if (voice->current_sample_data && voice->length && voice->ptr_sample) {
-                        // again with the hacks...
-                        smp = voice->ptr_sample - current_song->samples;
-                        if (smp <= 0 || smp >= MAX_SAMPLES)
-                                continue;
-                } else {
+                smp = voice->sample;
+                if (!(voice->playing && smp))
                         continue;
-                }
 
                 // Frequency
                 sprintf(buf, "%10d", voice->sample_freq);
@@ -191,7 +180,7 @@ static void info_draw_technical(int base, int height, int active, int first_chan
                 draw_text(numtostr(3, voice->final_volume / 128, buf), 32, pos, 2, 0); // FVl
                 draw_text(numtostr(2, voice->volume >> 2, buf), 36, pos, 2, 0); // Vl
                 draw_text(numtostr(2, voice->global_volume, buf), 39, pos, 2, 0); // CV
-                draw_text(numtostr(2, voice->ptr_sample->global_volume, buf), 42, pos, 2, 0); // SV
+                draw_text(numtostr(2, voice->sample_global_volume, buf), 42, pos, 2, 0); // SV
                 draw_text(numtostr(2, voice->instrument_volume, buf), 45, pos, 2, 0); // VE
                 draw_text(numtostr(3, voice->fadeout_volume / 128, buf), 48, pos, 2, 0); // Fde
 
@@ -218,6 +207,8 @@ static void info_draw_technical(int base, int height, int active, int first_chan
 
 static void info_draw_samples(int base, int height, int active, int first_channel)
 {
+        const song_playback_state_t *ps;
+        song_instrument_t *inst;
         int vu, smp, ins, n, pos, fg, fg2, c = first_channel;
         char buf[8];
         char *ptr;
@@ -250,8 +241,9 @@ static void info_draw_samples(int base, int height, int active, int first_channe
                 return;
         }
 
+        ps = song_get_playback_state();
         for (pos = base + 1; pos < base + height - 1; pos++, c++) {
-                song_voice_t *voice = current_song->voices + c - 1;
+                const song_voice_state_t *voice = ps->channels + c - 1;
 
                 /* always draw the channel number */
                 if (c == selected_channel)
@@ -262,7 +254,7 @@ static void info_draw_samples(int base, int height, int active, int first_channe
                         fg = active ? 1 : 0;
                 draw_text(numtostr(2, c, buf), 2, pos, fg, 2);
 
-                if (!(voice->current_sample_data && voice->length))
+                if (!voice->playing)
                         continue;
 
                 /* first box: vu meter */
@@ -278,16 +270,10 @@ static void info_draw_samples(int base, int height, int active, int first_channe
                 draw_vu_meter(5, pos, 24, vu, fg, fg2);
 
                 /* second box: sample number/name */
-                ins = song_get_instrument_number(voice->ptr_instrument);
-                /* figuring out the sample number is an ugly hack... considering all the crap that's
-                copied to the channel, i'm surprised that the sample and instrument numbers aren't
-                in there somewhere... */
-                if (voice->ptr_sample)
-                        smp = voice->ptr_sample - current_song->samples;
-                else
-                        smp = ins = 0;
-                if(smp < 0 || smp >= MAX_SAMPLES)
-                        smp = ins = 0; /* This sample is not in the sample array */
+                smp = voice->sample;
+                ins = smp ? voice->instrument : 0;
+                /* just look; song_get_instrument would make one if it isn't there */
+                inst = (ins > 0 && ins < MAX_INSTRUMENTS) ? current_song->instruments[ins] : NULL;
 
                 if (smp) {
                         draw_text(num99tostr(smp, buf), 31, pos, 6, 0);
@@ -305,33 +291,12 @@ static void info_draw_samples(int base, int height, int active, int first_channe
                         else
                                 fg = 6;
                         draw_char(':', n++, pos, fg, 0);
-                        if (instrument_names && voice->ptr_instrument) {
-                                ptr = voice->ptr_instrument->name;
+                        if (instrument_names && inst) {
+                                ptr = inst->name;
                         } else {
                                 ptr = current_song->samples[smp].name;
                         }
                         draw_text_len(ptr, 25, n, pos, 6, 0);
-                } else if (ins && voice->ptr_instrument && voice->ptr_instrument->midi_channel_mask) {
-                        // XXX why? what?
-                        if (voice->ptr_instrument->midi_channel_mask >= 0x10000) {
-                                draw_text(numtostr(2, ((c-1) % 16)+1, buf), 31, pos, 6, 0);
-                        } else {
-                                int ch = 0;
-                                while(!(voice->ptr_instrument->midi_channel_mask & (1 << ch))) ++ch;
-                                draw_text(numtostr(2, ch, buf), 31, pos, 6, 0);
-                        }
-                        draw_char('/', 33, pos, 6, 0);
-                        draw_text(num99tostr(ins, buf), 34, pos, 6, 0);
-                        n = 36;
-                        if (voice->volume == 0)
-                                fg = 4;
-                        else if (voice->flags & (CHN_KEYOFF | CHN_NOTEFADE))
-                                fg = 7;
-                        else
-                                fg = 6;
-                        draw_char(':', n++, pos, fg, 0);
-                        ptr = voice->ptr_instrument->name;
-                        draw_text_len( ptr, 25, n, pos, 6, 0);
                 } else {
                         continue;
                 }
@@ -339,7 +304,7 @@ static void info_draw_samples(int base, int height, int active, int first_channe
                 /* last box: panning. this one's much easier than the
                  * other two, thankfully :) */
                 if (song_is_stereo()) {
-                        if (!voice->ptr_sample) {
+                        if (!voice->sample) {
                                 /* nothing... */
                         } else if (voice->flags & CHN_SURROUND) {
                                 draw_text("Surround", 64, pos, 2, 0);
@@ -373,8 +338,9 @@ static void _draw_track_view(int base, int height, int first_channel, int num_ch
                              int channel_width, int separator, draw_note_func draw_note)
 {
         /* way too many variables */
-        int current_row = song_get_current_row();
-        int current_order = song_get_current_order();
+        const song_playback_state_t *ps = song_get_playback_state();
+        int current_row = ps->row;
+        int current_order = ps->order;
         const song_note_t *note;
         // These can't be const because of song_get_pattern, but song_get_pattern is stupid and smells funny.
         song_note_t *cur_pattern, *prev_pattern, *next_pattern;
@@ -396,7 +362,7 @@ static void _draw_track_view(int base, int height, int first_channel, int num_ch
         switch (song_get_mode()) {
         case MODE_PATTERN_LOOP:
                 prev_pattern_rows = next_pattern_rows = cur_pattern_rows
-                        = song_get_pattern(song_get_playing_pattern(), &cur_pattern);
+                        = song_get_pattern(ps->pattern, &cur_pattern);
                 prev_pattern = next_pattern = cur_pattern;
                 break;
         case MODE_PLAYING:
@@ -672,7 +638,8 @@ static void info_draw_note_dots(int base, int height, int active, int first_chan
         int fg, v;
         int c, pos;
         int n;
-        song_voice_t *voice;
+        const song_playback_state_t *ps = song_get_playback_state();
+        const song_voice_state_t *voice;
         char buf[4];
         uint8_t d, dn;
         uint8_t dot_field[73][36] = { {0} }; // f#2 -> f#8 = 73 columns
@@ -680,21 +647,21 @@ static void info_draw_note_dots(int base, int height, int active, int first_chan
         draw_fill_chars(5, base + 1, 77, base + height - 2, 0);
         draw_box(4, base, 78, base + height - 1, BOX_THICK | BOX_INNER | BOX_INSET);
 
-        n = current_song->num_voices;
+        n = ps->num_mix;
         while (n--) {
-                voice = current_song->voices + current_song->voice_mix[n];
+                voice = ps->mix + n;
 
                 /* 31 = f#2, 103 = f#8. (i hope ;) */
-                if (!(voice->ptr_sample && voice->note >= 31 && voice->note <= 103))
+                if (!(voice->sample && voice->note >= 31 && voice->note <= 103))
                         continue;
-                pos = voice->master_channel ?: (1 + current_song->voice_mix[n]);
+                pos = voice->channel;
                 if (pos < first_channel)
                         continue;
                 pos -= first_channel;
                 if (pos > height - 1)
                         continue;
 
-                fg = (voice->flags & CHN_MUTE) ? 1 : ((voice->ptr_sample - current_song->samples) % 4 + 2);
+                fg = (voice->flags & CHN_MUTE) ? 1 : (voice->sample % 4 + 2);
 
                 if (velocity_mode || (status.flags & CLASSIC_MODE))
                         v = (voice->final_volume + 2047) >> 11;
@@ -726,6 +693,59 @@ static void info_draw_note_dots(int base, int height, int active, int first_chan
         }
 }
 
+/* per-channel oscilloscopes, fed by the mixer's scope tap */
+static void info_draw_scopes(int base, int height, int active, int first_channel)
+{
+        struct vgamem_overlay ovl = {22, base + 1, 77, base + height - 2, NULL, 0, 0, 0};
+        const struct channel_scope *scope;
+        int c, pos, row, fg, fg2, n, x, y, last_y, mid;
+        uint32_t end;
+        char buf[4];
+
+        draw_fill_chars(5, base + 1, 19, base + height - 2, 0);
+        draw_box(4, base, 20, base + height - 1, BOX_THICK | BOX_INNER | BOX_INSET);
+        draw_box(21, base, 78, base + height - 1, BOX_THICK | BOX_INNER | BOX_INSET);
+        vgamem_ovl_alloc(&ovl);
+        vgamem_ovl_clear(&ovl, 0);
+
+        for (c = first_channel, pos = base + 1, row = 0; pos < base + height - 1; pos++, c++, row++) {
+                int muted = current_song->channels[c - 1].flags & CHN_MUTE;
+
+                if (c == selected_channel)
+                        fg = muted ? 6 : 3;
+                else if (muted)
+                        fg = 2;
+                else
+                        fg = active ? 1 : 0;
+                draw_text(numtostr(2, c, buf), 2, pos, fg, 2);
+
+                scope = song_get_channel_scope(c - 1);
+                if (!scope || song_get_mode() == MODE_STOPPED)
+                        continue;
+
+                if (muted) {
+                        fg = 1; fg2 = 2;
+                } else {
+                        fg = 5; fg2 = 4;
+                }
+                draw_vu_meter(5, pos, 15, scope->peak >> 9, fg, fg2);
+
+                /* the newest ovl.width points, oldest on the left, squeezed into the row */
+                end = scope->pos;
+                mid = 8 * row + 4;
+                last_y = mid;
+                for (x = 0; x < ovl.width; x++) {
+                        n = scope->wave[(end - ovl.width + x) & (SCOPE_POINTS - 1)];
+                        y = CLAMP(mid - n / 8192, 8 * row, 8 * row + 7);
+                        if (x)
+                                vgamem_ovl_drawline(&ovl, x - 1, last_y, x, y, muted ? 1 : 13);
+                        last_y = y;
+                }
+        }
+
+        vgamem_ovl_apply(&ovl);
+}
+
 /* --------------------------------------------------------------------- */
 /* click receivers */
 
@@ -804,6 +824,7 @@ static const struct info_window_type window_types[] = {
         {"global", info_draw_channels, click_chn_nil, 1, 0},
         {"dots", info_draw_note_dots, click_chn_is_y_nohead, 0, -2},
         {"tech", info_draw_technical, click_chn_is_y, 1, -2},
+        {"scopes", info_draw_scopes, click_chn_is_y_nohead, 0, -2},
 };
 #undef TRACK_VIEW
 
@@ -1002,6 +1023,13 @@ void cfg_load_info(cfg_file_t *cfg)
 static void info_page_redraw(void)
 {
         int n, height, pos = (window_types[windows[0].type].first_row ? 13 : 12);
+        int scopes = 0;
+
+        /* the mixer only keeps the channels apart while there's a scope window */
+        for (n = 0; n < num_windows; n++)
+                if (window_types[windows[n].type].draw == info_draw_scopes)
+                        scopes = 1;
+        song_set_scope_tap(scopes);
 
         for (n = 0; n < num_windows - 1; n++) {
                 height = windows[n].height;
@@ -1080,8 +1080,8 @@ static void _env_draw_loop(int xs, int xe, int sustain)
 static void _env_draw(const song_envelope_t *env, int middle, int current_node,
                         int env_on, int loop_on, int sustain_on, int env_num)
 {
-        song_voice_t *channel;
-        unsigned int *channel_list;
+        const song_playback_state_t *ps = song_get_playback_state();
+        const song_voice_state_t *channel;
         char buf[16];
         unsigned int envpos[3];
         int x, y, n, m, c;
@@ -1127,10 +1127,10 @@ static void _env_draw(const song_envelope_t *env, int middle, int current_node,
 
         if (env_on) {
                 max_ticks = env->ticks[env->nodes-1];
-                m = max_ticks ? song_get_mix_state(&channel_list) : 0;
+                m = max_ticks ? ps->num_mix : 0;
                 while (m--) {
-                        channel = song_get_mix_channel(channel_list[m]);
-                        if (channel->ptr_instrument != song_get_instrument(current_instrument))
+                        channel = ps->mix + m;
+                        if (channel->instrument != current_instrument)
                                 continue;
 
                         envpos[0] = channel->vol_env_position;
@@ -2143,9 +2143,10 @@ static void instrument_list_handle_key(struct key_event * k)
                         }
 
                         if (k->state == KEY_RELEASE) {
-                                song_keyup(0, current_instrument, n);
+                                if (!k->midi_live)
+                                        song_keyup(0, current_instrument, n);
                                 status.last_keysym = 0;
-                        } else if (!k->is_repeat) {
+                        } else if (!k->is_repeat && !k->midi_live) {
                                 song_keydown(KEYJAZZ_NOINST, current_instrument, n, v, KEYJAZZ_CHAN_CURRENT);
                         }
                         last_note = n;
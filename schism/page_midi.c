@@ -29,6 +29,7 @@
 #include "midi.h"
 
 #include "song.h"
+#include "snd_gm.h"
 
 /* --------------------------------------------------------------------- */
 
@@ -58,6 +59,12 @@ static void update_ip_ports(void)
         status.flags |= NEED_UPDATE;
 }
 
+static void update_quantize_strength(void)
+{
+        /* the take in the pattern editor moves over to this when that's shown next */
+        midi_quantize_strength = widgets_midi[15].d.thumbbar.value;
+}
+
 static void update_midi_values(void)
 {
         midi_flags = 0
@@ -94,6 +101,7 @@ static void get_midi_config(void)
         widgets_midi[8].d.thumbbar.value = midi_c5note;
         widgets_midi[10].d.thumbbar.value = midi_pitch_depth;
         widgets_midi[12].d.thumbbar.value = ip_midi_getports();
+        widgets_midi[15].d.thumbbar.value = midi_quantize_strength;
 }
 
 static void toggle_port(void)
@@ -245,13 +253,19 @@ static void midi_page_redraw(void)
 
         draw_text(    "IP MIDI ports", 39, 41, 0, 2);
         draw_box(52,40,73,42, BOX_THIN|BOX_INNER|BOX_INSET);
+
+        draw_text("Quantize strength", 35, 44, 0, 2);
+        draw_box(52,43,73,45, BOX_THIN|BOX_INNER|BOX_INSET);
 }
 
 static void midi_page_draw_portlist(void)
 {
         struct midi_port *p;
         const char *name, *state;
-        char buffer[64];
+        struct midi_queue_stats qs;
+        struct ip_midi_stats ips;
+        struct gm_output_stats gms;
+        char buffer[80];
         int i, n, ct, fg, bg;
         unsigned long j;
         time_t now;
@@ -306,6 +320,41 @@ static void midi_page_draw_portlist(void)
                 }
                 draw_text(state, 3, 15 + i, fg, bg);
         }
+
+        GM_GetStats(&gms);
+        if (gms.frames && gms.rate) {
+                double secs = (double) gms.frames / gms.rate;
+                unsigned long saved = gms.bytes_saved;
+
+                /* plus the status bytes the ports that do running status actually left out */
+                for (i = midi_engine_port_count() - 1; i >= 0; i--) {
+                        p = midi_engine_port(i, NULL);
+                        if (p && midi_port_get_stats(p, &qs))
+                                saved += qs.status_saved;
+                }
+                snprintf(buffer, sizeof(buffer), "Tracker MIDI: %lu messages, %.0f bytes/sec, %.0f bytes/sec saved",
+                         gms.messages, gms.bytes / secs, saved / secs);
+                draw_text_len(buffer, 76, 2, 46, 0, 2);
+        }
+
+        /* the selected port's output queue */
+        p = midi_engine_port(current_port, &name);
+        if (p && midi_port_get_stats(p, &qs) && (qs.sent || qs.dropped)) {
+                snprintf(buffer, sizeof(buffer), "Port: %lu sent, %lu late, %lu dropped, jitter %u/%u usec, peak %u%%",
+                         qs.sent, qs.late, qs.dropped,
+                         qs.sent ? (unsigned int) (qs.jitter_total_usec / qs.sent) : 0, qs.jitter_max_usec,
+                         qs.capacity ? (unsigned int) ((uint64_t) qs.peak * 100 / qs.capacity) : 0);
+                draw_text_len(buffer, 76, 2, 47, 0, 2);
+        }
+
+        ip_midi_get_stats(&ips);
+        if (ips.packets_sent || ips.packets_received) {
+                snprintf(buffer, sizeof(buffer), "IP: %lu/%lu out, %lu/%lu in, %lu lost, %lu late, transit %lld..%lld usec",
+                         ips.packets_sent, ips.events_sent, ips.packets_received, ips.events_received,
+                         ips.lost, ips.reordered,
+                         (long long) ips.transit_min_usec, (long long) ips.transit_max_usec);
+                draw_text_len(buffer, 76, 2, 48, 0, 2);
+        }
 }
 
 /* --------------------------------------------------------------------- */
@@ -319,7 +368,7 @@ void midi_load_page(struct page *page)
         page->playback_update = NULL;
         page->handle_key = NULL;
         page->set_page = get_midi_config;
-        page->total_widgets = 15;
+        page->total_widgets = 16;
         page->widgets = widgets_midi;
         page->help_index = HELP_GLOBAL;
 
@@ -340,10 +389,11 @@ void midi_load_page(struct page *page)
         create_toggle(widgets_midi + 9, 53, 34, 8, 10, 5, 5, 5, update_midi_values);
         create_thumbbar(widgets_midi + 10, 53, 35, 20, 9, 11, 6, update_midi_values, 0, 48);
         create_toggle(widgets_midi + 11, 53, 38, 10, 12, 13, 13, 13, update_midi_values);
-        create_thumbbar(widgets_midi + 12, 53, 41, 20, 11, 12, 13, update_ip_ports, 0, 128);
+        create_thumbbar(widgets_midi + 12, 53, 41, 20, 11, 15, 13, update_ip_ports, 0, 128);
         create_button(widgets_midi + 13, 2, 41, 27, 6, 14, 12, 12, 12,
                 midi_output_config, "MIDI Output Configuration", 2);
-        create_button(widgets_midi + 14, 2, 44, 27, 13, 14, 12, 12, 12,
+        create_button(widgets_midi + 14, 2, 44, 27, 13, 14, 15, 15, 15,
                 cfg_midipage_save, "Save Output Configuration", 2);
+        create_thumbbar(widgets_midi + 15, 53, 44, 20, 12, 15, 14, update_quantize_strength, 0, 100);
 }
 
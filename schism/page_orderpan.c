@@ -149,6 +149,7 @@ static void orderlist_cheater(void)
         song_pattern_resize(best, rows);
         song_pattern_install(best, data, rows);
         current_song->orderlist[current_order] = best;
+        song_orderlist_changed();
         current_order++;
         status.flags |= SONG_NEEDS_SAVE;
         status.flags |= NEED_UPDATE;
@@ -204,6 +205,7 @@ static void orderlist_insert_pos(void)
                 current_song->orderlist + current_order,
                 255 - current_order);
         current_song->orderlist[current_order] = ORDER_LAST;
+        song_orderlist_changed();
 
         status.flags |= NEED_UPDATE | SONG_NEEDS_SAVE;
 }
@@ -220,6 +222,7 @@ static void orderlist_restore(void)
         memcpy(oldlist, current_song->orderlist, 255);
         memcpy(current_song->orderlist, saved_orderlist, 255);
         memcpy(saved_orderlist, oldlist, 255);
+        song_orderlist_changed();
 }
 
 static void orderlist_delete_pos(void)
@@ -228,6 +231,7 @@ static void orderlist_delete_pos(void)
                 current_song->orderlist + current_order + 1,
                 255 - current_order);
         current_song->orderlist[255] = ORDER_LAST;
+        song_orderlist_changed();
 
         status.flags |= NEED_UPDATE | SONG_NEEDS_SAVE;
 }
@@ -242,6 +246,7 @@ static void orderlist_insert_next(void)
         if (next_pattern > 199)
                 next_pattern = 199;
         current_song->orderlist[current_order] = next_pattern;
+        song_orderlist_changed();
         if (current_order < 255)
                 current_order++;
         orderlist_reposition();
@@ -280,6 +285,7 @@ static void orderlist_add_unused_patterns(void)
                 }
                 current_song->orderlist[n++] = p;
         }
+        song_orderlist_changed();
         if (n == n0) {
                 status_text_flash("No unused patterns");
         } else {
@@ -322,6 +328,7 @@ static void orderlist_reorder(void)
                 /* replace orderlist entry */
                 current_song->orderlist[i] = mapol[ current_song->orderlist[i] ];
         }
+        song_orderlist_changed();
         for (i = 0; i < 200; i++) {
                 if (!np[i]) {
                         song_pattern_install(i, NULL, 64);
@@ -351,6 +358,7 @@ static int orderlist_handle_char(struct key_event *k)
                         return 1;
                 status.flags |= SONG_NEEDS_SAVE;
                 current_song->orderlist[current_order] = ORDER_SKIP;
+                song_orderlist_changed();
                 orderlist_cursor_pos = 2;
                 break;
         case SDLK_PERIOD:
@@ -359,6 +367,7 @@ static int orderlist_handle_char(struct key_event *k)
                         return 1;
                 status.flags |= SONG_NEEDS_SAVE;
                 current_song->orderlist[current_order] = ORDER_LAST;
+                song_orderlist_changed();
                 orderlist_cursor_pos = 2;
                 break;
         default:
@@ -380,6 +389,7 @@ static int orderlist_handle_char(struct key_event *k)
                 cur_pattern = CLAMP(cur_pattern, 0, 199);
                 song_get_pattern(cur_pattern, &tmp); /* make sure it exists */
                 current_song->orderlist[current_order] = cur_pattern;
+                song_orderlist_changed();
                 break;
         };
 
@@ -557,6 +557,7 @@ static void copyin_addnote(song_note_t *note, int *copyin_x, int *copyin_y)
         int num_rows;
 
         status.flags |= (SONG_NEEDS_SAVE|NEED_UPDATE);
+        song_pattern_changed(current_pattern);
         num_rows = song_get_pattern(current_pattern, &pattern);
         if ((*copyin_x + (current_channel-1)) >= 64) return;
         if ((*copyin_y + current_row) >= num_rows) return;
@@ -1200,6 +1201,7 @@ static void block_length_double(void)
                 return;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         total_rows = song_get_pattern(current_pattern, &pattern);
 
         if (selection.last_row >= total_rows)
@@ -1242,6 +1244,7 @@ static void block_length_halve(void)
                 return;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         total_rows = song_get_pattern(current_pattern, &pattern);
 
         if (selection.last_row >= total_rows)
@@ -1280,6 +1283,7 @@ static void selection_erase(void)
                 return;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         total_rows = song_get_pattern(current_pattern, &pattern);
         if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1314,6 +1318,7 @@ static void selection_set_sample(void)
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         pated_history_add("Undo set sample/instrument     (Alt-S)",
                 selection.first_channel - 1,
                 selection.first_row,
@@ -1348,6 +1353,7 @@ static void selection_swap(void)
         CHECK_FOR_SELECTION(return);
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         total_rows = song_get_pattern(current_pattern, &pattern);
         if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1398,6 +1404,7 @@ static void selection_set_volume(void)
         CHECK_FOR_SELECTION(return);
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         total_rows = song_get_pattern(current_pattern, &pattern);
         if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1438,6 +1445,7 @@ static void selection_slide_volume(void)
                 return;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
 
         pated_history_add("Undo volume or panning slide   (Alt-K)",
                 selection.first_channel - 1,
@@ -1510,6 +1518,7 @@ static void selection_wipe_volume(int reckless)
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
 
         pated_history_add((reckless
                                 ? "Recover volumes/pannings     (2*Alt-K)"
@@ -1594,6 +1603,7 @@ static void selection_vary(int fast, int depth, int how)
         CHECK_FOR_SELECTION(return);
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         switch (how) {
         case FX_CHANNELVOLUME:
         case FX_CHANNELVOLSLIDE:
@@ -1708,6 +1718,7 @@ static void selection_amplify(int percentage)
                 return;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         total_rows = song_get_pattern(current_pattern, &pattern);
         if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1760,6 +1771,7 @@ static void selection_slide_effect(void)
                 return;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
 
         pated_history_add("Undo effect data slide         (Alt-X)",
                 selection.first_channel - 1,
@@ -1794,6 +1806,7 @@ static void selection_wipe_effect(void)
         if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
 
         pated_history_add("Recover effects/effect data  (2*Alt-X)",
                 selection.first_channel - 1,
@@ -1823,6 +1836,7 @@ static void pattern_insert_rows(int what_row, int num_rows, int first_channel, i
         int row, total_rows = song_get_pattern(current_pattern, &pattern);
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         if (first_channel < 1)
                 first_channel = 1;
         if (chan_width + first_channel - 1 > 64)
@@ -1856,6 +1870,7 @@ static void pattern_delete_rows(int what_row, int num_rows, int first_channel, i
         int row, total_rows = song_get_pattern(current_pattern, &pattern);
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         if (first_channel < 1)
                 first_channel = 1;
         if (chan_width + first_channel - 1 > 64)
@@ -1919,6 +1934,7 @@ static void snap_paste(struct pattern_snap *s, int x, int y, int xlate)
 
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         if (x < 0) x = s->x;
         if (y < 0) y = s->y;
 
@@ -2172,6 +2188,7 @@ static void clipboard_paste_mix_notes(int clip, int xlate)
         }
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         num_rows = song_get_pattern(current_pattern, &pattern);
         num_rows -= current_row;
         if (clipboard.rows < num_rows)
@@ -2230,6 +2247,7 @@ static void clipboard_paste_mix_fields(int prec, int xlate)
         }
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         num_rows = song_get_pattern(current_pattern, &pattern);
         num_rows -= current_row;
         if (clipboard.rows < num_rows)
@@ -2676,6 +2694,7 @@ static void transpose_notes(int amount)
         song_note_t *pattern, *note;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         song_get_pattern(current_pattern, &pattern);
 
         pated_history_add_grouped(((amount > 0)
@@ -2833,6 +2852,7 @@ static int patedit_record_note(song_note_t *cur_note, int channel, UNUSED int ro
         int i, r = 1, channels;
 
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         if (NOTE_IS_NOTE(note)) {
                 if (template_mode) {
                         q = clipboard.data;
@@ -2897,12 +2917,227 @@ static int patedit_record_note(song_note_t *cur_note, int channel, UNUSED int ro
         return r;
 }
 
+/* --------------------------------------------------------------------------------------------------------- */
+/* MIDI takes. While the song is playing, notes go where the player heard the song when they played them
+(see song_get_position_at), pulled toward the grid by midi_quantize_strength. Everything recorded since
+playback last started is remembered, so that changing the strength afterwards can move it all again; that
+happens once, the next time the pattern editor is shown, and can be undone. */
+
+#define MIDI_TAKE_SIZE 4096
+
+struct midi_take_note {
+        int pattern, next;      /* where it was played, and the pattern that plays after that (or -1) */
+        int channel;
+        double pos;             /* where it was played, in rows */
+        int speed;
+        int at, row, delay;     /* where it's written now (at is -1 once the note's been edited away),
+                                and the SDx written with it (or zero) */
+        song_note_t data;
+};
+
+static struct midi_take_note midi_take[MIDI_TAKE_SIZE];
+static int midi_take_count = 0;
+static int midi_take_serial = 0;
+static int midi_take_strength = 100; /* what everything in the take is quantized to */
+
+/* returns the row for a note played at 'pos' (in rows), and the tick into it; this
+can be one past the end of the pattern, if the note was played right at the end */
+static int midi_take_quantize(double pos, int speed, int *tick)
+{
+        double grid, q;
+        int row;
+
+        if (midi_flags & MIDI_TICK_QUANTIZE)
+                grid = (int) (pos + 0.5);
+        else
+                grid = (int) (pos * speed + 0.5) / (double) speed;
+        q = pos + (grid - pos) * midi_quantize_strength / 100;
+
+        row = (int) q;
+        *tick = (int) ((q - row) * speed + 0.5);
+        if (*tick >= speed) {
+                row++;
+                *tick = 0;
+        }
+        *tick = MIN(*tick, 15);
+        return row;
+}
+
+/* the pattern that plays after the one at 'sp', for notes that round past its end */
+static int midi_take_next_pattern(const struct song_position *sp)
+{
+        const uint8_t *orderlist = song_get_orderlist();
+        int ord;
+
+        if (song_get_mode() & MODE_PATTERN_LOOP)
+                return sp->pattern;
+        for (ord = sp->order + 1; ord < MAX_ORDERS; ord++) {
+                if (orderlist[ord] == ORDER_SKIP)
+                        continue;
+                return (orderlist[ord] < MAX_PATTERNS) ? orderlist[ord] : -1;
+        }
+        return -1;
+}
+
+/* where a note played at 'pos' in 'pattern' goes: returns the pattern, which is 'next' if it
+rounded past the end, or -1 if there's nowhere for it */
+static int midi_take_place(int pattern, int next, double pos, int speed, int *row, int *tick)
+{
+        int rows = song_get_pattern(pattern, NULL);
+
+        *row = midi_take_quantize(pos, speed, tick);
+        if (*row < rows)
+                return pattern;
+        *row -= rows;
+        if (next < 0 || *row >= song_get_pattern(next, NULL))
+                return -1;
+        return next;
+}
+
+/* returns the delay written, which is zero if the effect column was taken */
+static int midi_take_set_delay(song_note_t *cur_note, int tick)
+{
+        if (!tick || cur_note->effect)
+                return 0;
+        cur_note->effect = FX_SPECIAL;
+        cur_note->param = 0xD0 | tick;
+        return tick;
+}
+
+static void midi_take_add(const struct song_position *sp, int next, double pos, int channel, int at, int row,
+        int delay, const song_note_t *cur_note)
+{
+        struct midi_take_note *t;
+
+        if (sp->serial != midi_take_serial) {
+                midi_take_serial = sp->serial;
+                midi_take_count = 0;
+                midi_take_strength = midi_quantize_strength;
+        }
+        if (midi_take_count == MIDI_TAKE_SIZE)
+                return;
+        t = midi_take + midi_take_count++;
+        t->pattern = sp->pattern;
+        t->next = next;
+        t->channel = channel;
+        t->pos = pos;
+        t->speed = sp->speed;
+        t->at = at;
+        t->row = row;
+        t->delay = delay;
+        t->data = *cur_note;
+}
+
+static int midi_take_cell_free(const song_note_t *note)
+{
+        return !note->note && !note->instrument && !note->voleffect && !note->volparam;
+}
+
+/* moves the take over to the current quantize strength */
+static void midi_take_requantize(void)
+{
+        struct midi_take_note *t;
+        song_note_t *pattern, *cur_note;
+        uint8_t undo[MAX_PATTERNS] = {0};
+        int n, d, rows, row, tick, at, save_pattern;
+
+        if (midi_take_strength == midi_quantize_strength)
+                return;
+        midi_take_strength = midi_quantize_strength;
+
+        /* one undo step for each pattern that gets changed */
+        save_pattern = current_pattern;
+        for (n = 0, t = midi_take; n < midi_take_count; n++, t++) {
+                if (t->at < 0 || undo[t->at])
+                        continue;
+                undo[t->at] = 1;
+                current_pattern = t->at;
+                pated_save("Requantize MIDI Take");
+        }
+        current_pattern = save_pattern;
+
+        /* lift everything out first, so the notes don't trip over each other */
+        for (n = 0, t = midi_take; n < midi_take_count; n++, t++) {
+                if (t->at < 0)
+                        continue;
+                rows = song_get_pattern(t->at, &pattern);
+                cur_note = pattern + 64 * t->row + t->channel - 1;
+                if (t->row >= rows || cur_note->note != t->data.note) {
+                        t->at = -1;
+                        continue;
+                }
+                t->data = *cur_note;
+                cur_note->note = 0;
+                cur_note->instrument = 0;
+                cur_note->voleffect = 0;
+                cur_note->volparam = 0;
+                if (t->delay && cur_note->effect == FX_SPECIAL && cur_note->param == (0xD0 | t->delay)) {
+                        cur_note->effect = 0;
+                        cur_note->param = 0;
+                }
+                song_pattern_changed(t->at);
+        }
+
+        /* Then put each one back where it goes now. Anything already there stays; the note goes back
+        where it was instead, or if that's been taken too, the nearest free row. (There's always one:
+        every note in the take left a free cell behind in its own channel.) */
+        for (n = 0, t = midi_take; n < midi_take_count; n++, t++) {
+                if (t->at < 0)
+                        continue;
+                at = midi_take_place(t->pattern, t->next, t->pos, t->speed, &row, &tick);
+                if (at >= 0) {
+                        rows = song_get_pattern(at, &pattern);
+                        cur_note = pattern + 64 * row + t->channel - 1;
+                }
+                if (at < 0 || !midi_take_cell_free(cur_note)) {
+                        at = t->at;
+                        row = t->row;
+                        tick = t->delay;
+                        rows = song_get_pattern(at, &pattern);
+                        for (d = 0; d < 2 * rows; d++) {
+                                row = t->row + ((d & 1) ? -(d + 1) / 2 : d / 2);
+                                if (row < 0 || row >= rows)
+                                        continue;
+                                if (midi_take_cell_free(pattern + 64 * row + t->channel - 1))
+                                        break;
+                        }
+                        if (d == 2 * rows) {
+                                t->at = -1; /* can't happen */
+                                continue;
+                        }
+                        if (row != t->row)
+                                tick = 0;
+                        cur_note = pattern + 64 * row + t->channel - 1;
+                }
+                cur_note->note = t->data.note;
+                cur_note->instrument = t->data.instrument;
+                cur_note->voleffect = t->data.voleffect;
+                cur_note->volparam = t->data.volparam;
+                t->at = at;
+                t->row = row;
+                t->delay = midi_take_set_delay(cur_note, tick);
+                song_pattern_changed(at);
+        }
+        if (midi_take_count)
+                status.flags |= SONG_NEEDS_SAVE | NEED_UPDATE;
+}
+
+int pattern_editor_midi_live(void)
+{
+        return !midi_start_record || (song_get_mode() & (MODE_PLAYING|MODE_PATTERN_LOOP));
+}
+
 static int pattern_editor_insert_midi(struct key_event *k)
 {
-        song_note_t *pattern, *cur_note = NULL;
-        int n, v = 0, c = 0, pd, speed, tick;
+        song_note_t *pattern, *take_pattern, *cur_note = NULL;
+        song_note_t dropped = {0};
+        struct song_position sp;
+        double pos = 0;
+        int n, v = 0, c = 0, pd, speed, tick, row, timed, next = -1, at = -1;
 
+        midi_take_requantize();
         status.flags |= SONG_NEEDS_SAVE;
+        song_pattern_changed(current_pattern);
         song_get_pattern(current_pattern, &pattern);
 
         if (midi_start_record && !(song_get_mode() & (MODE_PLAYING|MODE_PATTERN_LOOP))) {
@@ -2922,10 +3157,31 @@ static int pattern_editor_insert_midi(struct key_event *k)
 
         speed = song_get_current_speed();
         tick = song_get_current_tick();
+
+        /* during playback, put the note where it was heard if we can find out where that was */
+        timed = k->midi_note != -1 && !template_mode && playback_tracing
+                && (song_get_mode() & (MODE_PLAYING | MODE_PATTERN_LOOP))
+                && song_get_position_at(k->midi_time, &sp);
+        if (timed) {
+                pos = sp.row + sp.tick / sp.speed;
+                next = midi_take_next_pattern(&sp);
+                at = midi_take_place(sp.pattern, next, pos, sp.speed, &row, &tick);
+                if (at >= 0) {
+                        song_get_pattern(at, &take_pattern);
+                        song_pattern_changed(at);
+                }
+        } else {
+                take_pattern = pattern;
+                row = current_row;
+        }
+
         if (k->midi_note == -1) {
                 /* nada */
         } else if (k->state == KEY_RELEASE) {
-                c = song_keyup(k->midi_channel, k->midi_channel, k->midi_note);
+                if (k->midi_live)
+                        c = song_keyjazz_channel(k->midi_note) ? : current_channel;
+                else
+                        c = song_keyup(k->midi_channel, k->midi_channel, k->midi_note);
 
                 /* don't record noteoffs for no good reason... */
                 if (!((midi_flags & MIDI_RECORD_NOTEOFF)
@@ -2934,9 +3190,10 @@ static int pattern_editor_insert_midi(struct key_event *k)
                         return 0;
                 }
 
-                cur_note = pattern + 64 * current_row + (c-1);
+                /* a note that rounded off the end of the song isn't written anywhere */
+                cur_note = (timed && at < 0) ? &dropped : take_pattern + 64 * row + (c-1);
                 /* never "overwrite" a note off */
-                patedit_record_note(cur_note, c, current_row, NOTE_OFF, 0);
+                patedit_record_note(cur_note, c, row, NOTE_OFF, 0);
 
 
         } else {
@@ -2950,9 +3207,10 @@ static int pattern_editor_insert_midi(struct key_event *k)
                 }
                 n = k->midi_note;
                 // XXX samp/ins were -1 here, I don't know what that meant (this is probably incorrect)
-                c = song_keydown(k->midi_channel, k->midi_channel, n, v, current_channel);
-                cur_note = pattern + 64 * current_row + (c-1);
-                patedit_record_note(cur_note, c, current_row, n, 0);
+                c = k->midi_live ? current_channel
+                        : song_keydown(k->midi_channel, k->midi_channel, n, v, current_channel);
+                cur_note = (timed && at < 0) ? &dropped : take_pattern + 64 * row + (c-1);
+                patedit_record_note(cur_note, c, row, n, 0);
 
                 if (!template_mode) {
                         if (k->midi_channel > 0) {
@@ -2965,10 +3223,16 @@ static int pattern_editor_insert_midi(struct key_event *k)
                                 cur_note->voleffect = VOLFX_VOLUME;
                                 cur_note->volparam = v;
                         }
-                        tick %= speed;
-                        if (!(midi_flags & MIDI_TICK_QUANTIZE) && !cur_note->effect && tick != 0) {
-                                cur_note->effect = FX_SPECIAL;
-                                cur_note->param = 0xD0 | MIN(tick, 15);
+                        if (timed) {
+                                if (at >= 0)
+                                        midi_take_add(&sp, next, pos, c, at, row,
+                                                midi_take_set_delay(cur_note, tick), cur_note);
+                        } else {
+                                tick %= speed;
+                                if (!(midi_flags & MIDI_TICK_QUANTIZE) && !cur_note->effect && tick != 0) {
+                                        cur_note->effect = FX_SPECIAL;
+                                        cur_note->param = 0xD0 | MIN(tick, 15);
+                                }
                         }
                 }
         }
@@ -3194,6 +3458,7 @@ static int pattern_editor_insert(struct key_event *k)
                 }
                 advance_cursor(1, 0);
                 status.flags |= SONG_NEEDS_SAVE;
+                song_pattern_changed(current_pattern);
                 pattern_selection_system_copyout();
                 break;
         case 2:                 /* instrument, first digit */
@@ -3208,6 +3473,7 @@ static int pattern_editor_insert(struct key_event *k)
                         cur_note->instrument = n;
                         advance_cursor(1, 0);
                         status.flags |= SONG_NEEDS_SAVE;
+                        song_pattern_changed(current_pattern);
                         break;
                 }
                 if (kbd_get_note(k) == 0) {
@@ -3218,6 +3484,7 @@ static int pattern_editor_insert(struct key_event *k)
                                 sample_set(0);
                         advance_cursor(1, 0);
                         status.flags |= SONG_NEEDS_SAVE;
+                        song_pattern_changed(current_pattern);
                         break;
                 }
 
@@ -3260,6 +3527,7 @@ static int pattern_editor_insert(struct key_event *k)
                 else
                         sample_set(n);
                 status.flags |= SONG_NEEDS_SAVE;
+                song_pattern_changed(current_pattern);
                 pattern_selection_system_copyout();
                 break;
         case 4:
@@ -3269,6 +3537,7 @@ static int pattern_editor_insert(struct key_event *k)
                         cur_note->voleffect = mask_note.voleffect;
                         advance_cursor(1, 0);
                         status.flags |= SONG_NEEDS_SAVE;
+                        song_pattern_changed(current_pattern);
                         break;
                 }
                 if (kbd_get_note(k) == 0) {
@@ -3276,6 +3545,7 @@ static int pattern_editor_insert(struct key_event *k)
                         cur_note->voleffect = mask_note.voleffect = VOLFX_NONE;
                         advance_cursor(1, 0);
                         status.flags |= SONG_NEEDS_SAVE;
+                        song_pattern_changed(current_pattern);
                         break;
                 }
                 if (key_scancode_lookup(k->scancode, k->sym) == SDLK_BACKQUOTE) {
@@ -3294,6 +3564,7 @@ static int pattern_editor_insert(struct key_event *k)
                         advance_cursor(1, 0);
                 }
                 status.flags |= SONG_NEEDS_SAVE;
+                song_pattern_changed(current_pattern);
                 pattern_selection_system_copyout();
                 break;
         case 6:                 /* effect */
@@ -3306,6 +3577,7 @@ static int pattern_editor_insert(struct key_event *k)
                         cur_note->effect = mask_note.effect = n;
                 }
                 status.flags |= SONG_NEEDS_SAVE;
+                song_pattern_changed(current_pattern);
                 if (link_effect_column)
                         current_position++;
                 else
@@ -3319,6 +3591,7 @@ static int pattern_editor_insert(struct key_event *k)
                         current_position = link_effect_column ? 6 : 7;
                         advance_cursor(1, 0);
                         status.flags |= SONG_NEEDS_SAVE;
+                        song_pattern_changed(current_pattern);
                         pattern_selection_system_copyout();
                         break;
                 } else if (kbd_get_note(k) == 0) {
@@ -3326,6 +3599,7 @@ static int pattern_editor_insert(struct key_event *k)
                         current_position = link_effect_column ? 6 : 7;
                         advance_cursor(1, 0);
                         status.flags |= SONG_NEEDS_SAVE;
+                        song_pattern_changed(current_pattern);
                         pattern_selection_system_copyout();
                         break;
                 }
@@ -3344,6 +3618,7 @@ static int pattern_editor_insert(struct key_event *k)
                         advance_cursor(1, 0);
                 }
                 status.flags |= SONG_NEEDS_SAVE;
+                song_pattern_changed(current_pattern);
                 mask_note.param = cur_note->param;
                 pattern_selection_system_copyout();
                 break;
@@ -4422,6 +4697,7 @@ void pattern_editor_load_page(struct page *page)
         page->clipboard_paste = pattern_selection_system_paste;
         page->widgets = widgets_pattern;
         page->help_index = HELP_PATTERN_EDITOR;
+        page->set_page = midi_take_requantize;
 
         create_other(widgets_pattern + 0, 0, pattern_editor_handle_key_cb, pattern_editor_redraw);
 }
@@ -1492,9 +1492,11 @@ static void sample_list_handle_key(struct key_event * k)
                                 v = KEYJAZZ_DEFAULTVOL;
                         }
                         if (k->state == KEY_RELEASE) {
-                                song_keyup(current_sample, KEYJAZZ_NOINST, n);
+                                if (!k->midi_live)
+                                        song_keyup(current_sample, KEYJAZZ_NOINST, n);
                         } else {
-                                song_keydown(current_sample, KEYJAZZ_NOINST, n, v, KEYJAZZ_CHAN_CURRENT);
+                                if (!k->midi_live)
+                                        song_keydown(current_sample, KEYJAZZ_NOINST, n, v, KEYJAZZ_CHAN_CURRENT);
                                 last_note = n;
                         }
                 }
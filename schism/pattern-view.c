@@ -55,6 +55,65 @@ static const char mask_chars[] = {
         ((pos2 && cursor_pos == pos2) ? 2 : 0) | \
         ((mask & field)      ? 4 : 0)          ]
 
+/* --------------------------------------------------------------------- */
+/* formatted cell cache
+
+Turning a note into text is a handful of table lookups and a printf, and with
+64 channels on screen it happens a couple of thousand times a frame -- nearly
+always for cells that look exactly like they did last frame. Entries are found
+by the note's address, so a row that scrolled up the screen is still cached,
+and checked against a copy of the note, so editing a cell is noticed without
+anyone having to invalidate anything.
+
+This only saves the formatting. Every cell is still looked up and drawn every
+frame, since the screen is rebuilt from scratch each time; nothing here knows
+about rows or patterns, or skips drawing ones that haven't changed. */
+
+#define CELL_CACHE_SIZE 4096 /* a power of two, and more than 32 rows * 64 channels */
+
+struct cell_text {
+        const song_note_t *addr;
+        song_note_t note;
+        int flats;
+
+        char note_long[4];      /* "C-5" */
+        char note_short[3];     /* "c5" */
+        char ins[3];            /* instrument, or dots */
+        char vol[3];
+        char fx[4];             /* effect and parameter */
+        char text13[16];        /* the whole 13-column cell */
+};
+
+static struct cell_text cell_cache[CELL_CACHE_SIZE];
+
+static const struct cell_text *get_cell_text(const song_note_t *note)
+{
+        struct cell_text *cell = cell_cache + ((uintptr_t) note / sizeof(song_note_t)) % CELL_CACHE_SIZE;
+        int flats = !!(status.flags & ACCIDENTALS_AS_FLATS);
+
+        if (cell->addr == note && cell->flats == flats
+            && memcmp(&cell->note, note, sizeof(song_note_t)) == 0)
+                return cell;
+
+        cell->addr = note;
+        cell->note = *note;
+        cell->flats = flats;
+
+        get_note_string(note->note, cell->note_long);
+        get_note_string_short(note->note, cell->note_short);
+        if (note->instrument) {
+                num99tostr(note->instrument, cell->ins);
+        } else {
+                cell->ins[0] = cell->ins[1] = 173;
+                cell->ins[2] = 0;
+        }
+        get_volume_string(note->volparam, note->voleffect, cell->vol);
+        snprintf(cell->fx, 4, "%c%02X", get_effect_char(note->effect), note->param);
+        snprintf(cell->text13, 16, "%s %s %s %s", cell->note_long, cell->ins, cell->vol, cell->fx);
+
+        return cell;
+}
+
 /* --------------------------------------------------------------------- */
 /* 13-column track view */
 
@@ -68,22 +127,10 @@ void draw_channel_header_13(int chan, int x, int y, int fg)
 void draw_note_13(int x, int y, const song_note_t *note, int cursor_pos, int fg, int bg)
 {
         int cursor_pos_map[9] = { 0, 2, 4, 5, 7, 8, 10, 11, 12 };
-        char note_text[16], note_buf[4], vol_buf[4];
-        char instbuf[4];
+        const struct cell_text *cell = get_cell_text(note);
+        char note_text[16];
 
-        get_note_string(note->note, note_buf);
-        get_volume_string(note->volparam, note->voleffect, vol_buf);
-
-        /* come to think of it, maybe the instrument text should be
-         * created the same way as the volume. */
-        if (note->instrument)
-                num99tostr(note->instrument, instbuf);
-        else
-                strcpy(instbuf, "\xad\xad");
-
-        snprintf(note_text, 16, "%s %s %s %c%02X",
-                note_buf, instbuf, vol_buf,
-                get_effect_char(note->effect), note->param);
+        strcpy(note_text, cell->text13);
 
         if (show_default_volumes && note->voleffect == VOLFX_NONE
             && note->instrument > 0 && NOTE_IS_NOTE(note->note)) {
@@ -106,7 +153,7 @@ void draw_note_13(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         /* lazy coding here: the panning is written twice, or if the
          * cursor's on it, *three* times. */
         if (note->voleffect == VOLFX_PANNING)
-                draw_text(vol_buf, x + 7, y, 2, bg);
+                draw_text(cell->vol, x + 7, y, 2, bg);
 
         if (cursor_pos == 9) {
                 draw_text(note_text + 10, x + 10, y, 0, 3);
@@ -150,17 +197,18 @@ void draw_channel_header_10(int chan, int x, int y, int fg)
 
 void draw_note_10(int x, int y, const song_note_t *note, int cursor_pos, UNUSED int fg, int bg)
 {
+        const struct cell_text *cell = get_cell_text(note);
         uint8_t c;
         char note_buf[4], ins_buf[3], vol_buf[3], effect_buf[4];
 
-        get_note_string(note->note, note_buf);
+        strcpy(note_buf, cell->note_long);
         if (note->instrument) {
-                num99tostr(note->instrument, ins_buf);
+                strcpy(ins_buf, cell->ins);
         } else {
                 ins_buf[0] = ins_buf[1] = 173;
                 ins_buf[2] = 0;
         }
-        get_volume_string(note->volparam, note->voleffect, vol_buf);
+        strcpy(vol_buf, cell->vol);
         sprintf(effect_buf, "%c%02X", get_effect_char(note->effect),
                 note->param);
 
@@ -222,22 +270,18 @@ void draw_channel_header_8(int chan, int x, int y, int fg)
 
 void draw_note_8(int x, int y, const song_note_t *note, UNUSED int cursor_pos, int fg, int bg)
 {
-        char buf[4];
+        const struct cell_text *cell = get_cell_text(note);
 
-        get_note_string(note->note, buf);
-        draw_text(buf, x, y, fg, bg);
+        draw_text(cell->note_long, x, y, fg, bg);
 
         if (note->volparam || note->voleffect) {
-                get_volume_string(note->volparam, note->voleffect, buf);
-                draw_text(buf, x + 3, y, (note->voleffect == VOLFX_PANNING) ? 1 : 2, bg);
+                draw_text(cell->vol, x + 3, y, (note->voleffect == VOLFX_PANNING) ? 1 : 2, bg);
         } else {
                 draw_char(0, x + 3, y, fg, bg);
                 draw_char(0, x + 4, y, fg, bg);
         }
 
-        snprintf(buf, 4, "%c%02X", get_effect_char(note->effect), note->param);
-        buf[3] = '\0';
-        draw_text(buf, x + 5, y, fg, bg);
+        draw_text(cell->fx, x + 5, y, fg, bg);
 }
 
 /* --------------------------------------------------------------------- */
@@ -252,15 +296,16 @@ void draw_channel_header_7(int chan, int x, int y, int fg)
 
 void draw_note_7(int x, int y, const song_note_t *note, int cursor_pos, UNUSED int fg, int bg)
 {
+        const struct cell_text *cell = get_cell_text(note);
         char note_buf[4], ins_buf[3], vol_buf[3];
         int fg1, bg1, fg2, bg2;
 
-        get_note_string(note->note, note_buf);
+        strcpy(note_buf, cell->note_long);
         if (note->instrument)
-                num99tostr(note->instrument, ins_buf);
+                strcpy(ins_buf, cell->ins);
         else
                 ins_buf[0] = ins_buf[1] = 173;
-        get_volume_string(note->volparam, note->voleffect, vol_buf);
+        strcpy(vol_buf, cell->vol);
 
         /* note & instrument */
         draw_text(note_buf, x, y, 6, bg);
@@ -371,6 +416,7 @@ void draw_channel_header_3(int chan, int x, int y, int fg)
 
 void draw_note_3(int x, int y, const song_note_t *note, int cursor_pos, int fg, int bg)
 {
+        const struct cell_text *cell = get_cell_text(note);
         char buf[4];
         int vfg = 6;
 
@@ -390,7 +436,7 @@ void draw_note_3(int x, int y, const song_note_t *note, int cursor_pos, int fg,
                 bg = 3;
                 break;
         case 1:
-                get_note_string(note->note, buf);
+                strcpy(buf, cell->note_long);
                 draw_text(buf, x, y, 6, bg);
                 draw_char(buf[2], x + 2, y, 0, 3);
                 return;
@@ -399,7 +445,7 @@ void draw_note_3(int x, int y, const song_note_t *note, int cursor_pos, int fg,
                 cursor_pos -= 1;
                 buf[0] = ' ';
                 if (note->instrument) {
-                        num99tostr(note->instrument, buf + 1);
+                        strcpy(buf + 1, cell->ins);
                 } else {
                         buf[1] = buf[2] = 173;
                         buf[3] = 0;
@@ -411,7 +457,7 @@ void draw_note_3(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         case 5:
                 cursor_pos -= 3;
                 buf[0] = ' ';
-                get_volume_string(note->volparam, note->voleffect, buf + 1);
+                strcpy(buf + 1, cell->vol);
                 draw_text(buf, x, y, vfg, bg);
                 draw_char(buf[cursor_pos], x + cursor_pos, y, 0, 3);
                 return;
@@ -419,12 +465,12 @@ void draw_note_3(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         case 7:
         case 8:
                 cursor_pos -= 6;
-                sprintf(buf, "%c%02X", get_effect_char(note->effect), note->param);
+                strcpy(buf, cell->fx);
                 draw_text(buf, x, y, 2, bg);
                 draw_char(buf[cursor_pos], x + cursor_pos, y, 0, 3);
                 return;
         case 9:
-                sprintf(buf, "%c%02X", get_effect_char(note->effect), note->param);
+                strcpy(buf, cell->fx);
                 draw_text(buf, x, y, 0, 3);
                 return;
         default:
@@ -434,20 +480,20 @@ void draw_note_3(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         }
 
         if (note->note) {
-                get_note_string(note->note, buf);
+                strcpy(buf, cell->note_long);
                 draw_text(buf, x, y, fg, bg);
         } else if (note->instrument) {
                 buf[0] = ' ';
-                num99tostr(note->instrument, buf + 1);
+                strcpy(buf + 1, cell->ins);
                 draw_text(buf, x, y, fg, bg);
         } else if (note->voleffect) {
                 buf[0] = ' ';
-                get_volume_string(note->volparam, note->voleffect, buf + 1);
+                strcpy(buf + 1, cell->vol);
                 draw_text(buf, x, y, vfg, bg);
         } else if (note->effect || note->param) {
                 if (cursor_pos != 0)
                         fg = 2;
-                sprintf(buf, "%c%02X", get_effect_char(note->effect), note->param);
+                strcpy(buf, cell->fx);
                 draw_text(buf, x, y, fg, bg);
         } else {
                 buf[0] = buf[1] = buf[2] = 173;
@@ -525,6 +571,7 @@ static void draw_effect_2(int x, int y, const song_note_t *note, int cursor_pos,
 
 void draw_note_2(int x, int y, const song_note_t *note, int cursor_pos, int fg, int bg)
 {
+        const struct cell_text *cell = get_cell_text(note);
         char buf[4];
         int vfg = 6;
 
@@ -543,7 +590,7 @@ void draw_note_2(int x, int y, const song_note_t *note, int cursor_pos, int fg,
                 vfg = fg = 0;
                 bg = 3;
         case 1: /* Mini-accidentals on 2-col. view */
-                get_note_string(note->note, buf);
+                strcpy(buf, cell->note_long);
                 draw_char(buf[0], x, y, fg, bg);
                 // XXX cut-and-paste hackjob programming... this code should only exist in one place
                 switch ((unsigned char) buf[0]) {
@@ -572,7 +619,7 @@ void draw_note_2(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         case 3:
                 cursor_pos -= 2;
                 if (note->instrument) {
-                        num99tostr(note->instrument, buf);
+                        strcpy(buf, cell->ins);
                 } else {
                         buf[0] = buf[1] = 173;
                         buf[2] = 0;
@@ -583,7 +630,7 @@ void draw_note_2(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         case 4:
         case 5:
                 cursor_pos -= 4;
-                get_volume_string(note->volparam, note->voleffect, buf);
+                strcpy(buf, cell->vol);
                 draw_text(buf, x, y, vfg, bg);
                 draw_char(buf[cursor_pos], x + cursor_pos, y, 0, 3);
                 return;
@@ -600,7 +647,7 @@ void draw_note_2(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         }
 
         if (note->note) {
-                get_note_string(note->note, buf);
+                strcpy(buf, cell->note_long);
                 draw_char(buf[0], x, y, 6, bg);
                 switch ((unsigned char) buf[0]) {
                 case '^':
@@ -622,10 +669,10 @@ void draw_note_2(int x, int y, const song_note_t *note, int cursor_pos, int fg,
                 draw_text(buf, x, y, fg, bg);
                 */
         } else if (note->instrument) {
-                num99tostr(note->instrument, buf);
+                strcpy(buf, cell->ins);
                 draw_text(buf, x, y, fg, bg);
         } else if (note->voleffect) {
-                get_volume_string(note->volparam, note->voleffect, buf);
+                strcpy(buf, cell->vol);
                 draw_text(buf, x, y, vfg, bg);
         } else if (note->effect || note->param) {
                 draw_effect_2(x, y, note, cursor_pos, bg);
@@ -703,6 +750,7 @@ static void draw_effect_1(int x, int y, const song_note_t *note, int cursor_pos,
 
 void draw_note_1(int x, int y, const song_note_t *note, int cursor_pos, int fg, int bg)
 {
+        const struct cell_text *cell = get_cell_text(note);
         char buf[4];
 
         switch (cursor_pos) {
@@ -710,20 +758,20 @@ void draw_note_1(int x, int y, const song_note_t *note, int cursor_pos, int fg,
                 fg = 0;
                 bg = 3;
                 if (note->note > 0 && note->note <= 120) {
-                        get_note_string_short(note->note, buf);
+                        strcpy(buf, cell->note_short);
                         draw_half_width_chars(buf[0], buf[1], x, y, fg, bg, fg, bg);
                         return;
                 }
                 break;
         case 1:
-                get_note_string_short(note->note, buf);
+                strcpy(buf, cell->note_short);
                 draw_half_width_chars(buf[0], buf[1], x, y, fg, bg, 0, 3);
                 return;
         case 2:
         case 3:
                 cursor_pos -= 2;
                 if (note->instrument)
-                        num99tostr(note->instrument, buf);
+                        strcpy(buf, cell->ins);
                 else
                         buf[0] = buf[1] = 173;
                 if (cursor_pos == 0)
@@ -734,7 +782,7 @@ void draw_note_1(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         case 4:
         case 5:
                 cursor_pos -= 4;
-                get_volume_string(note->volparam, note->voleffect, buf);
+                strcpy(buf, cell->vol);
                 fg = note->voleffect == VOLFX_PANNING ? 1 : 2;
                 if (cursor_pos == 0)
                         draw_half_width_chars(buf[0], buf[1], x, y, 0, 3, fg, bg);
@@ -752,15 +800,15 @@ void draw_note_1(int x, int y, const song_note_t *note, int cursor_pos, int fg,
         }
 
         if (note->note) {
-                get_note_string_short(note->note, buf);
+                strcpy(buf, cell->note_short);
                 draw_char(buf[0], x, y, fg, bg);
         } else if (note->instrument) {
-                num99tostr(note->instrument, buf);
+                strcpy(buf, cell->ins);
                 draw_half_width_chars(buf[0], buf[1], x, y, fg, bg, fg, bg);
         } else if (note->voleffect) {
                 if (cursor_pos != 0)
                         fg = (note->voleffect == VOLFX_PANNING) ? 1 : 2;
-                get_volume_string(note->volparam, note->voleffect, buf);
+                strcpy(buf, cell->vol);
                 draw_half_width_chars(buf[0], buf[1], x, y, fg, bg, fg, bg);
         } else if (note->effect || note->param) {
                 draw_effect_1(x, y, note, cursor_pos, fg, bg);
@@ -806,14 +854,15 @@ void draw_channel_header_6(int chan, int x, int y, int fg)
 
 void draw_note_6(int x, int y, const song_note_t *note, int cursor_pos, UNUSED int fg, int bg)
 {
+        const struct cell_text *cell = get_cell_text(note);
         char note_buf[4], ins_buf[3], vol_buf[3];
         int fg1, bg1, fg2, bg2;
 
 #ifdef USE_LOWERCASE_NOTES
 
-        get_note_string_short(note->note, note_buf);
+        strcpy(note_buf, cell->note_short);
         if (note->instrument)
-                num99tostr(note->instrument, ins_buf);
+                strcpy(ins_buf, cell->ins);
         else
                 ins_buf[0] = ins_buf[1] = 173;
         /* note & instrument */
@@ -839,7 +888,7 @@ void draw_note_6(int x, int y, const song_note_t *note, int cursor_pos, UNUSED i
 
 #else
 
-        get_note_string(note->note, note_buf);
+        strcpy(note_buf, cell->note_long);
 
         if (cursor_pos == 0)
                 draw_char(note_buf[0], x, y, 0, 3);
@@ -866,7 +915,7 @@ void draw_note_6(int x, int y, const song_note_t *note, int cursor_pos, UNUSED i
 #endif
 
         if (note->instrument)
-                num99tostr(note->instrument, ins_buf);
+                strcpy(ins_buf, cell->ins);
         else
                 ins_buf[0] = ins_buf[1] = 173;
 
@@ -885,7 +934,7 @@ void draw_note_6(int x, int y, const song_note_t *note, int cursor_pos, UNUSED i
 
         draw_half_width_chars(ins_buf[0], ins_buf[1], x + 2, y, fg1, bg1, fg2, bg2);
         /* volume */
-        get_volume_string(note->volparam, note->voleffect, vol_buf);
+        strcpy(vol_buf, cell->vol);
 
         switch (note->voleffect) {
         case VOLFX_NONE:
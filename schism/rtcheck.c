@@ -0,0 +1,142 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* See rtcheck.h. The allocator is replaced outright, handing the real work to
+glibc's own entry points, since looking anything up with dlsym can itself
+call calloc. pthread_mutex_lock is found with dlsym on first use. */
+
+#include "headers.h"
+
+#include "rtcheck.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+enum {
+        RT_MALLOC,
+        RT_FREE,
+        RT_LOCK,
+        RT_KINDS,
+};
+
+static const char *const rt_names[RT_KINDS] = {
+        "memory allocated",
+        "memory freed",
+        "mutex locked",
+};
+
+static __thread int rt_inside = 0;
+static int rt_trap = 0;
+static unsigned int rt_count[RT_KINDS];
+
+static int (*real_mutex_lock)(pthread_mutex_t *mutex) = NULL;
+
+/* nothing in here may allocate or lock, of course */
+static void rt_violation(int kind)
+{
+        const char *name = rt_names[kind];
+
+        if (__sync_fetch_and_add(&rt_count[kind], 1) == 0) {
+                if (write(2, "rtcheck: ", 9) < 0
+                    || write(2, name, strlen(name)) < 0
+                    || write(2, " in the audio callback\n", 23) < 0) {
+                        /* nowhere to complain to */
+                }
+        }
+        if (rt_trap)
+                raise(SIGTRAP);
+}
+
+void *malloc(size_t size)
+{
+        if (rt_inside)
+                rt_violation(RT_MALLOC);
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+        if (rt_inside)
+                rt_violation(RT_MALLOC);
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        if (rt_inside)
+                rt_violation(RT_MALLOC);
+        return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+        if (rt_inside && ptr)
+                rt_violation(RT_FREE);
+        __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+        if (!real_mutex_lock)
+                real_mutex_lock = (int (*)(pthread_mutex_t *)) dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        if (rt_inside)
+                rt_violation(RT_LOCK);
+        return real_mutex_lock(mutex);
+}
+
+static void rtcheck_report(void)
+{
+        int n;
+
+        fprintf(stderr, "rtcheck: in the audio callback:");
+        for (n = 0; n < RT_KINDS; n++)
+                fprintf(stderr, " %s %u time%s%s", rt_names[n], rt_count[n],
+                        rt_count[n] == 1 ? "" : "s", n + 1 < RT_KINDS ? "," : "\n");
+}
+
+void rtcheck_init(void)
+{
+        const char *e = getenv("SCHISM_RTCHECK");
+
+        rt_trap = (e && strcmp(e, "trap") == 0);
+        if (!real_mutex_lock)
+                real_mutex_lock = (int (*)(pthread_mutex_t *)) dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        atexit(rtcheck_report);
+}
+
+void rtcheck_enter(void)
+{
+        rt_inside = 1;
+}
+
+void rtcheck_leave(void)
+{
+        rt_inside = 0;
+}
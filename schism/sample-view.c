@@ -188,18 +188,17 @@ static void _draw_sample_play_marks(struct vgamem_overlay *r, song_sample_t * sa
 {
         int n, x, y;
         int c;
-        song_voice_t *channel;
-        unsigned int *channel_list;
+        const song_playback_state_t *ps;
+        const song_voice_state_t *channel;
 
         if (song_get_mode() == MODE_STOPPED)
                 return;
 
-        song_lock_audio();
-
-        n = song_get_mix_state(&channel_list);
+        ps = song_get_playback_state();
+        n = ps->num_mix;
         while (n--) {
-                channel = song_get_mix_channel(channel_list[n]);
-                if (channel->current_sample_data != sample->data)
+                channel = ps->mix + n;
+                if (channel->sample_data != sample->data)
                         continue;
                 if (!channel->final_volume) continue;
                 c = (channel->flags & (CHN_KEYOFF | CHN_NOTEFADE)) ? SAMPLE_BGMARK_COLOR : SAMPLE_MARK_COLOR;
@@ -221,8 +220,6 @@ static void _draw_sample_play_marks(struct vgamem_overlay *r, song_sample_t * sa
                         vgamem_ovl_drawpixel(r, x, y++, c);
                 } while (y < r->height);
         }
-
-        song_unlock_audio();
 }
 
 /* --------------------------------------------------------------------- */
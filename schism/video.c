@@ -104,6 +104,13 @@ struct video_cf {
         SDL_Renderer *renderer;
         SDL_Texture *texture;
         SDL_Surface *surface;
+        /* no window at all; video_blit only fills in the surface */
+        int offscreen;
+        /* microseconds spent in the last video_blit */
+        struct {
+                unsigned int scan;
+                unsigned int present;
+        } time;
         /* to convert 32-bit color to 24-bit color */
         unsigned char *cv32backing;
         /* for tv mode */
@@ -119,15 +126,65 @@ struct video_cf {
 };
 static struct video_cf video;
 
+#define SW_MAX_THREADS  8
+#define SW_MIN_BAND     32      /* don't bother splitting bands smaller than this */
+
+struct sw_worker {
+        SDL_Thread *thread;
+        SDL_sem *go;
+        unsigned int *scan;     /* two native scanlines, 32-bit */
+        unsigned int *line;     /* one output row, for targets that aren't 32-bit */
+        unsigned int mouseline[80];
+        unsigned int y0, y1;    /* band to draw (output rows, or native rows if integral) */
+};
+
+static struct {
+        int enabled;
+        int forced;             /* asked for by name, rather than fallen back to */
+        int quit;
+
+        /* coordinate tables; rebuilt when the clip size changes */
+        unsigned int tw, th;
+        unsigned short *xsrc, *ysrc;
+        unsigned char *xfrac, *yfrac;
+        unsigned int xint, yint; /* integral scale factors, or 0 */
+
+        /* the current job */
+        int bpp;
+        unsigned char *pixels;
+        unsigned int pitch;
+        SDL_PixelFormat *format;
+        unsigned int mouseline_x, mouseline_v;
+
+        int nworkers;
+        struct sw_worker worker[SW_MAX_THREADS];
+        SDL_sem *done;
+} sw;
+
+static void _sw_init(void);
+static void _sw_shutdown(void);
+
 const char *video_driver_name(void)
 {
-        return "sdl";
+        if (video.offscreen)
+                return "offscreen";
+        return sw.forced ? "software" : "sdl";
 }
 
 void video_report(void)
 {
+        if (video.offscreen) {
+                log_appendf(5, " Off-screen framebuffer, %dx%d",
+                            NATIVE_SCREEN_WIDTH, NATIVE_SCREEN_HEIGHT);
+                return;
+        }
         log_appendf(5, " Using driver '%s'", SDL_GetCurrentVideoDriver());
-        log_appendf(5, "Hardware-accelerated SDL surface");
+        if (sw.enabled) {
+                log_appendf(5, " Software scaling, %d thread%s",
+                            sw.nworkers, sw.nworkers == 1 ? "" : "s");
+        } else {
+                log_appendf(5, "Hardware-accelerated SDL surface");
+        }
         log_appendf(5, " Display format: %d bits/pixel",
                     video.surface->format->BitsPerPixel);
 
@@ -136,27 +193,54 @@ void video_report(void)
         }
 }
 
-void video_init()
+void video_init(const char *driver)
 {
+        SDL_RendererInfo info;
+
         memset(&video, 0, sizeof(video));
 
-        video.window = SDL_CreateWindow("Schism Tracker",
-                        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                        NATIVE_SCREEN_WIDTH, NATIVE_SCREEN_HEIGHT, 0);
-        if (!video.window) {
-                perror("SDL_CreateWindow");
-                exit(EXIT_FAILURE);
+        if (driver && (strcasecmp(driver, "software") == 0 || strcasecmp(driver, "sw") == 0)) {
+                sw.enabled = sw.forced = 1;
+        } else if (driver && strcasecmp(driver, "offscreen") == 0) {
+                video.offscreen = 1;
+        }
+
+        if (!video.offscreen) {
+                video.window = SDL_CreateWindow("Schism Tracker",
+                                SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                NATIVE_SCREEN_WIDTH, NATIVE_SCREEN_HEIGHT,
+                                sw.forced ? SDL_WINDOW_RESIZABLE : 0);
+                if (!video.window) {
+                        perror("SDL_CreateWindow");
+                        exit(EXIT_FAILURE);
+                }
         }
 
-        video.renderer = SDL_CreateRenderer(video.window, -1, 0);
-        video.texture = SDL_CreateTexture(video.renderer,
-                                          SDL_PIXELFORMAT_ARGB8888,
-                                          SDL_TEXTUREACCESS_STREAMING,
-                                          NATIVE_SCREEN_WIDTH,
-                                          NATIVE_SCREEN_HEIGHT);
-        SDL_RenderSetLogicalSize(video.renderer,
-                                 NATIVE_SCREEN_WIDTH, NATIVE_SCREEN_HEIGHT);
-        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        if (!video.offscreen && !sw.enabled) {
+                video.renderer = SDL_CreateRenderer(video.window, -1, 0);
+                /* SDL's own software renderer scales per pixel, per frame;
+                we can do better than that */
+                if (!video.renderer
+                    || (SDL_GetRendererInfo(video.renderer, &info) == 0
+                        && (info.flags & SDL_RENDERER_SOFTWARE))) {
+                        if (video.renderer)
+                                SDL_DestroyRenderer(video.renderer);
+                        video.renderer = NULL;
+                        sw.enabled = 1;
+                }
+        }
+        if (sw.enabled) {
+                _sw_init();
+        } else if (video.renderer) {
+                video.texture = SDL_CreateTexture(video.renderer,
+                                                  SDL_PIXELFORMAT_ARGB8888,
+                                                  SDL_TEXTUREACCESS_STREAMING,
+                                                  NATIVE_SCREEN_WIDTH,
+                                                  NATIVE_SCREEN_HEIGHT);
+                SDL_RenderSetLogicalSize(video.renderer,
+                                         NATIVE_SCREEN_WIDTH, NATIVE_SCREEN_HEIGHT);
+                SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        }
 
         video.surface = SDL_CreateRGBSurface(0,
                                              NATIVE_SCREEN_WIDTH,
@@ -189,19 +273,27 @@ int video_is_fullscreen(void)
 
 void enter_fullscreen(void)
 {
-        Uint32 flags = SDL_GetWindowFlags(video.window);
-        flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
+        Uint32 flags;
 
         video.desktop.fullscreen = 1;
+        if (!video.window)
+                return;
+
+        flags = SDL_GetWindowFlags(video.window);
+        flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
         SDL_SetWindowFullscreen(video.window, flags);
 }
 
 void exit_fullscreen(void)
 {
-        Uint32 flags = SDL_GetWindowFlags(video.window);
-        flags &= ~SDL_WINDOW_FULLSCREEN_DESKTOP;
+        Uint32 flags;
 
         video.desktop.fullscreen = 0;
+        if (!video.window)
+                return;
+
+        flags = SDL_GetWindowFlags(video.window);
+        flags &= ~SDL_WINDOW_FULLSCREEN_DESKTOP;
         SDL_SetWindowFullscreen(video.window, flags);
 }
 
@@ -210,6 +302,9 @@ void video_shutdown(void)
         if (video.desktop.fullscreen) {
                 exit_fullscreen();
         }
+        if (sw.enabled) {
+                _sw_shutdown();
+        }
 }
 
 void video_fullscreen(int tri)
@@ -375,132 +470,329 @@ static inline void make_mouseline(unsigned int x, unsigned int v, unsigned int y
 #define FIXED2INT(x) ((x) >> FIXED_BITS)
 #define FRAC(x) ((x) & FIXED_MASK)
 
-static void _blit1n(int bpp, unsigned char *pixels, unsigned int pitch)
+/* ------------------------------------------------------------------------ */
+/* software scaling
+
+When there's no usable hardware renderer we scale into the window surface
+ourselves. The source coordinate and weight for every output column and row
+only depend on the clip size, so they're computed once per resize instead
+of once per pixel. Exact integer multiples of the native resolution skip
+the interpolation entirely, and the output rows are split into bands which
+are blitted in parallel. */
+
+
+static void _sw_tables(unsigned int w, unsigned int h)
 {
-        unsigned int *csp, *esp, *dp;
-        unsigned int c00, c01, c10, c11;
-        unsigned int outr, outg, outb;
-        unsigned int pad;
-        int fixedx, fixedy, scalex, scaley;
-        unsigned int y, x,ey,ex,t1,t2;
-        unsigned int mouseline[80];
-        unsigned int mouseline_x, mouseline_v;
-        int iny, lasty;
+        unsigned int i, scale;
+        int n;
+
+        if (w == sw.tw && h == sw.th)
+                return;
+
+        sw.xsrc = mem_realloc(sw.xsrc, w * sizeof(unsigned short));
+        sw.xfrac = mem_realloc(sw.xfrac, w);
+        sw.ysrc = mem_realloc(sw.ysrc, h * sizeof(unsigned short));
+        sw.yfrac = mem_realloc(sw.yfrac, h);
+
+        /* same stepping the per-pixel scaler used, so [src + 1] stays in range */
+        scale = INT2FIXED(NATIVE_SCREEN_WIDTH - 1) / w;
+        for (i = 0; i < w; i++) {
+                sw.xsrc[i] = FIXED2INT(i * scale);
+                sw.xfrac[i] = FRAC(i * scale);
+        }
+        scale = INT2FIXED(NATIVE_SCREEN_HEIGHT - 1) / h;
+        for (i = 0; i < h; i++) {
+                sw.ysrc[i] = FIXED2INT(i * scale);
+                sw.yfrac[i] = FRAC(i * scale);
+        }
+
+        sw.xint = (w % NATIVE_SCREEN_WIDTH) ? 0 : w / NATIVE_SCREEN_WIDTH;
+        sw.yint = (h % NATIVE_SCREEN_HEIGHT) ? 0 : h / NATIVE_SCREEN_HEIGHT;
+        if (!sw.xint || !sw.yint)
+                sw.xint = sw.yint = 0;
+
+        for (n = 0; n < sw.nworkers; n++)
+                sw.worker[n].line = mem_realloc(sw.worker[n].line, w * sizeof(unsigned int));
+
+        sw.tw = w;
+        sw.th = h;
+}
+
+/* convert one row of 32-bit pixels to the surface format */
+static void _sw_put_row(unsigned char *pixels, const unsigned int *src, unsigned int w)
+{
+        unsigned int x, c, outr, outg, outb;
+
+        switch (sw.bpp) {
+        case 4:
+                memcpy(pixels, src, w * 4);
+                break;
+        case 3:
+                for (x = 0; x < w; x++) {
+#if WORDS_BIGENDIAN
+                        memcpy(pixels, ((const unsigned char *) (src + x)) + 1, 3);
+#else
+                        memcpy(pixels, src + x, 3);
+#endif
+                        pixels += 3;
+                }
+                break;
+        case 2:
+                for (x = 0; x < w; x++) {
+                        c = src[x];
+                        outr = (c >> 16) & 0xFF;
+                        outg = (c >> 8) & 0xFF;
+                        outb = c & 0xFF;
+                        if (sw.format->palette) {
+                                /* err... */
+                                ((unsigned short *) pixels)[x] = SDL_MapRGB(sw.format, outr, outg, outb);
+                        } else if (sw.format->Gloss == 2) {
+                                /* RGB565 */
+                                ((unsigned short *) pixels)[x] = ((outr << 8) & 0xF800) |
+                                        ((outg << 3) & 0x07E0) |
+                                        (outb >> 3);
+                        } else {
+                                /* RGB555 */
+                                ((unsigned short *) pixels)[x] = 0x8000 |
+                                        ((outr << 7) & 0x7C00) |
+                                        ((outg << 2) & 0x03E0) |
+                                        (outb >> 3);
+                        }
+                }
+                break;
+        case 1:
+                /* er... */
+                for (x = 0; x < w; x++) {
+                        c = src[x];
+                        pixels[x] = SDL_MapRGB(sw.format, (c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF);
+                }
+                break;
+        };
+}
+
+/* When there are enough bits between blue and red, do the RB channels
+ * together. See http://www.virtualdub.org/blog/pivot/entry.php?id=117
+ * for a quick explanation */
+#define REDBLUE(Q) ((Q) & 0x00FF00FF)
+#define GREEN(Q) ((Q) & 0x0000FF00)
+#define LERP(M, a, b, e) M((((M(b) - M(a)) * (e)) >> FIXED_BITS) + M(a))
+
+static void _sw_lerp_row(unsigned int *out, const unsigned int *csp, const unsigned int *esp,
+                        unsigned int ey, unsigned int w)
+{
+        const unsigned short *xsrc = sw.xsrc;
+        const unsigned char *xfrac = sw.xfrac;
+        unsigned int x, sx, ex, t1, t2, rb, g;
+
+        if (!ey) {
+                /* sitting right on a source row; only need to blend horizontally */
+                for (x = 0; x < w; x++) {
+                        sx = xsrc[x];
+                        ex = xfrac[x];
+                        rb = LERP(REDBLUE, csp[sx], csp[sx + 1], ex);
+                        g = LERP(GREEN, csp[sx], csp[sx + 1], ex);
+                        out[x] = 0xFF000000 | rb | g;
+                }
+                return;
+        }
+
+        for (x = 0; x < w; x++) {
+                sx = xsrc[x];
+                ex = xfrac[x];
+
+                t1 = LERP(REDBLUE, csp[sx], csp[sx + 1], ex);
+                t2 = LERP(REDBLUE, esp[sx], esp[sx + 1], ex);
+                rb = REDBLUE((((t2 - t1) * ey) >> FIXED_BITS) + t1);
 
-        mouseline_x = (video.mouse.x / 8);
-        mouseline_v = (video.mouse.x % 8);
+                t1 = LERP(GREEN, csp[sx], csp[sx + 1], ex);
+                t2 = LERP(GREEN, esp[sx], esp[sx + 1], ex);
+                g = GREEN((((t2 - t1) * ey) >> FIXED_BITS) + t1);
+
+                out[x] = 0xFF000000 | rb | g;
+        }
+}
+
+#undef LERP
+#undef GREEN
+#undef REDBLUE
+
+static void _sw_band_lerp(struct sw_worker *wk)
+{
+        unsigned int *csp, *esp, *tmp, *out;
+        unsigned char *pixels;
+        unsigned int y;
+        int iny, lasty;
 
-        csp = (unsigned int *)video.cv32backing;
+        csp = wk->scan;
         esp = csp + NATIVE_SCREEN_WIDTH;
         lasty = -2;
-        iny = 0;
-        pad = pitch - (video.clip.w * bpp);
-        scalex = INT2FIXED(NATIVE_SCREEN_WIDTH-1) / video.clip.w;
-        scaley = INT2FIXED(NATIVE_SCREEN_HEIGHT-1) / video.clip.h;
-        for (y = 0, fixedy = 0; (y < video.clip.h); y++, fixedy += scaley) {
-                iny = FIXED2INT(fixedy);
+        pixels = sw.pixels + wk->y0 * sw.pitch;
+        for (y = wk->y0; y < wk->y1; y++, pixels += sw.pitch) {
+                iny = sw.ysrc[y];
                 if (iny != lasty) {
-                        make_mouseline(mouseline_x, mouseline_v, iny, mouseline);
-
-                        /* we'll downblit the colors later */
+                        make_mouseline(sw.mouseline_x, sw.mouseline_v, iny, wk->mouseline);
                         if (iny == lasty + 1) {
                                 /* move up one line */
-                                vgamem_scan32(iny+1, csp, video.tc_bgr32, mouseline);
-                                dp = esp; esp = csp; csp=dp;
+                                tmp = csp; csp = esp; esp = tmp;
+                                vgamem_scan32(iny + 1, esp, video.tc_bgr32, wk->mouseline);
                         } else {
-                                vgamem_scan32(iny, (csp = (unsigned int *)video.cv32backing),
-                                        video.tc_bgr32, mouseline);
-                                vgamem_scan32(iny+1, (esp = (csp + NATIVE_SCREEN_WIDTH)),
-                                        video.tc_bgr32, mouseline);
+                                vgamem_scan32(iny, csp, video.tc_bgr32, wk->mouseline);
+                                vgamem_scan32(iny + 1, esp, video.tc_bgr32, wk->mouseline);
                         }
                         lasty = iny;
                 }
-                for (x = 0, fixedx = 0; x < video.clip.w; x++, fixedx += scalex) {
-                        ex = FRAC(fixedx);
-                        ey = FRAC(fixedy);
-
-                        c00 = csp[FIXED2INT(fixedx)];
-                        c01 = csp[FIXED2INT(fixedx) + 1];
-                        c10 = esp[FIXED2INT(fixedx)];
-                        c11 = esp[FIXED2INT(fixedx) + 1];
-
-#if FIXED_BITS <= 8
-                        /* When there are enough bits between blue and
-                         * red, do the RB channels together
-                         * See http://www.virtualdub.org/blog/pivot/entry.php?id=117
-                         * for a quick explanation */
-#define REDBLUE(Q) ((Q) & 0x00FF00FF)
-#define GREEN(Q) ((Q) & 0x0000FF00)
-                        t1 = REDBLUE((((REDBLUE(c01)-REDBLUE(c00))*ex) >> FIXED_BITS)+REDBLUE(c00));
-                        t2 = REDBLUE((((REDBLUE(c11)-REDBLUE(c10))*ex) >> FIXED_BITS)+REDBLUE(c10));
-                        outb = ((((t2-t1)*ey) >> FIXED_BITS) + t1);
+                out = (sw.bpp == 4) ? (unsigned int *) pixels : wk->line;
+                _sw_lerp_row(out, csp, esp, sw.yfrac[y], sw.tw);
+                if (out == wk->line)
+                        _sw_put_row(pixels, out, sw.tw);
+        }
+}
 
-                        t1 = GREEN((((GREEN(c01)-GREEN(c00))*ex) >> FIXED_BITS)+GREEN(c00));
-                        t2 = GREEN((((GREEN(c11)-GREEN(c10))*ex) >> FIXED_BITS)+GREEN(c10));
-                        outg = (((((t2-t1)*ey) >> FIXED_BITS) + t1) >> 8) & 0xFF;
+static void _sw_band_int(struct sw_worker *wk)
+{
+        unsigned int *out, c;
+        unsigned char *pixels;
+        unsigned int x, y, i, rowbytes;
+
+        rowbytes = sw.tw * sw.bpp;
+        pixels = sw.pixels + wk->y0 * sw.yint * sw.pitch;
+        for (y = wk->y0; y < wk->y1; y++) {
+                make_mouseline(sw.mouseline_x, sw.mouseline_v, y, wk->mouseline);
+                if (sw.xint == 1 && sw.bpp == 4) {
+                        vgamem_scan32(y, (unsigned int *) pixels, video.tc_bgr32, wk->mouseline);
+                } else {
+                        vgamem_scan32(y, wk->scan, video.tc_bgr32, wk->mouseline);
+                        out = (sw.bpp == 4) ? (unsigned int *) pixels : wk->line;
+                        for (x = 0; x < NATIVE_SCREEN_WIDTH; x++) {
+                                c = wk->scan[x];
+                                for (i = 0; i < sw.xint; i++)
+                                        *out++ = c;
+                        }
+                        if (sw.bpp != 4)
+                                _sw_put_row(pixels, wk->line, sw.tw);
+                }
+                /* the rest of the rows are copies of the first */
+                for (i = 1; i < sw.yint; i++)
+                        memcpy(pixels + i * sw.pitch, pixels, rowbytes);
+                pixels += sw.yint * sw.pitch;
+        }
+}
 
-                        outr = (outb >> 16) & 0xFF;
-                        outb &= 0xFF;
-#undef REDBLUE
-#undef GREEN
-#else
-#define BLUE(Q) (Q & 255)
-#define GREEN(Q) ((Q >> 8) & 255)
-#define RED(Q) ((Q >> 16) & 255)
-                        t1 = ((((BLUE(c01)-BLUE(c00))*ex) >> FIXED_BITS)+BLUE(c00)) & 0xFF;
-                        t2 = ((((BLUE(c11)-BLUE(c10))*ex) >> FIXED_BITS)+BLUE(c10)) & 0xFF;
-                        outb = ((((t2-t1)*ey) >> FIXED_BITS) + t1);
-
-                        t1 = ((((GREEN(c01)-GREEN(c00))*ex) >> FIXED_BITS)+GREEN(c00)) & 0xFF;
-                        t2 = ((((GREEN(c11)-GREEN(c10))*ex) >> FIXED_BITS)+GREEN(c10)) & 0xFF;
-                        outg = ((((t2-t1)*ey) >> FIXED_BITS) + t1);
-
-                        t1 = ((((RED(c01)-RED(c00))*ex) >> FIXED_BITS)+RED(c00)) & 0xFF;
-                        t2 = ((((RED(c11)-RED(c10))*ex) >> FIXED_BITS)+RED(c10)) & 0xFF;
-                        outr = ((((t2-t1)*ey) >> FIXED_BITS) + t1);
-#undef RED
-#undef GREEN
-#undef BLUE
-#endif
-                        /* write output "pixel" */
-                        switch (bpp) {
-                        case 4:
-                                /* inline MapRGB */
-                                (*(unsigned int *)pixels) = 0xFF000000 | (outr << 16) | (outg << 8) | outb;
-                                break;
-                        case 3:
-                                /* inline MapRGB */
-                                (*(unsigned int *)pixels) = (outr << 16) | (outg << 8) | outb;
-                                break;
-                        case 2:
-                                /* inline MapRGB if possible */
-                                if (video.surface->format->palette) {
-                                        /* err... */
-                                        (*(unsigned short *)pixels) = SDL_MapRGB(
-                                                video.surface->format, outr, outg, outb);
-                                } else if (video.surface->format->Gloss == 2) {
-                                        /* RGB565 */
-                                        (*(unsigned short *)pixels) = ((outr << 8) & 0xF800) |
-                                                ((outg << 3) & 0x07E0) |
-                                                (outb >> 3);
-                                } else {
-                                        /* RGB555 */
-                                        (*(unsigned short *)pixels) = 0x8000 |
-                                                ((outr << 7) & 0x7C00) |
-                                                ((outg << 2) & 0x03E0) |
-                                                (outb >> 3);
-                                }
-                                break;
-                        case 1:
-                                /* er... */
-                                (*pixels) = SDL_MapRGB(
-                                        video.surface->format, outr, outg, outb);
-                                break;
-                        };
-                        pixels += bpp;
+static void _sw_band(struct sw_worker *wk)
+{
+        if (sw.yint)
+                _sw_band_int(wk);
+        else
+                _sw_band_lerp(wk);
+}
+
+static int _sw_thread(void *data)
+{
+        struct sw_worker *wk = data;
+
+        for (;;) {
+                SDL_SemWait(wk->go);
+                if (sw.quit)
+                        break;
+                _sw_band(wk);
+                SDL_SemPost(sw.done);
+        }
+        return 0;
+}
+
+static void _sw_init(void)
+{
+        char *q;
+        int n;
+
+        n = SDL_GetCPUCount();
+        if ((q = getenv("SCHISM_VIDEO_THREADS")))
+                n = atoi(q);
+        sw.nworkers = CLAMP(n, 1, SW_MAX_THREADS);
+
+        if (sw.nworkers > 1)
+                sw.done = SDL_CreateSemaphore(0);
+        for (n = 0; n < sw.nworkers; n++) {
+                sw.worker[n].scan = mem_alloc(NATIVE_SCREEN_WIDTH * 2 * sizeof(unsigned int));
+                /* worker 0 is whoever calls video_blit */
+                if (n == 0)
+                        continue;
+                sw.worker[n].go = SDL_CreateSemaphore(0);
+                sw.worker[n].thread = SDL_CreateThread(_sw_thread, "Video scaler", &sw.worker[n]);
+                if (!sw.worker[n].thread) {
+                        log_appendf(4, "Couldn't start video thread: %s", SDL_GetError());
+                        SDL_DestroySemaphore(sw.worker[n].go);
+                        sw.worker[n].go = NULL;
+                        free(sw.worker[n].scan);
+                        sw.worker[n].scan = NULL;
+                        break;
                 }
-                pixels += pad;
         }
+        sw.nworkers = n;
+}
+
+static void _sw_shutdown(void)
+{
+        int n;
+
+        sw.quit = 1;
+        for (n = 1; n < sw.nworkers; n++) {
+                SDL_SemPost(sw.worker[n].go);
+                SDL_WaitThread(sw.worker[n].thread, NULL);
+                SDL_DestroySemaphore(sw.worker[n].go);
+                free(sw.worker[n].scan);
+                free(sw.worker[n].line);
+                sw.worker[n].scan = NULL;
+                sw.worker[n].line = NULL;
+        }
+        sw.nworkers = 1;
+}
+
+/* fit the native aspect ratio into the window, and center it */
+static void _sw_resize(SDL_Surface *ws)
+{
+        video.draw.width = ws->w;
+        video.draw.height = ws->h;
+        if (ws->w * NATIVE_SCREEN_HEIGHT > ws->h * NATIVE_SCREEN_WIDTH) {
+                video.clip.h = ws->h;
+                video.clip.w = ws->h * NATIVE_SCREEN_WIDTH / NATIVE_SCREEN_HEIGHT;
+        } else {
+                video.clip.w = ws->w;
+                video.clip.h = ws->w * NATIVE_SCREEN_HEIGHT / NATIVE_SCREEN_WIDTH;
+        }
+        video.clip.x = (ws->w - video.clip.w) / 2;
+        video.clip.y = (ws->h - video.clip.h) / 2;
+        SDL_FillRect(ws, NULL, 0);
+}
+
+static void _blit1n(int bpp, unsigned char *pixels, unsigned int pitch, SDL_PixelFormat *format)
+{
+        unsigned int units;
+        int n, i;
+
+        _sw_tables(video.clip.w, video.clip.h);
+
+        sw.bpp = bpp;
+        sw.pixels = pixels;
+        sw.pitch = pitch;
+        sw.format = format;
+        sw.mouseline_x = (video.mouse.x / 8);
+        sw.mouseline_v = (video.mouse.x % 8);
+
+        /* integral scaling is split on native rows so each band owns its copies */
+        units = sw.yint ? NATIVE_SCREEN_HEIGHT : sw.th;
+        n = units / SW_MIN_BAND;
+        n = CLAMP(n, 1, sw.nworkers);
+        for (i = 0; i < n; i++) {
+                sw.worker[i].y0 = units * i / n;
+                sw.worker[i].y1 = units * (i + 1) / n;
+        }
+
+        for (i = 1; i < n; i++)
+                SDL_SemPost(sw.worker[i].go);
+        _sw_band(&sw.worker[0]);
+        for (i = 1; i < n; i++)
+                SDL_SemWait(sw.done);
 }
 
 static void _blit11(int bpp, unsigned char *pixels, unsigned int pitch,
@@ -561,11 +853,55 @@ static void _blit11(int bpp, unsigned char *pixels, unsigned int pitch,
         };
 }
 
+static unsigned int _elapsed_usec(Uint64 since)
+{
+        return (SDL_GetPerformanceCounter() - since) * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+void video_blit_timing(unsigned int *scan_usec, unsigned int *present_usec)
+{
+        if (scan_usec) *scan_usec = video.time.scan;
+        if (present_usec) *present_usec = video.time.present;
+}
+
 void video_blit(void)
 {
         unsigned char *pixels = NULL;
         unsigned int bpp = 0;
         unsigned int pitch = 0;
+        SDL_Surface *ws;
+        Uint64 start;
+
+        if (sw.enabled) {
+                /* this goes away whenever the window is resized */
+                ws = SDL_GetWindowSurface(video.window);
+                if (!ws)
+                        return;
+                if ((unsigned int) ws->w != video.draw.width
+                    || (unsigned int) ws->h != video.draw.height)
+                        _sw_resize(ws);
+
+                bpp = ws->format->BytesPerPixel;
+                pitch = ws->pitch;
+                pixels = (unsigned char *)ws->pixels;
+                pixels += video.clip.y * pitch;
+                pixels += video.clip.x * bpp;
+
+                vgamem_lock();
+                start = SDL_GetPerformanceCounter();
+                if (SDL_MUSTLOCK(ws))
+                        SDL_LockSurface(ws);
+                _blit1n(bpp, pixels, pitch, ws->format);
+                if (SDL_MUSTLOCK(ws))
+                        SDL_UnlockSurface(ws);
+                video.time.scan = _elapsed_usec(start);
+
+                start = SDL_GetPerformanceCounter();
+                SDL_UpdateWindowSurface(video.window);
+                video.time.present = _elapsed_usec(start);
+                vgamem_unlock();
+                return;
+        }
 
         bpp = video.surface->format->BytesPerPixel;
         pixels = (unsigned char *)video.surface->pixels;
@@ -575,12 +911,18 @@ void video_blit(void)
 
         vgamem_lock();
 
-        /* hardware scaling provided by SDL */
+        start = SDL_GetPerformanceCounter();
         _blit11(bpp, pixels, pitch, video.pal);
-
-        SDL_UpdateTexture(video.texture, NULL, pixels, pitch);
-        SDL_RenderCopy(video.renderer, video.texture, NULL, NULL);
-        SDL_RenderPresent(video.renderer);
+        video.time.scan = _elapsed_usec(start);
+
+        if (video.renderer) {
+                /* hardware scaling provided by SDL */
+                start = SDL_GetPerformanceCounter();
+                SDL_UpdateTexture(video.texture, NULL, pixels, pitch);
+                SDL_RenderCopy(video.renderer, video.texture, NULL, NULL);
+                SDL_RenderPresent(video.renderer);
+                video.time.present = _elapsed_usec(start);
+        }
 
         vgamem_unlock();
 }